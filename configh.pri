@@ -4,6 +4,11 @@ trojita_harmattan {
     DEFINES += TROJITA_MOBILITY_SYSTEMINFO
 }
 
+# Counters of cache hits, parsed responses and memory usage; enable through "qmake CONFIG+=instrumentation"
+instrumentation {
+    DEFINES += TROJITA_INSTRUMENTATION
+}
+
 # common stuff
 DEFINES -= QT3_SUPPORT
 DEFINES += QT_STRICT_ITERATORS
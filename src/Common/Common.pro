@@ -4,15 +4,18 @@ TARGET = Common
 SOURCES += SettingsNames.cpp \
     FileLogger.cpp \
     DeleteAfter.cpp \
-    ConnectionId.cpp
+    ConnectionId.cpp \
+    Instrumentation.cpp
 HEADERS += SettingsNames.h \
     SqlTransactionAutoAborter.h \
     PortNumbers.h \
     FindWithUnknown.h \
     Logging.h \
     RingBuffer.h \
+    ObjectPool.h \
     FileLogger.h \
     DeleteAfter.h \
-    ConnectionId.h
+    ConnectionId.h \
+    Instrumentation.h
 
 include(../../configh.pri)
@@ -0,0 +1,80 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "Instrumentation.h"
+#include <QMutex>
+#include <QMutexLocker>
+
+namespace
+{
+
+QMutex *instrumentationMutex()
+{
+    static QMutex mutex;
+    return &mutex;
+}
+
+Common::Instrumentation::Snapshot &instrumentationCounters()
+{
+    static Common::Instrumentation::Snapshot counters;
+    return counters;
+}
+
+}
+
+namespace Common
+{
+
+void Instrumentation::add(const QString &category, const QString &name, const qint64 delta)
+{
+    QMutexLocker locker(instrumentationMutex());
+    instrumentationCounters()[category][name] += delta;
+}
+
+Instrumentation::Snapshot Instrumentation::snapshot()
+{
+    QMutexLocker locker(instrumentationMutex());
+    return instrumentationCounters();
+}
+
+void Instrumentation::reset()
+{
+    QMutexLocker locker(instrumentationMutex());
+    instrumentationCounters().clear();
+}
+
+QByteArray Instrumentation::format(const Snapshot &snapshot)
+{
+    QByteArray res("# trojita-instrumentation 1\n");
+    for (Snapshot::const_iterator category = snapshot.constBegin(); category != snapshot.constEnd(); ++category) {
+        for (QMap<QString, qint64>::const_iterator it = category->constBegin(); it != category->constEnd(); ++it) {
+            // The names come from the code, but better make sure that they won't break the format
+            QString name = it.key();
+            name.replace(QLatin1Char('\t'), QLatin1Char(' ')).replace(QLatin1Char('\n'), QLatin1Char(' '));
+            res += category.key().toUtf8() + '\t' + name.toUtf8() + '\t' + QByteArray::number(*it) + '\n';
+        }
+    }
+    return res;
+}
+
+}
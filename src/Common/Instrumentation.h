@@ -0,0 +1,68 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef TROJITA_COMMON_INSTRUMENTATION_H
+#define TROJITA_COMMON_INSTRUMENTATION_H
+
+#include <QMap>
+#include <QString>
+
+namespace Common
+{
+
+/** @short Process-wide counters which show where the memory and the time go
+
+The counters are grouped into categories, e.g. the cache hits per AbstractCache method. The code which shall be measured
+uses the TROJITA_INSTRUMENT macro, which only does something when Trojita has been built with "CONFIG+=instrumentation".
+Otherwise it expands to nothing, so there is no overhead in regular builds.
+*/
+class Instrumentation
+{
+public:
+    /** @short Values of the counters, indexed by their category and name */
+    typedef QMap<QString, QMap<QString, qint64> > Snapshot;
+
+    /** @short Add @arg delta to the counter @arg name within the @arg category */
+    static void add(const QString &category, const QString &name, const qint64 delta);
+    /** @short Return the current values of all counters */
+    static Snapshot snapshot();
+    /** @short Forget all counters */
+    static void reset();
+
+    /** @short Convert the @arg snapshot to a line-based format which is easy to process by scripts
+
+    Each counter is put on its own line which consists of the category, the counter name and its value, all separated by
+    tabs. The first line is a comment with the format version.
+    */
+    static QByteArray format(const Snapshot &snapshot);
+};
+
+}
+
+#ifdef TROJITA_INSTRUMENTATION
+#define TROJITA_INSTRUMENT(CATEGORY, NAME, DELTA) Common::Instrumentation::add(CATEGORY, NAME, DELTA)
+#else
+#define TROJITA_INSTRUMENT(CATEGORY, NAME, DELTA) do {} while (0)
+#endif
+
+#endif // TROJITA_COMMON_INSTRUMENTATION_H
@@ -0,0 +1,188 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TROJITA_OBJECTPOOL_H
+#define TROJITA_OBJECTPOOL_H
+
+#include <cstddef>
+#include <map>
+#include <new>
+#include <QList>
+
+namespace Common
+{
+
+/** @short Counters describing the activity of an ObjectPool */
+struct PoolStatistics {
+    /** @short Number of objects which have been handed out */
+    quint64 allocations;
+    /** @short Number of objects which have been returned */
+    quint64 deallocations;
+    /** @short Number of chunks which have been obtained from the system allocator */
+    quint64 chunksAllocated;
+    /** @short Number of chunks which have been given back to the system allocator */
+    quint64 chunksReleased;
+
+    PoolStatistics(): allocations(0), deallocations(0), chunksAllocated(0), chunksReleased(0) {}
+
+    /** @short Number of objects which are currently alive */
+    quint64 liveObjects() const { return allocations - deallocations; }
+    /** @short Number of chunks which are currently held */
+    quint64 liveChunks() const { return chunksAllocated - chunksReleased; }
+};
+
+/** @short Allocator for many small objects of the same type
+
+Memory for the objects is obtained in chunks which hold @arg ChunkSize objects each. Freed objects go back to their chunk and
+are reused by the subsequent allocations, and a chunk is returned to the system once all of its objects are gone, as long as
+there is another chunk with some free space left. That keeps the objects which are created by the thousands from scattering
+all over the heap, which otherwise leads to a fragmentation in the long-running sessions.
+
+The intended use is through a class-specific operator new and operator delete which forward to allocate() and release().
+Requests for a size different from sizeof(T), i.e. the ones for derived classes, are passed to the global operators.
+
+The pool is not thread-safe; the objects shall be only created and destroyed from a single thread.
+*/
+template<typename T, int ChunkSize = 256>
+class ObjectPool
+{
+public:
+    static void *allocate(const size_t size)
+    {
+        if (size != sizeof(T))
+            return ::operator new(size);
+        return instance()->take();
+    }
+
+    static void release(void *ptr, const size_t size)
+    {
+        if (!ptr)
+            return;
+        if (size != sizeof(T)) {
+            ::operator delete(ptr);
+            return;
+        }
+        instance()->give(ptr);
+    }
+
+    static PoolStatistics statistics()
+    {
+        return instance()->m_stats;
+    }
+
+private:
+    /** @short Size of one slot, rounded up so that the objects remain suitably aligned */
+    enum {
+        ALIGNMENT = 2 * sizeof(void *),
+        SLOT_SIZE = (sizeof(T) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT
+    };
+
+    struct Chunk {
+        char *memory;
+        /** @short Linked list of the free slots, the link is stored in the slot itself */
+        void *freeList;
+        int used;
+    };
+
+    ObjectPool() {}
+    ObjectPool(const ObjectPool &); // don't implement
+    ObjectPool &operator=(const ObjectPool &); // don't implement
+
+    /** @short Return the pool for this type
+
+    The pool is never destroyed, so that the objects which outlive the static destructors can still be deleted.
+    */
+    static ObjectPool *instance()
+    {
+        static ObjectPool *pool = new ObjectPool();
+        return pool;
+    }
+
+    void *take()
+    {
+        if (m_available.isEmpty())
+            m_available.append(newChunk());
+        Chunk *chunk = m_available.last();
+        void *ptr = chunk->freeList;
+        chunk->freeList = *static_cast<void **>(ptr);
+        ++chunk->used;
+        if (!chunk->freeList)
+            m_available.removeLast();
+        ++m_stats.allocations;
+        return ptr;
+    }
+
+    void give(void *ptr)
+    {
+        typename std::map<char *, Chunk *>::iterator it = m_chunks.upper_bound(static_cast<char *>(ptr));
+        Q_ASSERT(it != m_chunks.begin());
+        --it;
+        Chunk *chunk = it->second;
+        Q_ASSERT(static_cast<char *>(ptr) < chunk->memory + SLOT_SIZE * ChunkSize);
+
+        if (!chunk->freeList)
+            m_available.append(chunk);
+        *static_cast<void **>(ptr) = chunk->freeList;
+        chunk->freeList = ptr;
+        --chunk->used;
+        ++m_stats.deallocations;
+
+        if (!chunk->used && m_available.size() > 1) {
+            m_available.removeOne(chunk);
+            m_chunks.erase(it);
+            ::operator delete(chunk->memory);
+            delete chunk;
+            ++m_stats.chunksReleased;
+        }
+    }
+
+    Chunk *newChunk()
+    {
+        Chunk *chunk = new Chunk();
+        chunk->memory = static_cast<char *>(::operator new(SLOT_SIZE * ChunkSize));
+        chunk->used = 0;
+        chunk->freeList = 0;
+        for (int i = ChunkSize - 1; i >= 0; --i) {
+            void *slot = chunk->memory + i * SLOT_SIZE;
+            *static_cast<void **>(slot) = chunk->freeList;
+            chunk->freeList = slot;
+        }
+        m_chunks[chunk->memory] = chunk;
+        ++m_stats.chunksAllocated;
+        return chunk;
+    }
+
+    /** @short All chunks, indexed by their starting address */
+    std::map<char *, Chunk *> m_chunks;
+    /** @short Chunks with at least one free slot */
+    QList<Chunk *> m_available;
+    PoolStatistics m_stats;
+};
+
+}
+
+/** @short Declare class-specific operators new and delete which use the ObjectPool for this class */
+#define TROJITA_POOLED_ALLOCATION(Class) \
+    static void *operator new(size_t size) { return Common::ObjectPool<Class>::allocate(size); } \
+    static void operator delete(void *ptr, size_t size) { Common::ObjectPool<Class>::release(ptr, size); }
+
+#endif // TROJITA_OBJECTPOOL_H
@@ -101,6 +101,10 @@ HEADERS += \
     EnvelopeView.h \
     ReplaceCharValidator.h \
     OnePanelAtTimeWidget.h
+instrumentation {
+    SOURCES += InstrumentationWidget.cpp
+    HEADERS += InstrumentationWidget.h
+}
 FORMS += CreateMailboxDialog.ui \
     ComposeWidget.ui \
     SettingsImapPage.ui \
@@ -0,0 +1,152 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QFile>
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QPushButton>
+#include <QTimer>
+#include <QTreeWidget>
+#include <QVBoxLayout>
+#include "InstrumentationWidget.h"
+#include "Common/Instrumentation.h"
+#include "Imap/Model/Model.h"
+
+namespace Gui
+{
+
+InstrumentationWidget::InstrumentationWidget(QWidget *parent) :
+    QWidget(parent), m_dumpTimer(0)
+{
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    m_view = new QTreeWidget(this);
+    m_view->setColumnCount(2);
+    m_view->setHeaderLabels(QStringList() << tr("Counter") << tr("Value"));
+    m_view->setRootIsDecorated(true);
+    m_view->setUniformRowHeights(true);
+    layout->addWidget(m_view);
+
+    m_save = new QPushButton(tr("Save..."), this);
+    connect(m_save, SIGNAL(clicked()), this, SLOT(slotSave()));
+    layout->addWidget(m_save, 0, Qt::AlignRight);
+
+    m_refreshTimer = new QTimer(this);
+    m_refreshTimer->setInterval(1000);
+    connect(m_refreshTimer, SIGNAL(timeout()), this, SLOT(slotRefresh()));
+
+    m_dumpFileName = QString::fromLocal8Bit(qgetenv("TROJITA_INSTRUMENTATION_DUMP"));
+    if (!m_dumpFileName.isEmpty()) {
+        m_dumpTimer = new QTimer(this);
+        m_dumpTimer->setInterval(10 * 1000);
+        connect(m_dumpTimer, SIGNAL(timeout()), this, SLOT(slotDump()));
+        m_dumpTimer->start();
+    }
+}
+
+InstrumentationWidget::~InstrumentationWidget()
+{
+    if (m_dumpTimer)
+        slotDump();
+}
+
+void InstrumentationWidget::setModel(Imap::Mailbox::Model *model)
+{
+    m_model = model;
+}
+
+QByteArray InstrumentationWidget::formattedSnapshot() const
+{
+    return Common::Instrumentation::format(m_model ? m_model->instrumentationSnapshot() : Common::Instrumentation::snapshot());
+}
+
+void InstrumentationWidget::slotRefresh()
+{
+    const Common::Instrumentation::Snapshot snapshot = m_model ?
+                m_model->instrumentationSnapshot() : Common::Instrumentation::snapshot();
+
+    // Update the items in place so that the expanded categories and the scroll position survive the refresh
+    for (Common::Instrumentation::Snapshot::const_iterator category = snapshot.constBegin(); category != snapshot.constEnd();
+         ++category) {
+        QTreeWidgetItem *categoryItem = 0;
+        for (int i = 0; i < m_view->topLevelItemCount(); ++i) {
+            if (m_view->topLevelItem(i)->text(0) == category.key()) {
+                categoryItem = m_view->topLevelItem(i);
+                break;
+            }
+        }
+        if (!categoryItem) {
+            categoryItem = new QTreeWidgetItem(m_view, QStringList() << category.key());
+            categoryItem->setExpanded(true);
+        }
+
+        for (QMap<QString, qint64>::const_iterator it = category->constBegin(); it != category->constEnd(); ++it) {
+            QTreeWidgetItem *item = 0;
+            for (int i = 0; i < categoryItem->childCount(); ++i) {
+                if (categoryItem->child(i)->text(0) == it.key()) {
+                    item = categoryItem->child(i);
+                    break;
+                }
+            }
+            if (!item) {
+                item = new QTreeWidgetItem(categoryItem, QStringList() << it.key());
+                item->setTextAlignment(1, Qt::AlignRight);
+            }
+            item->setText(1, QString::number(*it));
+        }
+    }
+    m_view->sortItems(0, Qt::AscendingOrder);
+}
+
+void InstrumentationWidget::slotSave()
+{
+    const QString fileName = QFileDialog::getSaveFileName(this, tr("Save Instrumentation Data"));
+    if (fileName.isEmpty())
+        return;
+
+    QFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate) || f.write(formattedSnapshot()) == -1) {
+        QMessageBox::critical(this, tr("Cannot save"), tr("Cannot write to %1: %2").arg(fileName, f.errorString()));
+    }
+}
+
+void InstrumentationWidget::slotDump()
+{
+    QFile f(m_dumpFileName);
+    if (f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        f.write(formattedSnapshot());
+}
+
+void InstrumentationWidget::showEvent(QShowEvent *e)
+{
+    slotRefresh();
+    m_refreshTimer->start();
+    QWidget::showEvent(e);
+}
+
+void InstrumentationWidget::hideEvent(QHideEvent *e)
+{
+    m_refreshTimer->stop();
+    QWidget::hideEvent(e);
+}
+
+}
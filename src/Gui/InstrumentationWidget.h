@@ -0,0 +1,83 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef GUI_INSTRUMENTATIONWIDGET_H
+#define GUI_INSTRUMENTATIONWIDGET_H
+
+#include <QPointer>
+#include <QWidget>
+
+class QPushButton;
+class QTimer;
+class QTreeWidget;
+
+namespace Imap {
+namespace Mailbox {
+class Model;
+}
+}
+
+namespace Gui
+{
+
+/** @short Debugging widget which shows the instrumentation counters and the memory statistics of the IMAP model
+
+The numbers are refreshed periodically while the widget is visible. They can be saved to a file in the format produced by
+Common::Instrumentation::format(). When the TROJITA_INSTRUMENTATION_DUMP environment variable is set, the same data are also
+written to the file it points to every few seconds, no matter whether the widget is shown or not.
+*/
+class InstrumentationWidget : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit InstrumentationWidget(QWidget *parent = 0);
+    virtual ~InstrumentationWidget();
+
+    /** @short Include the statistics about the tree of this @arg model */
+    void setModel(Imap::Mailbox::Model *model);
+
+private slots:
+    /** @short Fill the view with the current values */
+    void slotRefresh();
+    /** @short Ask for a file name and save the current values there */
+    void slotSave();
+    /** @short Save the current values into the file from the environment */
+    void slotDump();
+
+private:
+    QByteArray formattedSnapshot() const;
+
+    virtual void showEvent(QShowEvent *e);
+    virtual void hideEvent(QHideEvent *e);
+
+    QPointer<Imap::Mailbox::Model> m_model;
+    QTreeWidget *m_view;
+    QPushButton *m_save;
+    QTimer *m_refreshTimer;
+    QTimer *m_dumpTimer;
+    QString m_dumpFileName;
+};
+
+}
+
+#endif // GUI_INSTRUMENTATIONWIDGET_H
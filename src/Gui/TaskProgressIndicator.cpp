@@ -39,6 +39,7 @@ TaskProgressIndicator::TaskProgressIndicator(QWidget *parent) :
 /** @short Connect to the specified IMAP model as the source of the activity information */
 void TaskProgressIndicator::setImapModel(Imap::Mailbox::Model *model)
 {
+    m_model = model;
     if (model) {
         m_visibleTasksModel = new Imap::Mailbox::VisibleTasksModel(model, model->taskModel());
         connect(m_visibleTasksModel, SIGNAL(layoutChanged()), this, SLOT(updateActivityIndication()));
@@ -62,11 +63,14 @@ void TaskProgressIndicator::updateActivityIndication()
         QApplication::restoreOverrideCursor();
     }
 
-    if (busy) {
-        setToolTip(tr("%1 ongoing actions").arg(QString::number(m_visibleTasksModel->rowCount())));
-    } else {
-        setToolTip(tr("IMAP connection idle"));
+    QString toolTip = busy ?
+                tr("%1 ongoing actions").arg(QString::number(m_visibleTasksModel->rowCount())) :
+                tr("IMAP connection idle");
+    if (m_model) {
+        toolTip += QLatin1Char('\n') + tr("%1 kB of message data in memory, %2 kB released").arg(
+                    QString::number(m_model->partDataInMemory() / 1024), QString::number(m_model->releasedPartData() / 1024));
     }
+    setToolTip(toolTip);
 
     m_busy = busy;
 }
@@ -54,6 +54,8 @@ protected:
     void mousePressEvent(QMouseEvent *event);
 
 private:
+    QPointer<Imap::Mailbox::Model> m_model;
+
     /** @short Model for a list of "visible tasks" */
     QPointer<Imap::Mailbox::VisibleTasksModel> m_visibleTasksModel;
 
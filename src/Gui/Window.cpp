@@ -65,6 +65,9 @@
 #include "CompleteMessageWidget.h"
 #include "ComposeWidget.h"
 #include "IconLoader.h"
+#ifdef TROJITA_INSTRUMENTATION
+#include "InstrumentationWidget.h"
+#endif
 #include "MailBoxTreeView.h"
 #include "MessageListWidget.h"
 #include "MessageView.h"
@@ -254,6 +257,13 @@ void MainWindow::createActions()
     connect(showImapLogger, SIGNAL(toggled(bool)), imapLoggerDock, SLOT(setVisible(bool)));
     connect(imapLoggerDock, SIGNAL(visibilityChanged(bool)), showImapLogger, SLOT(setChecked(bool)));
 
+#ifdef TROJITA_INSTRUMENTATION
+    m_showInstrumentation = new QAction(tr("Show &instrumentation"), this);
+    m_showInstrumentation->setCheckable(true);
+    connect(m_showInstrumentation, SIGNAL(toggled(bool)), m_instrumentationDock, SLOT(setVisible(bool)));
+    connect(m_instrumentationDock, SIGNAL(visibilityChanged(bool)), m_showInstrumentation, SLOT(setChecked(bool)));
+#endif
+
     //: file to save the debug log into
     logPersistent = new QAction(tr("Log &into %1").arg(Imap::Mailbox::persistentLogFileName()), this);
     logPersistent->setCheckable(true);
@@ -482,6 +492,9 @@ void MainWindow::createMenus()
     debugMenu->addAction(showTaskView);
     debugMenu->addAction(showImapLogger);
     debugMenu->addAction(logPersistent);
+#ifdef TROJITA_INSTRUMENTATION
+    debugMenu->addAction(m_showInstrumentation);
+#endif
     debugMenu->addAction(showImapCapabilities);
     imapMenu->addSeparator();
     imapMenu->addAction(configSettings);
@@ -583,6 +596,15 @@ void MainWindow::createWidgets()
     imapLoggerDock->setWidget(imapLogger);
     addDockWidget(Qt::BottomDockWidgetArea, imapLoggerDock);
 
+#ifdef TROJITA_INSTRUMENTATION
+    m_instrumentationDock = new QDockWidget(tr("Instrumentation"), this);
+    m_instrumentationDock->setObjectName(QLatin1String("instrumentationDock"));
+    m_instrumentation = new InstrumentationWidget(m_instrumentationDock);
+    m_instrumentationDock->hide();
+    m_instrumentationDock->setWidget(m_instrumentation);
+    addDockWidget(Qt::BottomDockWidgetArea, m_instrumentationDock);
+#endif
+
     busyParsersIndicator = new TaskProgressIndicator(this);
     statusBar()->addPermanentWidget(busyParsersIndicator);
     busyParsersIndicator->hide();
@@ -719,6 +741,9 @@ void MainWindow::setupModels()
     connect(model, SIGNAL(mailboxCreationFailed(QString,QString)), this, SLOT(slotMailboxCreateFailed(QString,QString)));
 
     connect(model, SIGNAL(logged(uint,Common::LogMessage)), imapLogger, SLOT(slotImapLogged(uint,Common::LogMessage)));
+#ifdef TROJITA_INSTRUMENTATION
+    m_instrumentation->setModel(model);
+#endif
 
     connect(model, SIGNAL(mailboxFirstUnseenMessage(QModelIndex,QModelIndex)), this, SLOT(slotScrollToUnseenMessage(QModelIndex,QModelIndex)));
 
@@ -1947,11 +1972,8 @@ void MainWindow::slotHideRead()
 
 void MainWindow::slotCapabilitiesUpdated(const QStringList &capabilities)
 {
-    if (capabilities.contains(QLatin1String("SORT"))) {
-        m_actionSortByDate->actionGroup()->setEnabled(true);
-    } else {
-        m_actionSortByDate->actionGroup()->setEnabled(false);
-    }
+    // Without the SORT extension, the mailbox is sorted locally
+    m_actionSortByDate->actionGroup()->setEnabled(true);
 
     msgListWidget->setFuzzySearchSupported(capabilities.contains(QLatin1String("SEARCH=FUZZY")));
 
@@ -1961,16 +1983,10 @@ void MainWindow::slotCapabilitiesUpdated(const QStringList &capabilities)
                                                Common::SettingsNames::guiMailboxListShowOnlySubscribed, false).toBool());
     m_actionSubscribeMailbox->setEnabled(m_actionShowOnlySubscribed->isEnabled());
 
-    const QStringList supportedCapabilities = Imap::Mailbox::ThreadingMsgListModel::supportedCapabilities();
-    Q_FOREACH(const QString &capability, capabilities) {
-        if (supportedCapabilities.contains(capability)) {
-            actionThreadMsgList->setEnabled(true);
-            if (actionThreadMsgList->isChecked())
-                slotThreadMsgList();
-            return;
-        }
-    }
-    actionThreadMsgList->setEnabled(false);
+    // Threading works even without any of the ThreadingMsgListModel::supportedCapabilities(), it's just done locally then
+    actionThreadMsgList->setEnabled(true);
+    if (actionThreadMsgList->isChecked())
+        slotThreadMsgList();
 }
 
 void MainWindow::slotShowImapInfo()
@@ -75,6 +75,7 @@ class AbstractAddressbook;
 class CompleteMessageWidget;
 class ComposeWidget;
 class MailBoxTreeView;
+class InstrumentationWidget;
 class MessageListWidget;
 class ProtocolLoggerWidget;
 class TaskProgressIndicator;
@@ -226,6 +227,10 @@ private:
 
     ProtocolLoggerWidget *imapLogger;
     QDockWidget *imapLoggerDock;
+#ifdef TROJITA_INSTRUMENTATION
+    InstrumentationWidget *m_instrumentation;
+    QDockWidget *m_instrumentationDock;
+#endif
 
     QPointer<QSplitter> m_mainHSplitter;
     QPointer<QSplitter> m_mainVSplitter;
@@ -244,6 +249,9 @@ private:
     QAction *showFullView;
     QAction *showTaskView;
     QAction *showImapLogger;
+#ifdef TROJITA_INSTRUMENTATION
+    QAction *m_showInstrumentation;
+#endif
     QAction *logPersistent;
     QAction *showImapCapabilities;
     QAction *showMenuBar;
@@ -385,6 +385,12 @@ QString decodeImapFolderName( const QByteArray& raw )
     return KIMAP::decodeImapFolderName( raw );
 }
 
+/** @short Interpret the raw byte array as a text in the given @arg charset, falling back to UTF-8 for unknown ones */
+QString decodeWithCharset(const QByteArray &raw, const QString &charset)
+{
+    return decodeByteArray(raw, charset);
+}
+
 QByteArray quotedPrintableDecode( const QByteArray& raw )
 {
     return KCodecs::quotedPrintableDecode( raw );
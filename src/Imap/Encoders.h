@@ -49,6 +49,8 @@ QByteArray encodeImapFolderName(const QString &text);
 
 QString decodeImapFolderName(const QByteArray &raw);
 
+QString decodeWithCharset(const QByteArray &raw, const QString &charset);
+
 QByteArray quotedPrintableDecode(const QByteArray &raw);
 QByteArray quotedPrintableEncode(const QByteArray &raw);
 
@@ -35,6 +35,13 @@ SOURCES += Parser/Parser.cpp \
     Model/PrettyMailboxModel.cpp \
     Model/MsgListModel.cpp \
     Model/ThreadingMsgListModel.cpp \
+    Model/LocalThreading.cpp \
+    Model/LocalSorting.cpp \
+    Model/CompactEnvelope.cpp \
+    Model/PartDataLru.cpp \
+    Model/MessageDisplayCache.cpp \
+    Model/FlagDictionary.cpp \
+    Model/FullTextIndex.cpp \
     Model/PrettyMsgListModel.cpp \
     Model/MailboxTree.cpp \
     Model/MemoryCache.cpp \
@@ -107,6 +114,13 @@ HEADERS += Parser/Parser.h \
     Model/PrettyMailboxModel.h \
     Model/MsgListModel.h \
     Model/ThreadingMsgListModel.h \
+    Model/LocalThreading.h \
+    Model/LocalSorting.h \
+    Model/CompactEnvelope.h \
+    Model/PartDataLru.h \
+    Model/MessageDisplayCache.h \
+    Model/FlagDictionary.h \
+    Model/FullTextIndex.h \
     Model/PrettyMsgListModel.h \
     Model/MailboxTree.h \
     Model/MemoryCache.h \
@@ -24,10 +24,16 @@
 #define IMAP_MODEL_CACHE_H
 
 #include <QUrl>
+#include "FullTextIndex.h"
 #include "MailboxMetadata.h"
 #include "../Parser/Message.h"
+#include "Common/Instrumentation.h"
 #include "Imap/Parser/ThreadingNode.h"
 
+/** @short Count one lookup through the cache's @arg METHOD which has found its data when @arg HIT is true */
+#define TROJITA_INSTRUMENT_CACHE(METHOD, HIT) \
+    TROJITA_INSTRUMENT((HIT) ? QLatin1String("cache hits") : QLatin1String("cache misses"), QLatin1String(METHOD), 1)
+
 /** @short Namespace for IMAP interaction */
 namespace Imap
 {
@@ -69,6 +75,13 @@ public:
         /** @short Is the List-Post set to "NO"? */
         bool hdrListPostNo;
 
+        /** @short The base subject from RFC 5256, derived from the envelope's subject
+
+        It is kept along with the rest of the metadata so that the client-side sorting and threading doesn't have to strip the
+        "Re:" and "Fwd:" prefixes of each message again after the mailbox has been loaded from the cache.
+        */
+        QString baseSubject;
+
         MessageDataBundle(): uid(0), size(0), hdrListPostNo(false) {}
 
         bool operator==(const MessageDataBundle &other) const
@@ -76,7 +89,31 @@ public:
             return uid == other.uid && envelope == other.envelope && internalDate == other.internalDate &&
                     serializedBodyStructure == other.serializedBodyStructure && size == other.size &&
                     hdrReferences == other.hdrReferences && hdrListPost == other.hdrListPost &&
-                    hdrListPostNo == other.hdrListPostNo;
+                    hdrListPostNo == other.hdrListPostNo && baseSubject == other.baseSubject;
+        }
+    };
+
+    /** @short The result of the last SORT or SEARCH in a mailbox, along with the state of the mailbox it is valid for */
+    struct MessageSorting {
+        /** @short The SORT criteria, or an empty list for a plain SEARCH */
+        QStringList sortCriteria;
+        /** @short The search conditions, or an empty list for searching through all messages */
+        QStringList searchConditions;
+        /** @short UIDs of the matching messages in the sorted order */
+        QList<uint> uids;
+        /** @short UIDVALIDITY of the mailbox at the time the command was issued */
+        uint uidValidity;
+        /** @short UIDNEXT of the mailbox at the time the command was issued */
+        uint uidNext;
+        /** @short HIGHESTMODSEQ of the mailbox at the time the command was issued, or zero if not known */
+        quint64 highestModSeq;
+
+        MessageSorting(): uidValidity(0), uidNext(0), highestModSeq(0) {}
+
+        bool operator==(const MessageSorting &other) const
+        {
+            return sortCriteria == other.sortCriteria && searchConditions == other.searchConditions && uids == other.uids &&
+                    uidValidity == other.uidValidity && uidNext == other.uidNext && highestModSeq == other.highestModSeq;
         }
     };
 
@@ -120,11 +157,28 @@ public:
     /** @short Save data for one message part */
     virtual void setMsgPart(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data) = 0;
 
+    /** @short Add words from the @arg text to the full-text index of a message
+
+    The envelope is indexed automatically by setMessageMetadata(), so this is meant for the textual body parts.
+    */
+    virtual void addMsgSearchableText(const QString &mailbox, uint uid, const QString &text) = 0;
+    /** @short Return sorted UIDs of messages whose indexed text contains all words from the @arg query
+
+    Only the words found in the @arg fields, a mask of FullTextIndex::Field, are considered. See FullTextIndex for what a "word"
+    means.
+    */
+    virtual QList<uint> searchMessages(const QString &mailbox, const QString &query, const uint fields) const = 0;
+
     /** @short Return cached threading info for a given mailbox */
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox) = 0;
     /** @short Save information about how messages are threaded */
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading) = 0;
 
+    /** @short Return the cached result of the last SORT or SEARCH in a given mailbox */
+    virtual MessageSorting messageSorting(const QString &mailbox) const = 0;
+    /** @short Remember the result of a SORT or SEARCH, replacing the previous one */
+    virtual void setMessageSorting(const QString &mailbox, const MessageSorting &sorting) = 0;
+
     /** @short How many days is it OK not to mark entries as accessed? */
     virtual void setRenewalThreshold(const int days) = 0;
 
@@ -124,6 +124,7 @@ QByteArray CombinedCache::messagePart(const QString &mailbox, uint uid, const QS
     QByteArray res = sqlCache->messagePart(mailbox, uid, partId);
     if (res.isEmpty()) {
         res = diskPartCache->messagePart(mailbox, uid, partId);
+        TROJITA_INSTRUMENT_CACHE("DiskPartCache::messagePart", !res.isEmpty());
     }
     return res;
 }
@@ -137,6 +138,16 @@ void CombinedCache::setMsgPart(const QString &mailbox, uint uid, const QString &
     }
 }
 
+void CombinedCache::addMsgSearchableText(const QString &mailbox, uint uid, const QString &text)
+{
+    sqlCache->addMsgSearchableText(mailbox, uid, text);
+}
+
+QList<uint> CombinedCache::searchMessages(const QString &mailbox, const QString &query, const uint fields) const
+{
+    return sqlCache->searchMessages(mailbox, query, fields);
+}
+
 QVector<Imap::Responses::ThreadingNode> CombinedCache::messageThreading(const QString &mailbox)
 {
     return sqlCache->messageThreading(mailbox);
@@ -147,6 +158,16 @@ void CombinedCache::setMessageThreading(const QString &mailbox, const QVector<Im
     sqlCache->setMessageThreading(mailbox, threading);
 }
 
+CombinedCache::MessageSorting CombinedCache::messageSorting(const QString &mailbox) const
+{
+    return sqlCache->messageSorting(mailbox);
+}
+
+void CombinedCache::setMessageSorting(const QString &mailbox, const MessageSorting &sorting)
+{
+    sqlCache->setMessageSorting(mailbox, sorting);
+}
+
 void CombinedCache::setRenewalThreshold(const int days)
 {
     sqlCache->setRenewalThreshold(days);
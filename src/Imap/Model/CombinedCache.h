@@ -83,9 +83,15 @@ public:
     virtual QByteArray messagePart(const QString &mailbox, uint uid, const QString &partId) const;
     virtual void setMsgPart(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data);
 
+    virtual void addMsgSearchableText(const QString &mailbox, uint uid, const QString &text);
+    virtual QList<uint> searchMessages(const QString &mailbox, const QString &query, const uint fields) const;
+
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading);
 
+    virtual MessageSorting messageSorting(const QString &mailbox) const;
+    virtual void setMessageSorting(const QString &mailbox, const MessageSorting &sorting);
+
     virtual void setRenewalThreshold(const int days);
 
     /** @short Open a connection to the cache */
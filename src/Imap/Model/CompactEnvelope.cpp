@@ -0,0 +1,168 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "CompactEnvelope.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+using Message::MailAddress;
+
+uint AddressPool::intern(const MailAddress &address)
+{
+    QHash<MailAddress, uint>::const_iterator it = m_ids.constFind(address);
+    if (it != m_ids.constEnd()) {
+        ++m_refCounts[*it];
+        return *it;
+    }
+
+    MailAddress stored = address;
+    if (!stored.host.isEmpty()) {
+        QHash<QString, uint>::iterator host = m_hosts.find(stored.host);
+        if (host == m_hosts.end()) {
+            m_hosts.insert(stored.host, 1);
+        } else {
+            stored.host = host.key();
+            ++*host;
+        }
+    }
+
+    uint id;
+    if (m_freeIds.isEmpty()) {
+        id = m_addresses.size();
+        m_addresses.append(stored);
+        m_refCounts.append(1);
+    } else {
+        id = m_freeIds.last();
+        m_freeIds.pop_back();
+        m_addresses[id] = stored;
+        m_refCounts[id] = 1;
+    }
+    m_ids.insert(stored, id);
+    return id;
+}
+
+void AddressPool::release(const uint id)
+{
+    Q_ASSERT(id < static_cast<uint>(m_refCounts.size()));
+    Q_ASSERT(m_refCounts[id]);
+    if (--m_refCounts[id])
+        return;
+
+    const MailAddress &address = m_addresses[id];
+    m_ids.remove(address);
+    if (!address.host.isEmpty()) {
+        QHash<QString, uint>::iterator host = m_hosts.find(address.host);
+        Q_ASSERT(host != m_hosts.end());
+        if (!--*host)
+            m_hosts.erase(host);
+    }
+
+    if (m_ids.isEmpty()) {
+        // All messages are gone, so there's no point in keeping the free slots around
+        m_addresses.clear();
+        m_refCounts.clear();
+        m_freeIds.clear();
+    } else {
+        m_addresses[id] = MailAddress();
+        m_freeIds.append(id);
+    }
+}
+
+const MailAddress &AddressPool::address(const uint id) const
+{
+    Q_ASSERT(id < static_cast<uint>(m_addresses.size()));
+    Q_ASSERT(m_refCounts[id]);
+    return m_addresses[id];
+}
+
+int AddressPool::size() const
+{
+    return m_ids.size();
+}
+
+/** @short Number of the address fields, i.e. the size of the header of the CompactEnvelope::m_addresses */
+static const int addressFieldCount = CompactEnvelope::BCC + 1;
+
+CompactEnvelope::CompactEnvelope()
+{
+}
+
+CompactEnvelope::CompactEnvelope(AddressPool &pool, const Message::Envelope &envelope):
+    date(envelope.date), subject(envelope.subject), inReplyTo(envelope.inReplyTo), messageId(envelope.messageId)
+{
+    const QList<MailAddress> *fields[] = {
+        &envelope.from, &envelope.sender, &envelope.replyTo, &envelope.to, &envelope.cc, &envelope.bcc
+    };
+    int total = 0;
+    for (int i = 0; i < addressFieldCount; ++i)
+        total += fields[i]->size();
+    if (!total)
+        return;
+
+    m_addresses.reserve(addressFieldCount + total);
+    for (int i = 0; i < addressFieldCount; ++i)
+        m_addresses.append(fields[i]->size());
+    for (int i = 0; i < addressFieldCount; ++i) {
+        Q_FOREACH(const MailAddress &address, *fields[i]) {
+            m_addresses.append(pool.intern(address));
+        }
+    }
+}
+
+Message::Envelope CompactEnvelope::envelope(const AddressPool &pool) const
+{
+    return Message::Envelope(date, subject, addresses(pool, FROM), addresses(pool, SENDER), addresses(pool, REPLY_TO),
+                             addresses(pool, TO), addresses(pool, CC), addresses(pool, BCC), inReplyTo, messageId);
+}
+
+QList<MailAddress> CompactEnvelope::addresses(const AddressPool &pool, const AddressField field) const
+{
+    QList<MailAddress> res;
+    if (m_addresses.isEmpty())
+        return res;
+
+    int offset = addressFieldCount;
+    for (int i = 0; i < field; ++i)
+        offset += m_addresses[i];
+    const int end = offset + m_addresses[field];
+    for (int i = offset; i < end; ++i)
+        res.append(pool.address(m_addresses[i]));
+    return res;
+}
+
+void CompactEnvelope::clear(AddressPool &pool)
+{
+    for (int i = addressFieldCount; i < m_addresses.size(); ++i)
+        pool.release(m_addresses[i]);
+    date = QDateTime();
+    subject.clear();
+    inReplyTo.clear();
+    messageId.clear();
+    m_addresses.clear();
+}
+
+}
+}
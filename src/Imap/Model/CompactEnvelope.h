@@ -0,0 +1,109 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAP_MODEL_COMPACTENVELOPE_H
+#define IMAP_MODEL_COMPACTENVELOPE_H
+
+#include <QHash>
+#include <QVector>
+#include "../Parser/Message.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+/** @short Storage of e-mail addresses which are shared by all messages of a mailbox
+
+The same people tend to appear in thousands of messages, so each distinct address is only stored once and the messages refer to
+it through a numeric ID. The host names are shared among the addresses, too. The entries are reference-counted, so an address
+is dropped once the last message which refers to it is gone, and its ID gets reused later.
+*/
+class AddressPool
+{
+public:
+    /** @short Return the ID of an address equal to @arg address, adding it to the pool if it hasn't been seen yet
+
+    Each call takes one reference which has to be given back through release().
+    */
+    uint intern(const Message::MailAddress &address);
+    /** @short Give back a reference to the address with the given @arg id, removing it when nobody uses it anymore */
+    void release(const uint id);
+    /** @short Return the address with the given @arg id */
+    const Message::MailAddress &address(const uint id) const;
+    /** @short Return the number of distinct addresses in the pool */
+    int size() const;
+
+private:
+    QVector<Message::MailAddress> m_addresses;
+    /** @short Number of references to each of the m_addresses; zero for the unused slots */
+    QVector<uint> m_refCounts;
+    /** @short Unused slots of the m_addresses */
+    QVector<uint> m_freeIds;
+    QHash<Message::MailAddress, uint> m_ids;
+    /** @short Shared host names along with the number of addresses which use them */
+    QHash<QString, uint> m_hosts;
+};
+
+/** @short Memory-efficient form of the ENVELOPE which is kept for each message
+
+The addresses are replaced by their IDs within an AddressPool, so that a message refers to them through a single array instead of
+six lists of four strings each. The full Message::Envelope is only built when somebody actually asks for it.
+*/
+class CompactEnvelope
+{
+public:
+    /** @short The address fields of the ENVELOPE, in the order in which they appear there */
+    typedef enum {
+        FROM,
+        SENDER,
+        REPLY_TO,
+        TO,
+        CC,
+        BCC
+    } AddressField;
+
+    CompactEnvelope();
+    CompactEnvelope(AddressPool &pool, const Message::Envelope &envelope);
+
+    /** @short Rebuild the original envelope */
+    Message::Envelope envelope(const AddressPool &pool) const;
+    /** @short Return the addresses from just one of the fields */
+    QList<Message::MailAddress> addresses(const AddressPool &pool, const AddressField field) const;
+    /** @short Forget the envelope, giving the addresses back to the @arg pool */
+    void clear(AddressPool &pool);
+
+    QDateTime date;
+    QString subject;
+    QList<QByteArray> inReplyTo;
+    QByteArray messageId;
+
+private:
+    /** @short Number of addresses in each field, followed by the IDs of all of them; empty if there are no addresses at all */
+    QVector<uint> m_addresses;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_COMPACTENVELOPE_H
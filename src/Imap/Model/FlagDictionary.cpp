@@ -0,0 +1,173 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "FlagDictionary.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+bool MessageFlags::test(const int flag) const
+{
+    Q_ASSERT(flag >= 0);
+    if (flag < INLINE_BITS)
+        return m_bits & (Q_UINT64_C(1) << flag);
+    const int word = flag / INLINE_BITS - 1;
+    return word < m_extraBits.size() && (m_extraBits[word] & (Q_UINT64_C(1) << (flag % INLINE_BITS)));
+}
+
+void MessageFlags::set(const int flag)
+{
+    Q_ASSERT(flag >= 0);
+    if (flag < INLINE_BITS) {
+        m_bits |= Q_UINT64_C(1) << flag;
+        return;
+    }
+    const int word = flag / INLINE_BITS - 1;
+    if (word >= m_extraBits.size())
+        m_extraBits.resize(word + 1);
+    m_extraBits[word] |= Q_UINT64_C(1) << (flag % INLINE_BITS);
+}
+
+void MessageFlags::clear(const int flag)
+{
+    Q_ASSERT(flag >= 0);
+    if (flag < INLINE_BITS) {
+        m_bits &= ~(Q_UINT64_C(1) << flag);
+        return;
+    }
+    const int word = flag / INLINE_BITS - 1;
+    if (word < m_extraBits.size())
+        m_extraBits[word] &= ~(Q_UINT64_C(1) << (flag % INLINE_BITS));
+}
+
+void MessageFlags::unite(const MessageFlags &other)
+{
+    m_bits |= other.m_bits;
+    if (m_extraBits.size() < other.m_extraBits.size())
+        m_extraBits.resize(other.m_extraBits.size());
+    for (int i = 0; i < other.m_extraBits.size(); ++i)
+        m_extraBits[i] |= other.m_extraBits[i];
+}
+
+void MessageFlags::subtract(const MessageFlags &other)
+{
+    m_bits &= ~other.m_bits;
+    const int common = qMin(m_extraBits.size(), other.m_extraBits.size());
+    for (int i = 0; i < common; ++i)
+        m_extraBits[i] &= ~other.m_extraBits[i];
+}
+
+bool MessageFlags::isEmpty() const
+{
+    if (m_bits)
+        return false;
+    for (int i = 0; i < m_extraBits.size(); ++i) {
+        if (m_extraBits[i])
+            return false;
+    }
+    return true;
+}
+
+bool MessageFlags::operator==(const MessageFlags &other) const
+{
+    if (m_bits != other.m_bits)
+        return false;
+    // The vectors might differ in their length, the missing words are all zero
+    const int size = qMax(m_extraBits.size(), other.m_extraBits.size());
+    for (int i = 0; i < size; ++i) {
+        if (m_extraBits.value(i) != other.m_extraBits.value(i))
+            return false;
+    }
+    return true;
+}
+
+FlagDictionary::FlagDictionary()
+{
+    // The order has to match the WellKnownFlag
+    intern(QLatin1String("\\Seen"));
+    intern(QLatin1String("\\Deleted"));
+    intern(QLatin1String("\\Answered"));
+    intern(QLatin1String("$Forwarded"));
+    intern(QLatin1String("\\Recent"));
+}
+
+int FlagDictionary::intern(const QString &flag)
+{
+    int index = find(flag);
+    if (index != -1)
+        return index;
+
+    index = m_names.size();
+    m_names.append(flag);
+    m_indexes.insert(flag, index);
+    return index;
+}
+
+int FlagDictionary::find(const QString &flag) const
+{
+    QHash<QString,int>::const_iterator it = m_indexes.constFind(flag);
+    if (it != m_indexes.constEnd())
+        return *it;
+
+    // The system flags are case-insensitive, so "\SEEN" is the same as "\Seen"
+    for (int i = FLAG_SEEN; i <= FLAG_RECENT && i < m_names.size(); ++i) {
+        if (flag.compare(m_names[i], Qt::CaseInsensitive) == 0)
+            return i;
+    }
+    return -1;
+}
+
+QString FlagDictionary::flag(const int index) const
+{
+    return m_names[index];
+}
+
+int FlagDictionary::size() const
+{
+    return m_names.size();
+}
+
+MessageFlags FlagDictionary::fromList(const QStringList &flags)
+{
+    MessageFlags res;
+    Q_FOREACH(const QString &flag, flags) {
+        res.set(intern(flag));
+    }
+    return res;
+}
+
+QStringList FlagDictionary::toList(const MessageFlags &flags) const
+{
+    QStringList res;
+    for (int i = 0; i < m_names.size(); ++i) {
+        if (flags.test(i))
+            res.append(m_names[i]);
+    }
+    res.sort();
+    return res;
+}
+
+}
+}
@@ -0,0 +1,105 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAP_MODEL_FLAGDICTIONARY_H
+#define IMAP_MODEL_FLAGDICTIONARY_H
+
+#include <QHash>
+#include <QStringList>
+#include <QVector>
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+/** @short Set of the flags of a single message, with one bit per flag
+
+The meaning of the individual bits is defined by the FlagDictionary of the mailbox which the message belongs to.
+*/
+class MessageFlags
+{
+public:
+    MessageFlags(): m_bits(0) {}
+
+    bool test(const int flag) const;
+    void set(const int flag);
+    void clear(const int flag);
+    /** @short Add all flags from the @arg other set */
+    void unite(const MessageFlags &other);
+    /** @short Remove all flags which are present in the @arg other set */
+    void subtract(const MessageFlags &other);
+    bool isEmpty() const;
+
+    bool operator==(const MessageFlags &other) const;
+    bool operator!=(const MessageFlags &other) const { return !(*this == other); }
+
+private:
+    enum { INLINE_BITS = 64 };
+    /** @short The first few flags which fit without any extra allocation */
+    quint64 m_bits;
+    /** @short Bits of the flags beyond the INLINE_BITS ones */
+    QVector<quint64> m_extraBits;
+};
+
+/** @short Mapping between the names of the message flags and their position in the MessageFlags
+
+Each mailbox has its own dictionary, so that the number of bits stays small even when the individual mailboxes use many
+different keywords. The well-known system flags always get the same positions, which means that they can be checked without
+any lookup. The special flags are matched case-insensitively, all other flags are compared exactly.
+*/
+class FlagDictionary
+{
+public:
+    /** @short Positions of the flags which are present in every dictionary */
+    typedef enum {
+        FLAG_SEEN,
+        FLAG_DELETED,
+        FLAG_ANSWERED,
+        FLAG_FORWARDED,
+        FLAG_RECENT
+    } WellKnownFlag;
+
+    FlagDictionary();
+
+    /** @short Return the position of the @arg flag, adding it to the dictionary if it isn't known yet */
+    int intern(const QString &flag);
+    /** @short Return the position of the @arg flag, or -1 if it isn't known */
+    int find(const QString &flag) const;
+    /** @short Return the name of the flag at position @arg index */
+    QString flag(const int index) const;
+    int size() const;
+
+    MessageFlags fromList(const QStringList &flags);
+    /** @short Return the flags in a sorted list, with all the strings implicitly shared */
+    QStringList toList(const MessageFlags &flags) const;
+
+private:
+    QVector<QString> m_names;
+    QHash<QString,int> m_indexes;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_FLAGDICTIONARY_H
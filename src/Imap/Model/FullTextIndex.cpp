@@ -0,0 +1,189 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "FullTextIndex.h"
+#include <algorithm>
+#include "Imap/Parser/Message.h"
+#include "LocalSorting.h"
+
+namespace {
+
+/** @short Longer "words" are most likely some encoded data, not something which people would search for */
+const int maxWordLength = 64;
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+void FullTextIndex::addText(const uint uid, const Field field, const QString &text)
+{
+    QSet<QString> &known = m_messageWords[uid];
+    Q_FOREACH(const QString &word, words(text)) {
+        known.insert(word);
+        m_postings[word][uid] |= field;
+    }
+}
+
+void FullTextIndex::removeMessage(const uint uid)
+{
+    QHash<uint, QSet<QString> >::iterator it = m_messageWords.find(uid);
+    if (it == m_messageWords.end())
+        return;
+    Q_FOREACH(const QString &word, *it) {
+        QMap<QString, QHash<uint, uint> >::iterator posting = m_postings.find(word);
+        if (posting == m_postings.end())
+            continue;
+        posting->remove(uid);
+        if (posting->isEmpty())
+            m_postings.erase(posting);
+    }
+    m_messageWords.erase(it);
+}
+
+void FullTextIndex::clear()
+{
+    m_postings.clear();
+    m_messageWords.clear();
+}
+
+QList<uint> FullTextIndex::search(const QString &query, const uint fields) const
+{
+    QList<QSet<uint> > matches;
+    Q_FOREACH(const QString &prefix, words(query)) {
+        QSet<uint> uids;
+        for (QMap<QString, QHash<uint, uint> >::const_iterator it = m_postings.lowerBound(prefix);
+             it != m_postings.constEnd() && it.key().startsWith(prefix); ++it) {
+            for (QHash<uint, uint>::const_iterator posting = it->constBegin(); posting != it->constEnd(); ++posting) {
+                if (*posting & fields)
+                    uids.insert(posting.key());
+            }
+        }
+        matches << uids;
+    }
+    return intersect(matches);
+}
+
+/** @short Split the @arg text into unique normalized words */
+QStringList FullTextIndex::words(const QString &text)
+{
+    const QString normalized = LocalSorting::collationKey(text);
+    QStringList res;
+    QSet<QString> seen;
+    int start = -1;
+    for (int i = 0; i <= normalized.size(); ++i) {
+        const bool isWordChar = i < normalized.size() && normalized[i].isLetterOrNumber();
+        if (isWordChar && start == -1) {
+            start = i;
+        } else if (!isWordChar && start != -1) {
+            if (i - start <= maxWordLength) {
+                const QString word = normalized.mid(start, i - start);
+                if (!seen.contains(word)) {
+                    seen.insert(word);
+                    res << word;
+                }
+            }
+            start = -1;
+        }
+    }
+    return res;
+}
+
+/** @short Return the searchable texts from the envelope, i.e. the subject and all addresses */
+FullTextIndex::FieldTexts FullTextIndex::envelopeTexts(const Message::Envelope &envelope)
+{
+    FieldTexts res;
+    res << qMakePair(FIELD_SUBJECT, envelope.subject);
+    QList<QPair<Field, const QList<Message::MailAddress> *> > addresses;
+    addresses << qMakePair(FIELD_FROM, &envelope.from) << qMakePair(FIELD_SENDER, &envelope.sender)
+              << qMakePair(FIELD_TO, &envelope.to) << qMakePair(FIELD_CC, &envelope.cc) << qMakePair(FIELD_BCC, &envelope.bcc);
+    for (int i = 0; i < addresses.size(); ++i) {
+        QStringList buf;
+        Q_FOREACH(const Message::MailAddress &addr, *addresses[i].second) {
+            buf << addr.name << addr.mailbox << addr.host;
+        }
+        if (!buf.isEmpty())
+            res << qMakePair(addresses[i].first, buf.join(QLatin1String(" ")));
+    }
+    return res;
+}
+
+/** @short Return a mask of fields searched by the IMAP SEARCH @arg key, or zero if that key is not about text */
+uint FullTextIndex::fieldsForSearchKey(const QString &key)
+{
+    const QString upper = key.toUpper();
+    if (upper == QLatin1String("TEXT"))
+        return FIELD_ANY;
+    else if (upper == QLatin1String("BODY"))
+        return FIELD_BODY;
+    else if (upper == QLatin1String("SUBJECT"))
+        return FIELD_SUBJECT;
+    else if (upper == QLatin1String("FROM"))
+        return FIELD_FROM;
+    else if (upper == QLatin1String("TO"))
+        return FIELD_TO;
+    else if (upper == QLatin1String("CC"))
+        return FIELD_CC;
+    else if (upper == QLatin1String("BCC"))
+        return FIELD_BCC;
+    return 0;
+}
+
+/** @short Return the smallest string which is greater than all strings starting with @arg prefix
+
+The @arg prefix has to be one of the words(), which guarantees that it doesn't end with U+FFFF.
+*/
+QString FullTextIndex::prefixUpperBound(const QString &prefix)
+{
+    Q_ASSERT(!prefix.isEmpty());
+    QString res = prefix;
+    res[res.size() - 1] = QChar(res[res.size() - 1].unicode() + 1);
+    return res;
+}
+
+/** @short Return the sorted UIDs which are present in each of the @arg matches */
+QList<uint> FullTextIndex::intersect(const QList<QSet<uint> > &matches)
+{
+    if (matches.isEmpty())
+        return QList<uint>();
+
+    // Start with the most selective word
+    int smallest = 0;
+    for (int i = 1; i < matches.size(); ++i) {
+        if (matches[i].size() < matches[smallest].size())
+            smallest = i;
+    }
+    QSet<uint> res = matches[smallest];
+    for (int i = 0; i < matches.size() && !res.isEmpty(); ++i) {
+        if (i != smallest)
+            res.intersect(matches[i]);
+    }
+    QList<uint> sorted = res.toList();
+    std::sort(sorted.begin(), sorted.end());
+    return sorted;
+}
+
+}
+}
@@ -0,0 +1,93 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAP_MODEL_FULLTEXTINDEX_H
+#define IMAP_MODEL_FULLTEXTINDEX_H
+
+#include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QSet>
+#include <QStringList>
+
+namespace Imap
+{
+
+namespace Message
+{
+class Envelope;
+}
+
+namespace Mailbox
+{
+
+/** @short An in-memory inverted index of words which appear in the messages of one mailbox
+
+The static helpers define what a "word" is, so that all cache backends agree on that. Words are case-folded and stripped of their
+diacritics, and the queries match them by prefix, i.e. a search for "meet" finds a message mentioning a "Meeting".
+
+Each word remembers the fields of the message where it was found, so that e.g. the FROM search key doesn't match a message which
+merely mentions the sender's name in its body.
+*/
+class FullTextIndex
+{
+public:
+    /** @short Parts of a message where a word can appear, to be combined as bits of a mask */
+    enum Field {
+        FIELD_BODY = 1 << 0,
+        FIELD_SUBJECT = 1 << 1,
+        FIELD_FROM = 1 << 2,
+        FIELD_SENDER = 1 << 3,
+        FIELD_TO = 1 << 4,
+        FIELD_CC = 1 << 5,
+        FIELD_BCC = 1 << 6,
+        /** @short All of the above, as used by the TEXT search key */
+        FIELD_ANY = (1 << 7) - 1
+    };
+    /** @short Texts to index, along with the field they come from */
+    typedef QList<QPair<Field, QString> > FieldTexts;
+
+    /** @short Add all words from the @arg text in the given @arg field to the message */
+    void addText(const uint uid, const Field field, const QString &text);
+    void removeMessage(const uint uid);
+    void clear();
+    /** @short Return UIDs of messages which contain all words from the @arg query in any of the @arg fields, sorted by UID */
+    QList<uint> search(const QString &query, const uint fields = FIELD_ANY) const;
+
+    static QStringList words(const QString &text);
+    static FieldTexts envelopeTexts(const Message::Envelope &envelope);
+    static uint fieldsForSearchKey(const QString &key);
+    static QString prefixUpperBound(const QString &prefix);
+    static QList<uint> intersect(const QList<QSet<uint> > &matches);
+
+private:
+    /** @short The posting lists, i.e. UIDs of messages containing each word along with a mask of the matching fields */
+    QMap<QString, QHash<uint, uint> > m_postings;
+    /** @short Words in each message, for a quick removal */
+    QHash<uint, QSet<QString> > m_messageWords;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_FULLTEXTINDEX_H
@@ -78,6 +78,8 @@ enum {
     RoleMessageUid,
     /** @short Subject of the message */
     RoleMessageSubject,
+    /** @short Subject of the message without the "Re:" and "Fwd:" prefixes, see RFC 5256 */
+    RoleMessageBaseSubject,
     /** @short The From addresses */
     RoleMessageFrom,
     /** @short The To addresses */
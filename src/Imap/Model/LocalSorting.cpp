@@ -0,0 +1,359 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "LocalSorting.h"
+#include <algorithm>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include "MailboxTree.h"
+
+namespace {
+
+/** @short Mailboxes smaller than this are sorted in a single thread */
+const int parallelSortThreshold = 20000;
+
+/** @short Return the length of the subj-blob from RFC 5256 which starts at @arg pos, or zero if there's none */
+int blobLength(const QString &s, const int pos)
+{
+    if (pos >= s.size() || s[pos] != QLatin1Char('['))
+        return 0;
+    int i = pos + 1;
+    while (i < s.size() && s[i] != QLatin1Char('[') && s[i] != QLatin1Char(']'))
+        ++i;
+    if (i >= s.size() || s[i] != QLatin1Char(']'))
+        return 0;
+    ++i;
+    while (i < s.size() && s[i] == QLatin1Char(' '))
+        ++i;
+    return i - pos;
+}
+
+/** @short Return the length of the subj-refwd from RFC 5256 which starts at @arg pos, or zero if there's none */
+int refwdLength(const QString &s, const int pos)
+{
+    int i = pos;
+    if (s.midRef(i, 3).compare(QLatin1String("fwd"), Qt::CaseInsensitive) == 0) {
+        i += 3;
+    } else if (s.midRef(i, 2).compare(QLatin1String("fw"), Qt::CaseInsensitive) == 0 ||
+               s.midRef(i, 2).compare(QLatin1String("re"), Qt::CaseInsensitive) == 0) {
+        i += 2;
+    } else {
+        return 0;
+    }
+    while (i < s.size() && s[i] == QLatin1Char(' '))
+        ++i;
+    i += blobLength(s, i);
+    if (i < s.size() && s[i] == QLatin1Char(':'))
+        return i + 1 - pos;
+    return 0;
+}
+
+/** @short Return the length of the subj-leader from RFC 5256, or zero if the subject doesn't start with one */
+int leaderLength(const QString &s)
+{
+    if (s.startsWith(QLatin1Char(' ')))
+        return 1;
+    int i = 0;
+    while (int blob = blobLength(s, i))
+        i += blob;
+    int refwd = refwdLength(s, i);
+    return refwd ? i + refwd : 0;
+}
+
+/** @short Order the positions by their numeric key and by the position itself */
+class NumericComparator {
+public:
+    explicit NumericComparator(const quint64 *keys): m_keys(keys) {}
+    bool operator()(const int a, const int b) const
+    {
+        return m_keys[a] != m_keys[b] ? m_keys[a] < m_keys[b] : a < b;
+    }
+private:
+    const quint64 *m_keys;
+};
+
+/** @short Order the positions by their textual key and by the position itself */
+class TextComparator {
+public:
+    explicit TextComparator(const QString *keys): m_keys(keys) {}
+    bool operator()(const int a, const int b) const
+    {
+        int res = QString::compare(m_keys[a], m_keys[b]);
+        return res ? res < 0 : a < b;
+    }
+private:
+    const QString *m_keys;
+};
+
+template <typename Comparator>
+class SortRunnable: public QRunnable {
+public:
+    SortRunnable(int *begin, int *end, const Comparator &comparator): m_begin(begin), m_end(end), m_comparator(comparator) {}
+    virtual void run()
+    {
+        std::sort(m_begin, m_end, m_comparator);
+    }
+private:
+    int *m_begin;
+    int *m_end;
+    Comparator m_comparator;
+};
+
+/** @short Sort the positions from 0 to @arg size - 1
+
+The comparators never consider two positions equal, so the result is the same no matter how the work gets split among the threads.
+*/
+template <typename Comparator>
+QVector<int> sortPositions(const int size, const Comparator &comparator)
+{
+    QVector<int> order(size);
+    int *data = order.data();
+    for (int i = 0; i < size; ++i)
+        data[i] = i;
+
+    const int threads = QThread::idealThreadCount();
+    if (size < parallelSortThreshold || threads < 2) {
+        std::sort(data, data + size, comparator);
+        return order;
+    }
+
+    // Sort the chunks in parallel and merge them afterwards
+    const int chunk = (size + threads - 1) / threads;
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    for (int i = 0; i < size; i += chunk) {
+        pool.start(new SortRunnable<Comparator>(data + i, data + qMin(i + chunk, size), comparator));
+    }
+    pool.waitForDone();
+    for (int width = chunk; width < size; width *= 2) {
+        for (int i = 0; i + width < size; i += 2 * width) {
+            std::inplace_merge(data + i, data + i + width, data + qMin(i + 2 * width, size), comparator);
+        }
+    }
+    return order;
+}
+
+/** @short The display name of the first address, or its addr-spec if there's no name, as per RFC 5957 */
+QString displayAddress(const QList<Imap::Message::MailAddress> &addresses)
+{
+    if (addresses.isEmpty())
+        return QString();
+    const Imap::Message::MailAddress &addr = addresses.first();
+    if (!addr.name.isEmpty())
+        return addr.name;
+    return addr.mailbox + QLatin1Char('@') + addr.host;
+}
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+LocalSorting::LocalSorting(): m_key(KEY_ARRIVAL)
+{
+}
+
+QList<uint> LocalSorting::sort(Model *model, TreeItemMsgList *list, const SortKey key, bool *complete)
+{
+    if (key != m_key) {
+        clear();
+        m_key = key;
+    }
+    const bool numeric = isNumeric(key);
+
+    const int size = static_cast<int>(list->rowCount(model));
+    QVector<uint> uids(size);
+    QVector<bool> known(size);
+    QVector<quint64> numericKeys(numeric ? size : 0);
+    QVector<QString> textKeys(numeric ? 0 : size);
+    *complete = true;
+
+    // Both the cached and the current messages are ordered by UID, which makes it possible to reuse the keys in a single pass
+    int old = 0;
+    for (int i = 0; i < size; ++i) {
+        const uint uid = list->messageUid(i);
+        uids[i] = uid;
+        if (!uid) {
+            // This one isn't going to be shown anyway
+            continue;
+        }
+        while (old < m_uids.size() && m_uids[old] < uid)
+            ++old;
+        if (old < m_uids.size() && m_uids[old] == uid && m_known[old]) {
+            known[i] = true;
+            if (numeric)
+                numericKeys[i] = m_numericKeys[old];
+            else
+                textKeys[i] = m_textKeys[old];
+            continue;
+        }
+
+        // This could load the metadata from cache right away; it's a no-op when the data are already being fetched
+        TreeItemMessage *message = list->message(i);
+        message->fetch(model);
+        if (!message->fetched()) {
+            *complete = false;
+            continue;
+        }
+        known[i] = true;
+        switch (key) {
+        case KEY_ARRIVAL:
+        {
+            QDateTime date = message->internalDate(model);
+            numericKeys[i] = date.isValid() ? date.toTime_t() : 0;
+            break;
+        }
+        case KEY_DATE:
+        {
+            // RFC 5256 says to use the INTERNALDATE if the sent date cannot be determined
+            QDateTime date = message->date(model);
+            if (!date.isValid())
+                date = message->internalDate(model);
+            numericKeys[i] = date.isValid() ? date.toTime_t() : 0;
+            break;
+        }
+        case KEY_SIZE:
+            numericKeys[i] = message->size(model);
+            break;
+        case KEY_CC:
+        {
+            const QList<Message::MailAddress> cc = message->addresses(model, CompactEnvelope::CC);
+            textKeys[i] = cc.isEmpty() ? QString() : collationKey(cc.first().mailbox);
+            break;
+        }
+        case KEY_DISPLAYFROM:
+            textKeys[i] = collationKey(displayAddress(message->addresses(model, CompactEnvelope::FROM)));
+            break;
+        case KEY_DISPLAYTO:
+            textKeys[i] = collationKey(displayAddress(message->addresses(model, CompactEnvelope::TO)));
+            break;
+        case KEY_SUBJECT:
+            textKeys[i] = collationKey(message->baseSubject(model));
+            break;
+        }
+    }
+
+    m_uids = uids;
+    m_known = known;
+    m_numericKeys = numericKeys;
+    m_textKeys = textKeys;
+
+    const QVector<int> order = numeric ? sortedOrder(m_numericKeys) : sortedOrder(m_textKeys);
+    QList<uint> res;
+    res.reserve(order.size());
+    for (QVector<int>::const_iterator it = order.constBegin(); it != order.constEnd(); ++it) {
+        if (m_uids[*it])
+            res.append(m_uids[*it]);
+    }
+    return res;
+}
+
+void LocalSorting::clear()
+{
+    m_uids.clear();
+    m_known.clear();
+    m_numericKeys.clear();
+    m_textKeys.clear();
+}
+
+bool LocalSorting::isNumeric(const SortKey key)
+{
+    return key == KEY_ARRIVAL || key == KEY_DATE || key == KEY_SIZE;
+}
+
+/** @short Return the positions of the @arg keys in the order in which they should be displayed */
+QVector<int> LocalSorting::sortedOrder(const QVector<quint64> &keys)
+{
+    return sortPositions(keys.size(), NumericComparator(keys.constData()));
+}
+
+/** @overload */
+QVector<int> LocalSorting::sortedOrder(const QVector<QString> &keys)
+{
+    return sortPositions(keys.size(), TextComparator(keys.constData()));
+}
+
+/** @short Extract the base subject as defined by RFC 5256, section 2.1
+
+The subject is expected to have its RFC 2047 encoded-words already decoded.
+*/
+QString LocalSorting::baseSubject(const QString &subject)
+{
+    QString s = subject.simplified();
+    while (true) {
+        // Remove the "(fwd)" trailers
+        while (true) {
+            if (s.endsWith(QLatin1Char(' ')))
+                s.chop(1);
+            else if (s.endsWith(QLatin1String("(fwd)"), Qt::CaseInsensitive))
+                s.chop(5);
+            else
+                break;
+        }
+
+        // Remove the leading "Re:", "Fwd:" and the blobs in front of the actual text
+        bool changed;
+        do {
+            changed = false;
+            int len;
+            while ((len = leaderLength(s)) > 0) {
+                s.remove(0, len);
+                changed = true;
+            }
+            len = blobLength(s, 0);
+            if (len && len < s.size()) {
+                s.remove(0, len);
+                changed = true;
+            }
+        } while (changed);
+
+        // The "[fwd: ...]" wrapper
+        if (s.startsWith(QLatin1String("[fwd:"), Qt::CaseInsensitive) && s.endsWith(QLatin1Char(']'))) {
+            s = s.mid(5, s.size() - 6);
+            continue;
+        }
+        return s;
+    }
+}
+
+/** @short Convert the @arg text into a form which sorts well by a plain comparison
+
+The case is folded and the diacritics are removed, so that the "Émile" sorts right next to the "emile".
+*/
+QString LocalSorting::collationKey(const QString &text)
+{
+    const QString decomposed = text.normalized(QString::NormalizationForm_KD);
+    QString res;
+    res.reserve(decomposed.size());
+    for (QString::const_iterator it = decomposed.constBegin(); it != decomposed.constEnd(); ++it) {
+        if (!it->isMark())
+            res.append(*it);
+    }
+    return res.toCaseFolded();
+}
+
+}
+}
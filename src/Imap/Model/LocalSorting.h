@@ -0,0 +1,96 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAP_MODEL_LOCALSORTING_H
+#define IMAP_MODEL_LOCALSORTING_H
+
+#include <QList>
+#include <QString>
+#include <QVector>
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+class Model;
+class TreeItemMsgList;
+
+/** @short Client-side sorting for servers which do not support the SORT command
+
+The sort keys are extracted from the message metadata (the ENVELOPE, INTERNALDATE and RFC822.SIZE) and stored in a column which
+is kept around for subsequent calls, so that re-sorting a mailbox after a new arrival or after switching the sort order only
+has to deal with messages which haven't been seen before. The textual keys are reduced to a form where a plain comparison is
+enough, i.e. the base subject from RFC 5256 and the display names are case-folded and stripped of any diacritics.
+
+Large mailboxes are sorted by several threads in parallel.
+*/
+class LocalSorting
+{
+public:
+    /** @short Which key to sort on; the meaning of these values is the same as in RFC 5256 and RFC 5957 */
+    typedef enum {
+        KEY_ARRIVAL,
+        KEY_CC,
+        KEY_DATE,
+        KEY_DISPLAYFROM,
+        KEY_SIZE,
+        KEY_SUBJECT,
+        KEY_DISPLAYTO
+    } SortKey;
+
+    LocalSorting();
+
+    /** @short Sort the messages in the @arg list and return their UIDs in the ascending order
+
+    Messages whose metadata are not available yet are asked for and sorted as if their key was empty for the time being;
+    the @arg complete is set to false in that case.  Ties are resolved by the sequence number.
+    */
+    QList<uint> sort(Model *model, TreeItemMsgList *list, const SortKey key, bool *complete);
+    /** @short Forget all cached keys */
+    void clear();
+
+    static QString baseSubject(const QString &subject);
+    static QString collationKey(const QString &text);
+    static QVector<int> sortedOrder(const QVector<quint64> &keys);
+    static QVector<int> sortedOrder(const QVector<QString> &keys);
+
+private:
+    static bool isNumeric(const SortKey key);
+
+    /** @short The key which the cached columns refer to */
+    SortKey m_key;
+    /** @short UIDs of the messages, ordered by their sequence numbers */
+    QVector<uint> m_uids;
+    /** @short Has the key at the same position been extracted from the real data? */
+    QVector<bool> m_known;
+    /** @short Keys for ARRIVAL, DATE and SIZE, one for each item in m_uids */
+    QVector<quint64> m_numericKeys;
+    /** @short Keys for the textual criteria, one for each item in m_uids */
+    QVector<QString> m_textKeys;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_LOCALSORTING_H
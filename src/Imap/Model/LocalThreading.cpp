@@ -0,0 +1,234 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LocalThreading.h"
+#include <algorithm>
+#include <QPair>
+
+namespace {
+
+bool lowerUid(const Imap::Responses::ThreadingNode &a, const Imap::Responses::ThreadingNode &b)
+{
+    return a.num < b.num;
+}
+
+bool lowerThreadKey(const QPair<uint, Imap::Responses::ThreadingNode> &a, const QPair<uint, Imap::Responses::ThreadingNode> &b)
+{
+    return a.first < b.first;
+}
+
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+using Responses::ThreadingNode;
+
+LocalThreading::LocalThreading()
+{
+}
+
+void LocalThreading::addMessage(const uint uid, const QByteArray &messageId, const QList<QByteArray> &references)
+{
+    if (!uid || m_uidTable.contains(uid))
+        return;
+
+    int self;
+    if (messageId.isEmpty()) {
+        self = createContainer();
+    } else {
+        self = containerForMessageId(messageId);
+        if (m_containers[self].uid) {
+            // RFC 5256 says to treat messages with a duplicate Message-Id as if they had none
+            self = createContainer();
+        }
+    }
+    m_containers[self].uid = uid;
+    m_uidTable.insert(uid, self);
+
+    // Link the referenced messages together, unless they already have a parent or unless that would create a loop
+    int previous = -1;
+    Q_FOREACH(const QByteArray &reference, references) {
+        if (reference.isEmpty())
+            continue;
+        const int current = containerForMessageId(reference);
+        if (previous != -1 && m_containers[current].parent == -1 && !isAncestorOrSelf(current, previous))
+            setParent(current, previous);
+        previous = current;
+    }
+
+    // The message's own idea about its parent is better than whatever was guessed from the References of other messages
+    if (previous == -1 || !isAncestorOrSelf(self, previous))
+        setParent(self, previous);
+}
+
+void LocalThreading::removeMessage(const uint uid)
+{
+    QHash<uint, int>::iterator it = m_uidTable.find(uid);
+    if (it == m_uidTable.end())
+        return;
+    // The container stays around as a placeholder which still ties the replies together
+    m_containers[*it].uid = 0;
+    m_uidTable.erase(it);
+}
+
+bool LocalThreading::contains(const uint uid) const
+{
+    return m_uidTable.contains(uid);
+}
+
+QVector<uint> LocalThreading::replies(const uint uid) const
+{
+    QVector<uint> res;
+    QHash<uint, int>::const_iterator it = m_uidTable.constFind(uid);
+    if (it != m_uidTable.constEnd())
+        appendReplies(*it, res);
+    return res;
+}
+
+int LocalThreading::messageCount() const
+{
+    return m_uidTable.size();
+}
+
+void LocalThreading::clear()
+{
+    m_containers.clear();
+    m_idTable.clear();
+    m_uidTable.clear();
+}
+
+QVector<ThreadingNode> LocalThreading::threading() const
+{
+    QVector<QPair<uint, ThreadingNode> > threads;
+    QVector<ThreadingNode> buf;
+    for (int i = 0; i < m_containers.size(); ++i) {
+        if (m_containers[i].parent != -1)
+            continue;
+        buf.clear();
+        const uint highestUid = appendThreadNodes(i, true, buf);
+        Q_FOREACH(const ThreadingNode &node, buf) {
+            threads.append(qMakePair(highestUid, node));
+        }
+    }
+
+    // Threads with recent activity go last
+    std::sort(threads.begin(), threads.end(), lowerThreadKey);
+    QVector<ThreadingNode> res;
+    res.reserve(threads.size());
+    for (QVector<QPair<uint, ThreadingNode> >::const_iterator it = threads.constBegin(); it != threads.constEnd(); ++it) {
+        res.append(it->second);
+    }
+    return res;
+}
+
+int LocalThreading::containerForMessageId(const QByteArray &messageId)
+{
+    QHash<QByteArray, int>::const_iterator it = m_idTable.constFind(messageId);
+    if (it != m_idTable.constEnd())
+        return *it;
+    const int container = createContainer();
+    m_idTable.insert(messageId, container);
+    return container;
+}
+
+int LocalThreading::createContainer()
+{
+    m_containers.append(Container());
+    return m_containers.size() - 1;
+}
+
+/** @short Return true if the @arg node is the same as @arg ancestor or if it is one of its descendants */
+bool LocalThreading::isAncestorOrSelf(const int ancestor, int node) const
+{
+    while (node != -1) {
+        if (node == ancestor)
+            return true;
+        node = m_containers[node].parent;
+    }
+    return false;
+}
+
+/** @short Move the @arg node below a new @arg parent; -1 makes it a root */
+void LocalThreading::setParent(const int node, const int parent)
+{
+    const int oldParent = m_containers[node].parent;
+    if (oldParent == parent)
+        return;
+
+    if (oldParent != -1) {
+        int *link = &m_containers[oldParent].firstChild;
+        while (*link != node) {
+            Q_ASSERT(*link != -1);
+            link = &m_containers[*link].nextSibling;
+        }
+        *link = m_containers[node].nextSibling;
+    }
+
+    m_containers[node].parent = parent;
+    m_containers[node].nextSibling = -1;
+    if (parent != -1) {
+        m_containers[node].nextSibling = m_containers[parent].firstChild;
+        m_containers[parent].firstChild = node;
+    }
+}
+
+/** @short Convert the subtree starting at @arg node and append it to @arg output
+
+Placeholders are dropped and their children are promoted one level up, unless that would put unrelated messages at the root
+level; that's the pruning step of the original algorithm. Returns the highest UID found in the subtree.
+*/
+uint LocalThreading::appendThreadNodes(const int node, const bool atRootLevel, QVector<ThreadingNode> &output) const
+{
+    const Container &container = m_containers[node];
+    QVector<ThreadingNode> children;
+    uint highestUid = container.uid;
+    for (int child = container.firstChild; child != -1; child = m_containers[child].nextSibling) {
+        highestUid = qMax(highestUid, appendThreadNodes(child, false, children));
+    }
+    std::sort(children.begin(), children.end(), lowerUid);
+
+    if (container.uid) {
+        output.append(ThreadingNode(container.uid, children));
+    } else if (atRootLevel && children.size() > 1) {
+        output.append(ThreadingNode(0, children));
+    } else {
+        output += children;
+    }
+    return highestUid;
+}
+
+/** @short Append UIDs of the children of @arg node to @arg output, looking through the placeholders */
+void LocalThreading::appendReplies(const int node, QVector<uint> &output) const
+{
+    for (int child = m_containers[node].firstChild; child != -1; child = m_containers[child].nextSibling) {
+        if (m_containers[child].uid)
+            output.append(m_containers[child].uid);
+        else
+            appendReplies(child, output);
+    }
+}
+
+}
+}
@@ -0,0 +1,101 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_LOCALTHREADING_H
+#define IMAP_MODEL_LOCALTHREADING_H
+
+#include <QHash>
+#include <QList>
+#include "Imap/Parser/ThreadingNode.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+/** @short Client-side threading for servers which do not support the THREAD command
+
+This is an implementation of the message threading algorithm by Jamie Zawinski, which is also the foundation of the
+REFERENCES algorithm from RFC 5256. Just like the REFS algorithm from the draft-ietf-morg-inthread, it does not group messages
+by their subject.
+
+The engine works incrementally: each message is linked into the tree at the time it is added, so that the arrival of new
+messages doesn't require going through the whole mailbox again. The result is produced in the same format as the one which the
+THREAD response uses, i.e. the siblings are ordered by their UIDs and the threads are sorted by the most recent message in them.
+*/
+class LocalThreading
+{
+public:
+    LocalThreading();
+
+    /** @short Put the message into the tree
+
+    The @arg references shall contain the message IDs from the References header, or the In-Reply-To if the References are
+    missing. Adding a message which is already known has no effect.
+    */
+    void addMessage(const uint uid, const QByteArray &messageId, const QList<QByteArray> &references);
+    /** @short Forget about a message, typically after it has been expunged */
+    void removeMessage(const uint uid);
+    /** @short Has this message been added already? */
+    bool contains(const uint uid) const;
+    /** @short Return the UIDs of the messages which belong right below this one, in no particular order
+
+    Placeholders are looked through, so replies to a referenced message which is not around are included as well.
+    */
+    QVector<uint> replies(const uint uid) const;
+    /** @short Return the number of messages which have been added */
+    int messageCount() const;
+    void clear();
+
+    /** @short Return the threading in the format used by the THREAD response */
+    QVector<Responses::ThreadingNode> threading() const;
+
+private:
+    /** @short One node of the tree, either a real message or just a placeholder for a Message-Id which was referenced */
+    struct Container {
+        /** @short UID of the message, or zero for placeholders */
+        uint uid;
+        int parent;
+        int firstChild;
+        int nextSibling;
+        Container(): uid(0), parent(-1), firstChild(-1), nextSibling(-1) {}
+    };
+
+    int containerForMessageId(const QByteArray &messageId);
+    int createContainer();
+    bool isAncestorOrSelf(const int ancestor, int node) const;
+    void setParent(const int node, const int parent);
+    uint appendThreadNodes(const int node, const bool atRootLevel, QVector<Responses::ThreadingNode> &output) const;
+    void appendReplies(const int node, QVector<uint> &output) const;
+
+    /** @short All containers, indexed by their position; nodes are never removed from here until clear() is called */
+    QVector<Container> m_containers;
+    /** @short Containers for the Message-Ids */
+    QHash<QByteArray, int> m_idTable;
+    /** @short Containers for the real messages */
+    QHash<uint, int> m_uidTable;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_LOCALTHREADING_H
@@ -21,14 +21,18 @@
 */
 
 #include <algorithm>
+#include <QDataStream>
+#include <QRegExp>
 #include <QTextStream>
 #include "Common/FindWithUnknown.h"
 #include "DelayedPopulation.h"
 #include "ItemRoles.h"
 #include "Imap/Encoders.h"
 #include "KeepMailboxOpenTask.h"
+#include "LocalSorting.h"
 #include "MailboxTree.h"
 #include "Model.h"
+#include "PartDataLru.h"
 #include "Parser/Rfc5322HeaderParser.h"
 #include <QtDebug>
 
@@ -50,6 +54,20 @@ void decodeMessagePartTransportEncoding(const QByteArray &rawData, const QByteAr
     }
 }
 
+/** @short Return the text of a textual body part which shall go to the full-text index, or a null string for other parts */
+QString searchableText(const QString &mimeType, const QString &charset, const QByteArray &data)
+{
+    if (!mimeType.startsWith(QLatin1String("text/")))
+        return QString();
+    QString text = Imap::decodeWithCharset(data, charset);
+    if (mimeType == QLatin1String("text/html")) {
+        // Good enough for finding words, the index doesn't care about the markup
+        QRegExp tag(QLatin1String("<[^>]*>"));
+        text.replace(tag, QLatin1String(" "));
+    }
+    return text;
+}
+
 QVariantList addresListToQVariant(const QList<Imap::Message::MailAddress> &addressList)
 {
     QVariantList res;
@@ -351,18 +369,24 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
         throw UnknownMessageIndex(QString::fromUtf8("Got FETCH that is out of bounds -- got %1 messages").arg(
                                       QString::number(list->m_children.size())).toUtf8().constData(), response);
 
-    TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(list->child(number, model));
-    Q_ASSERT(message);   // FIXME: this should be relaxed for allowing null pointers instead of "unfetched" TreeItemMessage
+    // Most of the FETCH responses which arrive during a sync carry nothing but the flags, so there's no reason for creating
+    // a TreeItemMessage for each of these rows. It only gets created when the response has something which the row itself
+    // cannot hold, or when there's a change which has to be announced.
+    const uint rowItems = Responses::Fetch::ITEM_UID | Responses::Fetch::ITEM_FLAGS | Responses::Fetch::ITEM_MODSEQ;
+    TreeItemMessage *message = list->existingMessage(number);
+    if (!message && ((response.items & ~rowItems) || !response.sections.isEmpty() || !response.binarySizes.isEmpty()))
+        message = list->message(number);
 
     // At first, have a look at the response and check the UID of the message
-    Responses::Fetch::dataType::const_iterator uidRecord = response.data.find("UID");
-    if (uidRecord != response.data.constEnd()) {
-        uint receivedUid = dynamic_cast<const Responses::RespData<uint>&>(*(uidRecord.value())).data;
-        if (message->uid() == receivedUid) {
+    const uint knownUid = list->messageUid(number);
+    if (response.has(Responses::Fetch::ITEM_UID)) {
+        const uint receivedUid = response.uid;
+        if (knownUid == receivedUid) {
             // That's what we expect -> do nothing
-        } else if (message->uid() == 0) {
+        } else if (knownUid == 0) {
             // This is the first time we see the UID, so let's take a note
-            message->m_uid = receivedUid;
+            list->m_rows[number].uid = receivedUid;
+            message = list->message(number);
             changedMessage = message;
             if (message->loading()) {
                 // The Model tried to ask for data for this message. That couldn't succeeded because the UID
@@ -391,116 +415,162 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
             }
         } else {
             throw MailboxException(QString::fromUtf8("FETCH response: UID consistency error for message #%1 -- expected UID %2, got UID %3").arg(
-                                       QString::number(response.number), QString::number(message->uid()), QString::number(receivedUid)
+                                       QString::number(response.number), QString::number(knownUid), QString::number(receivedUid)
                                        ).toUtf8().constData(), response);
         }
-    } else if (! message->uid()) {
+    } else if (! knownUid) {
         qDebug() << "FETCH: received a FETCH response for message #" << response.number << "whose UID is not yet known. This sucks.";
         QList<uint> uidsInMailbox;
-        Q_FOREACH(TreeItem *node, list->m_children) {
-            uidsInMailbox << dynamic_cast<TreeItemMessage *>(node)->uid();
+        for (int i = 0; i < list->m_rows.size(); ++i) {
+            uidsInMailbox << list->messageUid(i);
         }
         qDebug() << "UIDs in the mailbox now: " << uidsInMailbox;
     }
 
     bool savedBodyStructure = false;
-    bool gotEnvelope = false;
-    bool gotSize = false;
-    bool gotInternalDate = false;
     bool updatedFlags = false;
 
-    for (Responses::Fetch::dataType::const_iterator it = response.data.begin(); it != response.data.end(); ++ it) {
-        if (it.key() == "UID") {
-            // established above
-            Q_ASSERT(dynamic_cast<const Responses::RespData<uint>&>(*(it.value())).data == message->uid());
-        } else if (it.key() == "ENVELOPE") {
-            message->m_envelope = dynamic_cast<const Responses::RespData<Message::Envelope>&>(*(it.value())).data;
-            message->m_fetchStatus = DONE;
-            gotEnvelope = true;
-            changedMessage = message;
-        } else if (it.key() == "BODYSTRUCTURE") {
-            if (message->fetched()) {
-                // The message structure is already known, so we are free to ignore it
-            } else {
-                // We had no idea about the structure of the message
-                QList<TreeItem *> newChildren = dynamic_cast<const Message::AbstractMessage &>(*(it.value())).createTreeItems(message);
-                if (! message->m_children.isEmpty()) {
-                    QModelIndex messageIdx = message->toIndex(model);
-                    model->beginRemoveRows(messageIdx, 0, message->m_children.size() - 1);
-                    QList<TreeItem *> oldChildren = message->setChildren(newChildren);
-                    model->endRemoveRows();
-                    qDeleteAll(oldChildren);
-                } else {
-                    QList<TreeItem *> oldChildren = message->setChildren(newChildren);
-                    Q_ASSERT(oldChildren.size() == 0);
-                }
-                savedBodyStructure = true;
+    if (response.has(Responses::Fetch::ITEM_BODYSTRUCTURE)) {
+        if (message->fetched()) {
+            // The message structure is already known, so we are free to ignore it
+        } else {
+            // We had no idea about the structure of the message. The parts will only be created when somebody asks
+            // for them, which is not going to happen for most of the messages in a big mailbox.
+            if (! message->m_children.isEmpty()) {
+                QModelIndex messageIdx = message->toIndex(model);
+                model->beginRemoveRows(messageIdx, 0, message->m_children.size() - 1);
+                QList<TreeItem *> oldChildren = message->setChildren(QList<TreeItem *>());
+                model->endRemoveRows();
+                qDeleteAll(oldChildren);
             }
-        } else if (it.key() == "x-trojita-bodystructure") {
-            // do nothing
-        } else if (it.key() == "RFC822.SIZE") {
-            message->m_size = dynamic_cast<const Responses::RespData<uint>&>(*(it.value())).data;
-            gotSize = true;
-        } else if (it.key().startsWith("BODY[HEADER.FIELDS (")) {
+            message->writableMetadata().bodyStructure = response.serializedBodyStructure;
+            savedBodyStructure = true;
+        }
+    }
+    if (response.has(Responses::Fetch::ITEM_ENVELOPE)) {
+        message->setEnvelope(model, response.envelope);
+        message->m_fetchStatus = DONE;
+        changedMessage = message;
+    }
+    if (response.has(Responses::Fetch::ITEM_RFC822_SIZE)) {
+        message->writableMetadata().size = response.rfc822Size;
+    }
+    if (response.has(Responses::Fetch::ITEM_INTERNALDATE)) {
+        message->writableMetadata().internalDate = response.internalDate;
+    }
+    if (response.items & (Responses::Fetch::ITEM_BODY | Responses::Fetch::ITEM_RFC822 |
+                          Responses::Fetch::ITEM_RFC822_HEADER | Responses::Fetch::ITEM_RFC822_TEXT)) {
+        qDebug() << "TreeItemMailbox::handleFetchResponse: ignoring unexpected FETCH items" << response.items;
+    }
+
+    for (QMap<QByteArray,uint>::const_iterator it = response.binarySizes.constBegin(); it != response.binarySizes.constEnd(); ++it) {
+        TreeItemPart *part = partIdToPtr(model, message, it.key());
+        if (! part)
+            throw UnknownMessageIndex("Got BINARY.SIZE[] fetch that did not resolve to any known part", response);
+        part->m_binarySize = *it;
+    }
+
+    for (QMap<QByteArray,QByteArray>::const_iterator it = response.sections.constBegin(); it != response.sections.constEnd(); ++it) {
+        if (it.key().startsWith("BODY[HEADER.FIELDS (")) {
             // Process any headers found in any such response bit
-            const QByteArray &rawHeaders = dynamic_cast<const Responses::RespData<QByteArray>&>(*(it.value())).data;
-            message->processAdditionalHeaders(model, rawHeaders);
+            message->processAdditionalHeaders(model, *it);
             changedMessage = message;
-        } else if (it.key().startsWith("BODY[") || it.key().startsWith("BINARY[")) {
-            if (it.key()[ it.key().size() - 1 ] != ']')
-                throw UnknownMessageIndex("Can't parse such BODY[]/BINARY[]", response);
-            TreeItemPart *part = partIdToPtr(model, message, it.key());
-            if (! part)
-                throw UnknownMessageIndex("Got BODY[]/BINARY[] fetch that did not resolve to any known part", response);
-            const QByteArray &data = dynamic_cast<const Responses::RespData<QByteArray>&>(*(it.value())).data;
-            if (it.key().startsWith("BODY[")) {
-                // got to decode the part data by hand
-                decodeMessagePartTransportEncoding(data, part->encoding(), part->dataPtr());
-            } else {
-                // A BINARY FETCH item is already decoded for us, yay
-                part->m_data = data;
-            }
-            part->m_fetchStatus = DONE;
-            if (message->uid())
-                model->cache()->setMsgPart(mailbox(), message->uid(), part->partId(), part->m_data);
-            changedParts.append(part);
-        } else if (it.key() == "FLAGS") {
-            // Only emit signals when the flags have actually changed
-            QStringList newFlags = model->normalizeFlags(dynamic_cast<const Responses::RespData<QStringList>&>(*(it.value())).data);
-            bool forceChange = (message->m_flags != newFlags);
-            message->setFlags(list, newFlags, forceChange);
-            if (forceChange) {
-                updatedFlags = true;
-                changedMessage = message;
+            continue;
+        }
+
+        // A partial fetch is answered with the starting offset attached, like BODY[1]<0>
+        QByteArray key = it.key();
+        int origin = -1;
+        if (key.endsWith('>')) {
+            const int originStart = key.lastIndexOf('<');
+            bool ok = false;
+            if (originStart != -1)
+                origin = key.mid(originStart + 1, key.size() - originStart - 2).toInt(&ok);
+            if (!ok || origin < 0)
+                throw UnknownMessageIndex("Can't parse the origin octet of a partial BODY[]/BINARY[]", response);
+            key = key.left(originStart);
+        }
+        if (key[ key.size() - 1 ] != ']')
+            throw UnknownMessageIndex("Can't parse such BODY[]/BINARY[]", response);
+        TreeItemPart *part = partIdToPtr(model, message, key);
+        if (! part)
+            throw UnknownMessageIndex("Got BODY[]/BINARY[] fetch that did not resolve to any known part", response);
+        const QByteArray &data = *it;
+        if (origin != -1) {
+            if (!part->m_partialFetch || !part->m_partialFetch->chunkPending ||
+                    static_cast<uint>(origin) != part->m_partialFetch->offset) {
+                // This can happen when the part got released in the meanwhile
+                qDebug() << "Ignoring unexpected partial data for message" << message->uid() << "part" << part->partId();
+                continue;
             }
-        } else if (it.key() == "INTERNALDATE") {
-            message->m_internalDate = dynamic_cast<const Responses::RespData<QDateTime>&>(*(it.value())).data;
-            gotInternalDate = true;
-        } else if (it.key() == "MODSEQ") {
-            quint64 num = dynamic_cast<const Responses::RespData<quint64>&>(*(it.value())).data;
-            if (num > syncState.highestModSeq()) {
-                syncState.setHighestModSeq(num);
-                // FIXME: when shall we save this one to the persistent cache?
+            if (part->appendChunk(data, key.startsWith("BINARY["))) {
+                part->finishPartialFetch();
+                part->m_fetchStatus = DONE;
+                if (message->uid())
+                    cacheFetchedPart(model, message, part);
+            } else if (part->m_partialFetch->restRequested) {
+                model->askForMsgPartChunk(part);
             }
+            changedParts.append(part);
+            continue;
+        }
+        if (key.startsWith("BODY[")) {
+            // got to decode the part data by hand
+            decodeMessagePartTransportEncoding(data, part->encoding(), part->dataPtr());
         } else {
-            qDebug() << "TreeItemMailbox::handleFetchResponse: unknown FETCH identifier" << it.key();
+            // A BINARY FETCH item is already decoded for us, yay
+            part->m_data = data;
         }
+        part->finishPartialFetch();
+        part->m_fetchStatus = DONE;
+        if (message->uid())
+            cacheFetchedPart(model, message, part);
+        changedParts.append(part);
     }
-    if (message->uid()) {
-        if (gotEnvelope && gotSize && savedBodyStructure && gotInternalDate) {
+
+    if (response.has(Responses::Fetch::ITEM_FLAGS)) {
+        // Only emit signals when the flags have actually changed
+        MessageFlags newFlags = list->m_flagDictionary.fromList(response.flags);
+        bool forceChange = (list->messageFlags(number) != newFlags);
+        if (forceChange && !message && (list->m_rows[number].flagsHandled || list->m_numberFetchingStatus == DONE)) {
+            // Somebody could have seen the old flags, or the unread counter is about to change. The first flags of a message
+            // which arrive while the mailbox is being synced are only accounted for at the end of the sync.
+            message = list->message(number);
+        }
+        list->setMessageFlags(number, newFlags, forceChange);
+        if (forceChange) {
+            updatedFlags = true;
+            if (message)
+                changedMessage = message;
+        }
+    }
+    if (response.has(Responses::Fetch::ITEM_MODSEQ)) {
+        if (response.modSeq > syncState.highestModSeq()) {
+            syncState.setHighestModSeq(response.modSeq);
+            // FIXME: when shall we save this one to the persistent cache?
+        }
+    }
+
+    const uint uid = list->messageUid(number);
+    if (uid) {
+        const uint metadataItems = Responses::Fetch::ITEM_ENVELOPE | Responses::Fetch::ITEM_RFC822_SIZE |
+                Responses::Fetch::ITEM_INTERNALDATE;
+        if ((response.items & metadataItems) == metadataItems && savedBodyStructure) {
             Imap::Mailbox::AbstractCache::MessageDataBundle dataForCache;
-            dataForCache.envelope = message->m_envelope;
-            dataForCache.serializedBodyStructure = dynamic_cast<const Responses::RespData<QByteArray>&>(*(response.data[ "x-trojita-bodystructure" ])).data;
-            dataForCache.size = message->m_size;
-            dataForCache.uid = message->uid();
-            dataForCache.internalDate = message->m_internalDate;
-            dataForCache.hdrReferences = message->m_hdrReferences;
-            dataForCache.hdrListPost = message->m_hdrListPost;
-            dataForCache.hdrListPostNo = message->m_hdrListPostNo;
-            model->cache()->setMessageMetadata(mailbox(), message->uid(), dataForCache);
+            dataForCache.envelope = response.envelope;
+            dataForCache.serializedBodyStructure = response.serializedBodyStructure;
+            const MessageMetadata &metadata = message->metadata();
+            dataForCache.size = metadata.size;
+            dataForCache.uid = uid;
+            dataForCache.internalDate = metadata.internalDate;
+            dataForCache.hdrReferences = metadata.hdrReferences;
+            dataForCache.hdrListPost = metadata.hdrListPost;
+            dataForCache.hdrListPostNo = metadata.hdrListPostNo;
+            dataForCache.baseSubject = metadata.baseSubject;
+            model->cache()->setMessageMetadata(mailbox(), uid, dataForCache);
         }
         if (updatedFlags) {
-            model->cache()->setMsgFlags(mailbox(), message->uid(), message->m_flags);
+            model->cache()->setMsgFlags(mailbox(), uid, list->m_flagDictionary.toList(list->messageFlags(number)));
         }
     }
 }
@@ -517,13 +587,10 @@ void TreeItemMailbox::handleExpunge(Model *const model, const Responses::NumberR
     uint offset = resp.number - 1;
 
     model->beginRemoveRows(list->toIndex(model), offset, offset);
-    TreeItemMessage *message = static_cast<TreeItemMessage *>(list->m_children.takeAt(offset));
-    model->cache()->clearMessage(static_cast<TreeItemMailbox *>(list->parent())->mailbox(), message->uid());
-    for (int i = offset; i < list->m_children.size(); ++i) {
-        --static_cast<TreeItemMessage *>(list->m_children[i])->m_offset;
-    }
+    model->cache()->clearMessage(static_cast<TreeItemMailbox *>(list->parent())->mailbox(), list->messageUid(offset));
+    QList<TreeItem *> removedItems = list->takeMessages(offset, 1);
     model->endRemoveRows();
-    delete message;
+    qDeleteAll(removedItems);
 
     --list->m_totalMessageCount;
     list->recalcVariousMessageCounts(const_cast<Model *>(model));
@@ -540,7 +607,6 @@ void TreeItemMailbox::handleVanished(Model *const model, const Responses::Vanish
     // Remove duplicates -- even that garbage can be present in a perfectly valid VANISHED :(
     uids.erase(std::unique(uids.begin(), uids.end()), uids.end());
 
-    QList<TreeItem *>::iterator it = list->m_children.end();
     while (!uids.isEmpty()) {
         // We have to process each UID separately because the UIDs in the mailbox are not necessarily present
         // in a continuous range; zeros might be present
@@ -564,37 +630,35 @@ void TreeItemMailbox::handleVanished(Model *const model, const Responses::Vanish
 
         // Find a highest message with UID zero such as no message with non-zero UID higher than the current UID exists
         // at a position after the target message
-        it = model->findMessageOrNextOneByUid(list, uid);
+        int row = model->findMessageOrNextOneByUid(list, uid);
 
-        if (it == list->m_children.end()) {
+        if (row == list->m_children.size()) {
             // this is a legitimate situation, the UID of the last message in the mailbox which is getting expunged right now
             // could very well be not know at this point
-            --it;
+            --row;
         }
         // there's a special case above guarding against an empty list
-        Q_ASSERT(it >= list->m_children.begin());
+        Q_ASSERT(row >= 0);
 
-        TreeItemMessage *msgCandidate = static_cast<TreeItemMessage*>(*it);
-        if (msgCandidate->uid() == uid) {
+        if (list->messageUid(row) == uid) {
             // will be deleted
         } else if (resp.earlier == Responses::Vanished::EARLIER) {
             // We don't have any such UID in our UID mapping, so we can safely ignore this one
             continue;
-        } else if (msgCandidate->uid() == 0) {
+        } else if (list->messageUid(row) == 0) {
             // will be deleted
         } else {
-            if (it != list->m_children.begin()) {
-                --it;
-                msgCandidate = static_cast<TreeItemMessage*>(*it);
-                if (msgCandidate->uid() == 0) {
+            if (row != 0) {
+                --row;
+                if (list->messageUid(row) == 0) {
                     // will be deleted
                 } else {
                     // VANISHED is free to refer to a non-existing UID...
                     QString str;
                     QTextStream ss(&str);
                     ss << "VANISHED refers to UID " << uid << " which wasn't found in the mailbox (found adjacent UIDs " <<
-                          msgCandidate->uid() << " and " << static_cast<TreeItemMessage*>(*(it + 1))->uid() << " with " <<
-                          static_cast<TreeItemMessage*>(*(list->m_children.end() - 1))->uid() << " at the end)";
+                          list->messageUid(row) << " and " << list->messageUid(row + 1) << " with " <<
+                          list->messageUid(list->m_rows.size() - 1) << " at the end)";
                     ss.flush();
                     qDebug() << str.toUtf8().constData();
                     model->logTrace(listIndex.parent(), Common::LOG_MAILBOX_SYNC, QLatin1String("TreeItemMailbox::handleVanished"), str);
@@ -605,7 +669,7 @@ void TreeItemMailbox::handleVanished(Model *const model, const Responses::Vanish
                 QString str;
                 QTextStream ss(&str);
                 ss << "VANISHED refers to UID " << uid << " which is too low (lowest UID is " <<
-                      static_cast<TreeItemMessage*>(list->m_children.front())->uid() << ")";
+                      list->messageUid(0) << ")";
                 ss.flush();
                 qDebug() << str.toUtf8().constData();
                 model->logTrace(listIndex.parent(), Common::LOG_MAILBOX_SYNC, QLatin1String("TreeItemMailbox::handleVanished"), str);
@@ -613,13 +677,8 @@ void TreeItemMailbox::handleVanished(Model *const model, const Responses::Vanish
             }
         }
 
-        int row = msgCandidate->row();
-        Q_ASSERT(row == it - list->m_children.begin());
         model->beginRemoveRows(listIndex, row, row);
-        it = list->m_children.erase(it);
-        for (QList<TreeItem*>::iterator furtherMessage = it; furtherMessage != list->m_children.end(); ++furtherMessage) {
-            --static_cast<TreeItemMessage *>(*furtherMessage)->m_offset;
-        }
+        QList<TreeItem *> removedItems = list->takeMessages(row, 1);
         model->endRemoveRows();
 
         if (syncState.uidNext() <= uid) {
@@ -628,7 +687,7 @@ void TreeItemMailbox::handleVanished(Model *const model, const Responses::Vanish
             syncState.setUidNext(uid + 1);
         }
         model->cache()->clearMessage(mailbox(), uid);
-        delete msgCandidate;
+        qDeleteAll(removedItems);
     }
 
     if (resp.earlier == Responses::Vanished::EARLIER && static_cast<uint>(list->m_children.size()) < syncState.exists()) {
@@ -639,12 +698,8 @@ void TreeItemMailbox::handleVanished(Model *const model, const Responses::Vanish
         QModelIndex parent = list->toIndex(model);
         int offset = list->m_children.size();
         model->beginInsertRows(parent, offset, syncState.exists() - 1);
-        for (int i = 0; i < newArrivals; ++i) {
-            TreeItemMessage *msg = new TreeItemMessage(list);
-            msg->m_offset = i + offset;
-            list->m_children << msg;
-            // yes, we really have to add this message with UID 0 :(
-        }
+        // yes, we really have to add these messages with UID 0 :(
+        list->appendMessages(newArrivals);
         model->endInsertRows();
     }
 
@@ -678,19 +733,23 @@ void TreeItemMailbox::handleExists(Model *const model, const Responses::NumberRe
     QModelIndex parent = list->toIndex(model);
     int offset = list->m_children.size();
     model->beginInsertRows(parent, offset, resp.number - 1);
-    for (int i = 0; i < newArrivals; ++i) {
-        TreeItemMessage *msg = new TreeItemMessage(list);
-        msg->m_offset = i + offset;
-        list->m_children << msg;
-        // yes, we really have to add this message with UID 0 :(
-    }
+    // yes, we really have to add these messages with UID 0 :(
+    list->appendMessages(newArrivals);
     model->endInsertRows();
     list->m_totalMessageCount = resp.number;
     model->emitMessageCountChanged(this);
 }
 
-TreeItemPart *TreeItemMailbox::partIdToPtr(Model *const model, TreeItemMessage *message, const QString &msgId)
+TreeItemPart *TreeItemMailbox::partIdToPtr(Model *const model, TreeItemMessage *message, const QString &fetchItem)
 {
+    // Partial fetches carry the <offset.length> suffix which has no relation to the part's identity
+    QString msgId = fetchItem;
+    if (msgId.endsWith(QLatin1Char('>'))) {
+        const int pos = msgId.lastIndexOf(QLatin1Char('<'));
+        if (pos != -1)
+            msgId = msgId.left(pos);
+    }
+
     QString partIdentification;
     if (msgId.startsWith(QLatin1String("BODY["))) {
         partIdentification = msgId.mid(5, msgId.size() - 6);
@@ -700,6 +759,8 @@ TreeItemPart *TreeItemMailbox::partIdToPtr(Model *const model, TreeItemMessage *
         partIdentification = msgId.mid(12, msgId.size() - 13);
     } else if (msgId.startsWith(QLatin1String("BINARY["))) {
         partIdentification = msgId.mid(7, msgId.size() - 8);
+    } else if (msgId.startsWith(QLatin1String("BINARY.SIZE["))) {
+        partIdentification = msgId.mid(12, msgId.size() - 13);
     } else {
         throw UnknownMessageIndex(QString::fromUtf8("Fetch identifier doesn't start with reasonable prefix: %1").arg(msgId).toUtf8().constData());
     }
@@ -749,6 +810,16 @@ TreeItemPart *TreeItemMailbox::partIdToPtr(Model *const model, TreeItemMessage *
     return part;
 }
 
+/** @short Save the part data into the cache and make its text searchable */
+void TreeItemMailbox::cacheFetchedPart(Model *const model, TreeItemMessage *message, TreeItemPart *part)
+{
+    model->cache()->setMsgPart(mailbox(), message->uid(), part->partId(), part->m_data);
+    QString text = searchableText(part->mimeType(), part->charset(), part->m_data);
+    if (!text.isEmpty())
+        model->cache()->addMsgSearchableText(mailbox(), message->uid(), text);
+    model->trackPartData(part);
+}
+
 bool TreeItemMailbox::isSelectable() const
 {
     return !m_metadata.flags.contains(QLatin1String("\\NOSELECT")) && !m_metadata.flags.contains(QLatin1String("\\NONEXISTENT"));
@@ -764,6 +835,13 @@ TreeItemMsgList::TreeItemMsgList(TreeItem *parent):
         m_fetchStatus = DONE;
 }
 
+TreeItemMsgList::~TreeItemMsgList()
+{
+    // The messages give their addresses back to the m_addressPool, so they have to go away before it
+    qDeleteAll(m_children);
+    m_children.clear();
+}
+
 void TreeItemMsgList::fetch(Model *const model)
 {
     if (fetched() || isUnavailable(model))
@@ -818,6 +896,145 @@ bool TreeItemMsgList::hasChildren(Model *const model)
     return true; // we can easily wait here
 }
 
+TreeItem *TreeItemMsgList::child(const int offset, Model *const model)
+{
+    fetch(model);
+    return message(offset);
+}
+
+TreeItemMessage *TreeItemMsgList::message(const int row)
+{
+    if (row < 0 || row >= m_children.size())
+        return 0;
+    if (!m_children[row]) {
+        TreeItemMessage *message = new TreeItemMessage(this);
+        message->m_offset = row;
+        m_children[row] = message;
+    }
+    return static_cast<TreeItemMessage *>(m_children[row]);
+}
+
+TreeItemMessage *TreeItemMsgList::existingMessage(const int row) const
+{
+    Q_ASSERT(row >= 0 && row < m_children.size());
+    return static_cast<TreeItemMessage *>(m_children[row]);
+}
+
+uint TreeItemMsgList::messageUid(const int row) const
+{
+    return m_rows[row].uid;
+}
+
+const MessageFlags &TreeItemMsgList::messageFlags(const int row) const
+{
+    return m_rows[row].flags;
+}
+
+bool TreeItemMsgList::isMessageMarkedAsRead(const int row) const
+{
+    return m_rows[row].flags.test(FlagDictionary::FLAG_SEEN);
+}
+
+bool TreeItemMsgList::rowData(const int row, const int role, QVariant *result) const
+{
+    const MessageRow &message = m_rows[row];
+    switch (role) {
+    case RoleMessageUid:
+        *result = message.uid ? QVariant(message.uid) : QVariant();
+        return true;
+    case RoleMessageFlags:
+        *result = m_flagDictionary.toList(message.flags);
+        return true;
+    case RoleMessageIsMarkedDeleted:
+        *result = message.flags.test(FlagDictionary::FLAG_DELETED);
+        return true;
+    case RoleMessageIsMarkedRead:
+        *result = message.flags.test(FlagDictionary::FLAG_SEEN);
+        return true;
+    case RoleMessageIsMarkedForwarded:
+        *result = message.flags.test(FlagDictionary::FLAG_FORWARDED);
+        return true;
+    case RoleMessageIsMarkedReplied:
+        *result = message.flags.test(FlagDictionary::FLAG_ANSWERED);
+        return true;
+    case RoleMessageIsMarkedRecent:
+        *result = message.flags.test(FlagDictionary::FLAG_RECENT);
+        return true;
+    case RoleMessageWasUnread:
+        *result = message.wasUnread;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/** @short Set FLAGS of the message at the given @arg row and maintain the unread message counter */
+void TreeItemMsgList::setMessageFlags(const int row, const MessageFlags &flags, bool forceChange)
+{
+    MessageRow &message = m_rows[row];
+    // wasSeen is used to determine if the message was marked as read before this operation
+    bool wasSeen = message.flags.test(FlagDictionary::FLAG_SEEN);
+    message.flags = flags;
+    if (m_numberFetchingStatus == DONE && forceChange) {
+        bool isSeen = message.flags.test(FlagDictionary::FLAG_SEEN);
+        if (message.flagsHandled) {
+            if (wasSeen && !isSeen) {
+                ++m_unreadMessageCount;
+                // leave the message as "was unread" so it persists in the view when read messages are hidden
+                message.wasUnread = true;
+            } else if (!wasSeen && isSeen) {
+                --m_unreadMessageCount;
+            }
+        } else {
+            // it's a new message
+            message.flagsHandled = true;
+            if (!isSeen) {
+                ++m_unreadMessageCount;
+                // mark the message as "was unread" so it shows up in the view when read messages are hidden
+                message.wasUnread = true;
+            }
+        }
+    }
+}
+
+/** @short Add @arg count rows with no UID and no TreeItemMessage at the end of the list
+
+The caller is responsible for emitting the signals about the new rows.
+*/
+void TreeItemMsgList::appendMessages(const int count)
+{
+    m_rows.resize(m_rows.size() + count);
+#if QT_VERSION >= 0x040700
+    m_children.reserve(m_children.size() + count);
+#endif
+    for (int i = 0; i < count; ++i)
+        m_children << static_cast<TreeItem *>(0);
+}
+
+/** @short Remove @arg count rows starting at @arg row
+
+The TreeItemMessage instances which have been created for these rows are returned and shall be deleted by the caller once
+the removal has been announced. Their UIDs are not available anymore.
+*/
+QList<TreeItem *> TreeItemMsgList::takeMessages(const int row, const int count)
+{
+    Q_ASSERT(row >= 0 && count >= 0 && row + count <= m_children.size());
+    QList<TreeItem *> res;
+    for (int i = row; i < row + count; ++i) {
+        if (TreeItemMessage *message = existingMessage(i)) {
+            message->m_offset = -1;
+            res << message;
+        }
+    }
+    m_children.erase(m_children.begin() + row, m_children.begin() + row + count);
+    m_rows.remove(row, count);
+    for (int i = row; i < m_children.size(); ++i) {
+        if (m_children[i])
+            static_cast<TreeItemMessage *>(m_children[i])->m_offset = i;
+    }
+    return res;
+}
+
 int TreeItemMsgList::totalMessageCount(Model *const model)
 {
     // Yes, the numbers can be accommodated by a full mailbox sync, but that's not really what we shall do from this context.
@@ -847,26 +1064,25 @@ void TreeItemMsgList::recalcVariousMessageCounts(Model *model)
 {
     m_unreadMessageCount = 0;
     m_recentMessageCount = 0;
-    for (int i = 0; i < m_children.size(); ++i) {
-        TreeItemMessage *message = static_cast<TreeItemMessage *>(m_children[i]);
-        if (!message->m_flagsHandled)
-            message->m_wasUnread = ! message->isMarkedAsRead();
-        message->m_flagsHandled = true;
-        if (! message->isMarkedAsRead())
+    for (QVector<MessageRow>::iterator message = m_rows.begin(); message != m_rows.end(); ++message) {
+        const bool isRead = message->flags.test(FlagDictionary::FLAG_SEEN);
+        if (!message->flagsHandled)
+            message->wasUnread = !isRead;
+        message->flagsHandled = true;
+        if (!isRead)
             ++m_unreadMessageCount;
-        if (message->isMarkedAsRecent())
+        if (message->flags.test(FlagDictionary::FLAG_RECENT))
             ++m_recentMessageCount;
     }
-    m_totalMessageCount = m_children.size();
+    m_totalMessageCount = m_rows.size();
     m_numberFetchingStatus = DONE;
     model->emitMessageCountChanged(static_cast<TreeItemMailbox *>(parent()));
 }
 
 void TreeItemMsgList::resetWasUnreadState()
 {
-    for (int i = 0; i < m_children.size(); ++i) {
-        TreeItemMessage *message = static_cast<TreeItemMessage *>(m_children[i]);
-        message->m_wasUnread = ! message->isMarkedAsRead();
+    for (QVector<MessageRow>::iterator message = m_rows.begin(); message != m_rows.end(); ++message) {
+        message->wasUnread = !message->flags.test(FlagDictionary::FLAG_SEEN);
     }
 }
 
@@ -878,23 +1094,63 @@ bool TreeItemMsgList::numbersFetched() const
 
 
 TreeItemMessage::TreeItemMessage(TreeItem *parent):
-    TreeItem(parent), m_size(0), m_uid(0), m_hdrListPostNo(false), m_flagsHandled(false), m_offset(-1), m_wasUnread(false),
-    m_partHeader(0), m_partText(0)
+    TreeItem(parent), m_metadata(0), m_offset(-1), m_partHeader(0), m_partText(0)
 {
 }
 
 TreeItemMessage::~TreeItemMessage()
 {
+    if (m_metadata)
+        m_metadata->envelope.clear(addressPool());
+    delete m_metadata;
     delete m_partHeader;
     delete m_partText;
 }
 
+/** @short Return the pool which keeps the addresses from the envelope */
+AddressPool &TreeItemMessage::addressPool() const
+{
+    return static_cast<TreeItemMsgList *>(parent())->m_addressPool;
+}
+
+/** @short Return the fetched data of this message; all of them are empty if nothing has arrived yet */
+const MessageMetadata &TreeItemMessage::metadata() const
+{
+    static const MessageMetadata empty;
+    return m_metadata ? *m_metadata : empty;
+}
+
+/** @short Return the fetched data for modification, allocating them when needed */
+MessageMetadata &TreeItemMessage::writableMetadata()
+{
+    if (!m_metadata)
+        m_metadata = new MessageMetadata();
+    return *m_metadata;
+}
+
+/** @short Take over the metadata which were loaded from the cache
+
+The implicitly shared members are swapped into this message instead of being copied, which leaves the @arg data in an
+unspecified state. Only the envelope has to be converted into the compact form.
+*/
+void TreeItemMessage::adoptMetadata(Model *const model, AbstractCache::MessageDataBundle &data)
+{
+    setEnvelope(model, data.envelope, data.baseSubject);
+    MessageMetadata &metadata = writableMetadata();
+    qSwap(metadata.internalDate, data.internalDate);
+    metadata.size = data.size;
+    qSwap(metadata.hdrReferences, data.hdrReferences);
+    qSwap(metadata.hdrListPost, data.hdrListPost);
+    metadata.hdrListPostNo = data.hdrListPostNo;
+    qSwap(metadata.bodyStructure, data.serializedBodyStructure);
+}
+
 void TreeItemMessage::fetch(Model *const model)
 {
     if (fetched() || loading() || isUnavailable(model))
         return;
 
-    if (m_uid) {
+    if (uid()) {
         // Message UID is already known, which means that we can request data for this message
         model->askForMsgMetadata(this, Model::PRELOAD_PER_POLICY);
     } else {
@@ -916,11 +1172,64 @@ void TreeItemMessage::fetch(Model *const model)
 }
 
 unsigned int TreeItemMessage::rowCount(Model *const model)
+{
+    return childrenCount(model);
+}
+
+unsigned int TreeItemMessage::childrenCount(Model *const model)
 {
     fetch(model);
+    createPartsIfNeeded(model);
     return m_children.size();
 }
 
+TreeItem *TreeItemMessage::child(const int offset, Model *const model)
+{
+    fetch(model);
+    createPartsIfNeeded(model);
+    if (offset >= 0 && offset < m_children.size())
+        return m_children[offset];
+    else
+        return 0;
+}
+
+/** @short Build the child parts from the serialized BODYSTRUCTURE unless they exist already
+
+A BODYSTRUCTURE which cannot be parsed is removed from the cache, and the message metadata are asked for once again.
+*/
+void TreeItemMessage::createPartsIfNeeded(Model *const model)
+{
+    if (!fetched() || !m_children.isEmpty() || metadata().bodyStructure.isEmpty())
+        return;
+
+    QDataStream stream(metadata().bodyStructure);
+    stream.setVersion(QDataStream::Qt_4_6);
+    QVariantList unserialized;
+    stream >> unserialized;
+    QSharedPointer<Message::AbstractMessage> abstractMessage;
+    try {
+        abstractMessage = Message::AbstractMessage::fromList(unserialized, QByteArray(), 0);
+    } catch (Imap::ParserException &e) {
+        qDebug() << "Error when parsing cached BODYSTRUCTURE" << e.what();
+    }
+    if (!abstractMessage) {
+        TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(parent()->parent());
+        Q_ASSERT(mailboxPtr);
+        AbstractCache::MessageDataBundle cached = model->cache()->messageMetadata(mailboxPtr->mailbox(), uid());
+        if (cached.uid == uid() && !cached.serializedBodyStructure.isEmpty()) {
+            // A cached record without the BODYSTRUCTURE is not used, see Model::askForMsgMetadata()
+            cached.serializedBodyStructure.clear();
+            model->cache()->setMessageMetadata(mailboxPtr->mailbox(), uid(), cached);
+        }
+        writableMetadata().bodyStructure.clear();
+        m_fetchStatus = NONE;
+        fetch(model);
+        return;
+    }
+    QList<TreeItem *> oldChildren = setChildren(abstractMessage->createTreeItems(this));
+    Q_ASSERT(oldChildren.isEmpty());
+}
+
 unsigned int TreeItemMessage::columnCount()
 {
     return 3;
@@ -963,24 +1272,13 @@ QVariant TreeItemMessage::data(Model *const model, int role)
         return QVariant();
 
     // Special item roles which should not trigger fetching of message metadata
+    QVariant res;
+    if (static_cast<TreeItemMsgList *>(parent())->rowData(row(), role, &res))
+        return res;
+
     switch (role) {
-    case RoleMessageUid:
-        return m_uid ? QVariant(m_uid) : QVariant();
     case RoleIsFetched:
         return fetched();
-    case RoleMessageFlags:
-        // The flags are already sorted by Model::normalizeFlags()
-        return m_flags;
-    case RoleMessageIsMarkedDeleted:
-        return isMarkedAsDeleted();
-    case RoleMessageIsMarkedRead:
-        return isMarkedAsRead();
-    case RoleMessageIsMarkedForwarded:
-        return isMarkedAsForwarded();
-    case RoleMessageIsMarkedReplied:
-        return isMarkedAsReplied();
-    case RoleMessageIsMarkedRecent:
-        return isMarkedAsRecent();
     case RoleMessageFuzzyDate:
     {
         // When the QML ListView is configured with its section.* properties, it will call the corresponding data() section *very*
@@ -992,7 +1290,7 @@ QVariant TreeItemMessage::data(Model *const model, int role)
             return QVariant();
         }
 
-        QDateTime timestamp = envelope(model).date;
+        QDateTime timestamp = date(model);
         if (!timestamp.isValid())
             return QString();
 
@@ -1005,8 +1303,6 @@ QVariant TreeItemMessage::data(Model *const model, int role)
 
         return QDate(timestamp.date().year(), timestamp.date().month(), 1).toString(Model::tr("MMMM yyyy"));
     }
-    case RoleMessageWasUnread:
-        return m_wasUnread;
     case RoleThreadRootWithUnreadMessages:
         // This one doesn't really make much sense here, but we do want to catch it to prevent a fetch request from this context
         qDebug() << "Warning: asked for RoleThreadRootWithUnreadMessages on TreeItemMessage. This does not make sense.";
@@ -1023,13 +1319,13 @@ QVariant TreeItemMessage::data(Model *const model, int role)
         } else if (isUnavailable(model)) {
             return QString::fromUtf8("[offline UID %1]").arg(QString::number(uid()));
         } else {
-            return QString::fromUtf8("UID %1: %2").arg(QString::number(uid()), m_envelope.subject);
+            return QString::fromUtf8("UID %1: %2").arg(QString::number(uid()), metadata().envelope.subject);
         }
     case Qt::ToolTipRole:
         if (fetched()) {
             QString buf;
             QTextStream stream(&buf);
-            stream << m_envelope;
+            stream << metadata().envelope.envelope(addressPool());
             return buf;
         } else {
             return QVariant();
@@ -1044,42 +1340,44 @@ QVariant TreeItemMessage::data(Model *const model, int role)
 
     switch (role) {
     case RoleMessageDate:
-        return envelope(model).date;
+        return metadata().envelope.date;
     case RoleMessageInternalDate:
-        return m_internalDate;
+        return metadata().internalDate;
     case RoleMessageFrom:
-        return addresListToQVariant(envelope(model).from);
+        return addresListToQVariant(metadata().envelope.addresses(addressPool(), CompactEnvelope::FROM));
     case RoleMessageTo:
-        return addresListToQVariant(envelope(model).to);
+        return addresListToQVariant(metadata().envelope.addresses(addressPool(), CompactEnvelope::TO));
     case RoleMessageCc:
-        return addresListToQVariant(envelope(model).cc);
+        return addresListToQVariant(metadata().envelope.addresses(addressPool(), CompactEnvelope::CC));
     case RoleMessageBcc:
-        return addresListToQVariant(envelope(model).bcc);
+        return addresListToQVariant(metadata().envelope.addresses(addressPool(), CompactEnvelope::BCC));
     case RoleMessageSender:
-        return addresListToQVariant(envelope(model).sender);
+        return addresListToQVariant(metadata().envelope.addresses(addressPool(), CompactEnvelope::SENDER));
     case RoleMessageReplyTo:
-        return addresListToQVariant(envelope(model).replyTo);
+        return addresListToQVariant(metadata().envelope.addresses(addressPool(), CompactEnvelope::REPLY_TO));
     case RoleMessageInReplyTo:
-        return QVariant::fromValue(envelope(model).inReplyTo);
+        return QVariant::fromValue(metadata().envelope.inReplyTo);
     case RoleMessageMessageId:
-        return envelope(model).messageId;
+        return metadata().envelope.messageId;
     case RoleMessageSubject:
-        return envelope(model).subject;
+        return metadata().envelope.subject;
+    case RoleMessageBaseSubject:
+        return metadata().baseSubject;
     case RoleMessageSize:
-        return m_size;
+        return metadata().size;
     case RoleMessageHeaderReferences:
-        return QVariant::fromValue(m_hdrReferences);
+        return QVariant::fromValue(metadata().hdrReferences);
     case RoleMessageHeaderListPost:
     {
         QVariantList res;
-        Q_FOREACH(const QUrl &url, m_hdrListPost)
+        Q_FOREACH(const QUrl &url, metadata().hdrListPost)
             res << url;
         return res;
     }
     case RoleMessageHeaderListPostNo:
-        return m_hdrListPostNo;
+        return metadata().hdrListPostNo;
     case RoleMessageEnvelope:
-        return QVariant::fromValue<Message::Envelope>(envelope(model));
+        return QVariant::fromValue<Message::Envelope>(metadata().envelope.envelope(addressPool()));
     default:
         return QVariant();
     }
@@ -1087,79 +1385,103 @@ QVariant TreeItemMessage::data(Model *const model, int role)
 
 bool TreeItemMessage::isMarkedAsDeleted() const
 {
-    return m_flags.contains(QLatin1String("\\Deleted"));
+    return messageRow().flags.test(FlagDictionary::FLAG_DELETED);
 }
 
 bool TreeItemMessage::isMarkedAsRead() const
 {
-    return m_flags.contains(QLatin1String("\\Seen"));
+    return messageRow().flags.test(FlagDictionary::FLAG_SEEN);
 }
 
 bool TreeItemMessage::isMarkedAsReplied() const
 {
-    return m_flags.contains(QLatin1String("\\Answered"));
+    return messageRow().flags.test(FlagDictionary::FLAG_ANSWERED);
 }
 
 bool TreeItemMessage::isMarkedAsForwarded() const
 {
-    return m_flags.contains(QLatin1String("$Forwarded"));
+    return messageRow().flags.test(FlagDictionary::FLAG_FORWARDED);
 }
 
 bool TreeItemMessage::isMarkedAsRecent() const
 {
-    return m_flags.contains(QLatin1String("\\Recent"));
+    return messageRow().flags.test(FlagDictionary::FLAG_RECENT);
 }
 
 uint TreeItemMessage::uid() const
 {
-    return m_uid;
+    return messageRow().uid;
 }
 
+/** @short Return the UID and flags of this message, which are kept by the list */
+const MessageRow &TreeItemMessage::messageRow() const
+{
+    return static_cast<const TreeItemMsgList *>(parent())->m_rows[row()];
+}
+
+/** @short Build the full envelope of the message
+
+The envelope is not stored in this form, so it is cheaper to use the addresses() or date() when just a part of it is needed.
+*/
 Message::Envelope TreeItemMessage::envelope(Model *const model)
 {
     fetch(model);
-    return m_envelope;
+    return metadata().envelope.envelope(addressPool());
 }
 
-QDateTime TreeItemMessage::internalDate(Model *const model)
+/** @short Return the addresses from one @arg field of the envelope */
+QList<Message::MailAddress> TreeItemMessage::addresses(Model *const model, const CompactEnvelope::AddressField field)
 {
     fetch(model);
-    return m_internalDate;
+    return metadata().envelope.addresses(addressPool(), field);
 }
 
-uint TreeItemMessage::size(Model *const model)
+/** @short Return the date from the envelope */
+QDateTime TreeItemMessage::date(Model *const model)
 {
     fetch(model);
-    return m_size;
+    return metadata().envelope.date;
 }
 
-void TreeItemMessage::setFlags(TreeItemMsgList *list, const QStringList &flags, bool forceChange)
-{
-    // wasSeen is used to determine if the message was marked as read before this operation
-    bool wasSeen = isMarkedAsRead();
-    m_flags = flags;
-    if (list->m_numberFetchingStatus == DONE && forceChange) {
-        bool isSeen = isMarkedAsRead();
-        if (m_flagsHandled) {
-            if (wasSeen && !isSeen) {
-                ++list->m_unreadMessageCount;
-                // leave the message as "was unread" so it persists in the view when read messages are hidden
-                m_wasUnread = true;
-            } else if (!wasSeen && isSeen) {
-                --list->m_unreadMessageCount;
-            }
-        } else {
-            // it's a new message
-            m_flagsHandled = true;
-            if (!isSeen) {
-                ++list->m_unreadMessageCount;
-                // mark the message as "was unread" so it shows up in the view when read messages are hidden
-                m_wasUnread = true;
-            }
-        }
+/** @short Store the @arg envelope in the compact form
+
+The @arg baseSubject shall be the base subject which was saved along with the envelope in the cache, or a null string if it
+has to be derived from the subject.
+*/
+void TreeItemMessage::setEnvelope(Model *const model, const Message::Envelope &envelope, const QString &baseSubject)
+{
+    MessageMetadata &metadata = writableMetadata();
+    AddressPool &pool = addressPool();
+    // The new addresses go in before the old ones are given back, so that the shared ones don't get dropped in between
+    CompactEnvelope compact(pool, envelope);
+    metadata.envelope.clear(pool);
+    metadata.envelope = compact;
+    metadata.baseSubject = baseSubject.isNull() ? LocalSorting::baseSubject(envelope.subject) : baseSubject;
+    if (metadata.baseSubject == metadata.envelope.subject) {
+        // Most subjects have no prefix, so let's share the data
+        metadata.baseSubject = metadata.envelope.subject;
     }
 }
 
+/** @short Return the subject with all the reply and forward markers removed, as defined by RFC 5256 */
+QString TreeItemMessage::baseSubject(Model *const model)
+{
+    fetch(model);
+    return metadata().baseSubject;
+}
+
+QDateTime TreeItemMessage::internalDate(Model *const model)
+{
+    fetch(model);
+    return metadata().internalDate;
+}
+
+uint TreeItemMessage::size(Model *const model)
+{
+    fetch(model);
+    return metadata().size;
+}
+
 /** @short Process the data found in the headers passed along and file in auxiliary metadata
 
 This function accepts a snippet containing some RFC5322 headers of a message, no matter what headers are actually
@@ -1176,20 +1498,22 @@ void TreeItemMessage::processAdditionalHeaders(Model *model, const QByteArray &r
                         QLatin1String("Unspecified error during RFC5322 header parsing"));
     }
 
-    m_hdrReferences = parser.references;
+    MessageMetadata &metadata = writableMetadata();
+    metadata.hdrReferences = parser.references;
     if (!parser.listPost.isEmpty()) {
-        m_hdrListPost.clear();
+        metadata.hdrListPost.clear();
         Q_FOREACH(const QByteArray &item, parser.listPost)
-            m_hdrListPost << QUrl(item);
+            metadata.hdrListPost << QUrl(item);
     }
     // That's right, this can only be set, not ever reset from this context.
     // This is because we absolutely want to support incremental header arrival.
     if (parser.listPostNo)
-        m_hdrListPostNo = true;
+        metadata.hdrListPostNo = true;
 }
 
 
-TreeItemPart::TreeItemPart(TreeItem *parent, const QString &mimeType): TreeItem(parent), m_mimeType(mimeType.toLower()), m_octets(0)
+TreeItemPart::TreeItemPart(TreeItem *parent, const QString &mimeType):
+    TreeItem(parent), m_mimeType(mimeType.toLower()), m_octets(0), m_binarySize(0), m_partialFetch(0), m_dataLru(0)
 {
     if (isTopLevelMultiPart()) {
         // Note that top-level multipart messages are special, their immediate contents
@@ -1202,15 +1526,24 @@ TreeItemPart::TreeItemPart(TreeItem *parent, const QString &mimeType): TreeItem(
 }
 
 TreeItemPart::TreeItemPart(TreeItem *parent):
-    TreeItem(parent), m_mimeType(QLatin1String("text/plain")), m_octets(0), m_partHeader(0), m_partText(0), m_partMime(0)
+    TreeItem(parent), m_mimeType(QLatin1String("text/plain")), m_octets(0), m_binarySize(0), m_partHeader(0), m_partText(0),
+    m_partMime(0), m_partialFetch(0), m_dataLru(0)
 {
 }
 
 TreeItemPart::~TreeItemPart()
 {
+    if (m_dataLru)
+        m_dataLru->remove(this);
     delete m_partHeader;
     delete m_partMime;
     delete m_partText;
+    delete m_partialFetch;
+}
+
+TreeItemPart::PartialFetchState::PartialFetchState(const PartFetchingMode mode):
+    mode(mode), offset(0), requestedLength(0), chunkPending(false), restRequested(false)
+{
 }
 
 unsigned int TreeItemPart::childrenCount(Model *const model)
@@ -1238,13 +1571,91 @@ QList<TreeItem *> TreeItemPart::setChildren(const QList<TreeItem *> items)
 
 void TreeItemPart::fetch(Model *const model)
 {
-    if (fetched() || loading() || isUnavailable(model))
+    if (fetched() || isUnavailable(model))
         return;
 
+    if (loading()) {
+        if (m_partialFetch && !m_partialFetch->restRequested) {
+            // Somebody needs the whole data, so there's no point in waiting for the progressive reader
+            m_partialFetch->restRequested = true;
+            if (!m_partialFetch->chunkPending)
+                model->askForMsgPartChunk(this);
+        }
+        return;
+    }
+
     m_fetchStatus = LOADING;
     model->askForMsgPart(this);
 }
 
+void TreeItemPart::fetchNextChunk(Model *const model)
+{
+    if (fetched() || isUnavailable(model))
+        return;
+
+    if (loading()) {
+        if (m_partialFetch && !m_partialFetch->chunkPending)
+            model->askForMsgPartChunk(this);
+        return;
+    }
+
+    m_fetchStatus = LOADING;
+    model->askForMsgPart(this, false, Model::PART_FETCH_PROGRESSIVE);
+}
+
+bool TreeItemPart::isPartiallyFetched() const
+{
+    return m_partialFetch && loading() && m_partialFetch->offset > 0;
+}
+
+uint TreeItemPart::fetchedOctets() const
+{
+    return m_partialFetch ? m_partialFetch->offset : (fetched() ? expectedOctets() : 0);
+}
+
+uint TreeItemPart::expectedOctets() const
+{
+    if (m_binarySize && (!m_partialFetch || m_partialFetch->mode == FETCH_PART_BINARY))
+        return m_binarySize;
+    return m_octets;
+}
+
+/** @short Process one chunk of a progressive download
+
+Returns true if this was the last chunk. The transfer encoding is only decoded up to the last complete line because neither
+the base64 nor the quoted-printable data can be split at arbitrary positions; the rest is kept for later.
+*/
+bool TreeItemPart::appendChunk(const QByteArray &data, const bool alreadyDecoded)
+{
+    Q_ASSERT(m_partialFetch);
+    m_partialFetch->chunkPending = false;
+    m_partialFetch->offset += data.size();
+    const bool complete = static_cast<uint>(data.size()) < m_partialFetch->requestedLength ||
+            (m_partialFetch->mode == FETCH_PART_IMAP && m_partialFetch->offset >= m_octets) ||
+            (m_partialFetch->mode == FETCH_PART_BINARY && m_binarySize && m_partialFetch->offset >= m_binarySize);
+
+    if (alreadyDecoded) {
+        m_data.append(data);
+    } else {
+        m_partialFetch->undecodedTail.append(data);
+        const int cut = complete ? m_partialFetch->undecodedTail.size() : m_partialFetch->undecodedTail.lastIndexOf('\n') + 1;
+        if (cut > 0) {
+            QByteArray decoded;
+            decodeMessagePartTransportEncoding(m_partialFetch->undecodedTail.left(cut), m_encoding, &decoded);
+            m_data.append(decoded);
+            m_partialFetch->undecodedTail.remove(0, cut);
+        }
+    }
+    return complete;
+}
+
+/** @short Forget about the progressive download, either because it has finished or because it cannot continue */
+void TreeItemPart::finishPartialFetch()
+{
+    delete m_partialFetch;
+    m_partialFetch = 0;
+}
+
 void TreeItemPart::fetchFromCache(Model *const model)
 {
     if (fetched() || loading() || isUnavailable(model))
@@ -1322,6 +1733,8 @@ QVariant TreeItemPart::data(Model *const model, int role)
     case Qt::ToolTipRole:
         return m_data.size() > 10000 ? Model::tr("%1 bytes of data").arg(m_data.size()) : m_data;
     case RolePartData:
+        if (m_dataLru)
+            m_dataLru->touch(this, m_data.size());
         return m_data;
     default:
         return QVariant();
@@ -1395,6 +1808,8 @@ TreeItemMessage *TreeItemPart::message() const
 
 QByteArray *TreeItemPart::dataPtr()
 {
+    if (m_dataLru)
+        m_dataLru->touch(this, m_data.size());
     return &m_data;
 }
 
@@ -1443,7 +1858,10 @@ void TreeItemPart::silentlyReleaseMemoryRecursive()
         delete m_partMime;
         m_partMime = 0;
     }
+    if (m_dataLru)
+        m_dataLru->forget(this);
     m_data.clear();
+    finishPartialFetch();
     m_fetchStatus = NONE;
     qDeleteAll(m_children);
     m_children.clear();
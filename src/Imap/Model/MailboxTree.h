@@ -27,8 +27,13 @@
 #include <QModelIndex>
 #include <QPointer>
 #include <QString>
+#include <QVector>
+#include "Common/ObjectPool.h"
 #include "../Parser/Response.h"
 #include "../Parser/Message.h"
+#include "Cache.h"
+#include "CompactEnvelope.h"
+#include "FlagDictionary.h"
 #include "MailboxMetadata.h"
 
 namespace Imap
@@ -40,6 +45,7 @@ namespace Mailbox
 class Model;
 class MailboxModel;
 class KeepMailboxOpenTask;
+class PartDataLru;
 
 class TreeItem
 {
@@ -168,31 +174,85 @@ public:
     void handleVanished(Model *const model, const Responses::Vanished &resp);
     bool isSelectable() const;
 private:
-    TreeItemPart *partIdToPtr(Model *model, TreeItemMessage *message, const QString &msgId);
+    TreeItemPart *partIdToPtr(Model *model, TreeItemMessage *message, const QString &fetchItem);
+    void cacheFetchedPart(Model *const model, TreeItemMessage *message, TreeItemPart *part);
 
     /** @short ImapTask which is currently responsible for well-being of this mailbox */
     QPointer<KeepMailboxOpenTask> maintainingTask;
 };
 
+/** @short Data which are kept for each and every message in a mailbox
+
+A mailbox can easily contain hundreds of thousands of messages, yet only a tiny fraction of them is ever shown. The list of
+messages is therefore an array of these compact records, and a TreeItemMessage is only created for the rows which somebody
+asks for.
+*/
+struct MessageRow
+{
+    MessageRow(): uid(0), flagsHandled(false), wasUnread(false) {}
+
+    uint uid;
+    MessageFlags flags;
+    /** @short Have the flags of this message been accounted for in the unread counter already? */
+    bool flagsHandled;
+    /** @short Was the message unread when the list was shown, so that it stays visible when the read ones are hidden? */
+    bool wasUnread;
+};
+
+}
+
+}
+
+// The MessageFlags only hold a quint64 and a QVector, so the rows can be moved around in memory as they are
+Q_DECLARE_TYPEINFO(Imap::Mailbox::MessageRow, Q_MOVABLE_TYPE);
+
+namespace Imap
+{
+
+namespace Mailbox
+{
+
 class TreeItemMsgList: public TreeItem
 {
     void operator=(const TreeItem &);  // don't implement
     friend class TreeItemMailbox;
-    friend class TreeItemMessage; // for maintaining the m_unreadMessageCount
+    friend class TreeItemMessage; // needs access to m_rows
     friend class Model;
     friend class ObtainSynchronizedMailboxTask;
     friend class KeepMailboxOpenTask;
+    friend class UpdateFlagsTask; // needs access to m_flagDictionary and setMessageFlags()
+    /** @short UID and flags of all messages; the m_children hold a null pointer for the rows without a TreeItemMessage */
+    QVector<MessageRow> m_rows;
     FetchingState m_numberFetchingStatus;
     int m_totalMessageCount;
     int m_unreadMessageCount;
     int m_recentMessageCount;
+    /** @short Positions of the flags in the MessageFlags of the messages in this mailbox */
+    FlagDictionary m_flagDictionary;
+    /** @short Addresses from the envelopes of the messages in this mailbox */
+    AddressPool m_addressPool;
 public:
     explicit TreeItemMsgList(TreeItem *parent);
+    ~TreeItemMsgList();
 
     virtual void fetch(Model *const model);
     virtual unsigned int rowCount(Model *const model);
     virtual QVariant data(Model *const model, int role);
     virtual bool hasChildren(Model *const model);
+    virtual TreeItem *child(const int offset, Model *const model);
+
+    /** @short Return the TreeItemMessage at the given @arg row, creating it if needed, or null if there's no such row */
+    TreeItemMessage *message(const int row);
+    /** @short Return the TreeItemMessage at the given @arg row only if it has been created already */
+    TreeItemMessage *existingMessage(const int row) const;
+    uint messageUid(const int row) const;
+    const MessageFlags &messageFlags(const int row) const;
+    bool isMessageMarkedAsRead(const int row) const;
+    /** @short Answer those item roles which need nothing but the UID and flags without creating the TreeItemMessage
+
+    Returns false when the @arg role is not one of them.
+    */
+    bool rowData(const int row, const int role, QVariant *result) const;
 
     int totalMessageCount(Model *const model);
     int unreadMessageCount(Model *const model);
@@ -201,6 +261,34 @@ public:
     void recalcVariousMessageCounts(Model *model);
     void resetWasUnreadState();
     bool numbersFetched() const;
+private:
+    void setMessageFlags(const int row, const MessageFlags &flags, bool forceChange);
+    void appendMessages(const int count);
+    QList<TreeItem *> takeMessages(const int row, const int count);
+};
+
+/** @short Data of a message which are only known once its metadata have been fetched
+
+Even a TreeItemMessage which has been created for a row does not necessarily need these, so it only carries its position and
+the parts. Everything else lives here, and the record is only created when the first piece of it arrives.
+*/
+class MessageMetadata
+{
+public:
+    MessageMetadata(): size(0), hdrListPostNo(false) {}
+    TROJITA_POOLED_ALLOCATION(MessageMetadata)
+
+    /** @short The ENVELOPE, with the addresses kept in the AddressPool of the mailbox */
+    CompactEnvelope envelope;
+    QDateTime internalDate;
+    uint size;
+    QList<QByteArray> hdrReferences;
+    QList<QUrl> hdrListPost;
+    bool hdrListPostNo;
+    /** @short The base subject from RFC 5256, computed once when the envelope arrives */
+    QString baseSubject;
+    /** @short Serialized BODYSTRUCTURE from which the child parts are built when somebody asks for them */
+    QByteArray bodyStructure;
 };
 
 class TreeItemMessage: public TreeItem
@@ -211,35 +299,38 @@ class TreeItemMessage: public TreeItem
     friend class Model;
     friend class ObtainSynchronizedMailboxTask; // needs access to m_offset
     friend class KeepMailboxOpenTask; // needs access to m_offset
-    friend class UpdateFlagsTask; // needs access to m_flags
-    Message::Envelope m_envelope;
-    QDateTime m_internalDate;
-    uint m_size;
-    uint m_uid;
-    QStringList m_flags;
-    QList<QByteArray> m_hdrReferences;
-    QList<QUrl> m_hdrListPost;
-    bool m_hdrListPostNo;
-    bool m_flagsHandled;
+    friend class ThreadingMsgListModel; // needs access to metadata()
+    /** @short Envelope, size and other fetched data; null until some of them arrive */
+    MessageMetadata *m_metadata;
     int m_offset;
-    bool m_wasUnread;
     // These are lazily-populated from a const method, so they got to be mutable
     mutable TreeItemPart *m_partHeader;
     mutable TreeItemPart *m_partText;
-    /** @short Set FLAGS and maintain the unread message counter */
-    void setFlags(TreeItemMsgList *list, const QStringList &flags, bool forceChange);
+    const MessageRow &messageRow() const;
     void processAdditionalHeaders(Model *model, const QByteArray &rawHeaders);
+    void setEnvelope(Model *const model, const Message::Envelope &envelope, const QString &baseSubject = QString());
+    void createPartsIfNeeded(Model *const model);
+    AddressPool &addressPool() const;
+    const MessageMetadata &metadata() const;
+    MessageMetadata &writableMetadata();
+    void adoptMetadata(Model *const model, AbstractCache::MessageDataBundle &data);
 public:
     explicit TreeItemMessage(TreeItem *parent);
     ~TreeItemMessage();
+    TROJITA_POOLED_ALLOCATION(TreeItemMessage)
 
     virtual int row() const;
+    virtual unsigned int childrenCount(Model *const model);
+    virtual TreeItem *child(const int offset, Model *const model);
     virtual void fetch(Model *const model);
     virtual unsigned int rowCount(Model *const model);
     virtual unsigned int columnCount();
     virtual QVariant data(Model *const model, int role);
     virtual bool hasChildren(Model *const model) { Q_UNUSED(model); return true; }
     Message::Envelope envelope(Model *const model);
+    QList<Message::MailAddress> addresses(Model *const model, const CompactEnvelope::AddressField field);
+    QDateTime date(Model *const model);
+    QString baseSubject(Model *const model);
     QDateTime internalDate(Model *const model);
     uint size(Model *const model);
     bool isMarkedAsDeleted() const;
@@ -256,6 +347,35 @@ class TreeItemPart: public TreeItem
     void operator=(const TreeItem &);  // don't implement
     friend class TreeItemMailbox; // needs access to m_data
     friend class Model; // dtto
+    friend class PartDataLru; // maintains m_dataLru
+public:
+    /** @short Shall we use RFC3516 BINARY for fetching message parts or not */
+    typedef enum {
+        /** @short Use the baseline IMAP feature, the BODY[...], from RFC 3501 */
+        FETCH_PART_IMAP,
+        /** @short Fetch via the RFC3516's BINARY extension */
+        FETCH_PART_BINARY
+    } PartFetchingMode;
+
+private:
+    /** @short Progress of a part which is being downloaded in chunks via the BODY[...]<offset.length> */
+    struct PartialFetchState {
+        PartialFetchState(const PartFetchingMode mode);
+
+        /** @short Which of the fetch items is in use; the offsets are not interchangeable between them */
+        PartFetchingMode mode;
+        /** @short Number of octets received so far, as counted by the IMAP server */
+        uint offset;
+        /** @short Length of the chunk which has been requested most recently */
+        uint requestedLength;
+        /** @short The tail of the transfer-encoded data which could not have been decoded yet */
+        QByteArray undecodedTail;
+        /** @short Is there a request for the next chunk in progress? */
+        bool chunkPending;
+        /** @short Has anybody asked for the complete data? */
+        bool restRequested;
+    };
+
     QString m_mimeType;
     QString m_charset;
     QString m_contentFormat;
@@ -265,13 +385,19 @@ class TreeItemPart: public TreeItem
     QByteArray m_bodyDisposition;
     QString m_fileName;
     uint m_octets;
+    /** @short Size of the decoded data as reported through the BINARY.SIZE, or zero if not known */
+    uint m_binarySize;
     QByteArray m_multipartRelatedStartPart;
     TreeItemPart *m_partHeader;
     TreeItemPart *m_partText;
     TreeItemPart *m_partMime;
+    PartialFetchState *m_partialFetch;
+    /** @short The tracker which knows about the m_data of this part, if any */
+    PartDataLru *m_dataLru;
 public:
     TreeItemPart(TreeItem *parent, const QString &mimeType);
     ~TreeItemPart();
+    TROJITA_POOLED_ALLOCATION(TreeItemPart)
 
     virtual unsigned int childrenCount(Model *const model);
     virtual TreeItem *child(const int offset, Model *const model);
@@ -286,13 +412,24 @@ public:
 
     virtual QString partId() const;
 
-    /** @short Shall we use RFC3516 BINARY for fetching message parts or not */
-    typedef enum {
-        /** @short Use the baseline IMAP feature, the BODY[...], from RFC 3501 */
-        FETCH_PART_IMAP,
-        /** @short Fetch via the RFC3516's BINARY extension */
-        FETCH_PART_BINARY
-    } PartFetchingMode;
+    /** @short Start or continue a progressive download of this part
+
+    Big textual parts are downloaded in chunks, with each subsequent chunk requested only after the previous one has arrived
+    and after somebody has called this function again. The data which have arrived so far are available through dataPtr()
+    while the part remains in the loading state. Calling the regular fetch() on a partially downloaded item requests all of
+    the remaining data.
+    */
+    void fetchNextChunk(Model *const model);
+    /** @short Return true if some chunks have arrived already, but the rest of this part is still missing */
+    bool isPartiallyFetched() const;
+    /** @short Return the number of octets which have been received so far */
+    uint fetchedOctets() const;
+    /** @short Return the value which the fetchedOctets() will reach once the download is complete
+
+    That's the size from the BODYSTRUCTURE when fetching via the BODY[...], and the one from the BINARY.SIZE (if available)
+    when the data are already decoded by the server.
+    */
+    uint expectedOctets() const;
 
     virtual QString partIdForFetch(const PartFetchingMode fetchingMode) const;
     virtual QString pathToPart() const;
@@ -322,6 +459,8 @@ public:
     void setOctets(const uint size) { m_octets = size; }
     /** @short Return the downloadable size of the message part */
     uint octets() const { return m_octets; }
+    /** @short Return the size of the decoded data as reported by the server, or zero if it isn't known */
+    uint binarySize() const { return m_binarySize; }
     QByteArray multipartRelatedStartPart() const { return m_multipartRelatedStartPart; }
     void setMultipartRelatedStartPart(const QByteArray &start) { m_multipartRelatedStartPart = start; }
     virtual TreeItem *specialColumnPtr(int row, int column) const;
@@ -329,6 +468,8 @@ public:
     void silentlyReleaseMemoryRecursive();
 protected:
     virtual bool isTopLevelMultiPart() const;
+    bool appendChunk(const QByteArray &data, const bool alreadyDecoded);
+    void finishPartialFetch();
     TreeItemPart(TreeItem *parent);
 };
 
@@ -341,6 +482,7 @@ class TreeItemModifiedPart: public TreeItemPart
     PartModifier m_modifier;
 public:
     TreeItemModifiedPart(TreeItem *parent, const PartModifier kind);
+    TROJITA_POOLED_ALLOCATION(TreeItemModifiedPart)
     virtual int row() const;
     virtual unsigned int columnCount();
     virtual QString partId() const;
@@ -42,6 +42,7 @@ QList<MailboxMetadata> MemoryCache::childMailboxes(const QString &mailbox) const
 
 bool MemoryCache::childMailboxesFresh(const QString &mailbox) const
 {
+    TROJITA_INSTRUMENT_CACHE("MemoryCache::childMailboxesFresh", mailboxes.contains(mailbox));
     return mailboxes.contains(mailbox);
 }
 
@@ -55,6 +56,7 @@ void MemoryCache::setChildMailboxes(const QString &mailbox, const QList<MailboxM
 
 SyncState MemoryCache::mailboxSyncState(const QString &mailbox) const
 {
+    TROJITA_INSTRUMENT_CACHE("MemoryCache::mailboxSyncState", syncState.contains(mailbox));
     return syncState[ mailbox ];
 }
 
@@ -90,6 +92,7 @@ void MemoryCache::clearAllMessages(const QString &mailbox)
     flags.remove(mailbox);
     msgMetadata.remove(mailbox);
     parts.remove(mailbox);
+    searchIndex.remove(mailbox);
 }
 
 void MemoryCache::clearMessage(const QString mailbox, uint uid)
@@ -103,6 +106,8 @@ void MemoryCache::clearMessage(const QString mailbox, uint uid)
         msgMetadata[ mailbox ].remove(uid);
     if (parts.contains(mailbox))
         parts[ mailbox ].remove(uid);
+    if (searchIndex.contains(mailbox))
+        searchIndex[mailbox].removeMessage(uid);
 }
 
 void MemoryCache::setMsgPart(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data)
@@ -113,6 +118,19 @@ void MemoryCache::setMsgPart(const QString &mailbox, uint uid, const QString &pa
     parts[ mailbox ][ uid ][ partId ] = data;
 }
 
+void MemoryCache::addMsgSearchableText(const QString &mailbox, uint uid, const QString &text)
+{
+    searchIndex[mailbox].addText(uid, FullTextIndex::FIELD_BODY, text);
+}
+
+QList<uint> MemoryCache::searchMessages(const QString &mailbox, const QString &query, const uint fields) const
+{
+    QMap<QString, FullTextIndex>::const_iterator it = searchIndex.constFind(mailbox);
+    if (it == searchIndex.constEnd())
+        return QList<uint>();
+    return it->search(query, fields);
+}
+
 void MemoryCache::setMsgFlags(const QString &mailbox, uint uid, const QStringList &newFlags)
 {
 #ifdef CACHE_DEBUG
@@ -123,23 +141,30 @@ void MemoryCache::setMsgFlags(const QString &mailbox, uint uid, const QStringLis
 
 QStringList MemoryCache::msgFlags(const QString &mailbox, uint uid) const
 {
+    TROJITA_INSTRUMENT_CACHE("MemoryCache::msgFlags", flags.value(mailbox).contains(uid));
     return flags[mailbox][uid];
 }
 
 QList<uint> MemoryCache::uidMapping(const QString &mailbox) const
 {
+    TROJITA_INSTRUMENT_CACHE("MemoryCache::uidMapping", seqToUid.contains(mailbox));
     return seqToUid[ mailbox ];
 }
 
 void MemoryCache::setMessageMetadata(const QString &mailbox, uint uid, const MessageDataBundle &metadata)
 {
     msgMetadata[mailbox][uid] = metadata;
+    FullTextIndex &index = searchIndex[mailbox];
+    Q_FOREACH(const FullTextIndex::FieldTexts::value_type &item, FullTextIndex::envelopeTexts(metadata.envelope)) {
+        index.addText(uid, item.first, item.second);
+    }
 }
 
 MemoryCache::MessageDataBundle MemoryCache::messageMetadata(const QString &mailbox, uint uid) const
 {
     const QMap<uint, MessageDataBundle> &firstLevel = msgMetadata[ mailbox ];
     QMap<uint, MessageDataBundle>::const_iterator it = firstLevel.find(uid);
+    TROJITA_INSTRUMENT_CACHE("MemoryCache::messageMetadata", it != firstLevel.end());
     if (it == firstLevel.end()) {
         return MessageDataBundle();
     }
@@ -148,6 +173,7 @@ MemoryCache::MessageDataBundle MemoryCache::messageMetadata(const QString &mailb
 
 QByteArray MemoryCache::messagePart(const QString &mailbox, uint uid, const QString &partId) const
 {
+    TROJITA_INSTRUMENT_CACHE("MemoryCache::messagePart", parts.value(mailbox).value(uid).contains(partId));
     if (! parts.contains(mailbox))
         return QByteArray();
     const QMap<uint, QMap<QString, QByteArray> > &mailboxParts = parts[ mailbox ];
@@ -161,6 +187,7 @@ QByteArray MemoryCache::messagePart(const QString &mailbox, uint uid, const QStr
 
 QVector<Imap::Responses::ThreadingNode> MemoryCache::messageThreading(const QString &mailbox)
 {
+    TROJITA_INSTRUMENT_CACHE("MemoryCache::messageThreading", threads.contains(mailbox));
     return threads[mailbox];
 }
 
@@ -169,6 +196,17 @@ void MemoryCache::setMessageThreading(const QString &mailbox, const QVector<Imap
     threads[mailbox] = threading;
 }
 
+MemoryCache::MessageSorting MemoryCache::messageSorting(const QString &mailbox) const
+{
+    TROJITA_INSTRUMENT_CACHE("MemoryCache::messageSorting", sortings.contains(mailbox));
+    return sortings.value(mailbox);
+}
+
+void MemoryCache::setMessageSorting(const QString &mailbox, const MessageSorting &sorting)
+{
+    sortings[mailbox] = sorting;
+}
+
 void MemoryCache::setRenewalThreshold(const int days)
 {
     Q_UNUSED(days);
@@ -24,6 +24,7 @@
 #define IMAP_MODEL_MEMORYCACHE_H
 
 #include "Cache.h"
+#include "FullTextIndex.h"
 #include <QMap>
 
 /** @short Namespace for IMAP interaction */
@@ -68,9 +69,15 @@ public:
     virtual QByteArray messagePart(const QString &mailbox, uint uid, const QString &partId) const;
     virtual void setMsgPart(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data);
 
+    virtual void addMsgSearchableText(const QString &mailbox, uint uid, const QString &text);
+    virtual QList<uint> searchMessages(const QString &mailbox, const QString &query, const uint fields) const;
+
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading);
 
+    virtual MessageSorting messageSorting(const QString &mailbox) const;
+    virtual void setMessageSorting(const QString &mailbox, const MessageSorting &sorting);
+
     virtual void setRenewalThreshold(const int days);
 
 private:
@@ -81,6 +88,8 @@ private:
     QMap<QString, QMap<uint, MessageDataBundle> > msgMetadata;
     QMap<QString, QMap<uint, QMap<QString, QByteArray> > > parts;
     QMap<QString, QVector<Imap::Responses::ThreadingNode> > threads;
+    QMap<QString, MessageSorting> sortings;
+    QMap<QString, FullTextIndex> searchIndex;
 };
 
 }
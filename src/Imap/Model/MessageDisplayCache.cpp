@@ -0,0 +1,117 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "MessageDisplayCache.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+MessageDisplayCache::MessageDisplayCache()
+{
+}
+
+int MessageDisplayCache::find(const void *key) const
+{
+    QHash<const void *, int>::const_iterator it = m_slots.constFind(key);
+    return it == m_slots.constEnd() ? -1 : *it;
+}
+
+int MessageDisplayCache::insert(const void *key)
+{
+    int slot = find(key);
+    if (slot != -1)
+        return slot;
+
+    if (m_freeSlots.isEmpty()) {
+        slot = m_flagIcon.size();
+        for (int i = 0; i < COLUMN_COUNT; ++i)
+            m_text[i].append(QString());
+        m_flagIcon.append(ICON_NONE);
+        m_style.append(0);
+    } else {
+        slot = m_freeSlots.last();
+        m_freeSlots.pop_back();
+    }
+    m_slots.insert(key, slot);
+    return slot;
+}
+
+void MessageDisplayCache::invalidate(const void *key)
+{
+    QHash<const void *, int>::iterator it = m_slots.find(key);
+    if (it == m_slots.end())
+        return;
+
+    const int slot = *it;
+    for (int i = 0; i < COLUMN_COUNT; ++i)
+        m_text[i][slot].clear();
+    m_flagIcon[slot] = ICON_NONE;
+    m_style[slot] = 0;
+    m_freeSlots.append(slot);
+    m_slots.erase(it);
+}
+
+void MessageDisplayCache::clear()
+{
+    for (int i = 0; i < COLUMN_COUNT; ++i)
+        m_text[i].clear();
+    m_flagIcon.clear();
+    m_style.clear();
+    m_freeSlots.clear();
+    m_slots.clear();
+}
+
+int MessageDisplayCache::size() const
+{
+    return m_slots.size();
+}
+
+QString MessageDisplayCache::text(const int slot, const Column column) const
+{
+    return m_text[column][slot];
+}
+
+void MessageDisplayCache::setText(const int slot, const Column column, const QString &text)
+{
+    m_text[column][slot] = text;
+}
+
+MessageDisplayCache::FlagIcon MessageDisplayCache::flagIcon(const int slot) const
+{
+    return static_cast<FlagIcon>(m_flagIcon[slot]);
+}
+
+uint MessageDisplayCache::style(const int slot) const
+{
+    return m_style[slot];
+}
+
+void MessageDisplayCache::setFlags(const int slot, const FlagIcon icon, const uint style)
+{
+    m_flagIcon[slot] = icon;
+    m_style[slot] = style;
+}
+
+}
+}
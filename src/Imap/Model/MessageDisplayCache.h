@@ -0,0 +1,107 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_MESSAGEDISPLAYCACHE_H
+#define IMAP_MODEL_MESSAGEDISPLAYCACHE_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+/** @short Display-ready values of the messages in one mailbox, stored column by column
+
+The message list view asks for the same few cells again and again while it is being scrolled or repainted. Producing each of
+them means going through several proxy models and QVariant conversions, and formatting the addresses and dates from scratch.
+This class remembers the formatted values of the messages which have been displayed, keyed by the internal pointers of their
+indexes in the source model, which are cheap to obtain and remain stable as long as the layout doesn't change. The rows are only
+filled once someone asks for them, which means that only the visible part of a huge mailbox is ever stored.
+
+Each column lives in its own array so that a lookup touches just the data it needs. Slots of invalidated messages are reused.
+*/
+class MessageDisplayCache
+{
+public:
+    enum Column {
+        COLUMN_FROM,
+        COLUMN_TO,
+        COLUMN_SUBJECT,
+        COLUMN_DATE,
+        COLUMN_SIZE,
+        COLUMN_COUNT
+    };
+
+    /** @short Icons representing the message flags */
+    enum FlagIcon {
+        ICON_NONE,
+        ICON_DELETED,
+        ICON_REPLIED_FORWARDED,
+        ICON_REPLIED,
+        ICON_FORWARDED,
+        ICON_RECENT,
+        ICON_UNREAD,
+        ICON_READ,
+        ICON_COUNT
+    };
+
+    /** @short Bits describing how to render the message */
+    enum Style {
+        STYLE_READ = 1 << 0,
+        STYLE_DELETED = 1 << 1
+    };
+
+    MessageDisplayCache();
+
+    /** @short Return the slot holding data for the message with the given key, or -1 if there's none */
+    int find(const void *key) const;
+    /** @short Return a slot for storing the message's data, reusing the existing one if available */
+    int insert(const void *key);
+    /** @short Forget whatever has been stored about the message */
+    void invalidate(const void *key);
+    void clear();
+    /** @short Return the number of messages with some data in the cache */
+    int size() const;
+
+    QString text(const int slot, const Column column) const;
+    void setText(const int slot, const Column column, const QString &text);
+    /** @short Return the icon to show next to the subject */
+    FlagIcon flagIcon(const int slot) const;
+    uint style(const int slot) const;
+    void setFlags(const int slot, const FlagIcon icon, const uint style);
+
+private:
+    QVector<QString> m_text[COLUMN_COUNT];
+    QVector<quint8> m_flagIcon;
+    QVector<quint8> m_style;
+    /** @short Slots which are not used by any message */
+    QVector<int> m_freeSlots;
+    QHash<const void *, int> m_slots;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_MESSAGEDISPLAYCACHE_H
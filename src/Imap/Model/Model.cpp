@@ -80,18 +80,15 @@ bool MailboxNameComparator(const TreeItem *const a, const TreeItem *const b)
     return mailboxA->mailbox().compare(mailboxB->mailbox(), Qt::CaseInsensitive) < 1;
 }
 
-bool uidComparator(const TreeItem *const item, const uint uid)
+bool uidComparator(const MessageRow &message, const uint uid)
 {
-    const TreeItemMessage *const message = static_cast<const TreeItemMessage *const>(item);
-    uint messageUid = message->uid();
-    Q_ASSERT(messageUid);
-    return messageUid < uid;
+    Q_ASSERT(message.uid);
+    return message.uid < uid;
 }
 
-bool messageHasUidZero(const TreeItem *const item)
+bool messageHasUidZero(const MessageRow &message)
 {
-    const TreeItemMessage *const message = static_cast<const TreeItemMessage *const>(item);
-    return message->uid() == 0;
+    return message.uid == 0;
 }
 
 }
@@ -138,6 +135,8 @@ Model::Model(QObject *parent, AbstractCache *cache, SocketFactoryPtr socketFacto
     m_specialFlagNames[QLatin1String("\\recent")] = QLatin1String("\\Recent");
     m_specialFlagNames[QLatin1String("$forwarded")] = QLatin1String("$Forwarded");
 
+    m_partDataLru.setBudget(64 * 1024 * 1024);
+
     m_periodicMailboxNumbersRefresh = new QTimer(this);
     // polling every five minutes
     m_periodicMailboxNumbersRefresh->setInterval(5 * 60 * 1000);
@@ -532,15 +531,30 @@ void Model::finalizeFetchPart(TreeItemMailbox *const mailbox, const uint sequenc
         return;
     }
 
+    if (partId.startsWith(QLatin1String("BINARY.SIZE["))) {
+        // That's just an auxiliary item for the real download which is checked separately
+        return;
+    }
+
     TreeItemPart *part = mailbox->partIdToPtr(this, static_cast<TreeItemMessage *>(item), partId);
     if (! part) {
         qDebug() << "Can't verify part fetching status: part is not here!";
         return;
     }
+    if (part->m_partialFetch) {
+        // Each chunk of a progressive download is requested with its own <offset.length>. If the data have arrived or if the
+        // command was about an older chunk, the rest will be taken care of by the request for the next chunk.
+        const int originStart = partId.lastIndexOf(QLatin1Char('<'));
+        if (!part->m_partialFetch->chunkPending ||
+                (originStart != -1 && partId.mid(originStart + 1).section(QLatin1Char('.'), 0, 0).toUInt() != part->m_partialFetch->offset)) {
+            return;
+        }
+    }
     if (part->loading()) {
         // basically, there's nothing to do if the FETCH targetted a message part and not the message as a whole
         qDebug() << "Imap::Model::_finalizeFetch(): didn't receive anything about message" <<
                  part->message()->row() << "part" << part->partId();
+        part->finishPartialFetch();
         part->m_fetchStatus = TreeItem::DONE;
     }
 }
@@ -813,14 +827,12 @@ void Model::askForMessagesInMailbox(TreeItemMsgList *item)
         Q_ASSERT(item->m_fetchStatus == TreeItem::LOADING);
         QModelIndex listIndex = item->toIndex(this);
         beginInsertRows(listIndex, 0, uidMapping.size() - 1);
-        for (uint seq = 0; seq < static_cast<uint>(uidMapping.size()); ++seq) {
-            TreeItemMessage *message = new TreeItemMessage(item);
-            message->m_offset = seq;
-            message->m_uid = uidMapping[ seq ];
-            item->m_children << message;
-            QStringList flags = cache()->msgFlags(mailbox, message->m_uid);
-            flags.removeOne(QLatin1String("\\Recent"));
-            message->m_flags = normalizeFlags(flags);
+        item->appendMessages(uidMapping.size());
+        for (int seq = 0; seq < uidMapping.size(); ++seq) {
+            MessageRow &message = item->m_rows[seq];
+            message.uid = uidMapping[seq];
+            message.flags = item->m_flagDictionary.fromList(cache()->msgFlags(mailbox, message.uid));
+            message.flags.clear(FlagDictionary::FLAG_RECENT);
         }
         endInsertRows();
         item->m_fetchStatus = TreeItem::DONE; // required for FETCH processing later on
@@ -868,38 +880,18 @@ void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloa
     if (item->uid()) {
         AbstractCache::MessageDataBundle data = cache()->messageMetadata(mailboxPtr->mailbox(), item->uid());
         if (data.uid == item->uid()) {
-            item->m_envelope = data.envelope;
-            QStringList flags = cache()->msgFlags(mailboxPtr->mailbox(), item->uid());
-            flags.removeOne(QLatin1String("\\Recent"));
-            item->m_flags = normalizeFlags(flags);
-            item->m_size = data.size;
-            item->m_hdrReferences = data.hdrReferences;
-            item->m_hdrListPost = data.hdrListPost;
-            item->m_hdrListPostNo = data.hdrListPostNo;
-            QDataStream stream(&data.serializedBodyStructure, QIODevice::ReadOnly);
-            stream.setVersion(QDataStream::Qt_4_6);
-            QVariantList unserialized;
-            stream >> unserialized;
-            QSharedPointer<Message::AbstractMessage> abstractMessage;
-            try {
-                abstractMessage = Message::AbstractMessage::fromList(unserialized, QByteArray(), 0);
-            } catch (Imap::ParserException &e) {
-                qDebug() << "Error when parsing cached BODYSTRUCTURE" << e.what();
-            }
-            if (! abstractMessage) {
+            MessageFlags &flags = list->m_rows[item->row()].flags;
+            flags = list->m_flagDictionary.fromList(cache()->msgFlags(mailboxPtr->mailbox(), item->uid()));
+            flags.clear(FlagDictionary::FLAG_RECENT);
+            item->adoptMetadata(this, data);
+            if (item->metadata().bodyStructure.isEmpty()) {
                 item->m_fetchStatus = TreeItem::UNAVAILABLE;
             } else {
-                QList<TreeItem *> newChildren = abstractMessage->createTreeItems(item);
-                if (item->m_children.isEmpty()) {
-                    QList<TreeItem *> oldChildren = item->setChildren(newChildren);
-                    Q_ASSERT(oldChildren.size() == 0);
-                } else {
-                    // The following assert guards against that crazy signal emitting we had when various askFor*()
-                    // functions were not delayed. If it gets hit, it means that someone tried to call this function
-                    // on an item which was already loaded.
-                    Q_ASSERT(item->m_children.isEmpty());
-                    item->setChildren(newChildren);
-                }
+                // The following assert guards against that crazy signal emitting we had when various askFor*()
+                // functions were not delayed. If it gets hit, it means that someone tried to call this function
+                // on an item which was already loaded.
+                Q_ASSERT(item->m_children.isEmpty());
+                // The BODYSTRUCTURE is only parsed when the message parts are needed
                 item->m_fetchStatus = TreeItem::DONE;
             }
         }
@@ -932,9 +924,10 @@ void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloa
             preload = 50;
         int order = item->row();
         for (int i = qMax(0, order - preload); i < qMin(list->m_children.size(), order + preload); ++i) {
-            TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(list->m_children[i]);
-            Q_ASSERT(message);
-            if (item != message && !message->fetched() && !message->loading() && message->uid()) {
+            if (!list->messageUid(i))
+                continue;
+            TreeItemMessage *message = list->message(i);
+            if (item != message && !message->fetched() && !message->loading()) {
                 message->m_fetchStatus = TreeItem::LOADING;
                 // cannot ask the KeepTask directly, that'd completely ignore the cache
                 // but we absolutely have to block the preload :)
@@ -946,9 +939,8 @@ void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloa
     }
 }
 
-void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
+void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache, PartFetchingStrategy strategy)
 {
-    // FIXME: fetch parts in chunks, not at once
     Q_ASSERT(item->message());   // TreeItemMessage
     Q_ASSERT(item->message()->parent());   // TreeItemMsgList
     Q_ASSERT(item->message()->parent()->parent());   // TreeItemMailbox
@@ -965,6 +957,7 @@ void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
     if (! data.isNull()) {
         item->m_data = data;
         item->m_fetchStatus = TreeItem::DONE;
+        trackPartData(item);
         return;
     }
 
@@ -981,7 +974,207 @@ void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
                 fetchingMode = TreeItemPart::FETCH_PART_BINARY;
             }
         }
-        keepTask->requestPartDownload(item->message()->m_uid, item->partIdForFetch(fetchingMode), item->octets());
+        if (strategy == PART_FETCH_PROGRESSIVE && item->octets() > 4 * partialFetchChunkSize() &&
+                item->mimeType().startsWith(QLatin1String("text/")) && !item->hasChildren(0)) {
+            // Big text parts are shown as they arrive, there's no point in making the user wait for the whole log file
+            delete item->m_partialFetch;
+            item->m_partialFetch = new TreeItemPart::PartialFetchState(fetchingMode);
+            askForMsgPartChunk(item);
+        } else {
+            keepTask->requestPartDownload(item->message()->uid(), item->partIdForFetch(fetchingMode), item->octets());
+        }
+    }
+}
+
+/** @short Request the next chunk of a progressively downloaded message part
+
+The offset refers to the data as transferred by the server, i.e. before the transfer encoding is removed for the BODY[] and
+after it is removed for the BINARY[]. Either way, it's the same number as the one which the server puts into its response.
+*/
+void Model::askForMsgPartChunk(TreeItemPart *item)
+{
+    Q_ASSERT(item->m_partialFetch);
+    Q_ASSERT(!item->m_partialFetch->chunkPending);
+    TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(item->message()->parent()->parent());
+    Q_ASSERT(mailboxPtr);
+
+    if (networkPolicy() == NETWORK_OFFLINE) {
+        // Whatever has arrived so far is all we're going to get
+        item->finishPartialFetch();
+        item->m_fetchStatus = TreeItem::UNAVAILABLE;
+        return;
+    }
+
+    KeepMailboxOpenTask *keepTask = findTaskResponsibleFor(mailboxPtr);
+    const bool binary = item->m_partialFetch->mode == TreeItemPart::FETCH_PART_BINARY;
+    if (binary && !item->m_binarySize && item->m_partialFetch->offset == 0) {
+        // The size from BODYSTRUCTURE refers to the encoded form, so it's useless for reporting the progress
+        keepTask->requestPartDownload(item->message()->uid(), QString::fromUtf8("BINARY.SIZE[%1]").arg(item->partId()), 0);
+    }
+
+    // When the rest is requested, the size from BODYSTRUCTURE is an upper bound of what is still missing
+    const uint chunkSize = partialFetchChunkSize();
+    uint length = chunkSize;
+    if (item->m_partialFetch->restRequested) {
+        length = binary && item->m_binarySize > item->m_partialFetch->offset ?
+                    item->m_binarySize - item->m_partialFetch->offset : qMax(item->octets(), chunkSize);
+    }
+    item->m_partialFetch->requestedLength = length;
+    item->m_partialFetch->chunkPending = true;
+    keepTask->requestPartDownload(
+                item->message()->uid(),
+                item->partIdForFetch(item->m_partialFetch->mode) +
+                    QString::fromUtf8("<%1.%2>").arg(QString::number(item->m_partialFetch->offset), QString::number(length)),
+                length);
+}
+
+/** @short The server refused to decode a part through the BINARY, so let's ask for the raw data and decode them ourselves
+
+This is what happens when the server replies with the UNKNOWN-CTE response code from RFC 3516.
+*/
+void Model::refetchPartWithoutBinary(TreeItemMailbox *const mailbox, const uint sequenceNo, const QString &partId)
+{
+    TreeItem *item = mailbox->m_children[0]->child(sequenceNo - 1, this);
+    Q_ASSERT(item);
+    if (item->m_fetchStatus == TreeItem::NONE)
+        return;
+
+    TreeItemPart *part = mailbox->partIdToPtr(this, static_cast<TreeItemMessage *>(item), partId);
+    if (!part || !part->loading())
+        return;
+
+    if (part->m_partialFetch) {
+        if (part->m_partialFetch->mode != TreeItemPart::FETCH_PART_BINARY || !part->m_partialFetch->chunkPending)
+            return;
+        // The offsets of the BINARY[] do not match those of the BODY[], so we have to start from scratch
+        part->m_data.clear();
+        part->m_partialFetch->mode = TreeItemPart::FETCH_PART_IMAP;
+        part->m_partialFetch->offset = 0;
+        part->m_partialFetch->chunkPending = false;
+        askForMsgPartChunk(part);
+    } else {
+        findTaskResponsibleFor(mailbox)->requestPartDownload(part->message()->uid(),
+                                                             part->partIdForFetch(TreeItemPart::FETCH_PART_IMAP), part->octets());
+    }
+}
+
+/** @short Size of one chunk of a progressive download; parts bigger than four chunks are downloaded progressively */
+uint Model::partialFetchChunkSize() const
+{
+    bool ok;
+    uint size = property("trojita-imap-partial-fetch-chunk").toUInt(&ok);
+    if (!ok || !size)
+        size = 64 * 1024;
+    return size;
+}
+
+/** @short Remember that the part's data are in memory, and release those which haven't been used for the longest time
+
+Only the parts which are available from the cache shall be passed here, the released ones will be re-read from there the next
+time somebody asks for them.
+*/
+void Model::trackPartData(TreeItemPart *part)
+{
+    m_partDataLru.touch(part, part->m_data.size());
+    Q_FOREACH(TreeItemPart *released, m_partDataLru.takeOverBudget()) {
+        released->m_data.clear();
+        released->m_fetchStatus = TreeItem::NONE;
+        QModelIndex idx = released->toIndex(this);
+        emit dataChanged(idx, idx);
+    }
+}
+
+void Model::pinPartData(const QModelIndex &part)
+{
+    TreeItemPart *partPtr = dynamic_cast<TreeItemPart *>(realTreeItem(part));
+    Q_ASSERT(partPtr);
+    m_partDataLru.pin(partPtr);
+}
+
+void Model::unpinPartData(const QModelIndex &part)
+{
+    TreeItemPart *partPtr = dynamic_cast<TreeItemPart *>(realTreeItem(part));
+    Q_ASSERT(partPtr);
+    m_partDataLru.unpin(partPtr);
+}
+
+void Model::setPartDataBudget(const qint64 bytes)
+{
+    m_partDataLru.setBudget(bytes);
+}
+
+qint64 Model::partDataInMemory() const
+{
+    return m_partDataLru.usedBytes();
+}
+
+qint64 Model::releasedPartData() const
+{
+    return m_partDataLru.releasedBytes();
+}
+
+Common::Instrumentation::Snapshot Model::instrumentationSnapshot() const
+{
+    Common::Instrumentation::Snapshot res = Common::Instrumentation::snapshot();
+    if (m_mailboxes)
+        instrumentTreeItem(m_mailboxes, res);
+
+    QMap<QString, qint64> &pools = res[QLatin1String("object pools")];
+#define TROJITA_INSTRUMENT_POOL(Class, Name) \
+    pools[QLatin1String(Name " live objects")] = Common::ObjectPool<Class>::statistics().liveObjects(); \
+    pools[QLatin1String(Name " live chunks")] = Common::ObjectPool<Class>::statistics().liveChunks();
+    TROJITA_INSTRUMENT_POOL(TreeItemMessage, "TreeItemMessage")
+    TROJITA_INSTRUMENT_POOL(TreeItemPart, "TreeItemPart")
+    TROJITA_INSTRUMENT_POOL(TreeItemModifiedPart, "TreeItemModifiedPart")
+    TROJITA_INSTRUMENT_POOL(MessageMetadata, "MessageMetadata")
+    TROJITA_INSTRUMENT_POOL(Responses::Fetch, "Responses::Fetch")
+#undef TROJITA_INSTRUMENT_POOL
+
+    QMap<QString, qint64> &memory = res[QLatin1String("memory")];
+    memory[QLatin1String("part data releasable")] = m_partDataLru.usedBytes();
+    memory[QLatin1String("part data released")] = m_partDataLru.releasedBytes();
+    return res;
+}
+
+/** @short Count the @arg item and everything below it, including the special parts which are not among the children */
+void Model::instrumentTreeItem(const TreeItem *item, Common::Instrumentation::Snapshot &snapshot)
+{
+    QString kind;
+    if (const TreeItemPart *part = dynamic_cast<const TreeItemPart *>(item)) {
+        if (dynamic_cast<const TreeItemModifiedPart *>(part))
+            kind = QLatin1String("TreeItemModifiedPart");
+        else if (dynamic_cast<const TreeItemPartMultipartMessage *>(part))
+            kind = QLatin1String("TreeItemPartMultipartMessage");
+        else
+            kind = QLatin1String("TreeItemPart");
+        snapshot[QLatin1String("memory")][QLatin1String("part data in tree")] += part->m_data.size();
+        if (part->m_partHeader)
+            instrumentTreeItem(part->m_partHeader, snapshot);
+        if (part->m_partText)
+            instrumentTreeItem(part->m_partText, snapshot);
+        if (part->m_partMime)
+            instrumentTreeItem(part->m_partMime, snapshot);
+    } else if (const TreeItemMessage *message = dynamic_cast<const TreeItemMessage *>(item)) {
+        kind = QLatin1String("TreeItemMessage");
+        if (message->m_metadata)
+            ++snapshot[QLatin1String("tree items")][QLatin1String("MessageMetadata")];
+        if (message->m_partHeader)
+            instrumentTreeItem(message->m_partHeader, snapshot);
+        if (message->m_partText)
+            instrumentTreeItem(message->m_partText, snapshot);
+    } else if (dynamic_cast<const TreeItemMsgList *>(item)) {
+        kind = QLatin1String("TreeItemMsgList");
+    } else if (dynamic_cast<const TreeItemMailbox *>(item)) {
+        kind = QLatin1String("TreeItemMailbox");
+    } else {
+        kind = QLatin1String("TreeItem");
+    }
+    ++snapshot[QLatin1String("tree items")][kind];
+
+    Q_FOREACH(const TreeItem *child, item->m_children) {
+        // The rows of a message list which nobody has asked for have no TreeItemMessage
+        if (child)
+            instrumentTreeItem(child, snapshot);
     }
 }
 
@@ -1194,10 +1387,8 @@ void Model::copyMoveMessages(TreeItemMailbox *sourceMbox, const QString &destMai
     qSort(uids);
 
     QModelIndexList messages;
-    Sequence seq;
     Q_FOREACH(TreeItemMessage* m, findMessagesByUids(sourceMbox, uids)) {
         messages << m->toIndex(this);
-        seq.add(m->uid());
     }
     m_taskFactory->createCopyMoveMessagesTask(this, messages, destMailboxName, op);
 }
@@ -1205,10 +1396,10 @@ void Model::copyMoveMessages(TreeItemMailbox *sourceMbox, const QString &destMai
 /** @short Convert a list of UIDs to a list of pointers to the relevant message nodes */
 QList<TreeItemMessage *> Model::findMessagesByUids(const TreeItemMailbox *const mailbox, const QList<uint> &uids)
 {
-    const TreeItemMsgList *const list = dynamic_cast<const TreeItemMsgList *const>(mailbox->m_children[0]);
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailbox->m_children[0]);
     Q_ASSERT(list);
     QList<TreeItemMessage *> res;
-    QList<TreeItem *>::const_iterator it = list->m_children.constBegin();
+    QVector<MessageRow>::const_iterator it = list->m_rows.constBegin();
     uint lastUid = 0;
     Q_FOREACH(const uint& uid, uids) {
         if (lastUid == uid) {
@@ -1216,9 +1407,9 @@ QList<TreeItemMessage *> Model::findMessagesByUids(const TreeItemMailbox *const
             continue;
         }
         lastUid = uid;
-        it = Common::lowerBoundWithUnknownElements(it, list->m_children.constEnd(), uid, messageHasUidZero, uidComparator);
-        if (it != list->m_children.end() && static_cast<TreeItemMessage *>(*it)->uid() == uid) {
-            res << static_cast<TreeItemMessage *>(*it);
+        it = Common::lowerBoundWithUnknownElements(it, list->m_rows.constEnd(), uid, messageHasUidZero, uidComparator);
+        if (it != list->m_rows.constEnd() && it->uid == uid) {
+            res << list->message(it - list->m_rows.constBegin());
         } else {
             qDebug() << "Can't find UID" << uid;
         }
@@ -1228,12 +1419,13 @@ QList<TreeItemMessage *> Model::findMessagesByUids(const TreeItemMailbox *const
 
 /** @short Find a message with UID that matches the passed key, handling those with UID zero correctly
 
-If there's no such message, the next message with a valid UID is returned instead. If there are no such messages, the iterator can
-point to a message with UID zero or to the end of the list.
+If there's no such message, the row of the next message with a valid UID is returned instead. If there are no such messages, the
+row can belong to a message with UID zero or be equal to the number of messages in the list.
 */
-QList<TreeItem*>::iterator Model::findMessageOrNextOneByUid(TreeItemMsgList *list, const uint uid)
+int Model::findMessageOrNextOneByUid(const TreeItemMsgList *list, const uint uid)
 {
-    return Common::lowerBoundWithUnknownElements(list->m_children.begin(), list->m_children.end(), uid, messageHasUidZero, uidComparator);
+    return Common::lowerBoundWithUnknownElements(list->m_rows.constBegin(), list->m_rows.constEnd(), uid, messageHasUidZero,
+                                                 uidComparator) - list->m_rows.constBegin();
 }
 
 TreeItemMailbox *Model::findMailboxByName(const QString &name) const
@@ -1351,8 +1543,8 @@ void Model::unsubscribeMailbox(const QString &name)
 void Model::saveUidMap(TreeItemMsgList *list)
 {
     QList<uint> seqToUid;
-    for (int i = 0; i < list->m_children.size(); ++i)
-        seqToUid << static_cast<TreeItemMessage *>(list->m_children[ i ])->uid();
+    for (int i = 0; i < list->m_rows.size(); ++i)
+        seqToUid << list->messageUid(i);
     cache()->setUidMapping(static_cast<TreeItemMailbox *>(list->parent())->mailbox(), seqToUid);
 }
 
@@ -1648,14 +1840,16 @@ void Model::releaseMessageData(const QModelIndex &message)
         return;
 
     msg->m_fetchStatus = TreeItem::NONE;
-    msg->m_envelope.clear();
-    msg->m_hdrListPost.clear();
-    msg->m_hdrListPostNo = false;
-    msg->m_hdrReferences.clear();
-    msg->m_internalDate = QDateTime();
+    if (msg->m_metadata)
+        msg->m_metadata->envelope.clear(msg->addressPool());
+    delete msg->m_metadata;
+    msg->m_metadata = 0;
 
+    // The parts are only created on demand, so there might be none
+    const bool hasParts = !msg->m_children.isEmpty();
 #ifndef XTUPLE_CONNECT
-    beginRemoveRows(realMessage, 0, msg->m_children.size() - 1);
+    if (hasParts)
+        beginRemoveRows(realMessage, 0, msg->m_children.size() - 1);
 #endif
     if (msg->m_partHeader) {
         msg->m_partHeader->silentlyReleaseMemoryRecursive();
@@ -1675,7 +1869,8 @@ void Model::releaseMessageData(const QModelIndex &message)
     }
     msg->m_children.clear();
 #ifndef XTUPLE_CONNECT
-    endRemoveRows();
+    if (hasParts)
+        endRemoveRows();
     emit dataChanged(realMessage, realMessage);
 #endif
 }
@@ -33,9 +33,11 @@
 #include "../Parser/Parser.h"
 #include "CopyMoveOperation.h"
 #include "FlagsOperation.h"
+#include "PartDataLru.h"
 #include "ParserState.h"
 #include "TaskFactory.h"
 
+#include "Common/Instrumentation.h"
 #include "Common/Logging.h"
 
 class QAuthenticator;
@@ -301,6 +303,30 @@ public:
     bool isGenUrlAuthSupported() const;
     bool isImapSubmissionSupported() const;
 
+    /** @short Limit the amount of message data which is kept in memory after being shown
+
+    The data of message parts which are available from the cache are released once they haven't been used for a while and
+    their total size exceeds the @arg bytes. Passing zero disables the limit.
+    */
+    void setPartDataBudget(const qint64 bytes);
+    /** @short Return the number of bytes of the message parts which are held in memory and can be released */
+    qint64 partDataInMemory() const;
+    /** @short Return the number of bytes of the message parts which have been released since the start */
+    qint64 releasedPartData() const;
+    /** @short Keep the data of the @arg part in memory while somebody reads them directly
+
+    Each call has to be balanced by a call to unpinPartData().
+    */
+    void pinPartData(const QModelIndex &part);
+    void unpinPartData(const QModelIndex &part);
+
+    /** @short Return the instrumentation counters along with the current statistics about the memory used by this model
+
+    The number of items of each type and the size of the message data are obtained by walking through the whole tree, so
+    this is not meant to be called often.
+    */
+    Common::Instrumentation::Snapshot instrumentationSnapshot() const;
+
 public slots:
     /** @short Ask for an updated list of mailboxes on the server */
     void reloadMailboxList();
@@ -497,11 +523,19 @@ private:
     typedef enum {PRELOAD_PER_POLICY, PRELOAD_DISABLED} PreloadingMode;
 
     void askForMsgMetadata(TreeItemMessage *item, PreloadingMode preloadMode);
-    void askForMsgPart(TreeItemPart *item, bool onlyFromCache=false);
+
+    /** @short Shall big parts be downloaded at once, or in chunks which can be displayed as they arrive? */
+    typedef enum {PART_FETCH_WHOLE, PART_FETCH_PROGRESSIVE} PartFetchingStrategy;
+
+    void askForMsgPart(TreeItemPart *item, bool onlyFromCache=false, PartFetchingStrategy strategy=PART_FETCH_WHOLE);
+    void askForMsgPartChunk(TreeItemPart *item);
+    uint partialFetchChunkSize() const;
+    void trackPartData(TreeItemPart *part);
 
     void finalizeList(Parser *parser, TreeItemMailbox *const mailboxPtr);
     void finalizeIncrementalList(Parser *parser, const QString &parentMailboxName);
     void finalizeFetchPart(TreeItemMailbox *const mailbox, const uint sequenceNo, const QString &partId);
+    void refetchPartWithoutBinary(TreeItemMailbox *const mailbox, const uint sequenceNo, const QString &partId);
     void genericHandleFetch(TreeItemMailbox *mailbox, const Imap::Responses::Fetch *const resp);
 
     void replaceChildMailboxes(TreeItemMailbox *mailboxPtr, const QList<TreeItem *> mailboxes);
@@ -515,10 +549,12 @@ private:
     TreeItemMailbox *findMailboxByName(const QString &name, const TreeItemMailbox *const root) const;
     TreeItemMailbox *findParentMailboxByName(const QString &name) const;
     QList<TreeItemMessage *> findMessagesByUids(const TreeItemMailbox *const mailbox, const QList<uint> &uids);
-    QList<TreeItem*>::iterator findMessageOrNextOneByUid(TreeItemMsgList *list, const uint uid);
+    static int findMessageOrNextOneByUid(const TreeItemMsgList *list, const uint uid);
 
     static TreeItemMailbox *mailboxForSomeItem(QModelIndex index);
 
+    static void instrumentTreeItem(const TreeItem *item, Common::Instrumentation::Snapshot &snapshot);
+
     void saveUidMap(TreeItemMsgList *list);
 
     /** @short Return a corresponding KeepMailboxOpenTask for a given mailbox */
@@ -571,6 +607,8 @@ private:
 
     QHash<QString,QString> m_specialFlagNames;
     mutable QSet<QString> m_flagLiterals;
+    /** @short Parts whose data could be released when the memory gets tight */
+    PartDataLru m_partDataLru;
 
     /** @short Username for login */
     QString m_imapUser;
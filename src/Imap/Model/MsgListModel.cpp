@@ -95,6 +95,7 @@ QHash<int, QByteArray> MsgListModel::roleNames() const
         roleNames[RoleMessageInReplyTo] = "inReplyTo";
         roleNames[RoleMessageMessageId] = "messageId";
         roleNames[RoleMessageSubject] = "subject";
+        roleNames[RoleMessageBaseSubject] = "baseSubject";
         roleNames[RoleMessageFlags] = "flags";
         roleNames[RoleMessageSize] = "size";
         roleNames[RoleMessageFuzzyDate] = "fuzzyDate";
@@ -147,7 +148,7 @@ QModelIndex MsgListModel::index(int row, int column, const QModelIndex &parent)
     if (row >= msgListPtr->m_children.size() || row < 0)
         return QModelIndex();
 
-    return createIndex(row, column, msgListPtr->m_children[row]);
+    return createIndex(row, column, msgListPtr->message(row));
 }
 
 QModelIndex MsgListModel::parent(const QModelIndex &index) const
@@ -193,7 +194,7 @@ QModelIndex MsgListModel::mapToSource(const QModelIndex &proxyIndex) const
 
     Model *model = dynamic_cast<Model *>(sourceModel());
     Q_ASSERT(model);
-    return model->createIndex(proxyIndex.row(), 0, msgListPtr->m_children[proxyIndex.row()]);
+    return model->createIndex(proxyIndex.row(), 0, msgListPtr->message(proxyIndex.row()));
 }
 
 QModelIndex MsgListModel::mapFromSource(const QModelIndex &sourceIndex) const
@@ -238,7 +239,7 @@ QVariant MsgListModel::data(const QModelIndex &proxyIndex, int role) const
         case BCC:
             return QLatin1String("[bcc]");
         case DATE:
-            return message->envelope(static_cast<Model *>(sourceModel())).date;
+            return message->date(static_cast<Model *>(sourceModel()));
         case RECEIVED_DATE:
             return message->internalDate(static_cast<Model *>(sourceModel()));
         case SIZE:
@@ -264,6 +265,7 @@ QVariant MsgListModel::data(const QModelIndex &proxyIndex, int role) const
     case RoleMessageInReplyTo:
     case RoleMessageMessageId:
     case RoleMessageSubject:
+    case RoleMessageBaseSubject:
     case RoleMessageFlags:
     case RoleMessageSize:
     case RoleMessageHeaderReferences:
@@ -390,8 +392,11 @@ void MsgListModel::handleRowsAboutToBeRemoved(const QModelIndex &parent, int sta
     if (newList) {
         if (newList == msgListPtr) {
             beginRemoveRows(mapFromSource(parent), start, end);
-            for (int i = start; i <= end; ++i)
-                emit messageRemoved(msgListPtr->m_children[i]);
+            for (int i = start; i <= end; ++i) {
+                // Nobody could have got hold of a message which has never been created
+                if (TreeItemMessage *message = msgListPtr->existingMessage(i))
+                    emit messageRemoved(message);
+            }
         }
     } else if (mailbox) {
         Q_ASSERT(start > 0);
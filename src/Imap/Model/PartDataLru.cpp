@@ -0,0 +1,150 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "PartDataLru.h"
+#include "MailboxTree.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+PartDataLru::PartDataLru(): m_clock(0), m_budget(0), m_usedBytes(0), m_releasedBytes(0)
+{
+}
+
+PartDataLru::~PartDataLru()
+{
+    for (QHash<TreeItemPart *, Entry>::const_iterator it = m_parts.constBegin(); it != m_parts.constEnd(); ++it) {
+        it.key()->m_dataLru = 0;
+    }
+    for (QHash<TreeItemPart *, int>::const_iterator it = m_pins.constBegin(); it != m_pins.constEnd(); ++it) {
+        it.key()->m_dataLru = 0;
+    }
+}
+
+void PartDataLru::setBudget(const qint64 bytes)
+{
+    m_budget = bytes;
+}
+
+qint64 PartDataLru::budget() const
+{
+    return m_budget;
+}
+
+qint64 PartDataLru::usedBytes() const
+{
+    return m_usedBytes;
+}
+
+qint64 PartDataLru::releasedBytes() const
+{
+    return m_releasedBytes;
+}
+
+void PartDataLru::touch(TreeItemPart *part, const int size)
+{
+    if (!size) {
+        forget(part);
+        return;
+    }
+
+    QHash<TreeItemPart *, Entry>::iterator it = m_parts.find(part);
+    if (it == m_parts.end()) {
+        it = m_parts.insert(part, Entry());
+        part->m_dataLru = this;
+    } else {
+        m_order.remove(it->lastUse);
+        m_usedBytes -= it->size;
+    }
+    it->lastUse = ++m_clock;
+    it->size = size;
+    m_order.insert(it->lastUse, part);
+    m_usedBytes += size;
+}
+
+void PartDataLru::forget(TreeItemPart *part)
+{
+    QHash<TreeItemPart *, Entry>::iterator it = m_parts.find(part);
+    if (it == m_parts.end())
+        return;
+    m_order.remove(it->lastUse);
+    m_usedBytes -= it->size;
+    m_parts.erase(it);
+    if (!m_pins.contains(part))
+        part->m_dataLru = 0;
+}
+
+void PartDataLru::remove(TreeItemPart *part)
+{
+    m_pins.remove(part);
+    forget(part);
+    part->m_dataLru = 0;
+}
+
+void PartDataLru::pin(TreeItemPart *part)
+{
+    ++m_pins[part];
+    part->m_dataLru = this;
+}
+
+void PartDataLru::unpin(TreeItemPart *part)
+{
+    QHash<TreeItemPart *, int>::iterator it = m_pins.find(part);
+    if (it == m_pins.end())
+        return;
+    if (--*it)
+        return;
+    m_pins.erase(it);
+    if (!m_parts.contains(part))
+        part->m_dataLru = 0;
+}
+
+QList<TreeItemPart *> PartDataLru::takeOverBudget()
+{
+    QList<TreeItemPart *> res;
+    if (m_budget <= 0 || m_order.isEmpty())
+        return res;
+    const quint64 newest = m_order.lastKey();
+    QMap<quint64, TreeItemPart *>::iterator it = m_order.begin();
+    while (m_usedBytes > m_budget && it.key() != newest) {
+        TreeItemPart *part = it.value();
+        if (m_pins.contains(part)) {
+            ++it;
+            continue;
+        }
+        QHash<TreeItemPart *, Entry>::iterator entry = m_parts.find(part);
+        Q_ASSERT(entry != m_parts.end());
+        m_releasedBytes += entry->size;
+        m_usedBytes -= entry->size;
+        m_parts.erase(entry);
+        it = m_order.erase(it);
+        part->m_dataLru = 0;
+        res << part;
+    }
+    return res;
+}
+
+}
+}
@@ -0,0 +1,98 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAP_MODEL_PARTDATALRU_H
+#define IMAP_MODEL_PARTDATALRU_H
+
+#include <QHash>
+#include <QList>
+#include <QMap>
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+class TreeItemPart;
+
+/** @short Keep track of how much message data is held in memory, and which parts have not been used for the longest time
+
+The data of each part which has ever been shown stays in its TreeItemPart, even though a copy is available from the cache. The
+tracker remembers the size of each such part along with the time it was last used. Once the total exceeds the budget, the
+least recently used parts are handed over for being released. The parts whose data are being read by somebody else can be
+pinned, and they are never released then.
+*/
+class PartDataLru
+{
+public:
+    PartDataLru();
+    ~PartDataLru();
+
+    /** @short Set the maximal number of bytes to keep; zero means no limit */
+    void setBudget(const qint64 bytes);
+    qint64 budget() const;
+    /** @short Return the number of bytes held by the tracked parts */
+    qint64 usedBytes() const;
+    /** @short Return the number of bytes which have been released so far */
+    qint64 releasedBytes() const;
+
+    /** @short Mark the @arg part which holds @arg size bytes as the most recently used one */
+    void touch(TreeItemPart *part, const int size);
+    /** @short Stop tracking the @arg part, typically because its data have been dropped */
+    void forget(TreeItemPart *part);
+    /** @short The @arg part is going away, so forget about it along with its pins */
+    void remove(TreeItemPart *part);
+    /** @short Never release the data of the @arg part until unpin() gets called as many times as this one */
+    void pin(TreeItemPart *part);
+    void unpin(TreeItemPart *part);
+    /** @short Stop tracking the least recently used parts until the rest fits into the budget, and return them
+
+    Neither the most recently used part nor the pinned ones are ever returned, no matter how big they are.
+    */
+    QList<TreeItemPart *> takeOverBudget();
+
+private:
+    PartDataLru(const PartDataLru &); // don't implement
+    PartDataLru &operator=(const PartDataLru &); // don't implement
+
+    struct Entry {
+        quint64 lastUse;
+        int size;
+        Entry(): lastUse(0), size(0) {}
+    };
+
+    QHash<TreeItemPart *, Entry> m_parts;
+    /** @short The tracked parts ordered by the time they were last used */
+    QMap<quint64, TreeItemPart *> m_order;
+    /** @short Number of pins held on each pinned part */
+    QHash<TreeItemPart *, int> m_pins;
+    quint64 m_clock;
+    qint64 m_budget;
+    qint64 m_usedBytes;
+    qint64 m_releasedBytes;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_PARTDATALRU_H
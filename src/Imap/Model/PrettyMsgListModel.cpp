@@ -21,6 +21,7 @@
 */
 #include "PrettyMsgListModel.h"
 #include <QFont>
+#include <QTimer>
 #include "Gui/IconLoader.h"
 #include "ItemRoles.h"
 #include "MsgListModel.h"
@@ -37,6 +38,13 @@ namespace Mailbox
 PrettyMsgListModel::PrettyMsgListModel(QObject *parent): QSortFilterProxyModel(parent), m_hideRead(false)
 {
     setDynamicSortFilter(true);
+
+    m_displayCacheTime = QDateTime::currentDateTime();
+    // The short date formats are relative to the current time, so they cannot be kept forever
+    m_displayCacheFlushTimer = new QTimer(this);
+    m_displayCacheFlushTimer->setInterval(60 * 1000);
+    connect(m_displayCacheFlushTimer, SIGNAL(timeout()), this, SLOT(resetDisplayCache()));
+    m_displayCacheFlushTimer->start();
 }
 
 QVariant PrettyMsgListModel::data(const QModelIndex &index, int role) const
@@ -51,6 +59,8 @@ QVariant PrettyMsgListModel::data(const QModelIndex &index, int role) const
         return QVariant();
 
     QModelIndex translated = mapToSource(index);
+    const int slot = (role == Qt::DisplayRole || role == Qt::DecorationRole || role == Qt::FontRole) ?
+                displayCacheSlot(translated) : -1;
 
     switch (role) {
 
@@ -62,6 +72,11 @@ QVariant PrettyMsgListModel::data(const QModelIndex &index, int role) const
         case MsgListModel::CC:
         case MsgListModel::BCC:
         {
+            if (slot != -1 && index.column() == MsgListModel::FROM)
+                return m_displayCache.text(slot, MessageDisplayCache::COLUMN_FROM);
+            if (slot != -1 && index.column() == MsgListModel::TO)
+                return m_displayCache.text(slot, MessageDisplayCache::COLUMN_TO);
+
             int backendRole = 0;
             switch (index.column()) {
             case MsgListModel::FROM:
@@ -85,15 +100,21 @@ QVariant PrettyMsgListModel::data(const QModelIndex &index, int role) const
         case MsgListModel::DATE:
         case MsgListModel::RECEIVED_DATE:
         {
+            if (slot != -1)
+                return m_displayCache.text(slot, MessageDisplayCache::COLUMN_DATE);
             QDateTime res = translated.data(RoleMessageDate).toDateTime();
             if (role == Qt::ToolTipRole) {
                 // tooltips shall always show the full and complete data
                 return res.toLocalTime().toString(Qt::DefaultLocaleLongDate);
             }
-            return prettyFormatDate(res.toLocalTime());
+            return prettyFormatDate(res.toLocalTime(), QDateTime::currentDateTime());
         }
         case MsgListModel::SIZE:
         {
+            if (slot != -1) {
+                QString size = m_displayCache.text(slot, MessageDisplayCache::COLUMN_SIZE);
+                return size.isNull() ? QVariant() : QVariant(size);
+            }
             QVariant size = translated.data(RoleMessageSize);
             if (!size.isValid()) {
                 return QVariant();
@@ -101,6 +122,8 @@ QVariant PrettyMsgListModel::data(const QModelIndex &index, int role) const
             return PrettySize::prettySize(size.toUInt());
         }
         case MsgListModel::SUBJECT:
+            if (slot != -1)
+                return m_displayCache.text(slot, MessageDisplayCache::COLUMN_SUBJECT);
             return translated.data(RoleIsFetched).toBool() ? translated.data(RoleMessageSubject) : tr("Loading...");
         }
         break;
@@ -115,6 +138,18 @@ QVariant PrettyMsgListModel::data(const QModelIndex &index, int role) const
         }
 
     case Qt::DecorationRole:
+        if (slot != -1) {
+            switch (index.column()) {
+            case MsgListModel::SUBJECT:
+                return flagIcon(m_displayCache.flagIcon(slot));
+            case MsgListModel::SEEN:
+                return flagIcon(m_displayCache.style(slot) & MessageDisplayCache::STYLE_READ ?
+                                    MessageDisplayCache::ICON_READ : MessageDisplayCache::ICON_UNREAD);
+            default:
+                return QVariant();
+            }
+        }
+
         // We will need the data, but asking for Flags or IsMarkedXYZ doesn't cause a fetch
         translated.data(RoleMessageSubject);
 
@@ -128,42 +163,51 @@ QVariant PrettyMsgListModel::data(const QModelIndex &index, int role) const
             bool isReplied = translated.data(RoleMessageIsMarkedReplied).toBool();
 
             if (translated.data(RoleMessageIsMarkedDeleted).toBool())
-                return Gui::loadIcon(QLatin1String("mail-deleted"));
+                return flagIcon(MessageDisplayCache::ICON_DELETED);
             else if (isForwarded && isReplied)
-                return Gui::loadIcon(QLatin1String("mail-replied-forw"));
+                return flagIcon(MessageDisplayCache::ICON_REPLIED_FORWARDED);
             else if (isReplied)
-                return Gui::loadIcon(QLatin1String("mail-replied"));
+                return flagIcon(MessageDisplayCache::ICON_REPLIED);
             else if (isForwarded)
-                return Gui::loadIcon(QLatin1String("mail-forwarded"));
+                return flagIcon(MessageDisplayCache::ICON_FORWARDED);
             else if (translated.data(RoleMessageIsMarkedRecent).toBool())
-                return Gui::loadIcon(QLatin1String("mail-recent"));
+                return flagIcon(MessageDisplayCache::ICON_RECENT);
             else
-                return QIcon(QLatin1String(":/icons/transparent.png"));
+                return flagIcon(MessageDisplayCache::ICON_NONE);
         }
         case MsgListModel::SEEN:
             if (! translated.data(RoleIsFetched).toBool())
                 return QVariant();
             if (! translated.data(RoleMessageIsMarkedRead).toBool())
-                return QIcon(QLatin1String(":/icons/mail-unread.png"));
+                return flagIcon(MessageDisplayCache::ICON_UNREAD);
             else
-                return QIcon(QLatin1String(":/icons/mail-read.png"));
+                return flagIcon(MessageDisplayCache::ICON_READ);
         default:
             return QVariant();
         }
 
     case Qt::FontRole: {
-        // We will need the data, but asking for Flags or IsMarkedXYZ doesn't cause a fetch
-        translated.data(RoleMessageSubject);
+        bool isDeleted, isRead;
+        if (slot != -1) {
+            isDeleted = m_displayCache.style(slot) & MessageDisplayCache::STYLE_DELETED;
+            isRead = m_displayCache.style(slot) & MessageDisplayCache::STYLE_READ;
+        } else {
+            // We will need the data, but asking for Flags or IsMarkedXYZ doesn't cause a fetch
+            translated.data(RoleMessageSubject);
+
+            // These items should definitely *not* be rendered in bold
+            if (!translated.data(RoleIsFetched).toBool())
+                return QVariant();
 
-        // These items should definitely *not* be rendered in bold
-        if (!translated.data(RoleIsFetched).toBool())
-            return QVariant();
+            isDeleted = translated.data(RoleMessageIsMarkedDeleted).toBool();
+            isRead = translated.data(RoleMessageIsMarkedRead).toBool();
+        }
 
         QFont font;
-        if (translated.data(RoleMessageIsMarkedDeleted).toBool())
+        if (isDeleted)
             font.setStrikeOut(true);
 
-        if (! translated.data(RoleMessageIsMarkedRead).toBool()) {
+        if (!isRead) {
             // If any message is marked as unread, show it in bold and be done with it
             font.setBold(true);
         } else if (translated.model()->hasChildren(translated.sibling(translated.row(), 0)) &&
@@ -181,10 +225,10 @@ QVariant PrettyMsgListModel::data(const QModelIndex &index, int role) const
 }
 
 /** @short Format a QDateTime for compact display in one column of the view */
-QString PrettyMsgListModel::prettyFormatDate(const QDateTime &dateTime) const
+QString PrettyMsgListModel::prettyFormatDate(const QDateTime &dateTime, const QDateTime &currentTime) const
 {
     // The time is not always synced properly, so better accept even slightly too new messages as "from today"
-    QDateTime now = QDateTime::currentDateTime().addSecs(15*60);
+    QDateTime now = currentTime.addSecs(15*60);
     if (dateTime >= now) {
         // Messages from future shall always be shown using full format to prevent nasty surprises.
         return dateTime.toString(Qt::DefaultLocaleShortDate);
@@ -209,6 +253,121 @@ QString PrettyMsgListModel::prettyFormatDate(const QDateTime &dateTime) const
     }
 }
 
+/** @short Return the display cache slot of the message at the @arg translated index, filling it if needed
+
+Returns -1 for messages which cannot be cached yet, typically because they haven't been fetched.
+*/
+int PrettyMsgListModel::displayCacheSlot(const QModelIndex &translated) const
+{
+    int slot = m_displayCache.find(translated.internalPointer());
+    if (slot != -1)
+        return slot;
+
+    // Asking for the subject is what makes the message fetched
+    QString subject = translated.data(RoleMessageSubject).toString();
+    if (!translated.data(RoleIsFetched).toBool())
+        return -1;
+
+    slot = m_displayCache.insert(translated.internalPointer());
+    m_displayCache.setText(slot, MessageDisplayCache::COLUMN_SUBJECT, subject);
+    m_displayCache.setText(slot, MessageDisplayCache::COLUMN_FROM,
+                           Imap::Message::MailAddress::prettyList(translated.data(RoleMessageFrom).toList(),
+                                                                  Imap::Message::MailAddress::FORMAT_JUST_NAME));
+    m_displayCache.setText(slot, MessageDisplayCache::COLUMN_TO,
+                           Imap::Message::MailAddress::prettyList(translated.data(RoleMessageTo).toList(),
+                                                                  Imap::Message::MailAddress::FORMAT_JUST_NAME));
+    m_displayCache.setText(slot, MessageDisplayCache::COLUMN_DATE,
+                           prettyFormatDate(translated.data(RoleMessageDate).toDateTime().toLocalTime(), m_displayCacheTime));
+    QVariant size = translated.data(RoleMessageSize);
+    if (size.isValid())
+        m_displayCache.setText(slot, MessageDisplayCache::COLUMN_SIZE, PrettySize::prettySize(size.toUInt()));
+
+    bool isDeleted = translated.data(RoleMessageIsMarkedDeleted).toBool();
+    bool isForwarded = translated.data(RoleMessageIsMarkedForwarded).toBool();
+    bool isReplied = translated.data(RoleMessageIsMarkedReplied).toBool();
+    MessageDisplayCache::FlagIcon icon = MessageDisplayCache::ICON_NONE;
+    if (isDeleted)
+        icon = MessageDisplayCache::ICON_DELETED;
+    else if (isForwarded && isReplied)
+        icon = MessageDisplayCache::ICON_REPLIED_FORWARDED;
+    else if (isReplied)
+        icon = MessageDisplayCache::ICON_REPLIED;
+    else if (isForwarded)
+        icon = MessageDisplayCache::ICON_FORWARDED;
+    else if (translated.data(RoleMessageIsMarkedRecent).toBool())
+        icon = MessageDisplayCache::ICON_RECENT;
+    uint style = 0;
+    if (translated.data(RoleMessageIsMarkedRead).toBool())
+        style |= MessageDisplayCache::STYLE_READ;
+    if (isDeleted)
+        style |= MessageDisplayCache::STYLE_DELETED;
+    m_displayCache.setFlags(slot, icon, style);
+    return slot;
+}
+
+/** @short Return an icon for the message list; the icons are loaded just once */
+QIcon PrettyMsgListModel::flagIcon(const MessageDisplayCache::FlagIcon icon) const
+{
+    if (m_flagIcons.isEmpty()) {
+        m_flagIcons.resize(MessageDisplayCache::ICON_COUNT);
+        m_flagIcons[MessageDisplayCache::ICON_NONE] = QIcon(QLatin1String(":/icons/transparent.png"));
+        m_flagIcons[MessageDisplayCache::ICON_DELETED] = Gui::loadIcon(QLatin1String("mail-deleted"));
+        m_flagIcons[MessageDisplayCache::ICON_REPLIED_FORWARDED] = Gui::loadIcon(QLatin1String("mail-replied-forw"));
+        m_flagIcons[MessageDisplayCache::ICON_REPLIED] = Gui::loadIcon(QLatin1String("mail-replied"));
+        m_flagIcons[MessageDisplayCache::ICON_FORWARDED] = Gui::loadIcon(QLatin1String("mail-forwarded"));
+        m_flagIcons[MessageDisplayCache::ICON_RECENT] = Gui::loadIcon(QLatin1String("mail-recent"));
+        m_flagIcons[MessageDisplayCache::ICON_UNREAD] = QIcon(QLatin1String(":/icons/mail-unread.png"));
+        m_flagIcons[MessageDisplayCache::ICON_READ] = QIcon(QLatin1String(":/icons/mail-read.png"));
+    }
+    return m_flagIcons[icon];
+}
+
+void PrettyMsgListModel::setSourceModel(QAbstractItemModel *sourceModel)
+{
+    if (this->sourceModel()) {
+        disconnect(this->sourceModel(), SIGNAL(dataChanged(QModelIndex,QModelIndex)),
+                   this, SLOT(handleSourceDataChanged(QModelIndex,QModelIndex)));
+        disconnect(this->sourceModel(), SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)),
+                   this, SLOT(handleSourceRowsAboutToBeRemoved(QModelIndex,int,int)));
+        disconnect(this->sourceModel(), SIGNAL(modelReset()), this, SLOT(resetDisplayCache()));
+        disconnect(this->sourceModel(), SIGNAL(layoutChanged()), this, SLOT(resetDisplayCache()));
+    }
+    resetDisplayCache();
+    QSortFilterProxyModel::setSourceModel(sourceModel);
+    if (sourceModel) {
+        connect(sourceModel, SIGNAL(dataChanged(QModelIndex,QModelIndex)),
+                this, SLOT(handleSourceDataChanged(QModelIndex,QModelIndex)));
+        connect(sourceModel, SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)),
+                this, SLOT(handleSourceRowsAboutToBeRemoved(QModelIndex,int,int)));
+        connect(sourceModel, SIGNAL(modelReset()), this, SLOT(resetDisplayCache()));
+        // The internal pointers of the source indexes might be assigned anew
+        connect(sourceModel, SIGNAL(layoutChanged()), this, SLOT(resetDisplayCache()));
+    }
+}
+
+void PrettyMsgListModel::handleSourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
+{
+    if (!topLeft.isValid() || !bottomRight.isValid())
+        return;
+    for (int row = topLeft.row(); row <= bottomRight.row(); ++row) {
+        m_displayCache.invalidate(topLeft.sibling(row, 0).internalPointer());
+    }
+}
+
+void PrettyMsgListModel::handleSourceRowsAboutToBeRemoved(const QModelIndex &parent, int start, int end)
+{
+    // The pointers of the removed messages could be reused by some others
+    for (int row = start; row <= end; ++row) {
+        m_displayCache.invalidate(sourceModel()->index(row, 0, parent).internalPointer());
+    }
+}
+
+void PrettyMsgListModel::resetDisplayCache()
+{
+    m_displayCache.clear();
+    m_displayCacheTime = QDateTime::currentDateTime();
+}
+
 void PrettyMsgListModel::setHideRead(bool value)
 {
     m_hideRead = value;
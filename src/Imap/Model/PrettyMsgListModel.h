@@ -22,8 +22,13 @@
 #ifndef PRETTYMSGLISTMODEL_H
 #define PRETTYMSGLISTMODEL_H
 
+#include <QIcon>
 #include <QSortFilterProxyModel>
 #include "Imap/Model/MailboxModel.h"
+#include "Imap/Model/MessageDisplayCache.h"
+
+class QTimer;
+class PrettyMsgListModelTest;
 
 namespace Imap
 {
@@ -31,13 +36,19 @@ namespace Imap
 namespace Mailbox
 {
 
-/** @short A pretty proxy model which increases sexiness of the (Threaded)MsgListModel */
+/** @short A pretty proxy model which increases sexiness of the (Threaded)MsgListModel
+
+The formatted values of the cells which the view paints most often are remembered in a MessageDisplayCache. An entry is
+dropped as soon as the source model reports a change of the message, and the whole cache is flushed every minute so that the
+relative dates do not go stale.
+*/
 class PrettyMsgListModel: public QSortFilterProxyModel
 {
     Q_OBJECT
 public:
     explicit PrettyMsgListModel(QObject *parent=0);
     virtual QVariant data(const QModelIndex &index, int role) const;
+    virtual void setSourceModel(QAbstractItemModel *sourceModel);
     void setHideRead(bool value);
     virtual bool filterAcceptsRow(int source_row, const QModelIndex &source_parent) const;
     virtual void sort(int column, Qt::SortOrder order);
@@ -45,10 +56,24 @@ public:
 signals:
     void sortingPreferenceChanged(int column, Qt::SortOrder order);
 
+private slots:
+    void handleSourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
+    void handleSourceRowsAboutToBeRemoved(const QModelIndex &parent, int start, int end);
+    void resetDisplayCache();
+
 private:
-    QString prettyFormatDate(const QDateTime &dateTime) const;
+    QString prettyFormatDate(const QDateTime &dateTime, const QDateTime &currentTime) const;
+    int displayCacheSlot(const QModelIndex &translated) const;
+    QIcon flagIcon(const MessageDisplayCache::FlagIcon icon) const;
 
     bool m_hideRead;
+    mutable MessageDisplayCache m_displayCache;
+    /** @short The current time used for the dates in the display cache */
+    QDateTime m_displayCacheTime;
+    QTimer *m_displayCacheFlushTimer;
+    mutable QVector<QIcon> m_flagIcons;
+
+    friend class ::PrettyMsgListModelTest; // needs access to the display cache
 };
 
 }
@@ -25,6 +25,7 @@
 #include <QSqlRecord>
 #include <QTimer>
 #include "Common/SqlTransactionAutoAborter.h"
+#include "FullTextIndex.h"
 
 //#define CACHE_DEBUG
 
@@ -60,7 +61,8 @@ namespace Mailbox
 QDate SQLCache::accessingThresholdDate = QDate(2012, 11, 1);
 
 SQLCache::SQLCache(QObject *parent):
-    AbstractCache(parent), delayedCommit(0), tooMuchTimeWithoutCommit(0), inTransaction(false), m_updateAccessIfOlder(0)
+    AbstractCache(parent), delayedCommit(0), tooMuchTimeWithoutCommit(0), m_reindexTimer(0), m_reindexPosition(0),
+    inTransaction(false), m_updateAccessIfOlder(0)
 {
 }
 
@@ -90,6 +92,12 @@ void SQLCache::init()
     tooMuchTimeWithoutCommit->setInterval(num);
     tooMuchTimeWithoutCommit->setObjectName(QString::fromUtf8("tooMuchTimeWithoutCommit-%1").arg(objectName()));
     connect(tooMuchTimeWithoutCommit, SIGNAL(timeout()), this, SLOT(timeToCommit()));
+    if (m_reindexTimer)
+        m_reindexTimer->deleteLater();
+    m_reindexTimer = new QTimer(this);
+    m_reindexTimer->setInterval(50);
+    m_reindexTimer->setObjectName(QString::fromUtf8("reindexTimer-%1").arg(objectName()));
+    connect(m_reindexTimer, SIGNAL(timeout()), this, SLOT(indexCachedEnvelopes()));
 }
 
 SQLCache::~SQLCache()
@@ -108,6 +116,15 @@ if ( ! q.exec( QLatin1String("CREATE TABLE msg_threading ( " \
     return false; \
 }
 
+#define TROJITA_SQL_CACHE_CREATE_SORTING \
+if ( ! q.exec( QLatin1String("CREATE TABLE msg_sorting ( " \
+                             "mailbox STRING NOT NULL PRIMARY KEY, " \
+                             "sorting BINARY" \
+                             " )") ) ) { \
+    emitError( SQLCache::tr("Can't create table msg_sorting"), q ); \
+    return false; \
+}
+
 #define TROJITA_SQL_CACHE_CREATE_SYNC_STATE \
 if ( ! q.exec( QLatin1String("CREATE TABLE mailbox_sync_state ( " \
                              "mailbox STRING NOT NULL PRIMARY KEY, " \
@@ -129,6 +146,34 @@ if ( ! q.exec( QLatin1String("CREATE TABLE mailbox_sync_state ( " \
         return false; \
     }
 
+#define TROJITA_SQL_CACHE_CREATE_MSG_WORDS \
+    if (! q.exec(QLatin1String("CREATE TABLE msg_words (" \
+                               "mailbox STRING NOT NULL, " \
+                               "word TEXT NOT NULL, " \
+                               "uid INT NOT NULL, " \
+                               "field INT NOT NULL, " \
+                               "PRIMARY KEY (mailbox, word, uid, field)" \
+                               ")"))) { \
+        emitError(SQLCache::tr("Can't create table msg_words"), q); \
+        return false; \
+    } \
+    if (! q.exec(QLatin1String("CREATE INDEX msg_words_uid ON msg_words (mailbox, uid)"))) { \
+        emitError(SQLCache::tr("Can't create index msg_words_uid"), q); \
+        return false; \
+    } \
+    if (! q.exec(QLatin1String("CREATE TABLE IF NOT EXISTS msg_words_reindex ( last_rowid INT NOT NULL )"))) { \
+        emitError(SQLCache::tr("Can't create table msg_words_reindex"), q); \
+        return false; \
+    }
+
+/** @short Put all envelopes which are already cached into the full-text index, in the background */
+#define TROJITA_SQL_CACHE_SCHEDULE_REINDEX \
+    if (! q.exec(QLatin1String("DELETE FROM msg_words_reindex")) || \
+        ! q.exec(QLatin1String("INSERT INTO msg_words_reindex ( last_rowid ) VALUES ( 0 )"))) { \
+        emitError(SQLCache::tr("Can't schedule the indexing of cached envelopes"), q); \
+        return false; \
+    }
+
 bool SQLCache::open(const QString &name, const QString &fileName)
 {
 #ifdef CACHE_DEBUG
@@ -207,7 +252,29 @@ bool SQLCache::open(const QString &name, const QString &fileName)
         }
     }
 
-    if (version != 6) {
+    if (version == 6) {
+        // V7 has added the full-text index. The envelopes which are already cached get indexed in the background, the textual
+        // body parts will be indexed as they get fetched.
+        TROJITA_SQL_CACHE_CREATE_MSG_WORDS;
+        TROJITA_SQL_CACHE_SCHEDULE_REINDEX;
+        version = 7;
+        if (! q.exec(QLatin1String("UPDATE trojita SET version = 7;"))) {
+            emitError(tr("Failed to update cache DB scheme from v6 to v7"), q);
+            return false;
+        }
+    }
+
+    if (version == 7) {
+        // V8 remembers the result of the last SORT, so that the sorted view is available right after opening a mailbox
+        TROJITA_SQL_CACHE_CREATE_SORTING;
+        version = 8;
+        if (! q.exec(QLatin1String("UPDATE trojita SET version = 8;"))) {
+            emitError(tr("Failed to update cache DB scheme from v7 to v8"), q);
+            return false;
+        }
+    }
+
+    if (version != 8) {
         emitError(tr("Unknown version"));
         return false;
     }
@@ -218,6 +285,11 @@ bool SQLCache::open(const QString &name, const QString &fileName)
         return false;
     }
     init();
+
+    if (q.exec(QLatin1String("SELECT last_rowid FROM msg_words_reindex")) && q.first()) {
+        m_reindexPosition = q.value(0).toLongLong();
+        m_reindexTimer->start();
+    }
 #ifdef CACHE_DEBUG
     qDebug() << "SQLCache::open() succeeded";
 #endif
@@ -232,7 +304,7 @@ bool SQLCache::createTables()
         emitError(tr("Failed to prepare table structures"), q);
         return false;
     }
-    if (! q.exec(QLatin1String("INSERT INTO trojita ( version ) VALUES ( 6 )"))) {
+    if (! q.exec(QLatin1String("INSERT INTO trojita ( version ) VALUES ( 8 )"))) {
         emitError(tr("Can't store version info"), q);
         return false;
     }
@@ -278,11 +350,61 @@ bool SQLCache::createTables()
     }
 
     TROJITA_SQL_CACHE_CREATE_THREADING;
+    TROJITA_SQL_CACHE_CREATE_SORTING;
     TROJITA_SQL_CACHE_CREATE_SYNC_STATE;
+    TROJITA_SQL_CACHE_CREATE_MSG_WORDS;
 
     return true;
 }
 
+/** @short Put another batch of the envelopes which were cached before the full-text index was built into the index
+
+The envelopes are processed in the order of their rowid and the position is saved along with the index, so an interrupted
+indexing resumes where it stopped the next time. The envelopes which get cached in the meanwhile are indexed right away by
+setMessageMetadata().
+*/
+void SQLCache::indexCachedEnvelopes()
+{
+    const int batchSize = 100;
+
+    touchingDB();
+    QSqlQuery q(db);
+    if (! q.prepare(QLatin1String("SELECT rowid, mailbox, uid, data FROM msg_metadata WHERE rowid > ? ORDER BY rowid LIMIT ?"))) {
+        emitError(tr("Can't read msg_metadata for indexing"), q);
+        m_reindexTimer->stop();
+        return;
+    }
+    q.bindValue(0, m_reindexPosition);
+    q.bindValue(1, batchSize);
+    if (! q.exec()) {
+        emitError(tr("Can't read msg_metadata for indexing"), q);
+        m_reindexTimer->stop();
+        return;
+    }
+    int processed = 0;
+    while (q.next()) {
+        ++processed;
+        m_reindexPosition = q.value(0).toLongLong();
+        Imap::Message::Envelope envelope;
+        QDataStream stream(qUncompress(q.value(3).toByteArray()));
+        stream.setVersion(streamVersion);
+        stream >> envelope;
+        addEnvelopeWords(q.value(1).toString(), q.value(2).toUInt(), envelope);
+    }
+
+    QSqlQuery progress(db);
+    if (processed < batchSize) {
+        m_reindexTimer->stop();
+        if (! progress.exec(QLatin1String("DELETE FROM msg_words_reindex")))
+            emitError(tr("Can't finish indexing of cached envelopes"), progress);
+    } else {
+        progress.prepare(QLatin1String("UPDATE msg_words_reindex SET last_rowid = ?"));
+        progress.bindValue(0, m_reindexPosition);
+        if (! progress.exec())
+            emitError(tr("Can't save progress of indexing of cached envelopes"), progress);
+    }
+}
+
 bool SQLCache::prepareQueries()
 {
     queryChildMailboxes = QSqlQuery(db);
@@ -425,6 +547,43 @@ bool SQLCache::prepareQueries()
         return false;
     }
 
+    queryMessageSorting = QSqlQuery(db);
+    if (! queryMessageSorting.prepare(QLatin1String("SELECT sorting FROM msg_sorting WHERE mailbox = ?"))) {
+        emitError(tr("Failed to prepare queryMessageSorting"), queryMessageSorting);
+        return false;
+    }
+
+    querySetMessageSorting = QSqlQuery(db);
+    if (! querySetMessageSorting.prepare(QLatin1String("INSERT OR REPLACE INTO msg_sorting (mailbox, sorting) VALUES ( ?, ? )"))) {
+        emitError(tr("Failed to prepare querySetMessageSorting"), querySetMessageSorting);
+        return false;
+    }
+
+    querySetMessageWord = QSqlQuery(db);
+    if (! querySetMessageWord.prepare(QLatin1String("INSERT OR IGNORE INTO msg_words ( mailbox, word, uid, field ) VALUES ( ?, ?, ?, ? )"))) {
+        emitError(tr("Failed to prepare querySetMessageWord"), querySetMessageWord);
+        return false;
+    }
+
+    querySearchMessageWords = QSqlQuery(db);
+    if (! querySearchMessageWords.prepare(QLatin1String("SELECT uid FROM msg_words WHERE mailbox = ? AND word >= ? AND word < ? "
+                                                         "AND (field & ?) != 0"))) {
+        emitError(tr("Failed to prepare querySearchMessageWords"), querySearchMessageWords);
+        return false;
+    }
+
+    queryClearAllMessages4 = QSqlQuery(db);
+    if (! queryClearAllMessages4.prepare(QLatin1String("DELETE FROM msg_words WHERE mailbox = ?"))) {
+        emitError(tr("Failed to prepare queryClearAllMessages4"), queryClearAllMessages4);
+        return false;
+    }
+
+    queryClearMessage4 = QSqlQuery(db);
+    if (! queryClearMessage4.prepare(QLatin1String("DELETE FROM msg_words WHERE mailbox = ? AND uid = ?"))) {
+        emitError(tr("Failed to prepare queryClearMessage4"), queryClearMessage4);
+        return false;
+    }
+
 #ifdef CACHE_DEBUG
     qDebug() << "SQLCache::_prepareQueries() succeeded";
 #endif
@@ -478,7 +637,9 @@ bool SQLCache::childMailboxesFresh(const QString &mailbox) const
         emitError(tr("Query queryChildMailboxesFresh failed"), queryChildMailboxesFresh);
         return false;
     }
-    return queryChildMailboxesFresh.first();
+    const bool found = queryChildMailboxesFresh.first();
+    TROJITA_INSTRUMENT_CACHE("SQLCache::childMailboxesFresh", found);
+    return found;
 }
 
 void SQLCache::setChildMailboxes(const QString &mailbox, const QList<MailboxMetadata> &data)
@@ -517,7 +678,9 @@ SyncState SQLCache::mailboxSyncState(const QString &mailbox) const
         emitError(tr("Query queryMailboxSyncState failed"), queryMailboxSyncState);
         return res;
     }
-    if (queryMailboxSyncState.first()) {
+    const bool found = queryMailboxSyncState.first();
+    TROJITA_INSTRUMENT_CACHE("SQLCache::mailboxSyncState", found);
+    if (found) {
         QDataStream stream(queryMailboxSyncState.value(0).toByteArray());
         stream.setVersion(streamVersion);
         stream >> res;
@@ -552,7 +715,9 @@ QList<uint> SQLCache::uidMapping(const QString &mailbox) const
         emitError(tr("Query queryUidMapping failed"), queryUidMapping);
         return res;
     }
-    if (queryUidMapping.first()) {
+    const bool found = queryUidMapping.first();
+    TROJITA_INSTRUMENT_CACHE("SQLCache::uidMapping", found);
+    if (found) {
         QDataStream stream(qUncompress(queryUidMapping.value(0).toByteArray()));
         stream.setVersion(streamVersion);
         stream >> res;
@@ -599,6 +764,7 @@ void SQLCache::clearAllMessages(const QString &mailbox)
     queryClearAllMessages1.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
     queryClearAllMessages2.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
     queryClearAllMessages3.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+    queryClearAllMessages4.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
     if (! queryClearAllMessages1.exec()) {
         emitError(tr("Query queryClearAllMessages1 failed"), queryClearAllMessages1);
     }
@@ -608,6 +774,9 @@ void SQLCache::clearAllMessages(const QString &mailbox)
     if (! queryClearAllMessages3.exec()) {
         emitError(tr("Query queryClearAllMessages3 failed"), queryClearAllMessages3);
     }
+    if (! queryClearAllMessages4.exec()) {
+        emitError(tr("Query queryClearAllMessages4 failed"), queryClearAllMessages4);
+    }
 }
 
 void SQLCache::clearMessage(const QString mailbox, uint uid)
@@ -622,6 +791,8 @@ void SQLCache::clearMessage(const QString mailbox, uint uid)
     queryClearMessage2.bindValue(1, uid);
     queryClearMessage3.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
     queryClearMessage3.bindValue(1, uid);
+    queryClearMessage4.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+    queryClearMessage4.bindValue(1, uid);
     if (! queryClearMessage1.exec()) {
         emitError(tr("Query queryClearMessage1 failed"), queryClearMessage1);
     }
@@ -631,6 +802,9 @@ void SQLCache::clearMessage(const QString mailbox, uint uid)
     if (! queryClearMessage3.exec()) {
         emitError(tr("Query queryClearMessage3 failed"), queryClearMessage3);
     }
+    if (! queryClearMessage4.exec()) {
+        emitError(tr("Query queryClearMessage4 failed"), queryClearMessage4);
+    }
 }
 
 QStringList SQLCache::msgFlags(const QString &mailbox, uint uid) const
@@ -642,7 +816,9 @@ QStringList SQLCache::msgFlags(const QString &mailbox, uint uid) const
         emitError(tr("Query queryMessageFlags failed"), queryMessageFlags);
         return res;
     }
-    if (queryMessageFlags.first()) {
+    const bool found = queryMessageFlags.first();
+    TROJITA_INSTRUMENT_CACHE("SQLCache::msgFlags", found);
+    if (found) {
         QDataStream stream(queryMessageFlags.value(0).toByteArray());
         stream.setVersion(streamVersion);
         stream >> res;
@@ -678,12 +854,17 @@ AbstractCache::MessageDataBundle SQLCache::messageMetadata(const QString &mailbo
         emitError(tr("Query queryMessageMetadata failed"), queryMessageMetadata);
         return res;
     }
-    if (queryMessageMetadata.first()) {
+    const bool found = queryMessageMetadata.first();
+    TROJITA_INSTRUMENT_CACHE("SQLCache::messageMetadata", found);
+    if (found) {
         res.uid = uid;
         QDataStream stream(qUncompress(queryMessageMetadata.value(0).toByteArray()));
         stream.setVersion(streamVersion);
         stream >> res.envelope >> res.internalDate >> res.size >> res.serializedBodyStructure >> res.hdrReferences
                   >> res.hdrListPost >> res.hdrListPostNo;
+        // The base subject has been added later on, so it's missing in the older records
+        if (!stream.atEnd())
+            stream >> res.baseSubject;
 
         if (m_updateAccessIfOlder) {
             int lastAccessTimestamp = queryMessageMetadata.value(1).toInt();
@@ -715,12 +896,13 @@ void SQLCache::setMessageMetadata(const QString &mailbox, uint uid, const Messag
     QDataStream stream(&buf, QIODevice::ReadWrite);
     stream.setVersion(streamVersion);
     stream << metadata.envelope << metadata.internalDate << metadata.size << metadata.serializedBodyStructure
-           << metadata.hdrReferences << metadata.hdrListPost << metadata.hdrListPostNo;
+           << metadata.hdrReferences << metadata.hdrListPost << metadata.hdrListPostNo << metadata.baseSubject;
     querySetMessageMetadata.bindValue(2, qCompress(buf));
     querySetMessageMetadata.bindValue(3, accessingThresholdDate.daysTo(QDate::currentDate()));
     if (! querySetMessageMetadata.exec()) {
         emitError(tr("Query querySetMessageMetadata failed"), querySetMessageMetadata);
     }
+    addEnvelopeWords(mailbox, uid, metadata.envelope);
 }
 
 QByteArray SQLCache::messagePart(const QString &mailbox, uint uid, const QString &partId) const
@@ -733,7 +915,9 @@ QByteArray SQLCache::messagePart(const QString &mailbox, uint uid, const QString
         emitError(tr("Query queryMessagePart failed"), queryMessagePart);
         return res;
     }
-    if (queryMessagePart.first()) {
+    const bool found = queryMessagePart.first();
+    TROJITA_INSTRUMENT_CACHE("SQLCache::messagePart", found);
+    if (found) {
         res = qUncompress(queryMessagePart.value(0).toByteArray());
         queryMessagePart.finish();
     }
@@ -755,6 +939,53 @@ void SQLCache::setMsgPart(const QString &mailbox, uint uid, const QString &partI
     }
 }
 
+void SQLCache::addMsgSearchableText(const QString &mailbox, uint uid, const QString &text)
+{
+    addMsgWords(mailbox, uid, FullTextIndex::FIELD_BODY, text);
+}
+
+void SQLCache::addEnvelopeWords(const QString &mailbox, const uint uid, const Imap::Message::Envelope &envelope)
+{
+    Q_FOREACH(const FullTextIndex::FieldTexts::value_type &item, FullTextIndex::envelopeTexts(envelope)) {
+        addMsgWords(mailbox, uid, item.first, item.second);
+    }
+}
+
+void SQLCache::addMsgWords(const QString &mailbox, const uint uid, const FullTextIndex::Field field, const QString &text)
+{
+    touchingDB();
+    querySetMessageWord.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+    querySetMessageWord.bindValue(2, uid);
+    querySetMessageWord.bindValue(3, static_cast<int>(field));
+    Q_FOREACH(const QString &word, FullTextIndex::words(text)) {
+        querySetMessageWord.bindValue(1, word);
+        if (! querySetMessageWord.exec()) {
+            emitError(tr("Query querySetMessageWord failed"), querySetMessageWord);
+            return;
+        }
+    }
+}
+
+QList<uint> SQLCache::searchMessages(const QString &mailbox, const QString &query, const uint fields) const
+{
+    QList<QSet<uint> > matches;
+    Q_FOREACH(const QString &prefix, FullTextIndex::words(query)) {
+        querySearchMessageWords.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+        querySearchMessageWords.bindValue(1, prefix);
+        querySearchMessageWords.bindValue(2, FullTextIndex::prefixUpperBound(prefix));
+        querySearchMessageWords.bindValue(3, fields);
+        if (! querySearchMessageWords.exec()) {
+            emitError(tr("Query querySearchMessageWords failed"), querySearchMessageWords);
+            return QList<uint>();
+        }
+        QSet<uint> uids;
+        while (querySearchMessageWords.next())
+            uids.insert(querySearchMessageWords.value(0).toUInt());
+        matches << uids;
+    }
+    return FullTextIndex::intersect(matches);
+}
+
 QVector<Imap::Responses::ThreadingNode> SQLCache::messageThreading(const QString &mailbox)
 {
     QVector<Imap::Responses::ThreadingNode> res;
@@ -763,7 +994,9 @@ QVector<Imap::Responses::ThreadingNode> SQLCache::messageThreading(const QString
         emitError(tr("Query queryMessageThreading failed"), queryMessageThreading);
         return res;
     }
-    if (queryMessageThreading.first()) {
+    const bool found = queryMessageThreading.first();
+    TROJITA_INSTRUMENT_CACHE("SQLCache::messageThreading", found);
+    if (found) {
         QDataStream stream(qUncompress(queryMessageThreading.value(0).toByteArray()));
         stream.setVersion(streamVersion);
         stream >> res;
@@ -789,6 +1022,42 @@ void SQLCache::setMessageThreading(const QString &mailbox, const QVector<Imap::R
 
 }
 
+SQLCache::MessageSorting SQLCache::messageSorting(const QString &mailbox) const
+{
+    MessageSorting res;
+    queryMessageSorting.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+    if (! queryMessageSorting.exec()) {
+        emitError(tr("Query queryMessageSorting failed"), queryMessageSorting);
+        return res;
+    }
+    const bool found = queryMessageSorting.first();
+    TROJITA_INSTRUMENT_CACHE("SQLCache::messageSorting", found);
+    if (found) {
+        QDataStream stream(qUncompress(queryMessageSorting.value(0).toByteArray()));
+        stream.setVersion(streamVersion);
+        stream >> res.sortCriteria >> res.searchConditions >> res.uids >> res.uidValidity >> res.uidNext >> res.highestModSeq;
+    }
+    return res;
+}
+
+void SQLCache::setMessageSorting(const QString &mailbox, const MessageSorting &sorting)
+{
+#ifdef CACHE_DEBUG
+    qDebug() << "Setting sorting for" << mailbox;
+#endif
+    touchingDB();
+    querySetMessageSorting.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+    QByteArray buf;
+    QDataStream stream(&buf, QIODevice::ReadWrite);
+    stream.setVersion(streamVersion);
+    stream << sorting.sortCriteria << sorting.searchConditions << sorting.uids << sorting.uidValidity << sorting.uidNext
+           << sorting.highestModSeq;
+    querySetMessageSorting.bindValue(1, qCompress(buf));
+    if (! querySetMessageSorting.exec()) {
+        emitError(tr("Query querySetMessageSorting failed"), querySetMessageSorting);
+    }
+}
+
 void SQLCache::touchingDB()
 {
     delayedCommit->start();
@@ -88,9 +88,15 @@ public:
     virtual QByteArray messagePart(const QString &mailbox, uint uid, const QString &partId) const;
     virtual void setMsgPart(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data);
 
+    virtual void addMsgSearchableText(const QString &mailbox, uint uid, const QString &text);
+    virtual QList<uint> searchMessages(const QString &mailbox, const QString &query, const uint fields) const;
+
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading);
 
+    virtual MessageSorting messageSorting(const QString &mailbox) const;
+    virtual void setMessageSorting(const QString &mailbox, const MessageSorting &sorting);
+
     /** @short Open a connection to the cache */
     bool open(const QString &name, const QString &fileName);
 
@@ -108,6 +114,10 @@ private:
     bool createTables();
     /** @short Initialize the prepared queries */
     bool prepareQueries();
+    /** @short Add words of the @arg envelope to the full-text index */
+    void addEnvelopeWords(const QString &mailbox, const uint uid, const Imap::Message::Envelope &envelope);
+    /** @short Add words of the @arg text found in the @arg field to the full-text index */
+    void addMsgWords(const QString &mailbox, const uint uid, const FullTextIndex::Field field, const QString &text);
 
     /** @short We're about to touch the DB, so it might be a good time to start a transaction */
     void touchingDB();
@@ -118,6 +128,7 @@ private:
 private slots:
     /** @short We haven't committed for a while */
     void timeToCommit();
+    void indexCachedEnvelopes();
 
 private:
     QSqlDatabase db;
@@ -145,9 +156,19 @@ private:
     mutable QSqlQuery querySetMessagePart;
     mutable QSqlQuery queryMessageThreading;
     mutable QSqlQuery querySetMessageThreading;
+    mutable QSqlQuery queryMessageSorting;
+    mutable QSqlQuery querySetMessageSorting;
+    mutable QSqlQuery querySetMessageWord;
+    mutable QSqlQuery querySearchMessageWords;
+    mutable QSqlQuery queryClearAllMessages4;
+    mutable QSqlQuery queryClearMessage4;
 
     QTimer *delayedCommit;
     QTimer *tooMuchTimeWithoutCommit;
+    /** @short Drives the indexing of envelopes which were cached before the full-text index was built */
+    QTimer *m_reindexTimer;
+    /** @short The rowid of the last cached envelope which has been indexed by indexCachedEnvelopes() */
+    qint64 m_reindexPosition;
     bool inTransaction;
 
     /** @short A point in time against which the "last accessed on" data is computed */
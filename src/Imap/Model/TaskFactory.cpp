@@ -95,12 +95,12 @@ ExpungeMailboxTask *TaskFactory::createExpungeMailboxTask(Model *model, const QM
     return new ExpungeMailboxTask(model, mailbox);
 }
 
-FetchMsgMetadataTask *TaskFactory::createFetchMsgMetadataTask(Model *model, const QModelIndex &mailbox, const QList<uint> &uids)
+FetchMsgMetadataTask *TaskFactory::createFetchMsgMetadataTask(Model *model, const QModelIndex &mailbox, const Sequence &uids)
 {
     return new FetchMsgMetadataTask(model, mailbox, uids);
 }
 
-FetchMsgPartTask *TaskFactory::createFetchMsgPartTask(Model *model, const QModelIndex &mailbox, const QList<uint> &uids, const QStringList &parts)
+FetchMsgPartTask *TaskFactory::createFetchMsgPartTask(Model *model, const QModelIndex &mailbox, const Sequence &uids, const QStringList &parts)
 {
     return new FetchMsgPartTask(model, mailbox, uids, parts);
 }
@@ -166,6 +166,12 @@ SortTask *TaskFactory::createSortTask(Model *model, const QModelIndex &mailbox,
     return new SortTask(model, mailbox, searchConditions, sortCriteria);
 }
 
+SortTask *TaskFactory::createPartialSearchTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions,
+                                               const int from, const int to)
+{
+    return new SortTask(model, mailbox, searchConditions, QStringList(), qMakePair(from, to));
+}
+
 AppendTask *TaskFactory::createAppendTask(Model *model, const QString &targetMailbox, const QByteArray &rawMessageData,
                                           const QStringList &flags, const QDateTime &timestamp)
 {
@@ -24,6 +24,7 @@
 #include <algorithm>
 #include <QBuffer>
 #include <QDebug>
+#include "Cache.h"
 #include "ItemRoles.h"
 #include "MailboxTree.h"
 #include "MsgListModel.h"
@@ -31,17 +32,66 @@
 #include "SortTask.h"
 #include "ThreadTask.h"
 
+namespace
+{
+
+/** @short Evaluate a single search key at @arg pos against the full-text index of the @arg cache
+
+The search keys use the same prefix notation as the IMAP SEARCH command. Returns false when the key cannot be answered from the
+local index.
+*/
+bool evaluateLocalSearchKey(const Imap::Mailbox::AbstractCache *cache, const QString &mailbox, const QStringList &conditions,
+                            int &pos, QSet<uint> &result)
+{
+    if (pos >= conditions.size())
+        return false;
+
+    const QString key = conditions[pos++].toUpper();
+    if (key == QLatin1String("FUZZY")) {
+        // The prefix matching is fuzzy enough
+        return evaluateLocalSearchKey(cache, mailbox, conditions, pos, result);
+    } else if (key == QLatin1String("OR")) {
+        QSet<uint> other;
+        if (!evaluateLocalSearchKey(cache, mailbox, conditions, pos, result) ||
+                !evaluateLocalSearchKey(cache, mailbox, conditions, pos, other))
+            return false;
+        result.unite(other);
+        return true;
+    } else if (const uint fields = Imap::Mailbox::FullTextIndex::fieldsForSearchKey(key)) {
+        if (pos >= conditions.size())
+            return false;
+        result = cache->searchMessages(mailbox, conditions[pos++], fields).toSet();
+        return true;
+    }
+    return false;
+}
+
+/** @short Return the Message-Id of the message which this one replies to
+
+RFC 5256 says to use the first message ID from the In-Reply-To when there are no References.
+*/
+QByteArray parentMessageId(const Imap::Mailbox::MessageMetadata &metadata)
+{
+    if (!metadata.hdrReferences.isEmpty())
+        return metadata.hdrReferences.last();
+    else if (!metadata.envelope.inReplyTo.isEmpty())
+        return metadata.envelope.inReplyTo.first();
+    return QByteArray();
+}
+
+}
+
 #if 0
 namespace
 {
 using Imap::Mailbox::ThreadNodeInfo;
-QByteArray dumpThreadNodeInfo(const QHash<uint,ThreadNodeInfo> &mapping, const uint nodeId, const uint offset)
+QByteArray dumpThreadNodeInfo(const ThreadNodeStorage &mapping, const uint nodeId, const uint offset)
 {
     QByteArray res;
     QByteArray prefix(offset, ' ');
     QTextStream ss(&res);
     Q_ASSERT(mapping.contains(nodeId));
-    const ThreadNodeInfo &node = mapping[nodeId];
+    const ThreadNodeInfo &node = *mapping.constFind(nodeId);
     ss << prefix << "ThreadNodeInfo intId " << node.internalId << " UID " << node.uid << " ptr " << node.ptr <<
           " parentIntId " << node.parent << "\n";
     Q_FOREACH(const uint childId, node.children) {
@@ -57,25 +107,163 @@ namespace Imap
 namespace Mailbox
 {
 
+ThreadNodeInfo &ThreadNodeStorage::operator[](const uint id)
+{
+    touch(id);
+    if (id >= static_cast<uint>(m_nodes.size())) {
+        m_nodes.resize(id + 1);
+        m_present.resize(id + 1);
+    }
+    if (!m_present.testBit(id)) {
+        m_present.setBit(id);
+        ++m_count;
+    }
+    return m_nodes[id];
+}
+
+ThreadNodeStorage::iterator ThreadNodeStorage::erase(iterator it)
+{
+    Q_ASSERT(contains(it.m_id));
+    touch(it.m_id);
+    // Release the list of children right away, the slot itself stays around until the next clear()
+    m_nodes[it.m_id] = ThreadNodeInfo();
+    m_present.clearBit(it.m_id);
+    --m_count;
+    return iterator(this, nextPresent(it.m_id + 1));
+}
+
+QList<uint> ThreadNodeStorage::keys() const
+{
+    QList<uint> res;
+#if QT_VERSION >= 0x040700
+    res.reserve(m_count);
+#endif
+    for (uint id = nextPresent(0); id < static_cast<uint>(m_nodes.size()); id = nextPresent(id + 1))
+        res.append(id);
+    return res;
+}
+
+void ThreadNodeStorage::clear()
+{
+    if (m_tracking) {
+        for (uint id = nextPresent(0); id < static_cast<uint>(m_nodes.size()); id = nextPresent(id + 1))
+            remember(id);
+    }
+    m_nodes.clear();
+    m_present.clear();
+    m_count = 0;
+}
+
+void ThreadNodeStorage::reserve(const int size)
+{
+    // The root node is not counted
+    m_nodes.reserve(size + 1);
+}
+
+void ThreadNodeStorage::swap(ThreadNodeStorage &other)
+{
+    if (m_tracking) {
+        for (uint id = nextPresent(0); id < static_cast<uint>(m_nodes.size()); id = nextPresent(id + 1))
+            remember(id);
+    }
+    qSwap(m_nodes, other.m_nodes);
+    qSwap(m_present, other.m_present);
+    qSwap(m_count, other.m_count);
+}
+
+void ThreadNodeStorage::startTracking()
+{
+    Q_ASSERT(!m_tracking);
+    Q_ASSERT(m_changes.isEmpty());
+    m_tracking = true;
+}
+
+QVector<ThreadNodeStorage::Change> ThreadNodeStorage::takeChanges()
+{
+    Q_ASSERT(m_tracking);
+    m_tracking = false;
+    // Only the bits which have been set are reset, so that this is proportional to the number of the modified nodes
+    Q_FOREACH(const Change &change, m_changes)
+        m_touched.clearBit(change.id);
+    QVector<Change> res;
+    qSwap(res, m_changes);
+    return res;
+}
+
+void ThreadNodeStorage::remember(const uint id)
+{
+    if (id >= static_cast<uint>(m_touched.size()))
+        m_touched.resize(qMax(qMax(id + 1, static_cast<uint>(m_nodes.size())), 2 * static_cast<uint>(m_touched.size())));
+    if (m_touched.testBit(id))
+        return;
+    m_touched.setBit(id);
+    Change change;
+    change.id = id;
+    change.existed = contains(id);
+    if (change.existed) {
+        change.offset = m_nodes[id].offset;
+        change.uid = m_nodes[id].uid;
+        change.ptr = m_nodes[id].ptr;
+    }
+    m_changes.append(change);
+}
+
+uint ThreadNodeStorage::nextPresent(uint id) const
+{
+    const uint size = m_nodes.size();
+    while (id < size && !m_present.testBit(id))
+        ++id;
+    return id;
+}
+
 ThreadingMsgListModel::ThreadingMsgListModel(QObject *parent):
-    QAbstractProxyModel(parent), threadingHelperLastId(0), modelResetInProgress(false), threadingInFlight(false),
+    QAbstractProxyModel(parent), threadingHelperLastId(0), m_deferInsertion(false), m_threadingApplied(false),
+    m_messageIdsIndexed(false), m_baseSubjectsIndexed(false), modelResetInProgress(false), threadingInFlight(false),
     m_shallBeThreading(false), m_sortTask(0), m_sortReverse(false), m_currentSortingCriteria(SORT_NONE),
-    m_searchValidity(RESULT_INVALIDATED)
+    m_searchValidity(RESULT_INVALIDATED), m_localThreadingActive(false), m_localSortingPending(false),
+    m_searchPageSize(500), m_partialSearchLoaded(0), m_partialSearchTotal(0), m_partialSearchReverse(false)
 {
     m_delayedPrune = new QTimer(this);
     m_delayedPrune->setSingleShot(true);
     m_delayedPrune->setInterval(0);
     connect(m_delayedPrune, SIGNAL(timeout()), this, SLOT(delayedPrune()));
+
+    m_delayedArrivals = new QTimer(this);
+    m_delayedArrivals->setSingleShot(true);
+    m_delayedArrivals->setInterval(0);
+    connect(m_delayedArrivals, SIGNAL(timeout()), this, SLOT(delayedArrivals()));
+
+    m_delayedLocalThreading = new QTimer(this);
+    m_delayedLocalThreading->setSingleShot(true);
+    m_delayedLocalThreading->setInterval(0);
+    connect(m_delayedLocalThreading, SIGNAL(timeout()), this, SLOT(delayedLocalThreading()));
+
+    m_delayedLocalSort = new QTimer(this);
+    m_delayedLocalSort->setSingleShot(true);
+    m_delayedLocalSort->setInterval(0);
+    connect(m_delayedLocalSort, SIGNAL(timeout()), this, SLOT(delayedLocalSort()));
+
+    m_slowSearch = new QTimer(this);
+    m_slowSearch->setSingleShot(true);
+    m_slowSearch->setInterval(3000);
+    connect(m_slowSearch, SIGNAL(timeout()), this, SLOT(slowSearchFallback()));
 }
 
 void ThreadingMsgListModel::setSourceModel(QAbstractItemModel *sourceModel)
 {
     threading.clear();
-    ptrToInternal.clear();
+    m_sourceRowToInternal.clear();
+    uidToInternal.clear();
     unknownUids.clear();
+    forgetArrivals();
+    m_threadingApplied = false;
     threadedRootIds.clear();
+    m_localThreading.clear();
+    m_localSorting.clear();
     m_currentSortResult.clear();
+    m_partialSearchLoaded = 0;
     m_searchValidity = RESULT_INVALIDATED;
+    m_unverifiedSortingMailbox = QModelIndex();
 
     if (this->sourceModel()) {
         // there's already something, so take care to disconnect all signals
@@ -124,29 +312,66 @@ void ThreadingMsgListModel::handleDataChanged(const QModelIndex &topLeft, const
     Q_ASSERT(topLeft.parent() == bottomRight.parent());
     Q_ASSERT(topLeft.row() == bottomRight.row());
     QModelIndex translated = mapFromSource(topLeft);
+    TreeItemMessage *message = static_cast<TreeItemMessage*>(topLeft.internalPointer());
 
-    emit dataChanged(translated, translated.sibling(translated.row(), bottomRight.column()));
+    if (translated.isValid()) {
+        emit dataChanged(translated, translated.sibling(translated.row(), bottomRight.column()));
 
-    // We provide funny data like "does this thread contain unread messages?". Now the original signal might mean that flags of a
-    // nested message have changed. In order to always be consistent, we have to find the thread root and emit dataChanged() on that
-    // as well.
-    QModelIndex rootCandidate = translated;
-    while (rootCandidate.parent().isValid()) {
-        rootCandidate = rootCandidate.parent();
+        // We provide funny data like "does this thread contain unread messages?". Now the original signal might mean that flags of a
+        // nested message have changed. In order to always be consistent, we have to find the thread root and emit dataChanged() on that
+        // as well.
+        QModelIndex rootCandidate = translated;
+        while (rootCandidate.parent().isValid()) {
+            rootCandidate = rootCandidate.parent();
+        }
+        if (rootCandidate != translated) {
+            // We're really an embedded message
+            emit dataChanged(rootCandidate, rootCandidate.sibling(rootCandidate.row(), bottomRight.column()));
+        }
+
+        if (m_messageIdsIndexed && message->fetched()) {
+            const QByteArray &messageId = message->metadata().envelope.messageId;
+            if (!messageId.isEmpty() && !m_messageIdToInternal.contains(messageId))
+                m_messageIdToInternal.insert(messageId, translated.internalId());
+        }
     }
-    if (rootCandidate != translated) {
-        // We're really an embedded message
-        emit dataChanged(rootCandidate, rootCandidate.sibling(rootCandidate.row(), bottomRight.column()));
+
+    const bool isPendingArrival = !m_pendingArrivals.isEmpty() && m_pendingArrivals.contains(message);
+    if (isPendingArrival) {
+        // Either the UID or the headers have arrived, so it might be possible to show this message now
+        unknownUids.remove(message);
+        if (!m_delayedArrivals->isActive())
+            m_delayedArrivals->start();
+        return;
     }
 
-    QSet<TreeItem*>::iterator persistent = unknownUids.find(static_cast<TreeItem*>(topLeft.internalPointer()));
+    QSet<TreeItem*>::iterator persistent = unknownUids.find(message);
     if (persistent != unknownUids.end()) {
         // The message wasn't fully synced before, and now it is
         persistent = unknownUids.erase(persistent);
+        const uint uid = message->uid();
+        const uint internalId = internalIdForSourceRow(message->row());
+        if (uid && internalId) {
+            uidToInternal[uid] = internalId;
+            threading[internalId].uid = uid;
+        }
         if (unknownUids.isEmpty()) {
             wantThreading();
         }
     }
+
+    if (m_localThreadingActive && message->uid() && message->fetched() && !m_localThreading.contains(message->uid())) {
+        // The headers have arrived, so this message can be put into its proper place now
+        addToLocalThreading(message);
+        m_localThreadingLate << message;
+        if (!m_delayedLocalThreading->isActive())
+            m_delayedLocalThreading->start();
+    }
+
+    if (m_localSortingPending && !m_delayedLocalSort->isActive() && message->fetched()) {
+        // Some sort keys might be available now
+        m_delayedLocalSort->start();
+    }
 }
 
 QModelIndex ThreadingMsgListModel::index(int row, int column, const QModelIndex &parent) const
@@ -168,7 +393,7 @@ QModelIndex ThreadingMsgListModel::index(int row, int column, const QModelIndex
 
     uint parentId = parent.isValid() ? parent.internalId() : 0;
 
-    QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(parentId);
+    ThreadNodeStorage::const_iterator it = threading.constFind(parentId);
     Q_ASSERT(it != threading.constEnd());
 
     if (it->children.size() <= row)
@@ -188,11 +413,11 @@ QModelIndex ThreadingMsgListModel::parent(const QModelIndex &index) const
     if (index.row() < 0 || index.column() < 0 || index.column() >= MsgListModel::COLUMN_COUNT)
         return QModelIndex();
 
-    QHash<uint,ThreadNodeInfo>::const_iterator node = threading.constFind(index.internalId());
+    ThreadNodeStorage::const_iterator node = threading.constFind(index.internalId());
     if (node == threading.constEnd())
         return QModelIndex();
 
-    QHash<uint,ThreadNodeInfo>::const_iterator parentNode = threading.constFind(node->parent);
+    ThreadNodeStorage::const_iterator parentNode = threading.constFind(node->parent);
     Q_ASSERT(parentNode != threading.constEnd());
     Q_ASSERT(parentNode->internalId == node->parent);
 
@@ -210,6 +435,24 @@ bool ThreadingMsgListModel::hasChildren(const QModelIndex &parent) const
     return ! threading.isEmpty() && ! threading.value(parent.internalId()).children.isEmpty();
 }
 
+/** @short Is there another page of the SEARCH result which hasn't been asked for yet? */
+bool ThreadingMsgListModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !parent.isValid() && !m_sortTask && m_searchValidity == RESULT_FRESH &&
+            m_partialSearchLoaded && m_partialSearchLoaded < m_partialSearchTotal;
+}
+
+void ThreadingMsgListModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent) || !sourceModel() || !sourceModel()->rowCount())
+        return;
+
+    const Model *realModel;
+    QModelIndex realIndex;
+    Model::realTreeItem(sourceModel()->index(0, 0), &realModel, &realIndex);
+    startPartialSearchTask(realModel, realIndex.parent().parent(), m_currentSearchConditions, m_partialSearchLoaded);
+}
+
 int ThreadingMsgListModel::rowCount(const QModelIndex &parent) const
 {
     if (threading.isEmpty())
@@ -240,16 +483,16 @@ QModelIndex ThreadingMsgListModel::mapToSource(const QModelIndex &proxyIndex) co
     Imap::Mailbox::MsgListModel *msgList = qobject_cast<Imap::Mailbox::MsgListModel *>(sourceModel());
     Q_ASSERT(msgList);
 
-    QHash<uint,ThreadNodeInfo>::const_iterator node = threading.constFind(proxyIndex.internalId());
+    ThreadNodeStorage::const_iterator node = threading.constFind(proxyIndex.internalId());
     if (node == threading.constEnd())
         return QModelIndex();
 
-    if (node->ptr) {
-        return msgList->createIndex(node->ptr->row(), proxyIndex.column(), node->ptr);
-    } else {
+    const int row = sourceRowForNode(*node);
+    if (row == -1) {
         // it's a fake message
         return QModelIndex();
     }
+    return msgList->index(row, proxyIndex.column());
 }
 
 QModelIndex ThreadingMsgListModel::mapFromSource(const QModelIndex &sourceIndex) const
@@ -259,20 +502,13 @@ QModelIndex ThreadingMsgListModel::mapFromSource(const QModelIndex &sourceIndex)
 
     Q_ASSERT(sourceIndex.model() == sourceModel());
 
-    QHash<void *,uint>::const_iterator it = ptrToInternal.constFind(sourceIndex.internalPointer());
-    if (it == ptrToInternal.constEnd())
-        return QModelIndex();
-
-    const uint internalId = *it;
-
-    QHash<uint,ThreadNodeInfo>::const_iterator node = threading.constFind(internalId);
-    if (node == threading.constEnd()) {
+    const uint internalId = internalIdForSourceRow(sourceIndex.row());
+    if (!internalId) {
         // The filtering criteria say that this index shall not be visible
         return QModelIndex();
     }
-    Q_ASSERT(node != threading.constEnd());
 
-    return createIndex(node->offset, sourceIndex.column(), internalId);
+    return createIndex(threading.constFind(internalId)->offset, sourceIndex.column(), internalId);
 }
 
 QVariant ThreadingMsgListModel::data(const QModelIndex &proxyIndex, int role) const
@@ -280,10 +516,10 @@ QVariant ThreadingMsgListModel::data(const QModelIndex &proxyIndex, int role) co
     if (! proxyIndex.isValid() || proxyIndex.model() != this)
         return QVariant();
 
-    QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(proxyIndex.internalId());
+    ThreadNodeStorage::const_iterator it = threading.constFind(proxyIndex.internalId());
     Q_ASSERT(it != threading.constEnd());
 
-    if (it->ptr) {
+    if (it->isMessage()) {
         // It's a real item which exists in the underlying model
         if (role == RoleThreadRootWithUnreadMessages) {
             if (proxyIndex.parent().isValid()) {
@@ -295,6 +531,11 @@ QVariant ThreadingMsgListModel::data(const QModelIndex &proxyIndex, int role) co
                 return threadContainsUnreadMessages(it->internalId);
             }
         } else {
+            // Things like the flags are known without the TreeItemMessage, which matters when a filter asks about all rows
+            QVariant res;
+            const int row = sourceRowForNode(*it);
+            if (row != -1 && sourceMessageList()->rowData(row, role, &res))
+                return res;
             return QAbstractProxyModel::data(proxyIndex, role);
         }
     }
@@ -316,9 +557,9 @@ Qt::ItemFlags ThreadingMsgListModel::flags(const QModelIndex &index) const
     if (! index.isValid() || index.model() != this)
         return Qt::NoItemFlags;
 
-    QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(index.internalId());
+    ThreadNodeStorage::const_iterator it = threading.constFind(index.internalId());
     Q_ASSERT(it != threading.constEnd());
-    if (it->ptr && it->uid)
+    if (it->uid)
         return Qt::ItemIsSelectable | Qt::ItemIsDragEnabled | Qt::ItemIsEnabled;
 
     return Qt::NoItemFlags;
@@ -329,21 +570,31 @@ void ThreadingMsgListModel::handleRowsAboutToBeRemoved(const QModelIndex &parent
 {
     Q_ASSERT(!parent.isValid());
 
+    // Going through the MVC API would create the TreeItemMessage of each and every removed message
+    TreeItemMsgList *list = sourceMessageList();
+    Q_ASSERT(list);
     for (int i = start; i <= end; ++i) {
-        QModelIndex index = sourceModel()->index(i, 0, parent);
-        Q_ASSERT(index.isValid());
-        QModelIndex translated = mapFromSource(index);
-
-        unknownUids.remove(static_cast<TreeItem*>(index.internalPointer()));
+        const uint uid = list->messageUid(i);
+        if (TreeItem *message = list->existingMessage(i)) {
+            unknownUids.remove(message);
+            m_pendingArrivals.removeOne(message);
+            if (m_localThreadingActive)
+                m_localThreadingLate.removeOne(message);
+        }
+        if (m_localThreadingActive)
+            m_localThreading.removeMessage(uid);
 
-        if (!translated.isValid()) {
+        const uint internalId = internalIdForSourceRow(i);
+        if (!internalId) {
             // The index being removed wasn't visible in our mapping anyway
             continue;
         }
 
-        Q_ASSERT(translated.isValid());
-        QHash<uint,ThreadNodeInfo>::iterator it = threading.find(translated.internalId());
+        ThreadNodeStorage::iterator it = threading.find(internalId);
         Q_ASSERT(it != threading.end());
+        QHash<uint,uint>::iterator idIt = uidToInternal.find(uid);
+        if (idIt != uidToInternal.end() && *idIt == it->internalId)
+            uidToInternal.erase(idIt);
         it->uid = 0;
         it->ptr = 0;
     }
@@ -352,8 +603,8 @@ void ThreadingMsgListModel::handleRowsAboutToBeRemoved(const QModelIndex &parent
 void ThreadingMsgListModel::handleRowsRemoved(const QModelIndex &parent, int start, int end)
 {
     Q_ASSERT(!parent.isValid());
-    Q_UNUSED(start);
-    Q_UNUSED(end);
+    if (start < m_sourceRowToInternal.size())
+        m_sourceRowToInternal.remove(start, qMin(end + 1, m_sourceRowToInternal.size()) - start);
     if (!m_delayedPrune->isActive())
         m_delayedPrune->start();
 }
@@ -367,10 +618,412 @@ void ThreadingMsgListModel::delayedPrune()
     emit layoutChanged();
 }
 
+/** @short Put the new arrivals into their threads as soon as their headers are known
+
+Each message is attached below the message it replies to, as indicated by its References or In-Reply-To, which is what the
+server would do as well. With the ORDEREDSUBJECT algorithm, the message goes below the thread root with the same base subject
+instead. The views only see a few inserted rows instead of a layout change, and no THREAD command is needed. When the parent
+is not among the messages whose headers are known, the arrivals are shown as standalone threads and the server is asked for
+the complete threading instead. The local threading keeps them as standalone threads until their parent shows up.
+*/
+void ThreadingMsgListModel::delayedArrivals()
+{
+    if (m_pendingArrivals.isEmpty())
+        return;
+
+    Q_FOREACH(TreeItem *item, m_pendingArrivals) {
+        TreeItemMessage *message = static_cast<TreeItemMessage*>(item);
+        if (!message->uid() || message->loading()) {
+            // We will get called again when the data arrive, see handleDataChanged()
+            return;
+        }
+    }
+
+    QSet<uint> affectedParents;
+    if (canAttachArrivalsLocally()) {
+        const bool byOrderedSubject = !m_localThreadingActive && requestedAlgorithm == QByteArray("ORDEREDSUBJECT");
+        while (!m_pendingArrivals.isEmpty()) {
+            TreeItemMessage *message = static_cast<TreeItemMessage*>(m_pendingArrivals.first());
+            uint parentId = 0;
+            if (byOrderedSubject) {
+                if (!findOrderedSubjectParent(message, &parentId))
+                    break;
+            } else if (message->fetched()) {
+                const QByteArray referencedId = parentMessageId(message->metadata());
+                parentId = findThreadNodeByMessageId(referencedId);
+                if (!parentId && !referencedId.isEmpty() && !m_localThreadingActive) {
+                    // Only the server knows where this one belongs
+                    break;
+                }
+            }
+            m_pendingArrivals.removeFirst();
+            insertArrival(message, parentId);
+            if (parentId)
+                affectedParents.insert(parentId);
+            // Some of the messages which are already shown might be replies to this one
+            const uint internalId = uidToInternal.value(message->uid());
+            if (m_localThreadingActive && adoptLocalReplies(internalId))
+                affectedParents.insert(internalId);
+        }
+    }
+
+    if (!m_pendingArrivals.isEmpty()) {
+        // Show the rest as standalone threads until the THREAD response tells us better
+        while (!m_pendingArrivals.isEmpty())
+            insertArrival(static_cast<TreeItemMessage*>(m_pendingArrivals.takeFirst()), 0);
+        invalidateSortResult();
+        wantThreading();
+        return;
+    }
+
+    calculateNullSort();
+    threadRootsChanged(affectedParents);
+
+    if (!m_localThreadingActive) {
+        // Keep the cached THREAD response up to date so that nothing has to be asked for when the threading is needed again
+        const Model *realModel = 0;
+        QModelIndex realIndex;
+        Model::realTreeItem(sourceModel()->index(0, 0), &realModel, &realIndex);
+        realModel->cache()->setMessageThreading(realIndex.parent().parent().data(RoleMailboxName).toString(),
+                                                currentThreading(0));
+    }
+}
+
+/** @short The thread roots report things like "does this thread contain unread messages?", so tell the views to update them */
+void ThreadingMsgListModel::threadRootsChanged(const QSet<uint> &internalIds)
+{
+    Q_FOREACH(const uint internalId, internalIds) {
+        uint rootId = internalId;
+        while (threading[rootId].parent)
+            rootId = threading[rootId].parent;
+        QModelIndex root = indexForThreadNode(rootId);
+        emit dataChanged(root, root.sibling(root.row(), MsgListModel::COLUMN_COUNT - 1));
+    }
+}
+
+/** @short Can the new arrivals be put into their threads without asking the server? */
+bool ThreadingMsgListModel::canAttachArrivalsLocally() const
+{
+    if (!m_shallBeThreading || !m_threadingApplied || threadingInFlight)
+        return false;
+
+    // The order of the threads is only as simple as this when no sorting is involved
+    if (m_currentSortingCriteria != SORT_NONE || !m_currentSearchConditions.isEmpty() || m_sortReverse)
+        return false;
+
+    if (!m_localThreadingActive && requestedAlgorithm != QByteArray("REFS") && requestedAlgorithm != QByteArray("REFERENCES") &&
+            requestedAlgorithm != QByteArray("ORDEREDSUBJECT"))
+        return false;
+
+    // Other messages which are still waiting for their UIDs will need a THREAD response anyway
+    Q_FOREACH(TreeItem *item, unknownUids) {
+        if (!m_pendingArrivals.contains(item))
+            return false;
+    }
+    return true;
+}
+
+/** @short Show a pending arrival as the last child of the @arg parentId */
+void ThreadingMsgListModel::insertArrival(TreeItemMessage *message, const uint parentId)
+{
+    Q_ASSERT(message->uid());
+    const int row = threading[parentId].children.size();
+    beginInsertRows(indexForThreadNode(parentId), row, row);
+    ThreadNodeInfo node;
+    node.internalId = ++threadingHelperLastId;
+    node.uid = message->uid();
+    node.parent = parentId;
+    node.offset = row;
+    threading[node.internalId] = node;
+    threading[parentId].children << node.internalId;
+    m_sourceRowToInternal[message->row()] = node.internalId;
+    uidToInternal[node.uid] = node.internalId;
+    if (!parentId)
+        threadedRootIds << node.internalId;
+    endInsertRows();
+
+    if (message->fetched()) {
+        const QByteArray &messageId = message->metadata().envelope.messageId;
+        if (m_messageIdsIndexed && !messageId.isEmpty() && !m_messageIdToInternal.contains(messageId))
+            m_messageIdToInternal.insert(messageId, node.internalId);
+        if (m_localThreadingActive)
+            addToLocalThreading(message);
+        const QString &baseSubject = message->metadata().baseSubject;
+        if (m_baseSubjectsIndexed && !parentId && !m_baseSubjectToRoot.contains(baseSubject))
+            m_baseSubjectToRoot.insert(baseSubject, node.internalId);
+    }
+}
+
+/** @short Return the internal ID of a shown message with this Message-Id, or zero if there is none
+
+Only the messages whose headers are already known are considered. The index is built when it is needed for the first time after
+the threading got rebuilt, and then it is kept up to date by handleDataChanged().
+*/
+uint ThreadingMsgListModel::findThreadNodeByMessageId(const QByteArray &messageId)
+{
+    if (messageId.isEmpty())
+        return 0;
+
+    if (!m_messageIdsIndexed) {
+        m_messageIdToInternal.clear();
+        // Only the messages which have their TreeItemMessage can have their headers known
+        TreeItemMsgList *list = sourceMessageList();
+        for (int row = 0; list && row < m_sourceRowToInternal.size(); ++row) {
+            TreeItemMessage *message = list->existingMessage(row);
+            if (!message || !message->fetched())
+                continue;
+            const uint internalId = internalIdForSourceRow(row);
+            const QByteArray &id = message->metadata().envelope.messageId;
+            if (internalId && !id.isEmpty() && !m_messageIdToInternal.contains(id))
+                m_messageIdToInternal.insert(id, internalId);
+        }
+        m_messageIdsIndexed = true;
+    }
+
+    QHash<QByteArray,uint>::iterator it = m_messageIdToInternal.find(messageId);
+    if (it == m_messageIdToInternal.end())
+        return 0;
+
+    // Expunged messages are not removed from the index right away
+    ThreadNodeStorage::const_iterator node = threading.constFind(*it);
+    TreeItemMessage *message = node == threading.constEnd() ? 0 : existingMessageForNode(*node);
+    if (!message || !message->fetched() || message->metadata().envelope.messageId != messageId) {
+        m_messageIdToInternal.erase(it);
+        return 0;
+    }
+    return node.key();
+}
+
+/** @short Find out where the ORDEREDSUBJECT algorithm would put a new arrival
+
+RFC 5256 makes the oldest message with a given base subject the thread root and all other messages with that base subject its
+children, ordered by their sent date, while the threads are ordered by the sent date of their roots. The arrival has the highest
+sequence number, so it goes last among its siblings unless it is older than them. The comparison uses the base subjects which
+are kept along with the message metadata.
+
+Returns false when only the server can tell, for example when some thread root has not got its headers yet.
+*/
+bool ThreadingMsgListModel::findOrderedSubjectParent(TreeItemMessage *message, uint *parentId)
+{
+    if (!message->fetched() || !message->metadata().envelope.date.isValid())
+        return false;
+
+    if (!m_baseSubjectsIndexed) {
+        m_baseSubjectToRoot.clear();
+        Q_FOREACH(const uint rootId, threading.constFind(0)->children) {
+            TreeItemMessage *root = existingMessageForNode(*threading.constFind(rootId));
+            if (!root || !root->fetched())
+                return false;
+            const QString &baseSubject = root->metadata().baseSubject;
+            if (!m_baseSubjectToRoot.contains(baseSubject))
+                m_baseSubjectToRoot.insert(baseSubject, rootId);
+        }
+        m_baseSubjectsIndexed = true;
+    }
+
+    uint candidate = 0;
+    QHash<QString,uint>::const_iterator it = m_baseSubjectToRoot.constFind(message->metadata().baseSubject);
+    if (it != m_baseSubjectToRoot.constEnd()) {
+        // Expunged messages are not removed from the index right away
+        ThreadNodeStorage::const_iterator root = threading.constFind(*it);
+        if (root == threading.constEnd() || root->parent || !root->isMessage())
+            return false;
+        candidate = *it;
+    }
+
+    const QList<uint> &siblings = threading.constFind(candidate)->children;
+    const uint previousId = siblings.isEmpty() ? candidate : siblings.last();
+    if (previousId) {
+        TreeItemMessage *previous = existingMessageForNode(*threading.constFind(previousId));
+        if (!previous || !previous->fetched() || !previous->metadata().envelope.date.isValid() ||
+                previous->metadata().envelope.date > message->metadata().envelope.date)
+            return false;
+    }
+    *parentId = candidate;
+    return true;
+}
+
+/** @short The threading is going to be rebuilt from all messages of the source model, including the pending arrivals */
+void ThreadingMsgListModel::forgetArrivals()
+{
+    m_pendingArrivals.clear();
+    m_localThreadingLate.clear();
+    m_messageIdToInternal.clear();
+    m_messageIdsIndexed = false;
+    m_baseSubjectToRoot.clear();
+    m_baseSubjectsIndexed = false;
+}
+
+/** @short New messages have arrived, so the result of the SORT or SEARCH might no longer be accurate */
+void ThreadingMsgListModel::invalidateSortResult()
+{
+    if (!m_sortTask || !m_sortTask->isPersistent()) {
+        m_currentSortResult.clear();
+        m_partialSearchLoaded = 0;
+        if (m_searchValidity == RESULT_FRESH)
+            m_searchValidity = RESULT_INVALIDATED;
+    }
+}
+
+/** @short Convert the shown threading below the @arg parentId into the format of the THREAD response */
+QVector<Responses::ThreadingNode> ThreadingMsgListModel::currentThreading(const uint parentId) const
+{
+    const QList<uint> &children = threading.constFind(parentId)->children;
+    QVector<Responses::ThreadingNode> res;
+    res.reserve(children.size());
+    Q_FOREACH(const uint childId, children) {
+        res.append(Responses::ThreadingNode(threading.constFind(childId)->uid, currentThreading(childId)));
+    }
+    return res;
+}
+
+/** @short Move the messages whose headers have arrived since the local threading was applied to their threads
+
+Only the affected nodes are moved. That includes the replies which have been shown as standalone threads because their parent
+had not got its headers yet. The views see a few moved rows instead of a layout change. When the order of the threads comes
+from sorting or searching, the threading is rebuilt instead, but only if some message really has to move.
+*/
+void ThreadingMsgListModel::delayedLocalThreading()
+{
+    const QList<TreeItem*> late = m_localThreadingLate;
+    m_localThreadingLate.clear();
+    if (!m_localThreadingActive || !m_shallBeThreading || late.isEmpty())
+        return;
+
+    const bool canMove = canAttachArrivalsLocally();
+    QSet<uint> affectedParents;
+    Q_FOREACH(TreeItem *item, late) {
+        TreeItemMessage *message = static_cast<TreeItemMessage*>(item);
+        const uint internalId = internalIdForSourceRow(message->row());
+        if (!internalId) {
+            // It isn't shown yet, so it will get its place along with the rest of the threading
+            continue;
+        }
+        ThreadNodeStorage::const_iterator node = threading.constFind(internalId);
+
+        const uint parentId = findThreadNodeByMessageId(parentMessageId(message->metadata()));
+        if (parentId && !node->parent && !isThreadAncestorOrSelf(internalId, parentId)) {
+            if (!canMove) {
+                wantThreading();
+                return;
+            }
+            moveThreadNode(internalId, parentId);
+            affectedParents.insert(parentId);
+        }
+
+        if (!canMove) {
+            if (!collectLocalReplies(internalId).isEmpty()) {
+                wantThreading();
+                return;
+            }
+        } else if (adoptLocalReplies(internalId)) {
+            affectedParents.insert(internalId);
+        }
+    }
+
+    if (!affectedParents.isEmpty()) {
+        calculateNullSort();
+        threadRootsChanged(affectedParents);
+    }
+}
+
+/** @short Return the internal IDs of the shown messages which the local threading puts below this one, but which are elsewhere */
+QList<uint> ThreadingMsgListModel::collectLocalReplies(const uint internalId) const
+{
+    QList<uint> res;
+    Q_FOREACH(const uint uid, m_localThreading.replies(threading.constFind(internalId)->uid)) {
+        const uint replyId = uidToInternal.value(uid);
+        if (!replyId)
+            continue;
+        ThreadNodeStorage::const_iterator reply = threading.constFind(replyId);
+        if (reply == threading.constEnd() || reply->uid != uid || reply->parent == internalId ||
+                isThreadAncestorOrSelf(replyId, internalId))
+            continue;
+        res << replyId;
+    }
+    return res;
+}
+
+/** @short Move the replies which have been waiting for this message below it; returns true if there were any */
+bool ThreadingMsgListModel::adoptLocalReplies(const uint internalId)
+{
+    const QList<uint> replies = collectLocalReplies(internalId);
+    Q_FOREACH(const uint replyId, replies) {
+        moveThreadNode(replyId, internalId);
+    }
+    return !replies.isEmpty();
+}
+
+/** @short Is the node @arg ancestorId the same as @arg internalId, or one of its ancestors? */
+bool ThreadingMsgListModel::isThreadAncestorOrSelf(const uint ancestorId, uint internalId) const
+{
+    while (internalId) {
+        if (internalId == ancestorId)
+            return true;
+        internalId = threading.constFind(internalId)->parent;
+    }
+    return false;
+}
+
+/** @short Move the node along with its subtree below @arg newParentId, keeping the siblings ordered by their UIDs */
+void ThreadingMsgListModel::moveThreadNode(const uint internalId, const uint newParentId)
+{
+    ThreadNodeStorage::iterator node = threading.find(internalId);
+    ThreadNodeStorage::iterator oldParent = threading.find(node->parent);
+    ThreadNodeStorage::iterator newParent = threading.find(newParentId);
+    Q_ASSERT(oldParent != newParent);
+
+    const int oldRow = node->offset;
+    int newRow = 0;
+    while (newRow < newParent->children.size() && threading.constFind(newParent->children[newRow])->uid < node->uid)
+        ++newRow;
+
+    beginMoveRows(indexForThreadNode(oldParent.key()), oldRow, oldRow, indexForThreadNode(newParentId), newRow);
+    oldParent->children.removeAt(oldRow);
+    for (int i = oldRow; i < oldParent->children.size(); ++i)
+        threading.find(oldParent->children[i])->offset = i;
+    newParent->children.insert(newRow, internalId);
+    for (int i = newRow; i < newParent->children.size(); ++i)
+        threading.find(newParent->children[i])->offset = i;
+    if (!oldParent.key())
+        threadedRootIds.removeOne(internalId);
+    node->parent = newParentId;
+    endMoveRows();
+}
+
+void ThreadingMsgListModel::delayedLocalSort()
+{
+    if (m_localSortingPending && m_currentSortingCriteria != SORT_NONE)
+        searchSortPreferenceImplementation(m_currentSearchConditions, m_currentSortingCriteria, m_sortReverse ? Qt::DescendingOrder : Qt::AscendingOrder);
+}
+
+/** @short Show what the local index knows while the server is still busy with the SEARCH
+
+The result stays in the RESULT_ASKED state, so the real answer replaces it as soon as it arrives.
+*/
+void ThreadingMsgListModel::slowSearchFallback()
+{
+    if (m_searchValidity != RESULT_ASKED || m_currentSearchConditions.isEmpty() || !sourceModel() || !sourceModel()->rowCount())
+        return;
+
+    const Model *realModel;
+    QModelIndex realIndex;
+    Model::realTreeItem(sourceModel()->index(0, 0), &realModel, &realIndex);
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(static_cast<TreeItem*>(realIndex.parent().internalPointer()));
+    Q_ASSERT(list);
+    applyLocalSearch(m_currentSearchConditions, m_currentSortingCriteria, list, const_cast<Model*>(realModel));
+}
+
 void ThreadingMsgListModel::handleRowsAboutToBeInserted(const QModelIndex &parent, int start, int end)
 {
     Q_ASSERT(!parent.isValid());
 
+    m_deferInsertion = canAttachArrivalsLocally();
+    if (m_deferInsertion) {
+        // The rows will only be inserted once we know where they belong
+        return;
+    }
+
     int myStart = threading[0].children.size();
     int myEnd = myStart + (end - start);
     beginInsertRows(QModelIndex(), myStart, myEnd);
@@ -380,30 +1033,50 @@ void ThreadingMsgListModel::handleRowsInserted(const QModelIndex &parent, int st
 {
     Q_ASSERT(!parent.isValid());
 
+    // Shift the mapping of the following rows
+    m_sourceRowToInternal.insert(qMin(start, m_sourceRowToInternal.size()), end - start + 1, 0);
+
+    if (m_deferInsertion) {
+        m_deferInsertion = false;
+        const Model *realModel = 0;
+        for (int i = start; i <= end; ++i) {
+            TreeItemMessage *message = static_cast<TreeItemMessage*>(
+                        Model::realTreeItem(sourceModel()->index(i, 0), &realModel));
+            Q_ASSERT(message);
+            m_pendingArrivals << message;
+            if (!message->uid())
+                unknownUids << message;
+            // The References are needed for finding the thread. When the UID is not known yet, the message is just marked as
+            // loading and its metadata are requested as soon as the UID arrives.
+            message->fetch(const_cast<Model*>(realModel));
+        }
+        if (!m_delayedArrivals->isActive())
+            m_delayedArrivals->start();
+        return;
+    }
+
+    TreeItemMsgList *list = sourceMessageList();
+    Q_ASSERT(list);
     for (int i = start; i <= end; ++i) {
-        QModelIndex index = sourceModel()->index(i, 0);
-        uint uid = index.data(RoleMessageUid).toUInt();
         ThreadNodeInfo node;
         node.internalId = ++threadingHelperLastId;
-        node.uid = uid;
-        node.ptr = static_cast<TreeItem *>(index.internalPointer());
+        node.uid = list->messageUid(i);
         node.offset = threading[0].children.size();
-        threading[node.internalId] = node;
-        threading[0].children << node.internalId;
-        ptrToInternal[node.ptr] = node.internalId;
         if (!node.uid) {
-            unknownUids << static_cast<TreeItem*>(index.internalPointer());
+            // There's nothing else to identify this message by
+            node.ptr = list->message(i);
+            unknownUids << node.ptr;
         } else {
+            uidToInternal[node.uid] = node.internalId;
             threadedRootIds.append(node.internalId);
         }
+        threading[node.internalId] = node;
+        threading[0].children << node.internalId;
+        m_sourceRowToInternal[i] = node.internalId;
     }
     endInsertRows();
 
-    if (!m_sortTask || !m_sortTask->isPersistent()) {
-        m_currentSortResult.clear();
-        if (m_searchValidity == RESULT_FRESH)
-            m_searchValidity = RESULT_INVALIDATED;
-    }
+    invalidateSortResult();
 
     if (m_shallBeThreading)
         wantThreading();
@@ -417,11 +1090,16 @@ void ThreadingMsgListModel::resetMe()
 
     modelResetInProgress = true;
     threading.clear();
-    ptrToInternal.clear();
+    m_sourceRowToInternal.clear();
+    uidToInternal.clear();
     unknownUids.clear();
     threadedRootIds.clear();
+    m_localThreading.clear();
+    m_localSorting.clear();
     m_currentSortResult.clear();
+    m_partialSearchLoaded = 0;
     m_searchValidity = RESULT_INVALIDATED;
+    m_unverifiedSortingMailbox = QModelIndex();
     RESET_MODEL;
     updateNoThreading();
     modelResetInProgress = false;
@@ -433,13 +1111,17 @@ void ThreadingMsgListModel::resetMe()
 void ThreadingMsgListModel::updateNoThreading()
 {
     threadingHelperLastId = 0;
+    // All messages from the source model will be shown right away
+    forgetArrivals();
+    m_threadingApplied = false;
 
     if (!sourceModel()) {
         // Maybe we got reset because the parent model is no longer here...
         if (! threading.isEmpty()) {
             beginRemoveRows(QModelIndex(), 0, rowCount() - 1);
             threading.clear();
-            ptrToInternal.clear();
+            m_sourceRowToInternal.clear();
+            uidToInternal.clear();
             endRemoveRows();
         }
         unknownUids.clear();
@@ -449,51 +1131,51 @@ void ThreadingMsgListModel::updateNoThreading()
     emit layoutAboutToBeChanged();
     updatePersistentIndexesPhase1();
     threading.clear();
-    ptrToInternal.clear();
+    m_sourceRowToInternal.clear();
+    uidToInternal.clear();
     unknownUids.clear();
     threadedRootIds.clear();
 
     int upstreamMessages = sourceModel()->rowCount();
     QList<uint> allIds;
-    QHash<uint,ThreadNodeInfo> newThreading;
-    QHash<void *,uint> newPtrToInternal;
+    ThreadNodeStorage newThreading;
+    QVector<uint> newSourceRowToInternal(upstreamMessages);
+    QHash<uint,uint> newUidToInternal;
+    newThreading.reserve(upstreamMessages);
+    newUidToInternal.reserve(upstreamMessages);
 
     if (upstreamMessages) {
-        // Prefer the direct pointer access instead of going through the MVC API -- similar to how applyThreading() works.
-        // This improves the speed of the testSortingPerformance benchmark by 18%.
-        QModelIndex firstMessageIndex = sourceModel()->index(0, 0);
-        Q_ASSERT(firstMessageIndex.isValid());
-        const Model *realModel = 0;
-        TreeItem *firstMessagePtr = Model::realTreeItem(firstMessageIndex, &realModel);
-        Q_ASSERT(firstMessagePtr);
-        // If the next asserts fails, it means that the implementation of MsgListModel has changed and uses its own pointers
-        Q_ASSERT(firstMessagePtr == firstMessageIndex.internalPointer());
-        TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(firstMessagePtr->parent());
+        // Prefer the direct access to the list instead of going through the MVC API -- similar to how applyThreading() works.
+        // This improves the speed of the testSortingPerformance benchmark by 18%, and the TreeItemMessage of a message is only
+        // created when it's needed.
+        TreeItemMsgList *list = sourceMessageList();
         Q_ASSERT(list);
 
         for (int i = 0; i < upstreamMessages; ++i) {
-            TreeItemMessage *ptr = static_cast<TreeItemMessage*>(list->m_children[i]);
-            Q_ASSERT(ptr);
             ThreadNodeInfo node;
             node.internalId = i + 1;
-            node.uid = ptr->uid();
-            node.ptr = ptr;
+            node.uid = list->messageUid(i);
             node.offset = i;
-            newThreading[node.internalId] = node;
-            allIds.append(node.internalId);
-            newPtrToInternal[node.ptr] = node.internalId;
             if (!node.uid) {
-                unknownUids << ptr;
+                node.ptr = list->message(i);
+                unknownUids << node.ptr;
+            } else {
+                newUidToInternal[node.uid] = node.internalId;
             }
+            newThreading[node.internalId] = node;
+            allIds.append(node.internalId);
+            newSourceRowToInternal[i] = node.internalId;
         }
     }
 
     if (newThreading.size()) {
-        threading = newThreading;
-        ptrToInternal = newPtrToInternal;
+        // Swapping avoids a deep copy once the root node gets modified
+        threading.swap(newThreading);
+        m_sourceRowToInternal = newSourceRowToInternal;
+        uidToInternal = newUidToInternal;
         threading[ 0 ].children = allIds;
         threading[ 0 ].ptr = 0;
-        threadingHelperLastId = newThreading.size();
+        threadingHelperLastId = upstreamMessages;
         threadedRootIds = threading[0].children;
     }
     updatePersistentIndexesPhase2();
@@ -503,6 +1185,7 @@ void ThreadingMsgListModel::updateNoThreading()
 void ThreadingMsgListModel::wantThreading(const SkipSortSearch skipSortSearch)
 {
     if (!sourceModel() || !sourceModel()->rowCount() || !m_shallBeThreading) {
+        m_localThreadingActive = false;
         updateNoThreading();
         if (skipSortSearch == AUTO_SORT_SEARCH) {
             searchSortPreferenceImplementation(m_currentSearchConditions, m_currentSortingCriteria, m_sortReverse ? Qt::DescendingOrder : Qt::AscendingOrder);
@@ -542,6 +1225,15 @@ void ThreadingMsgListModel::wantThreading(const SkipSortSearch skipSortSearch)
     TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(static_cast<TreeItem*>(realIndex.parent().internalPointer()));
     Q_ASSERT(list);
 
+    if (preferredThreadingAlgorithm(realModel).isEmpty()) {
+        // No THREAD command, so we have to do it ourselves
+        m_localThreadingActive = true;
+        applyLocalThreading(list);
+        return;
+    }
+    m_localThreadingActive = false;
+    requestedAlgorithm = preferredThreadingAlgorithm(realModel);
+
     // Something has happened and we want to process the THREAD response
     QVector<Imap::Responses::ThreadingNode> mapping = realModel->cache()->messageThreading(mailbox.data(RoleMailboxName).toString());
 
@@ -558,12 +1250,11 @@ void ThreadingMsgListModel::wantThreading(const SkipSortSearch skipSortSearch)
     } else {
         // There's apparently at least one known UID whose threading info we do not know; that means that we have to ask the
         // server here.
-        QList<TreeItem*>::iterator roughlyLastKnown =
-                const_cast<Model*>(realModel)->findMessageOrNextOneByUid(list, highestUidInThreadingLowerBound);
-        if (list->m_children.end() - roughlyLastKnown >= 50 || roughlyLastKnown == list->m_children.begin()) {
+        const int roughlyLastKnown = Model::findMessageOrNextOneByUid(list, highestUidInThreadingLowerBound);
+        if (list->m_children.size() - roughlyLastKnown >= 50 || roughlyLastKnown == 0) {
             askForThreading();
         } else {
-            askForThreading(static_cast<TreeItemMessage*>(*roughlyLastKnown)->uid() + 1);
+            askForThreading(list->messageUid(roughlyLastKnown) + 1);
         }
     }
 }
@@ -572,7 +1263,7 @@ uint ThreadingMsgListModel::findHighestUidInMailbox(TreeItemMsgList *list)
 {
     uint highestUidInMailbox = 0;
     for (int i = sourceModel()->rowCount() - 1; i > -1 && !highestUidInMailbox; --i) {
-        highestUidInMailbox = dynamic_cast<TreeItemMessage*>(list->m_children[i])->uid();
+        highestUidInMailbox = list->messageUid(i);
     }
     return highestUidInMailbox;
 }
@@ -620,13 +1311,7 @@ void ThreadingMsgListModel::askForThreading(const uint firstUnknownUid)
     Imap::Mailbox::Model::realTreeItem(someMessage, &realModel, &realIndex);
     QModelIndex mailboxIndex = realIndex.parent().parent();
 
-    if (realModel->capabilities().contains(QLatin1String("THREAD=REFS"))) {
-        requestedAlgorithm = "REFS";
-    } else if (realModel->capabilities().contains(QLatin1String("THREAD=REFERENCES"))) {
-        requestedAlgorithm = "REFERENCES";
-    } else if (realModel->capabilities().contains(QLatin1String("THREAD=ORDEREDSUBJECT"))) {
-        requestedAlgorithm = "ORDEREDSUBJECT";
-    }
+    requestedAlgorithm = preferredThreadingAlgorithm(realModel);
 
     if (! requestedAlgorithm.isEmpty()) {
         threadingInFlight = true;
@@ -650,6 +1335,47 @@ void ThreadingMsgListModel::askForThreading(const uint firstUnknownUid)
     }
 }
 
+QByteArray ThreadingMsgListModel::preferredThreadingAlgorithm(const Model *model)
+{
+    const QStringList capabilities = model->capabilities();
+    Q_FOREACH(const QString &capability, supportedCapabilities()) {
+        if (capabilities.contains(capability))
+            return capability.section(QLatin1Char('='), 1).toUtf8();
+    }
+    return QByteArray();
+}
+
+void ThreadingMsgListModel::applyLocalThreading(TreeItemMsgList *list)
+{
+    // Messages whose headers are not available yet are shown as separate threads for now. The headers are not requested here;
+    // they arrive as the views ask for the messages, and then delayedLocalThreading() moves the messages to their proper place.
+    QVector<Responses::ThreadingNode> pending;
+    for (int i = 0; i < list->m_children.size(); ++i) {
+        const uint uid = list->messageUid(i);
+        if (!uid || m_localThreading.contains(uid))
+            continue;
+        TreeItemMessage *message = list->existingMessage(i);
+        if (message && message->fetched())
+            addToLocalThreading(message);
+        else
+            pending.append(Responses::ThreadingNode(uid));
+    }
+
+    QVector<Responses::ThreadingNode> mapping = m_localThreading.threading();
+    mapping += pending;
+    applyThreading(mapping);
+}
+
+void ThreadingMsgListModel::addToLocalThreading(TreeItemMessage *message)
+{
+    // RFC 5256 says to use the first message ID from the In-Reply-To when there are no References
+    const MessageMetadata &metadata = message->metadata();
+    QList<QByteArray> references = metadata.hdrReferences;
+    if (references.isEmpty() && !metadata.envelope.inReplyTo.isEmpty())
+        references << metadata.envelope.inReplyTo.first();
+    m_localThreading.addMessage(message->uid(), metadata.envelope.messageId, references);
+}
+
 /** @short Gather all UIDs present in the mapping and push them into the "uids" vector */
 static void gatherAllUidsFromThreadNode(QVector<uint> &uids, const QVector<Responses::ThreadingNode> &list)
 {
@@ -661,14 +1387,7 @@ static void gatherAllUidsFromThreadNode(QVector<uint> &uids, const QVector<Respo
 
 void ThreadingMsgListModel::slotIncrementalThreadingAvailable(const Responses::ESearch::IncrementalThreadingData_t &data)
 {
-    // Preparation: get through to the real model
-    const Imap::Mailbox::Model *realModel;
-    QModelIndex someMessage = sourceModel()->index(0,0);
-    Q_ASSERT(someMessage.isValid());
-    QModelIndex realIndex;
-    Imap::Mailbox::Model::realTreeItem(someMessage, &realModel, &realIndex);
-    QModelIndex mailboxIndex = realIndex.parent().parent();
-    Q_ASSERT(mailboxIndex.isValid());
+    threadingInFlight = false;
 
     // First phase: remove all messages mentioned in the incremental responses from their original placement
     QVector<uint> affectedUids;
@@ -676,19 +1395,20 @@ void ThreadingMsgListModel::slotIncrementalThreadingAvailable(const Responses::E
         gatherAllUidsFromThreadNode(affectedUids, it->thread);
     }
     qSort(affectedUids);
-    QList<TreeItemMessage*> affectedMessages = const_cast<Model*>(realModel)->
-            findMessagesByUids(static_cast<TreeItemMailbox*>(mailboxIndex.internalPointer()), affectedUids.toList());
     QHash<uint,void *> uidToPtrCache;
 
 
     emit layoutAboutToBeChanged();
     updatePersistentIndexesPhase1();
-    for (QList<TreeItemMessage*>::const_iterator it = affectedMessages.constBegin(); it != affectedMessages.constEnd(); ++it) {
-        QHash<void *,uint>::const_iterator ptrMappingIt = ptrToInternal.constFind(*it);
-        Q_ASSERT(ptrMappingIt != ptrToInternal.constEnd());
-        QHash<uint,ThreadNodeInfo>::iterator threadIt = threading.find(*ptrMappingIt);
-        Q_ASSERT(threadIt != threading.end());
-        uidToPtrCache[(*it)->uid()] = threadIt->ptr;
+    Q_FOREACH(const uint uid, affectedUids) {
+        // UIDs which are no longer in the mailbox have no node
+        const uint internalId = uidToInternal.value(uid);
+        ThreadNodeStorage::iterator threadIt = threading.find(internalId);
+        if (!internalId || threadIt == threading.end() || threadIt->uid != uid)
+            continue;
+        uidToPtrCache[uid] = threadIt->ptr;
+        // This turns it into a fake node until registerThreading() puts it at its new place
+        threadIt->uid = 0;
         threadIt->ptr = 0;
     }
     pruneTree();
@@ -720,6 +1440,7 @@ void ThreadingMsgListModel::slotIncrementalThreadingAvailable(const Responses::E
 
 void ThreadingMsgListModel::slotIncrementalThreadingFailed()
 {
+    threadingInFlight = false;
 }
 
 bool ThreadingMsgListModel::shouldIgnoreThisThreadingResponse(const QModelIndex &mailbox, const QByteArray &algorithm,
@@ -798,6 +1519,8 @@ void ThreadingMsgListModel::slotThreadingAvailable(const QModelIndex &mailbox, c
 
 void ThreadingMsgListModel::slotSortingAvailable(const QList<uint> &uids)
 {
+    m_slowSearch->stop();
+    saveSortingToCache(uids);
     if (!m_sortTask->isPersistent()) {
         disconnect(m_sortTask, 0, this, SLOT(slotSortingAvailable(QList<uint>)));
         disconnect(m_sortTask, 0, this, SLOT(slotSortingFailed()));
@@ -807,13 +1530,47 @@ void ThreadingMsgListModel::slotSortingAvailable(const QList<uint> &uids)
     }
 
     m_currentSortResult = uids;
+    m_partialSearchLoaded = 0;
     if (m_searchValidity == RESULT_ASKED)
         m_searchValidity = RESULT_FRESH;
     wantThreading();
 }
 
+void ThreadingMsgListModel::slotPartialSortingAvailable(const QList<uint> &uids, const uint offset, const uint total)
+{
+    if (sender() != m_sortTask) {
+        // This is an answer to a request which has been superseded since then
+        return;
+    }
+    m_slowSearch->stop();
+    disconnect(m_sortTask, 0, this, SLOT(slotSortingAvailable(QList<uint>)));
+    disconnect(m_sortTask, 0, this, SLOT(slotPartialSortingAvailable(QList<uint>,uint,uint)));
+    disconnect(m_sortTask, 0, this, SLOT(slotSortingFailed()));
+    m_sortTask = 0;
+
+    if (offset) {
+        if (m_searchValidity != RESULT_FRESH || offset != m_partialSearchLoaded) {
+            // The result has been thrown away in the meanwhile, the search will be started from scratch
+            wantThreading();
+            return;
+        }
+        if (m_partialSearchReverse)
+            m_currentSortResult = uids + m_currentSortResult;
+        else
+            m_currentSortResult += uids;
+    } else {
+        m_currentSortResult = uids;
+        if (m_searchValidity == RESULT_ASKED)
+            m_searchValidity = RESULT_FRESH;
+    }
+    m_partialSearchLoaded = offset + m_searchPageSize;
+    m_partialSearchTotal = total;
+    wantThreading();
+}
+
 void ThreadingMsgListModel::slotSortingFailed()
 {
+    m_slowSearch->stop();
     disconnect(m_sortTask, 0, this, SLOT(slotSortingAvailable(QList<uint>)));
     disconnect(m_sortTask, 0, this, SLOT(slotSortingFailed()));
     disconnect(m_sortTask, 0, this, SLOT(slotSortingIncrementalUpdate(Imap::Responses::ESearch::IncrementalContextData_t)));
@@ -830,31 +1587,53 @@ void ThreadingMsgListModel::slotSortingIncrementalUpdate(const Responses::ESearc
     for (Responses::ESearch::IncrementalContextData_t::const_iterator it = updates.constBegin(); it != updates.constEnd(); ++it) {
         switch (it->modification) {
         case Responses::ESearch::ContextIncrementalItem::ADDTO:
-            for (int i = 0; i < it->uids.size(); ++i)  {
-                int offset = it->offset + i;
-                if (offset < 0 || offset >= m_currentSortResult.size()) {
-                    throw MailboxException("ESEARCH: ADDTO out of bounds");
-                }
-                m_currentSortResult.insert(offset, it->uids[i]);
+        {
+            if (it->uids.isEmpty())
+                break;
+            const int offset = it->offset;
+            if (offset < 0 || offset >= m_currentSortResult.size()) {
+                throw MailboxException("ESEARCH: ADDTO out of bounds");
             }
+            // Splice the whole range at once instead of shifting the tail for each UID
+            QList<uint> res;
+#if QT_VERSION >= 0x040700
+            res.reserve(m_currentSortResult.size() + it->uids.size());
+#endif
+            res += m_currentSortResult.mid(0, offset);
+            res += it->uids;
+            res += m_currentSortResult.mid(offset);
+            m_currentSortResult = res;
             break;
+        }
 
         case Responses::ESearch::ContextIncrementalItem::REMOVEFROM:
+            if (it->offset == 0) {
+                // When the offset is not given, we have to find it ourselves; a single pass is enough for all of them
+                QSet<uint> removed;
+                removed.reserve(it->uids.size());
+                for (int i = 0; i < it->uids.size(); ++i)
+                    removed.insert(it->uids[i]);
+                QList<uint> res;
+#if QT_VERSION >= 0x040700
+                res.reserve(m_currentSortResult.size());
+#endif
+                Q_FOREACH(const uint uid, m_currentSortResult) {
+                    if (!removed.remove(uid))
+                        res.append(uid);
+                }
+                m_currentSortResult = res;
+                break;
+            }
             for (int i = 0; i < it->uids.size(); ++i)  {
-                if (it->offset == 0) {
-                    // When the offset is not given, we have to find it ourselves
-                    m_currentSortResult.removeOne(it->uids[i]);
-                } else {
-                    // We're given an offset, so let's make sure it is a correct one
-                    int offset = it->offset + i - 1;
-                    if (offset < 0 || offset >= m_currentSortResult.size()) {
-                        throw MailboxException("ESEARCH: REMOVEFROM out of bounds");
-                    }
-                    if (m_currentSortResult[offset] != it->uids[i]) {
-                        throw MailboxException("ESEARCH: REMOVEFROM UID mismatch");
-                    }
-                    m_currentSortResult.removeAt(offset);
+                // We're given an offset, so let's make sure it is a correct one
+                int offset = it->offset + i - 1;
+                if (offset < 0 || offset >= m_currentSortResult.size()) {
+                    throw MailboxException("ESEARCH: REMOVEFROM out of bounds");
                 }
+                if (m_currentSortResult[offset] != it->uids[i]) {
+                    throw MailboxException("ESEARCH: REMOVEFROM UID mismatch");
+                }
+                m_currentSortResult.removeAt(offset);
             }
             break;
         }
@@ -867,11 +1646,12 @@ void ThreadingMsgListModel::slotSortingIncrementalUpdate(const Responses::ESearc
 void ThreadingMsgListModel::calculateNullSort()
 {
     m_currentSortResult.clear();
+    m_partialSearchLoaded = 0;
 #if QT_VERSION >= 0x040700
     m_currentSortResult.reserve(threadedRootIds.size());
 #endif
     Q_FOREACH(const uint internalId, threadedRootIds) {
-        QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(internalId);
+        ThreadNodeStorage::const_iterator it = threading.constFind(internalId);
         if (it == threading.constEnd())
             continue;
         if (it->uid)
@@ -880,6 +1660,15 @@ void ThreadingMsgListModel::calculateNullSort()
     m_searchValidity = RESULT_FRESH;
 }
 
+QModelIndex ThreadingMsgListModel::indexForThreadNode(const uint internalId) const
+{
+    if (!internalId)
+        return QModelIndex();
+    ThreadNodeStorage::const_iterator it = threading.constFind(internalId);
+    Q_ASSERT(it != threading.constEnd());
+    return createIndex(it->offset, 0, internalId);
+}
+
 void ThreadingMsgListModel::applyThreading(const QVector<Imap::Responses::ThreadingNode> &mapping)
 {
     if (! unknownUids.isEmpty()) {
@@ -893,7 +1682,8 @@ void ThreadingMsgListModel::applyThreading(const QVector<Imap::Responses::Thread
     updatePersistentIndexesPhase1();
 
     threading.clear();
-    ptrToInternal.clear();
+    uidToInternal.clear();
+    forgetArrivals();
     // Default-construct the root node
     threading[ 0 ].ptr = 0;
 
@@ -905,35 +1695,30 @@ void ThreadingMsgListModel::applyThreading(const QVector<Imap::Responses::Thread
     QSet<uint> usedNodes;
     uidToPtrCache.reserve(upstreamMessages);
     threading.reserve(upstreamMessages);
-    ptrToInternal.reserve(upstreamMessages);
+    m_sourceRowToInternal.fill(0, upstreamMessages);
+    uidToInternal.reserve(upstreamMessages);
 
     if (upstreamMessages) {
-        // Work with pointers instead going through the MVC API for performance.
+        // Work with the list directly instead going through the MVC API for performance.
         // This matters (at least that's what by benchmarks said).
-        QModelIndex firstMessageIndex = sourceModel()->index(0, 0);
-        Q_ASSERT(firstMessageIndex.isValid());
-        const Model *realModel = 0;
-        TreeItem *firstMessagePtr = Model::realTreeItem(firstMessageIndex, &realModel);
-        Q_ASSERT(firstMessagePtr);
-        // If the next asserts fails, it means that the implementation of MsgListModel has changed and uses its own pointers
-        Q_ASSERT(firstMessagePtr == firstMessageIndex.internalPointer());
-        TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(firstMessagePtr->parent());
+        TreeItemMsgList *list = sourceMessageList();
         Q_ASSERT(list);
         for (int i = 0; i < upstreamMessages; ++i) {
             ThreadNodeInfo node;
-            node.uid = dynamic_cast<TreeItemMessage *>(list->m_children[i])->uid();
+            node.uid = list->messageUid(i);
             if (! node.uid) {
                 throw UnknownMessageIndex("Encountered a message with zero UID when threading. This is a bug in Trojita, sorry.");
             }
 
             node.internalId = i + 1;
-            node.ptr = list->m_children[i];
-            uidToPtrCache[node.uid] = node.ptr;
+            // The UID identifies the message, so there's no need for its TreeItemMessage
+            uidToPtrCache[node.uid] = 0;
             threadingHelperLastId = node.internalId;
             // We're creating a new node here
             Q_ASSERT(!threading.contains(node.internalId));
             threading[ node.internalId ] = node;
-            ptrToInternal[ node.ptr ] = node.internalId;
+            m_sourceRowToInternal[i] = node.internalId;
+            uidToInternal[node.uid] = node.internalId;
         }
     }
 
@@ -944,14 +1729,18 @@ void ThreadingMsgListModel::applyThreading(const QVector<Imap::Responses::Thread
     registerThreading(mapping, 0, uidToPtrCache, usedNodes);
 
     // Now remove all messages which were not referenced in the THREAD response from our mapping
-    QHash<uint,ThreadNodeInfo>::iterator it = threading.begin();
+    ThreadNodeStorage::iterator it = threading.begin();
     while (it != threading.end()) {
         if (usedNodes.contains(it.key())) {
             // this message should be shown
             ++it;
         } else {
             // this message is not included in the list of messages actually to be shown
-            ptrToInternal.remove(it->ptr);
+            const int row = sourceRowForNode(*it);
+            if (row != -1)
+                m_sourceRowToInternal[row] = 0;
+            if (it->uid)
+                uidToInternal.remove(it->uid);
             it = threading.erase(it);
         }
     }
@@ -959,6 +1748,7 @@ void ThreadingMsgListModel::applyThreading(const QVector<Imap::Responses::Thread
     updatePersistentIndexesPhase2();
     if (rowCount())
         threadedRootIds = threading[0].children;
+    m_threadingApplied = true;
     emit layoutChanged();
 
     // If the sorting was active before, we shall reactivate it now
@@ -986,12 +1776,13 @@ void ThreadingMsgListModel::registerThreading(const QVector<Imap::Responses::Thr
             threading[ fake.internalId ] = fake;
             nodeId = fake.internalId;
         } else {
-            QHash<void *,uint>::const_iterator nodeIt = ptrToInternal.constFind(*ptrIt);
-            // The following assert would fail if there was a node with a valid UID, but not in our ptrToInternal mapping.
+            QHash<uint,uint>::const_iterator nodeIt = uidToInternal.constFind(node.num);
+            // The following assert would fail if there was a node with a valid UID, but not in our uidToInternal mapping.
             // That is however non-issue, as we pre-create nodes for all messages beforehand.
-            Q_ASSERT(nodeIt != ptrToInternal.constEnd());
+            Q_ASSERT(nodeIt != uidToInternal.constEnd());
             nodeId = *nodeIt;
             // This is needed for the incremental stuff
+            threading[nodeId].uid = node.num;
             threading[nodeId].ptr = static_cast<TreeItem*>(*ptrIt);
         }
         threading[nodeId].offset = threading[parentId].children.size();
@@ -1002,52 +1793,102 @@ void ThreadingMsgListModel::registerThreading(const QVector<Imap::Responses::Thr
     }
 }
 
-/** @short Gather a list of persistent indexes which we have to transform after out layout change */
+/** @short Start tracking the nodes which get moved by our change in the layout */
 void ThreadingMsgListModel::updatePersistentIndexesPhase1()
 {
-    oldPersistentIndexes = persistentIndexList();
-    oldPtrs.clear();
-    Q_FOREACH(const QModelIndex &idx, oldPersistentIndexes) {
-        // the index could get invalidated by the pruneTree() or something else manipulating our threading
-        bool isOk = idx.isValid() && threading.contains(idx.internalId());
-        if (!isOk) {
-            oldPtrs << 0;
-            continue;
-        }
-        QModelIndex translated = mapToSource(idx);
-        if (!translated.isValid()) {
-            // another stale item
-            oldPtrs << 0;
-            continue;
-        }
-        oldPtrs << translated.internalPointer();
-    }
+    threading.startTracking();
 }
 
-/** @short Update the gathered persistent indexes after our change in the layout */
+/** @short Update the persistent indexes of the nodes which have been modified since updatePersistentIndexesPhase1()
+
+Only the nodes which were touched are checked, so this doesn't depend on the number of the persistent indexes at all.
+*/
 void ThreadingMsgListModel::updatePersistentIndexesPhase2()
 {
-    Q_ASSERT(oldPersistentIndexes.size() == oldPtrs.size());
-    QList<QModelIndex> updatedIndexes;
-    for (int i = 0; i < oldPersistentIndexes.size(); ++i) {
-        QHash<void *,uint>::const_iterator ptrIt = ptrToInternal.constFind(oldPtrs[i]);
-        if (ptrIt == ptrToInternal.constEnd()) {
-            // That message is no longer there
-            updatedIndexes.append(QModelIndex());
+    const QVector<ThreadNodeStorage::Change> changes = threading.takeChanges();
+    QModelIndexList changedFrom, changedTo;
+    Q_FOREACH(const ThreadNodeStorage::Change &change, changes) {
+        if (!change.id || !change.existed) {
+            // Nobody can refer to the root or to a node which has been created meanwhile
             continue;
         }
-        QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(*ptrIt);
-        if (it == threading.constEnd()) {
-            // Filtering doesn't accept this index, let's declare it dead
-            updatedIndexes.append(QModelIndex());
-        } else {
-            updatedIndexes.append(createIndex(it->offset, oldPersistentIndexes[i].column(), it->internalId));
+        ThreadNodeStorage::const_iterator it = threading.constEnd();
+        if (change.ptr || change.uid) {
+            // Sorting and pruning keep the internal IDs, so the lookup through the message is only needed after re-threading
+            it = threading.constFind(change.id);
+            if (it == threading.constEnd() || it->ptr != change.ptr || it->uid != change.uid) {
+                // If the message is no longer there or if filtering doesn't accept it, the index is dead
+                uint internalId = 0;
+                if (change.ptr) {
+                    internalId = internalIdForSourceRow(change.ptr->row());
+                } else {
+                    internalId = uidToInternal.value(change.uid);
+                    if (internalId && threading.constFind(internalId)->uid != change.uid)
+                        internalId = 0;
+                }
+                it = internalId ? threading.constFind(internalId) : threading.constEnd();
+            }
+        }
+        if (it != threading.constEnd() && it.key() == change.id && it->offset == change.offset)
+            continue;
+        for (int column = 0; column < MsgListModel::COLUMN_COUNT; ++column) {
+            changedFrom.append(createIndex(change.offset, column, change.id));
+            changedTo.append(it == threading.constEnd() ? QModelIndex() : createIndex(it->offset, column, it->internalId));
         }
     }
-    Q_ASSERT(oldPersistentIndexes.size() == updatedIndexes.size());
-    changePersistentIndexList(oldPersistentIndexes, updatedIndexes);
-    oldPersistentIndexes.clear();
-    oldPtrs.clear();
+    // Indexes which nobody holds are simply skipped by the QAbstractItemModel
+    changePersistentIndexList(changedFrom, changedTo);
+}
+
+/** @short Return the internal ID of the node which shows the message at the @arg row of the source model, or zero if there's no such node */
+uint ThreadingMsgListModel::internalIdForSourceRow(const int row) const
+{
+    if (row < 0 || row >= m_sourceRowToInternal.size())
+        return 0;
+    const uint internalId = m_sourceRowToInternal[row];
+    ThreadNodeStorage::const_iterator it = threading.constFind(internalId);
+    if (!internalId || it == threading.constEnd())
+        return 0;
+    TreeItemMsgList *list = sourceMessageList();
+    if (!list)
+        return 0;
+    if (it->ptr)
+        return it->ptr == list->existingMessage(row) ? internalId : 0;
+    return it->uid && it->uid == list->messageUid(row) ? internalId : 0;
+}
+
+/** @short Return the list of messages which the source MsgListModel shows, or null if there's none */
+TreeItemMsgList *ThreadingMsgListModel::sourceMessageList() const
+{
+    MsgListModel *msgList = qobject_cast<MsgListModel *>(sourceModel());
+    if (!msgList)
+        return 0;
+    msgList->checkPersistentIndex();
+    return msgList->msgListPtr;
+}
+
+/** @short Return the row of the source model which shows the message of this @arg node, or -1 for the fake nodes
+
+The messages whose UID is known are looked up by their UID, so that their TreeItemMessage need not exist.
+*/
+int ThreadingMsgListModel::sourceRowForNode(const ThreadNodeInfo &node) const
+{
+    if (node.ptr)
+        return node.ptr->row();
+    if (!node.uid)
+        return -1;
+    TreeItemMsgList *list = sourceMessageList();
+    if (!list)
+        return -1;
+    const int row = Model::findMessageOrNextOneByUid(list, node.uid);
+    return row < list->m_children.size() && list->messageUid(row) == node.uid ? row : -1;
+}
+
+/** @short Return the TreeItemMessage of this @arg node, or null if it's a fake node or if the message has not been needed yet */
+TreeItemMessage *ThreadingMsgListModel::existingMessageForNode(const ThreadNodeInfo &node) const
+{
+    const int row = sourceRowForNode(node);
+    return row == -1 ? 0 : sourceMessageList()->existingMessage(row);
 }
 
 void ThreadingMsgListModel::pruneTree()
@@ -1058,28 +1899,30 @@ void ThreadingMsgListModel::pruneTree()
     // of the iteration I'm right now, the next node to process should be that one, and then we should resume with the rest").
     QList<uint> pending = threading.keys();
     for (QList<uint>::iterator id = pending.begin(); id != pending.end(); /* nothing */) {
-        // Convert to the hashmap
-        // The "it" iterator point to the current node in the threading mapping
-        QHash<uint, ThreadNodeInfo>::iterator it = threading.find(*id);
-        if (it == threading.end()) {
+        // Only look at the node at first, so that the untouched nodes are not reported as modified, see ThreadNodeStorage::Change
+        ThreadNodeStorage::const_iterator node = threading.constFind(*id);
+        if (node == threading.constEnd()) {
             // We've already seen this node, that's due to promoting
             ++id;
             continue;
         }
 
-        if (it->internalId == 0) {
+        if (node->internalId == 0) {
             // A special root item; we should not delete that one :)
             ++id;
             continue;
         }
-        if (it->ptr) {
+        if (node->isMessage()) {
             // regular and valid message -> skip
             ++id;
         } else {
             // a fake one
 
+            // The "it" iterator point to the current node in the threading mapping
+            ThreadNodeStorage::iterator it = threading.find(*id);
+
             // each node has a parent
-            QHash<uint, ThreadNodeInfo>::iterator parent = threading.find(it->parent);
+            ThreadNodeStorage::iterator parent = threading.find(it->parent);
             Q_ASSERT(parent != threading.end());
 
             // and the node itself has to be found in its parent's children
@@ -1097,7 +1940,7 @@ void ThreadingMsgListModel::pruneTree()
 
                 // Update offsets of all further nodes, siblings to the one we've just deleted
                 while (childIt != parent->children.end()) {
-                    QHash<uint, ThreadNodeInfo>::iterator sibling = threading.find(*childIt);
+                    ThreadNodeStorage::iterator sibling = threading.find(*childIt);
                     Q_ASSERT(sibling != threading.end());
                     --sibling->offset;
                     Q_ASSERT(sibling->offset >= 0);
@@ -1106,7 +1949,7 @@ void ThreadingMsgListModel::pruneTree()
             } else {
                 // This node has some children, so we can't just delete it. Instead of that, we promote its first child
                 // to replace this node.
-                QHash<uint, ThreadNodeInfo>::iterator replaceWith = threading.find(it->children.first());
+                ThreadNodeStorage::iterator replaceWith = threading.find(it->children.first());
                 Q_ASSERT(replaceWith != threading.end());
 
                 // Make sure that the offsets are still correct
@@ -1123,7 +1966,7 @@ void ThreadingMsgListModel::pruneTree()
 
                 // Fix parent and offset information of all children of the replacement node
                 for (int i = 0; i < replaceWith->children.size(); ++i) {
-                    QHash<uint, ThreadNodeInfo>::iterator sibling = threading.find(replaceWith->children[i]);
+                    ThreadNodeStorage::iterator sibling = threading.find(replaceWith->children[i]);
                     Q_ASSERT(sibling != threading.end());
 
                     sibling->parent = replaceWith.key();
@@ -1140,7 +1983,7 @@ void ThreadingMsgListModel::pruneTree()
                 // Now that all references are gone, remove the original node
                 threading.erase(it);
 
-                if (!replaceWith->ptr) {
+                if (!replaceWith->isMessage()) {
                     // If the just-promoted item is also a fake one, we'll have to visit it as well. This assignment is safe,
                     // because we've already processed the current item and are completely done with it. The worst which can
                     // happen is that we'll visit the same node twice, which is reasonably acceptable.
@@ -1181,19 +2024,18 @@ Qt::DropActions ThreadingMsgListModel::supportedDropActions() const
 bool ThreadingMsgListModel::threadContainsUnreadMessages(const uint root) const
 {
     // FIXME: cache the value somewhere...
+    TreeItemMsgList *list = sourceMessageList();
+    Q_ASSERT(list);
     QList<uint> queue;
     queue.append(root);
     while (! queue.isEmpty()) {
         uint current = queue.takeFirst();
-        QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(current);
+        ThreadNodeStorage::const_iterator it = threading.constFind(current);
         Q_ASSERT(it != threading.constEnd());
-        if (it->ptr) {
-            // Because of the delayed delete via pruneTree, we can hit a null pointer here
-            TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(it->ptr);
-            Q_ASSERT(message);
-            if (! message->isMarkedAsRead())
-                return true;
-        }
+        // Because of the delayed delete via pruneTree, we can hit a fake node here
+        const int row = sourceRowForNode(*it);
+        if (row != -1 && !list->isMessageMarkedAsRead(row))
+            return true;
         queue.append(it->children);
     }
     return false;
@@ -1246,6 +2088,8 @@ bool ThreadingMsgListModel::setUserSearchingSortingPreference(const QStringList
 bool ThreadingMsgListModel::searchSortPreferenceImplementation(const QStringList &searchConditions, const SortCriterium criterium, const Qt::SortOrder order)
 {
     Q_ASSERT(sourceModel());
+    m_localSortingPending = false;
+    m_unverifiedSortingMailbox = QModelIndex();
     if (!sourceModel()->rowCount()) {
         return false;
     }
@@ -1255,6 +2099,8 @@ bool ThreadingMsgListModel::searchSortPreferenceImplementation(const QStringList
     QModelIndex realIndex;
     Model::realTreeItem(someMessage, &realModel, &realIndex);
     QModelIndex mailboxIndex = realIndex.parent().parent();
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(static_cast<TreeItem*>(realIndex.parent().internalPointer()));
+    Q_ASSERT(list);
 
     bool hasDisplaySort = false;
     bool hasSort = false;
@@ -1267,6 +2113,18 @@ bool ThreadingMsgListModel::searchSortPreferenceImplementation(const QStringList
     }
 
     m_sortReverse = order == Qt::DescendingOrder;
+
+    if (!searchConditions.isEmpty() && !realModel->isNetworkAvailable()) {
+        // The server is out of reach, so let's at least look at what is in the cache
+        if (!applyLocalSearch(searchConditions, criterium, list, const_cast<Model*>(realModel)))
+            return false;
+        m_currentSearchConditions = searchConditions;
+        m_currentSortingCriteria = criterium;
+        // An answer from the local index is never final, the search will be repeated the next time
+        m_searchValidity = RESULT_INVALIDATED;
+        return true;
+    }
+
     QStringList sortOptions;
     switch (criterium) {
     case SORT_ARRIVAL:
@@ -1305,15 +2163,26 @@ bool ThreadingMsgListModel::searchSortPreferenceImplementation(const QStringList
             calculateNullSort();
             applySort();
             return true;
-        } else if (searchConditions != m_currentSearchConditions || m_searchValidity != RESULT_FRESH) {
-            // We have to update our search conditions
-            m_sortTask = realModel->m_taskFactory->createSortTask(const_cast<Model *>(realModel), mailboxIndex, searchConditions,
-                                                                  QStringList());
-            connect(m_sortTask, SIGNAL(sortingAvailable(QList<uint>)), this, SLOT(slotSortingAvailable(QList<uint>)));
-            connect(m_sortTask, SIGNAL(sortingFailed()), this, SLOT(slotSortingFailed()));
-            connect(m_sortTask, SIGNAL(incrementalSortUpdate(Imap::Responses::ESearch::IncrementalContextData_t)),
-                    this, SLOT(slotSortingIncrementalUpdate(Imap::Responses::ESearch::IncrementalContextData_t)));
+        } else if (searchConditions != m_currentSearchConditions || m_searchValidity != RESULT_FRESH ||
+                   (m_partialSearchLoaded && m_partialSearchLoaded < m_partialSearchTotal &&
+                    m_partialSearchReverse != m_sortReverse)) {
+            // We have to update our search conditions, or the loaded pages are at the wrong end of the result
             m_currentSearchConditions = searchConditions;
+            bool cacheIsFresh = false;
+            if (useCachedSorting(realModel, mailboxIndex, searchConditions, QStringList(), &cacheIsFresh)) {
+                applySort();
+                if (cacheIsFresh) {
+                    m_searchValidity = RESULT_FRESH;
+                    return true;
+                }
+            }
+            if (m_searchPageSize && realModel->capabilities().contains(QLatin1String("CONTEXT=SEARCH")) &&
+                    static_cast<uint>(sourceModel()->rowCount()) > m_searchPageSize) {
+                // Huge mailboxes get their SEARCH results page by page, as the view scrolls down
+                startPartialSearchTask(realModel, mailboxIndex, searchConditions, 0);
+            } else {
+                startSortTask(realModel, mailboxIndex, searchConditions, QStringList());
+            }
             m_searchValidity = RESULT_ASKED;
         } else {
             // A result of SEARCH has just arrived
@@ -1325,8 +2194,18 @@ bool ThreadingMsgListModel::searchSortPreferenceImplementation(const QStringList
     }
 
     if (!hasSort) {
-        // sorting is completely unsupported
-        return false;
+        if (!searchConditions.isEmpty()) {
+            // We can sort the whole mailbox, but not the result of a search
+            return false;
+        }
+
+        if (m_sortTask && m_sortTask->isPersistent())
+            m_sortTask->cancelSortingUpdates();
+
+        m_currentSearchConditions = searchConditions;
+        m_currentSortingCriteria = criterium;
+        applyLocalSort(list, const_cast<Model*>(realModel));
+        return true;
     }
 
     Q_ASSERT(!sortOptions.isEmpty());
@@ -1337,23 +2216,273 @@ bool ThreadingMsgListModel::searchSortPreferenceImplementation(const QStringList
     } else {
         m_currentSearchConditions = searchConditions;
         m_currentSortingCriteria = criterium;
-        calculateNullSort();
-        applySort();
 
         if (m_sortTask && m_sortTask->isPersistent())
             m_sortTask->cancelSortingUpdates();
 
-        m_sortTask = realModel->m_taskFactory->createSortTask(const_cast<Model *>(realModel), mailboxIndex, searchConditions, sortOptions);
-        connect(m_sortTask, SIGNAL(sortingAvailable(QList<uint>)), this, SLOT(slotSortingAvailable(QList<uint>)));
-        connect(m_sortTask, SIGNAL(sortingFailed()), this, SLOT(slotSortingFailed()));
-        connect(m_sortTask, SIGNAL(incrementalSortUpdate(Imap::Responses::ESearch::IncrementalContextData_t)),
-                this, SLOT(slotSortingIncrementalUpdate(Imap::Responses::ESearch::IncrementalContextData_t)));
+        // Show whatever we remember from the last time right away; unless it's known to be current, the server is asked anyway
+        bool cacheIsFresh = false;
+        if (!useCachedSorting(realModel, mailboxIndex, searchConditions, sortOptions, &cacheIsFresh))
+            calculateNullSort();
+        applySort();
+        if (cacheIsFresh) {
+            m_searchValidity = RESULT_FRESH;
+            return true;
+        }
+
+        startSortTask(realModel, mailboxIndex, searchConditions, sortOptions);
         m_searchValidity = RESULT_ASKED;
     }
 
     return true;
 }
 
+/** @short Ask the server for SORT or SEARCH and fall back to the local index if the answer takes too long */
+void ThreadingMsgListModel::startSortTask(const Model *realModel, const QModelIndex &mailboxIndex,
+                                          const QStringList &searchConditions, const QStringList &sortOptions)
+{
+    m_sortTask = realModel->m_taskFactory->createSortTask(const_cast<Model *>(realModel), mailboxIndex, searchConditions, sortOptions);
+    m_requestedSortingMailbox = mailboxIndex;
+    m_requestedSortCriteria = sortOptions;
+    m_requestedSearchConditions = searchConditions;
+    connect(m_sortTask, SIGNAL(sortingAvailable(QList<uint>)), this, SLOT(slotSortingAvailable(QList<uint>)));
+    connect(m_sortTask, SIGNAL(sortingFailed()), this, SLOT(slotSortingFailed()));
+    connect(m_sortTask, SIGNAL(incrementalSortUpdate(Imap::Responses::ESearch::IncrementalContextData_t)),
+            this, SLOT(slotSortingIncrementalUpdate(Imap::Responses::ESearch::IncrementalContextData_t)));
+    if (searchConditions.isEmpty())
+        m_slowSearch->stop();
+    else
+        m_slowSearch->start();
+}
+
+/** @short Ask for a window of the SEARCH result starting at the zero-based @arg offset
+
+The offset is counted from the end of the result when the view is sorted in the descending order, because that's where
+the view starts. RFC 5267 uses negative positions for that.
+*/
+void ThreadingMsgListModel::startPartialSearchTask(const Model *realModel, const QModelIndex &mailboxIndex,
+                                                   const QStringList &searchConditions, const uint offset)
+{
+    if (!offset)
+        m_partialSearchReverse = m_sortReverse;
+    const int sign = m_partialSearchReverse ? -1 : 1;
+    m_sortTask = realModel->m_taskFactory->createPartialSearchTask(const_cast<Model *>(realModel), mailboxIndex, searchConditions,
+                                                                   sign * static_cast<int>(offset + 1),
+                                                                   sign * static_cast<int>(offset + m_searchPageSize));
+    m_requestedSortingMailbox = mailboxIndex;
+    m_requestedSortCriteria.clear();
+    m_requestedSearchConditions = searchConditions;
+    // The server might not support the PARTIAL after all, in which case the whole result arrives
+    connect(m_sortTask, SIGNAL(sortingAvailable(QList<uint>)), this, SLOT(slotSortingAvailable(QList<uint>)));
+    connect(m_sortTask, SIGNAL(partialSortingAvailable(QList<uint>,uint,uint)),
+            this, SLOT(slotPartialSortingAvailable(QList<uint>,uint,uint)));
+    connect(m_sortTask, SIGNAL(sortingFailed()), this, SLOT(slotSortingFailed()));
+    if (!offset)
+        m_slowSearch->start();
+}
+
+/** @short Load the result of the last SORT or SEARCH from the cache if it was computed for the same criteria
+
+Returns true if m_currentSortResult has been replaced by the cached copy. The @arg isFresh is set to true when the mailbox has not
+changed since the time the cached result was computed, i.e. when there's no need to ask the server again.
+
+Before the mailbox gets selected, and when working offline, the shown messages come from the cache, so the cached result is checked
+against the mailbox state which is stored in the cache. A result which looks fresh is checked once again as soon as the sync
+finishes, see slotMailboxSyncingProgress().
+*/
+bool ThreadingMsgListModel::useCachedSorting(const Model *realModel, const QModelIndex &mailboxIndex,
+                                             const QStringList &searchConditions, const QStringList &sortOptions, bool *isFresh)
+{
+    *isFresh = false;
+    m_unverifiedSortingMailbox = QModelIndex();
+    TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox*>(static_cast<TreeItem*>(mailboxIndex.internalPointer()));
+    Q_ASSERT(mailbox);
+    const AbstractCache::MessageSorting cached = realModel->cache()->messageSorting(mailbox->mailbox());
+    // The live state is only complete once the mailbox has been selected
+    const bool isSelected = mailbox->syncState.isUsableForSyncing();
+    const SyncState syncState = isSelected ? mailbox->syncState : realModel->cache()->mailboxSyncState(mailbox->mailbox());
+    if (cached.sortCriteria != sortOptions || cached.searchConditions != searchConditions ||
+            !cached.uidValidity || cached.uidValidity != syncState.uidValidity()) {
+        return false;
+    }
+
+    m_currentSortResult = cached.uids;
+    m_partialSearchLoaded = 0;
+    if (searchConditions.isEmpty()) {
+        // Messages which have arrived since then are not part of the cached result, but they shall remain visible
+        QSet<uint> known;
+        known.reserve(cached.uids.size());
+        Q_FOREACH(const uint uid, cached.uids)
+            known.insert(uid);
+        Q_FOREACH(const uint internalId, threadedRootIds) {
+            ThreadNodeStorage::const_iterator it = threading.constFind(internalId);
+            if (it != threading.constEnd() && it->uid && !known.contains(it->uid))
+                m_currentSortResult.append(it->uid);
+        }
+    }
+
+    *isFresh = isCachedSortingFresh(cached, syncState);
+    if (*isFresh && !isSelected) {
+        // The mailbox might have changed on the server since the last time we were looking
+        m_unverifiedSorting = cached;
+        m_unverifiedSortingMailbox = mailboxIndex;
+        connect(realModel, SIGNAL(mailboxSyncingProgress(QModelIndex,Imap::Mailbox::MailboxSyncingProgress)),
+                this, SLOT(slotMailboxSyncingProgress(QModelIndex,Imap::Mailbox::MailboxSyncingProgress)),
+                Qt::UniqueConnection);
+    }
+    return true;
+}
+
+/** @short Is the @arg cached result of SORT or SEARCH still valid for a mailbox in the @arg syncState? */
+bool ThreadingMsgListModel::isCachedSortingFresh(const AbstractCache::MessageSorting &cached, const SyncState &syncState)
+{
+    // A SORT of the whole mailbox only changes when messages arrive or get expunged, while the result of a SEARCH depends on the
+    // flags as well, which is only trackable through CONDSTORE
+    return cached.uidValidity == syncState.uidValidity() && cached.uidNext && cached.uidNext == syncState.uidNext() &&
+            (cached.searchConditions.isEmpty() ?
+                 cached.uids.size() == static_cast<int>(syncState.exists()) :
+                 cached.highestModSeq && cached.highestModSeq == syncState.highestModSeq());
+}
+
+/** @short The mailbox has been synced, so a cached result of SORT or SEARCH which has been used before can be verified now */
+void ThreadingMsgListModel::slotMailboxSyncingProgress(const QModelIndex &mailboxIndex, MailboxSyncingProgress state)
+{
+    if (state != STATE_DONE || !m_unverifiedSortingMailbox.isValid() || m_unverifiedSortingMailbox != mailboxIndex)
+        return;
+
+    const QModelIndex mailboxCopy = m_unverifiedSortingMailbox;
+    m_unverifiedSortingMailbox = QModelIndex();
+    if (m_searchValidity == RESULT_ASKED) {
+        // The server is being asked already
+        return;
+    }
+
+    TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox*>(static_cast<TreeItem*>(mailboxCopy.internalPointer()));
+    Q_ASSERT(mailbox);
+    if (isCachedSortingFresh(m_unverifiedSorting, mailbox->syncState))
+        return;
+
+    // The mailbox has changed while we weren't looking, so the server has to be asked after all
+    const Model *realModel = qobject_cast<const Model*>(mailboxCopy.model());
+    Q_ASSERT(realModel);
+    startSortTask(realModel, mailboxCopy, m_unverifiedSorting.searchConditions, m_unverifiedSorting.sortCriteria);
+    m_searchValidity = RESULT_ASKED;
+}
+
+/** @short Remember the result of the SortTask along with the current state of the mailbox */
+void ThreadingMsgListModel::saveSortingToCache(const QList<uint> &uids)
+{
+    if (!m_requestedSortingMailbox.isValid())
+        return;
+    TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox*>(static_cast<TreeItem*>(m_requestedSortingMailbox.internalPointer()));
+    Q_ASSERT(mailbox);
+    const Model *realModel = qobject_cast<const Model*>(m_requestedSortingMailbox.model());
+    Q_ASSERT(realModel);
+
+    AbstractCache::MessageSorting sorting;
+    sorting.sortCriteria = m_requestedSortCriteria;
+    sorting.searchConditions = m_requestedSearchConditions;
+    sorting.uids = uids;
+    sorting.uidValidity = mailbox->syncState.uidValidity();
+    sorting.uidNext = mailbox->syncState.uidNext();
+    sorting.highestModSeq = mailbox->syncState.highestModSeq();
+    realModel->cache()->setMessageSorting(mailbox->mailbox(), sorting);
+}
+
+/** @short Evaluate the search on the client side, using the full-text index of the cache
+
+Returns false if the search conditions contain something which the local index cannot answer.
+*/
+bool ThreadingMsgListModel::applyLocalSearch(const QStringList &searchConditions, const SortCriterium criterium,
+                                             TreeItemMsgList *list, Model *realModel)
+{
+    TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox*>(list->parent());
+    Q_ASSERT(mailbox);
+
+    // All top-level keys have to match
+    QSet<uint> matches;
+    int pos = 0;
+    bool first = true;
+    while (pos < searchConditions.size()) {
+        QSet<uint> keyMatches;
+        if (!evaluateLocalSearchKey(realModel->cache(), mailbox->mailbox(), searchConditions, pos, keyMatches))
+            return false;
+        if (first)
+            matches = keyMatches;
+        else
+            matches.intersect(keyMatches);
+        first = false;
+    }
+
+    LocalSorting::SortKey key;
+    if (localSortKey(criterium, &key)) {
+        bool complete;
+        const QList<uint> order = m_localSorting.sort(realModel, list, key, &complete);
+        m_localSortingPending = !complete;
+        m_currentSortResult.clear();
+        Q_FOREACH(const uint uid, order) {
+            if (matches.contains(uid))
+                m_currentSortResult.append(uid);
+        }
+    } else {
+        m_currentSortResult = matches.toList();
+        std::sort(m_currentSortResult.begin(), m_currentSortResult.end());
+    }
+    m_partialSearchLoaded = 0;
+    applySort();
+    return true;
+}
+
+/** @short Sort the mailbox on the client side, for servers without the SORT extension */
+void ThreadingMsgListModel::applyLocalSort(TreeItemMsgList *list, Model *realModel)
+{
+    LocalSorting::SortKey key;
+    if (!localSortKey(m_currentSortingCriteria, &key)) {
+        Q_ASSERT(false);
+        return;
+    }
+
+    // Messages whose metadata have not arrived yet are sorted as if their keys were empty; the sort will be redone once the data
+    // are available, see handleDataChanged().
+    bool complete;
+    m_currentSortResult = m_localSorting.sort(realModel, list, key, &complete);
+    m_partialSearchLoaded = 0;
+    m_localSortingPending = !complete;
+    m_searchValidity = RESULT_FRESH;
+    applySort();
+}
+
+/** @short Find out which key of the local sorting corresponds to the @arg criterium; returns false for SORT_NONE */
+bool ThreadingMsgListModel::localSortKey(const SortCriterium criterium, LocalSorting::SortKey *key)
+{
+    switch (criterium) {
+    case SORT_ARRIVAL:
+        *key = LocalSorting::KEY_ARRIVAL;
+        return true;
+    case SORT_CC:
+        *key = LocalSorting::KEY_CC;
+        return true;
+    case SORT_DATE:
+        *key = LocalSorting::KEY_DATE;
+        return true;
+    case SORT_FROM:
+        *key = LocalSorting::KEY_DISPLAYFROM;
+        return true;
+    case SORT_SIZE:
+        *key = LocalSorting::KEY_SIZE;
+        return true;
+    case SORT_SUBJECT:
+        *key = LocalSorting::KEY_SUBJECT;
+        return true;
+    case SORT_TO:
+        *key = LocalSorting::KEY_DISPLAYTO;
+        return true;
+    case SORT_NONE:
+        break;
+    }
+    return false;
+}
+
 void ThreadingMsgListModel::applySort()
 {
     if (!sourceModel()->rowCount()) {
@@ -1361,51 +2490,54 @@ void ThreadingMsgListModel::applySort()
         return;
     }
 
-    const Imap::Mailbox::Model *realModel;
-    QModelIndex someMessage = sourceModel()->index(0,0);
-    QModelIndex realIndex;
-    Model::realTreeItem(someMessage, &realModel, &realIndex);
-    TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox*>(static_cast<TreeItem*>(realIndex.parent().parent().internalPointer()));
-    Q_ASSERT(mailbox);
-
     emit layoutAboutToBeChanged();
     updatePersistentIndexesPhase1();
-    QSet<uint> newlyUnreachable(threading[0].children.toSet());
-    threading[0].children.clear();
-#if QT_VERSION >= 0x040700
-    threading[0].children.reserve(m_currentSortResult.size());
-#endif
 
-    QSet<uint> allRootIds(threadedRootIds.toSet());
+    // The offsets are reused for marking the nodes during the walk: -2 is for the nodes which were shown before, -1 for thread
+    // roots which might get shown. Everything which is shown afterwards gets its proper offset.
+    const QList<uint> previouslyShown = threading[0].children;
+    Q_FOREACH(const uint internalId, previouslyShown) {
+        ThreadNodeStorage::iterator it = threading.find(internalId);
+        Q_ASSERT(it != threading.end());
+        it->offset = -2;
+    }
+    Q_FOREACH(const uint internalId, threadedRootIds) {
+        ThreadNodeStorage::iterator it = threading.find(internalId);
+        if (it != threading.end())
+            it->offset = -1;
+    }
 
+    QList<uint> roots;
+#if QT_VERSION >= 0x040700
+    roots.reserve(m_currentSortResult.size());
+#endif
     for (int i = 0; i < m_currentSortResult.size(); ++i) {
         int offset = m_sortReverse ? m_currentSortResult.size() - 1 - i : i;
-        QList<TreeItemMessage *> messages = const_cast<Model*>(realModel)
-                ->findMessagesByUids(mailbox, QList<uint>() << m_currentSortResult[offset]);
-        if (messages.isEmpty()) {
+        QHash<uint,uint>::const_iterator idIt = uidToInternal.constFind(m_currentSortResult[offset]);
+        if (idIt == uidToInternal.constEnd()) {
             // wrong UID, weird
             continue;
         }
-        Q_ASSERT(messages.size() == 1);
-        QHash<void *,uint>::const_iterator it = ptrToInternal.constFind(messages.front());
-        Q_ASSERT(it != ptrToInternal.constEnd());
-        if (!allRootIds.contains(*it)) {
+        ThreadNodeStorage::iterator it = threading.find(*idIt);
+        if (it == threading.end() || it->offset != -1) {
             // not a thread root, so don't show it
             continue;
         }
-        threading[*it].offset = threading[0].children.size();
-        threading[0].children.append(*it);
+        it->offset = roots.size();
+        roots.append(*idIt);
     }
+    threading[0].children = roots;
 
     // Now remove everything which is no longer reachable from the root of the thread mapping
-    newlyUnreachable -= threading[0].children.toSet();
+    QList<uint> newlyUnreachable;
+    Q_FOREACH(const uint internalId, previouslyShown) {
+        if (threading[internalId].offset < 0)
+            newlyUnreachable.append(internalId);
+    }
     while (!newlyUnreachable.isEmpty()) {
-        QSet<uint>::iterator it = newlyUnreachable.begin();
-        uint item = *it;
-        newlyUnreachable.erase(it);
-        QHash<uint,ThreadNodeInfo>::iterator threadingIt = threading.find(item);
+        ThreadNodeStorage::iterator threadingIt = threading.find(newlyUnreachable.takeLast());
         Q_ASSERT(threadingIt != threading.end());
-        newlyUnreachable += threadingIt->children.toSet();
+        newlyUnreachable += threadingIt->children;
         threading.erase(threadingIt);
     }
 
@@ -1413,6 +2545,12 @@ void ThreadingMsgListModel::applySort()
     emit layoutChanged();
 }
 
+/** @short Set how many positions of a SEARCH result shall be requested at once; zero disables the paging */
+void ThreadingMsgListModel::setSearchPageSize(const uint size)
+{
+    m_searchPageSize = size;
+}
+
 QStringList ThreadingMsgListModel::currentSearchCondition() const
 {
     return m_currentSearchConditions;
@@ -24,12 +24,19 @@
 #define IMAP_THREADINGMSGLISTMODEL_H
 
 #include <QAbstractProxyModel>
+#include <QBitArray>
+#include <QPersistentModelIndex>
 #include <QPointer>
 #include <QSet>
+#include <QVector>
 #include "Imap/Parser/Response.h"
+#include "LocalSorting.h"
+#include "LocalThreading.h"
+#include "Model.h"
 
 class QTimer;
 class ImapModelThreadingTest;
+class ImapThreadingPerformanceTest;
 
 /** @short Namespace for IMAP interaction */
 namespace Imap
@@ -39,8 +46,10 @@ namespace Imap
 namespace Mailbox
 {
 
+class Model;
 class SortTask;
 class TreeItem;
+class TreeItemMessage;
 class TreeItemMsgList;
 
 /** @short A node in tree structure used for threading representation */
@@ -53,15 +62,123 @@ struct ThreadNodeInfo {
     uint parent;
     /** @short List of children of current node */
     QList<uint> children;
-    /** @short Pointer to the TreeItemMessage* of the corresponding message */
+    /** @short Pointer to the TreeItemMessage* of a message whose UID was not known when the node got created
+
+    The other messages are identified by their UID alone, so that their TreeItemMessage need not exist at all.
+    */
     TreeItem *ptr;
     /** @short Position among our parent's children */
     int offset;
     ThreadNodeInfo(): internalId(0), uid(0), parent(0), ptr(0), offset(0) {}
+    /** @short Is this a real message, as opposed to a fake one which only holds a thread together? */
+    bool isMessage() const { return uid || ptr; }
 };
 
 QDebug operator<<(QDebug debug, const ThreadNodeInfo &node);
 
+/** @short Storage for the ThreadNodeInfo nodes, indexed by their internal ID
+
+The internal IDs are handed out sequentially, so the nodes are kept in a contiguous array instead of a hash table and a lookup
+is a plain array access. The interface mimics the subset of QHash<uint,ThreadNodeInfo> which the ThreadingMsgListModel uses.
+Unlike the QHash ones, the iterators are just positions in the array, so they remain valid when other nodes get added.
+*/
+class ThreadNodeStorage
+{
+public:
+    class const_iterator;
+
+    class iterator
+    {
+    public:
+        iterator(): m_storage(0), m_id(0) {}
+        uint key() const { return m_id; }
+        ThreadNodeInfo &operator*() const { m_storage->touch(m_id); return m_storage->m_nodes[m_id]; }
+        ThreadNodeInfo *operator->() const { m_storage->touch(m_id); return &m_storage->m_nodes[m_id]; }
+        iterator &operator++() { m_id = m_storage->nextPresent(m_id + 1); return *this; }
+        bool operator==(const iterator &other) const { return m_id == other.m_id; }
+        bool operator!=(const iterator &other) const { return m_id != other.m_id; }
+    private:
+        iterator(ThreadNodeStorage *storage, const uint id): m_storage(storage), m_id(id) {}
+        ThreadNodeStorage *m_storage;
+        uint m_id;
+        friend class ThreadNodeStorage;
+        friend class const_iterator;
+    };
+
+    class const_iterator
+    {
+    public:
+        const_iterator(): m_storage(0), m_id(0) {}
+        const_iterator(const iterator &other): m_storage(other.m_storage), m_id(other.m_id) {}
+        uint key() const { return m_id; }
+        const ThreadNodeInfo &operator*() const { return m_storage->m_nodes[m_id]; }
+        const ThreadNodeInfo *operator->() const { return &m_storage->m_nodes[m_id]; }
+        const_iterator &operator++() { m_id = m_storage->nextPresent(m_id + 1); return *this; }
+        bool operator==(const const_iterator &other) const { return m_id == other.m_id; }
+        bool operator!=(const const_iterator &other) const { return m_id != other.m_id; }
+    private:
+        const_iterator(const ThreadNodeStorage *storage, const uint id): m_storage(storage), m_id(id) {}
+        const ThreadNodeStorage *m_storage;
+        uint m_id;
+        friend class ThreadNodeStorage;
+    };
+
+    /** @short Position of a node before the tracked modifications */
+    struct Change {
+        uint id;
+        /** @short Did the node exist when the tracking started? */
+        bool existed;
+        int offset;
+        uint uid;
+        TreeItem *ptr;
+        Change(): id(0), existed(false), offset(0), uid(0), ptr(0) {}
+    };
+
+    ThreadNodeStorage(): m_count(0), m_tracking(false) {}
+
+    iterator begin() { return iterator(this, nextPresent(0)); }
+    iterator end() { return iterator(this, m_nodes.size()); }
+    const_iterator begin() const { return constBegin(); }
+    const_iterator end() const { return constEnd(); }
+    const_iterator constBegin() const { return const_iterator(this, nextPresent(0)); }
+    const_iterator constEnd() const { return const_iterator(this, m_nodes.size()); }
+
+    iterator find(const uint id) { return iterator(this, contains(id) ? id : m_nodes.size()); }
+    const_iterator find(const uint id) const { return constFind(id); }
+    const_iterator constFind(const uint id) const { return const_iterator(this, contains(id) ? id : m_nodes.size()); }
+    bool contains(const uint id) const { return id < static_cast<uint>(m_present.size()) && m_present.testBit(id); }
+    ThreadNodeInfo value(const uint id) const { return contains(id) ? m_nodes[id] : ThreadNodeInfo(); }
+
+    /** @short Return the node with this ID, creating an empty one if it doesn't exist yet */
+    ThreadNodeInfo &operator[](const uint id);
+    iterator erase(iterator it);
+    QList<uint> keys() const;
+    void clear();
+    void reserve(const int size);
+    int size() const { return m_count; }
+    bool isEmpty() const { return !m_count; }
+    /** @short Exchange the nodes with the @arg other storage, but keep the tracking state */
+    void swap(ThreadNodeStorage &other);
+
+    /** @short Start remembering the original position of each node which is accessed for modification */
+    void startTracking();
+    /** @short Stop the tracking and return the original positions of all nodes which might have been modified */
+    QVector<Change> takeChanges();
+
+private:
+    uint nextPresent(uint id) const;
+    void touch(const uint id) { if (m_tracking) remember(id); }
+    void remember(const uint id);
+
+    QVector<ThreadNodeInfo> m_nodes;
+    QBitArray m_present;
+    int m_count;
+    bool m_tracking;
+    /** @short Nodes which are already listed in m_changes */
+    QBitArray m_touched;
+    QVector<Change> m_changes;
+};
+
 /** @short A model implementing view of the whole IMAP server
 
 The problem with threading is that due to the extremely asynchronous nature of the IMAP Model, we often get informed about indexes
@@ -130,6 +247,8 @@ public:
     virtual QModelIndex mapToSource(const QModelIndex &proxyIndex) const;
     virtual QModelIndex mapFromSource(const QModelIndex &sourceIndex) const;
     virtual bool hasChildren(const QModelIndex &parent=QModelIndex()) const;
+    virtual bool canFetchMore(const QModelIndex &parent) const;
+    virtual void fetchMore(const QModelIndex &parent);
     virtual QVariant data(const QModelIndex &proxyIndex, int role) const;
     virtual Qt::ItemFlags flags(const QModelIndex &index) const;
     QVariant headerData(int section, Qt::Orientation orientation, int role) const;
@@ -138,9 +257,9 @@ public:
     virtual QMimeData *mimeData(const QModelIndexList &indexes) const;
     virtual Qt::DropActions supportedDropActions() const;
 
-    /** @short List of capabilities which could be used for threading
+    /** @short List of capabilities which could be used for server-side threading, the preferred ones first
 
-    If any of them are present in server's capabilities, at least some level of threading will be possible.
+    If none of them are present in server's capabilities, the threading is performed locally.
     */
     static QStringList supportedCapabilities();
 
@@ -148,6 +267,8 @@ public:
     SortCriterium currentSortCriterium() const;
     Qt::SortOrder currentSortOrder() const;
 
+    void setSearchPageSize(const uint size);
+
 public slots:
     void resetMe();
     void handleDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
@@ -165,6 +286,12 @@ public slots:
     /** @short SORT response has arrived */
     void slotSortingAvailable(const QList<uint> &uids);
 
+    /** @short A window of the SEARCH result has arrived */
+    void slotPartialSortingAvailable(const QList<uint> &uids, const uint offset, const uint total);
+
+    /** @short Verify the cached result of SORT or SEARCH once the mailbox is synced */
+    void slotMailboxSyncingProgress(const QModelIndex &mailboxIndex, Imap::Mailbox::MailboxSyncingProgress state);
+
     /** @short SORT has failed */
     void slotSortingFailed();
 
@@ -183,6 +310,10 @@ public slots:
     void slotIncrementalThreadingFailed();
 
     void delayedPrune();
+    void delayedArrivals();
+    void delayedLocalThreading();
+    void delayedLocalSort();
+    void slowSearchFallback();
 
 signals:
     void sortingFailed();
@@ -199,6 +330,10 @@ private:
 
     void updatePersistentIndexesPhase1();
     void updatePersistentIndexesPhase2();
+    uint internalIdForSourceRow(const int row) const;
+    TreeItemMsgList *sourceMessageList() const;
+    int sourceRowForNode(const ThreadNodeInfo &node) const;
+    TreeItemMessage *existingMessageForNode(const ThreadNodeInfo &node) const;
 
     /** @short Shall we ask for SORT/SEARCH automatically? */
     typedef enum {
@@ -209,6 +344,39 @@ private:
     /** @short Apply cached THREAD response or ask for threading again */
     void wantThreading(const SkipSortSearch skipSortSearch = AUTO_SORT_SEARCH);
 
+    /** @short Return the THREAD algorithm to use with this server, or an empty value if the server cannot thread at all */
+    static QByteArray preferredThreadingAlgorithm(const Model *model);
+
+    /** @short Thread the messages locally, based on their Message-Id and References headers */
+    void applyLocalThreading(TreeItemMsgList *list);
+    void addToLocalThreading(TreeItemMessage *message);
+    QList<uint> collectLocalReplies(const uint internalId) const;
+    bool adoptLocalReplies(const uint internalId);
+    bool isThreadAncestorOrSelf(const uint ancestorId, uint internalId) const;
+    void moveThreadNode(const uint internalId, const uint newParentId);
+    void applyLocalSort(TreeItemMsgList *list, Model *realModel);
+    static bool localSortKey(const SortCriterium criterium, LocalSorting::SortKey *key);
+    bool applyLocalSearch(const QStringList &searchConditions, const SortCriterium criterium, TreeItemMsgList *list,
+                          Model *realModel);
+    void startSortTask(const Model *realModel, const QModelIndex &mailboxIndex, const QStringList &searchConditions,
+                       const QStringList &sortOptions);
+    void startPartialSearchTask(const Model *realModel, const QModelIndex &mailboxIndex, const QStringList &searchConditions,
+                                const uint offset);
+    bool useCachedSorting(const Model *realModel, const QModelIndex &mailboxIndex, const QStringList &searchConditions,
+                          const QStringList &sortOptions, bool *isFresh);
+    static bool isCachedSortingFresh(const AbstractCache::MessageSorting &cached, const SyncState &syncState);
+    void saveSortingToCache(const QList<uint> &uids);
+
+    bool canAttachArrivalsLocally() const;
+    void insertArrival(TreeItemMessage *message, const uint parentId);
+    void threadRootsChanged(const QSet<uint> &internalIds);
+    uint findThreadNodeByMessageId(const QByteArray &messageId);
+    bool findOrderedSubjectParent(TreeItemMessage *message, uint *parentId);
+    void forgetArrivals();
+    void invalidateSortResult();
+    QVector<Imap::Responses::ThreadingNode> currentThreading(const uint parentId) const;
+    QModelIndex indexForThreadNode(const uint internalId) const;
+
     /** @short Convert the threading from a THREAD response and apply that threading to this model */
     void registerThreading(const QVector<Imap::Responses::ThreadingNode> &mapping, uint parentId,
                            const QHash<uint,void *> &uidToPtr, QSet<uint> &usedNodes);
@@ -239,14 +407,24 @@ private:
     ThreadingMsgListModel &operator=(const ThreadingMsgListModel &);  // don't implement
     ThreadingMsgListModel(const ThreadingMsgListModel &);  // don't implement
 
-    /** @short Mapping from the upstream model's internalId to ThreadingMsgListModel's internal IDs */
-    QHash<void *,uint> ptrToInternal;
+    /** @short Mapping from the row in the upstream model to ThreadingMsgListModel's internal IDs
+
+    Zero is used for messages which are not part of the threading. The entries are shifted along with the upstream rows.
+    */
+    QVector<uint> m_sourceRowToInternal;
+
+    /** @short Mapping from the UIDs of messages to ThreadingMsgListModel's internal IDs
+
+    This is what makes the conversion of the SORT results into the order of the thread roots a linear operation. Entries
+    for messages which are no longer in the threading might be stale, so the IDs have to be checked against the threading.
+    */
+    QHash<uint,uint> uidToInternal;
 
     /** @short Tree for the threading
 
     This tree is indexed by our internal ID.
     */
-    QHash<uint,ThreadNodeInfo> threading;
+    ThreadNodeStorage threading;
 
     /** @short Last assigned internal ID */
     uint threadingHelperLastId;
@@ -254,6 +432,31 @@ private:
     /** @short Messages with unknown UIDs */
     QSet<TreeItem*> unknownUids;
 
+    /** @short New arrivals which are not shown yet because their headers are needed for finding their thread
+
+    These messages are present in the source model, but not in the threading. They get inserted below their parents
+    by delayedArrivals() as soon as their References are known.
+    */
+    QList<TreeItem*> m_pendingArrivals;
+
+    /** @short The rows which the source model is inserting right now will become pending arrivals */
+    bool m_deferInsertion;
+
+    /** @short Is the current layout the result of threading, so that new arrivals can be attached to their threads? */
+    bool m_threadingApplied;
+
+    /** @short Message-Ids of the messages in the threading whose headers are known, see findThreadNodeByMessageId() */
+    QHash<QByteArray,uint> m_messageIdToInternal;
+
+    /** @short Has the m_messageIdToInternal been built for the current threading? */
+    bool m_messageIdsIndexed;
+
+    /** @short Base subjects of the thread roots of the ORDEREDSUBJECT threading, see findOrderedSubjectParent() */
+    QHash<QString,uint> m_baseSubjectToRoot;
+
+    /** @short Has the m_baseSubjectToRoot been built for the current threading? */
+    bool m_baseSubjectsIndexed;
+
     /** @short Threading algorithm we're using for this request */
     QByteArray requestedAlgorithm;
 
@@ -265,9 +468,6 @@ private:
     */
     bool modelResetInProgress;
 
-    QModelIndexList oldPersistentIndexes;
-    QList<void *> oldPtrs;
-
     /** @short There's a pending THREAD command for which we haven't received data yet */
     bool threadingInFlight;
 
@@ -277,6 +477,11 @@ private:
     /** @short Task handling the SORT command */
     QPointer<SortTask> m_sortTask;
 
+    /** @short Mailbox, SORT criteria and search conditions of the last SortTask, so that its result can be cached */
+    QPersistentModelIndex m_requestedSortingMailbox;
+    QStringList m_requestedSortCriteria;
+    QStringList m_requestedSearchConditions;
+
     /** @short Shall we sort in a reversed order? */
     bool m_sortReverse;
 
@@ -304,9 +509,55 @@ private:
 
     ResultValidity m_searchValidity;
 
+    /** @short The cached result of SORT or SEARCH which is shown, but which has to be checked once the mailbox is synced */
+    AbstractCache::MessageSorting m_unverifiedSorting;
+
+    /** @short The mailbox whose sync shall be waited for before checking the m_unverifiedSorting */
+    QPersistentModelIndex m_unverifiedSortingMailbox;
+
     QTimer *m_delayedPrune;
 
+    /** @short Headers of the pending arrivals have arrived */
+    QTimer *m_delayedArrivals;
+
+    /** @short Is the threading done by us instead of the IMAP server? */
+    bool m_localThreadingActive;
+
+    /** @short Client-side threading for servers which cannot do that */
+    LocalThreading m_localThreading;
+
+    /** @short Messages which got their headers after the local threading was applied, see delayedLocalThreading() */
+    QList<TreeItem*> m_localThreadingLate;
+
+    /** @short Metadata of messages have arrived, so the local threading shall be updated */
+    QTimer *m_delayedLocalThreading;
+
+    /** @short Client-side sorting for servers without the SORT extension */
+    LocalSorting m_localSorting;
+
+    /** @short Does the current result of the local sorting miss some keys? */
+    bool m_localSortingPending;
+
+    /** @short Metadata of messages have arrived, so the local sorting shall be updated */
+    QTimer *m_delayedLocalSort;
+
+    /** @short The server takes too long to answer a SEARCH, so the local full-text index shall be tried meanwhile */
+    QTimer *m_slowSearch;
+
+    /** @short Number of positions of the SEARCH result to ask for at once, or zero for getting all of them */
+    uint m_searchPageSize;
+
+    /** @short Number of positions of the paged SEARCH result which have been asked for, or zero if paging is not active */
+    uint m_partialSearchLoaded;
+
+    /** @short Number of all matches of the paged SEARCH */
+    uint m_partialSearchTotal;
+
+    /** @short Are the pages of the SEARCH result counted from its end? */
+    bool m_partialSearchReverse;
+
     friend class ::ImapModelThreadingTest; // needs access to wantThreading();
+    friend class ::ImapThreadingPerformanceTest; // needs access to pruneTree();
 };
 
 }
@@ -35,7 +35,7 @@ namespace Network
 {
 
 MsgPartNetworkReply::MsgPartNetworkReply(QObject *parent, const QPersistentModelIndex &part):
-    QNetworkReply(parent), part(part)
+    QNetworkReply(parent), part(part), headersSet(false)
 {
     setOpenMode(QIODevice::ReadOnly | QIODevice::Unbuffered);
     Q_ASSERT(part.isValid());
@@ -48,9 +48,13 @@ MsgPartNetworkReply::MsgPartNetworkReply(QObject *parent, const QPersistentModel
     Mailbox::TreeItemPart *partPtr = dynamic_cast<Mailbox::TreeItemPart *>(static_cast<Mailbox::TreeItem *>(part.internalPointer()));
     Q_ASSERT(partPtr);
 
-    // We have to ask for contents before we check whether it's already fetched
-    partPtr->fetch(const_cast<Mailbox::Model *>(model));
-    if (partPtr->fetched()) {
+    // The buffer reads straight from the part, so its data must not be released while we're alive
+    const_cast<Mailbox::Model *>(model)->pinPartData(part);
+
+    // We have to ask for contents before we check whether it's already fetched.
+    // Big parts are delivered progressively, chunk by chunk, as we read them.
+    partPtr->fetchNextChunk(const_cast<Mailbox::Model *>(model));
+    if (partPtr->fetched() || partPtr->isPartiallyFetched()) {
         QTimer::singleShot(0, this, SLOT(slotMyDataChanged()));
     }
 
@@ -58,6 +62,16 @@ MsgPartNetworkReply::MsgPartNetworkReply(QObject *parent, const QPersistentModel
     buffer.open(QIODevice::ReadOnly);
 }
 
+MsgPartNetworkReply::~MsgPartNetworkReply()
+{
+    if (!part.isValid())
+        return;
+    const Mailbox::Model *model = 0;
+    Mailbox::Model::realTreeItem(part, &model);
+    Q_ASSERT(model);
+    const_cast<Mailbox::Model *>(model)->unpinPartData(part);
+}
+
 /** @short Check to see whether the data which concern this object has arrived already */
 void MsgPartNetworkReply::slotModelDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
 {
@@ -74,6 +88,27 @@ void MsgPartNetworkReply::slotModelDataChanged(const QModelIndex &topLeft, const
 /** @short Data for the current message part are available now */
 void MsgPartNetworkReply::slotMyDataChanged()
 {
+    setContentTypeHeader();
+
+    Mailbox::TreeItemPart *partPtr = partPointer();
+    if (partPtr && partPtr->isPartiallyFetched()) {
+        emit downloadProgress(partPtr->fetchedOctets(), partPtr->expectedOctets());
+        emit readyRead();
+        requestNextChunkIfDrained();
+        return;
+    }
+
+    emit readyRead();
+    emit finished();
+}
+
+/** @short Set the Content-Type before the first chunk of data is made available */
+void MsgPartNetworkReply::setContentTypeHeader()
+{
+    if (headersSet)
+        return;
+    headersSet = true;
+
     QString mimeType = part.data(Mailbox::RolePartMimeType).toString();
     QString charset = part.data(Mailbox::RolePartCharset).toString();
     if (mimeType.startsWith(QLatin1String("text/"))) {
@@ -92,8 +127,6 @@ void MsgPartNetworkReply::slotMyDataChanged()
     } else {
         setHeader(QNetworkRequest::ContentTypeHeader, mimeType);
     }
-    emit readyRead();
-    emit finished();
 }
 
 /** @short QIODevice compatibility */
@@ -120,7 +153,30 @@ qint64 MsgPartNetworkReply::bytesAvailable() const
 qint64 MsgPartNetworkReply::readData(char *data, qint64 maxSize)
 {
     disconnectBufferIfVanished();
-    return buffer.read(data, maxSize);
+    qint64 res = buffer.read(data, maxSize);
+    requestNextChunkIfDrained();
+    return res;
+}
+
+/** @short Return the message part, or 0 if it has vanished already */
+Mailbox::TreeItemPart *MsgPartNetworkReply::partPointer() const
+{
+    if (!part.isValid())
+        return 0;
+    return dynamic_cast<Mailbox::TreeItemPart *>(static_cast<Mailbox::TreeItem *>(part.internalPointer()));
+}
+
+/** @short Ask for more data of a progressively downloaded part once the reader has consumed what has arrived so far */
+void MsgPartNetworkReply::requestNextChunkIfDrained()
+{
+    Mailbox::TreeItemPart *partPtr = partPointer();
+    if (!partPtr || !partPtr->isPartiallyFetched() || buffer.bytesAvailable() > 0)
+        return;
+
+    const Mailbox::Model *model = 0;
+    Mailbox::Model::realTreeItem(part, &model);
+    Q_ASSERT(model);
+    partPtr->fetchNextChunk(const_cast<Mailbox::Model *>(model));
 }
 
 
@@ -28,15 +28,25 @@
 
 namespace Imap
 {
+namespace Mailbox
+{
+class TreeItemPart;
+}
+
 namespace Network
 {
 
-/** @short Qt-like access to one MIME message part */
+/** @short Qt-like access to one MIME message part
+
+Big textual parts are delivered progressively; the readyRead() is emitted for each chunk which arrives, and the next chunk is
+requested only after the reader has consumed all data which are available.
+*/
 class MsgPartNetworkReply : public QNetworkReply
 {
     Q_OBJECT
 public:
     MsgPartNetworkReply(QObject *parent, const QPersistentModelIndex &part);
+    ~MsgPartNetworkReply();
     virtual void abort();
     virtual void close();
     virtual qint64 bytesAvailable() const;
@@ -47,9 +57,13 @@ protected:
     virtual qint64 readData(char *data, qint64 maxSize);
 private:
     void disconnectBufferIfVanished() const;
+    void setContentTypeHeader();
+    Mailbox::TreeItemPart *partPointer() const;
+    void requestNextChunkIfDrained();
 
     QPersistentModelIndex part;
     mutable QBuffer buffer;
+    bool headersSet;
 
     MsgPartNetworkReply(const MsgPartNetworkReply &); // don't implement
     MsgPartNetworkReply &operator=(const MsgPartNetworkReply &); // don't implement
@@ -22,6 +22,7 @@
 
 #include <typeinfo>
 
+#include <QHash>
 #include <QTextDocument>
 #include <QUrl>
 #if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
@@ -311,6 +312,11 @@ bool operator==(const MailAddress &a, const MailAddress &b)
     return a.name == b.name && a.adl == b.adl && a.mailbox == b.mailbox && a.host == b.host;
 }
 
+uint qHash(const MailAddress &address)
+{
+    return ::qHash(address.mailbox) ^ (::qHash(address.host) << 1) ^ (::qHash(address.name) << 2) ^ ::qHash(address.adl);
+}
+
 MailAddressesEqualByMail::result_type MailAddressesEqualByMail::operator()(const MailAddress &a, const MailAddress &b) const
 {
     // FIXME: fancy stuff like the IDN?
@@ -86,6 +86,7 @@ QTextStream &operator<<(QTextStream &stream, const MailAddress &address);
 
 bool operator==(const MailAddress &a, const MailAddress &b);
 inline bool operator!=(const MailAddress &a, const MailAddress &b) { return !(a == b); }
+uint qHash(const MailAddress &address);
 
 
 /** Are the actual e-mail addresses (without any fancy details) equal?
@@ -25,6 +25,7 @@
 #include <QMutexLocker>
 #include <QProcess>
 #include <QSslError>
+#include <QTextStream>
 #include <QTime>
 #include <QTimer>
 #include "Parser.h"
@@ -32,6 +33,7 @@
 #include "LowLevelParser.h"
 #include "../../Streams/IODeviceSocket.h"
 #include "../Model/Utils.h"
+#include "Common/Instrumentation.h"
 
 //#define PRINT_TRAFFIC 100
 //#define PRINT_TRAFFIC_TX 500
@@ -83,6 +85,22 @@
  *
  * */
 
+#ifdef TROJITA_INSTRUMENTATION
+namespace {
+
+/** @short Name of the response kind as used by the instrumentation counters */
+QString responseKindName(const Imap::Responses::Kind kind)
+{
+    QString res;
+    QTextStream ss(&res);
+    ss << kind;
+    ss.flush();
+    return res;
+}
+
+}
+#endif
+
 namespace Imap
 {
 
@@ -606,6 +624,7 @@ CommandHandle Parser::queueCommand(Commands::Command command)
 
 void Parser::queueResponse(const QSharedPointer<Responses::AbstractResponse> &resp)
 {
+    TROJITA_INSTRUMENT(QLatin1String("parsed responses"), responseKindName(resp->kind), 1);
     respQueue.push_back(resp);
     // Try to limit the signal rate -- when there are multiple items in the queue, there's no point in sending more signals
     if (respQueue.size() == 1) {
@@ -648,6 +667,7 @@ void Parser::handleReadyRead()
         case ReadingNumberOfBytes:
         {
             QByteArray buf = socket->read(readingBytes);
+            TROJITA_INSTRUMENT(QLatin1String("bytes received"), QString::fromUtf8("parser %1").arg(m_parserId), buf.size());
             readingBytes -= buf.size();
             currentLine += buf;
             if (readingBytes == 0) {
@@ -665,7 +685,9 @@ void Parser::handleReadyRead()
 void Parser::reallyReadLine()
 {
     try {
-        currentLine += socket->readLine();
+        QByteArray line = socket->readLine();
+        TROJITA_INSTRUMENT(QLatin1String("bytes received"), QString::fromUtf8("parser %1").arg(m_parserId), line.size());
+        currentLine += line;
         if (currentLine.endsWith("}\r\n")) {
             int offset = currentLine.lastIndexOf('{');
             if (offset < oldLiteralPosition)
@@ -38,6 +38,7 @@ AbstractResponse::~AbstractResponse()
 
 static QString threadDumpHelper(const ThreadingNode &node);
 static void threadingHelperInsertHere(ThreadingNode *where, const QVariantList &what);
+static int partialPositionHelper(const QByteArray &line, int &start);
 
 QTextStream &operator<<(QTextStream &stream, const Code &r)
 {
@@ -785,6 +786,38 @@ ESearch::ESearch(const QByteArray &line, int &start): AbstractResponse(ESEARCH),
             }
             incThreadData.push_back(IncrementalThreadingItem_t(previousRoot, node.children));
             LowLevelParser::eatSpaces(line, start);
+        } else if (label == "PARTIAL") {
+            // RFC 5267: a parenthesized pair of the requested range of positions and the matching items, or NIL
+
+            if (start >= line.size() - 2)
+                throw NoData("ESEARCH PARTIAL: no data", line, start);
+
+            if (line[start] != '(')
+                throw UnexpectedHere("ESEARCH PARTIAL: missing '('", line, start);
+            ++start;
+
+            const int from = partialPositionHelper(line, start);
+            if (start >= line.size() - 2 || line[start] != ':')
+                throw UnexpectedHere("ESEARCH PARTIAL: malformed range", line, start);
+            ++start;
+            const int to = partialPositionHelper(line, start);
+            LowLevelParser::eatSpaces(line, start);
+
+            if (start >= line.size() - 2)
+                throw NoData("ESEARCH PARTIAL: truncated data", line, start);
+            if (line.mid(start, 3).toUpper() == "NIL") {
+                start += 3;
+                partialData.clear();
+            } else {
+                partialData = LowLevelParser::getSequence(line, start);
+            }
+            LowLevelParser::eatSpaces(line, start);
+
+            if (start >= line.size() - 2 || line[start] != ')')
+                throw UnexpectedHere("ESEARCH PARTIAL: missing ')'", line, start);
+            ++start;
+            partialRange = qMakePair(from, to);
+            LowLevelParser::eatSpaces(line, start);
         } else {
             // A generic case: be prepapred to accept a (sequence of) numbers
 
@@ -866,7 +899,7 @@ QDateTime Fetch::dateify(QByteArray str, const QByteArray &line, const int start
 }
 
 Fetch::Fetch(const uint _number, const QByteArray &line, int &start):
-    AbstractResponse(FETCH), number(_number)
+    AbstractResponse(FETCH), number(_number), items(0), uid(0), rfc822Size(0), modSeq(0)
 {
     ++start;
 
@@ -883,69 +916,81 @@ Fetch::Fetch(const uint _number, const QByteArray &line, int &start):
             identifier = it->toByteArray().toUpper();
             if (identifier.isEmpty())
                 throw UnexpectedHere(line, start);   // FIXME: wrong offset
-            if (data.contains(identifier))
-                throw UnexpectedHere(line, start);   // FIXME: wrong offset
         } else {
             if (identifier == "BODY" || identifier == "BODYSTRUCTURE") {
                 if (it->type() != QVariant::List)
                     throw UnexpectedHere(line, start);
-                data[identifier] = Message::AbstractMessage::fromList(it->toList(), line, start);
-                QByteArray buffer;
-                QDataStream stream(&buffer, QIODevice::WriteOnly);
+                setItem(identifier == "BODY" ? ITEM_BODY : ITEM_BODYSTRUCTURE, line, start);
+                bodyStructure = Message::AbstractMessage::fromList(it->toList(), line, start);
+                QDataStream stream(&serializedBodyStructure, QIODevice::WriteOnly);
                 stream.setVersion(QDataStream::Qt_4_6);
                 stream << it->toList();
-                data["x-trojita-bodystructure"] = QSharedPointer<AbstractData>(
-                                                      new RespData<QByteArray>(buffer));
 
             } else if (identifier.startsWith("BODY[") || identifier.startsWith("BINARY[")) {
                 if (it->type() != QVariant::ByteArray)
                     throw UnexpectedHere(line, start);
-                data[identifier] = QSharedPointer<AbstractData>(
-                                       new RespData<QByteArray>(it->toByteArray()));
+                if (sections.contains(identifier))
+                    throw UnexpectedHere(line, start);   // FIXME: wrong offset
+                sections[identifier] = it->toByteArray();
 
             } else if (identifier == "ENVELOPE") {
                 if (it->type() != QVariant::List)
                     throw UnexpectedHere(line, start);
-                QVariantList items = it->toList();
-                data[identifier] = QSharedPointer<AbstractData>(
-                                       new RespData<Message::Envelope>(Message::Envelope::fromList(items, line, start)));
+                setItem(ITEM_ENVELOPE, line, start);
+                envelope = Message::Envelope::fromList(it->toList(), line, start);
 
             } else if (identifier == "FLAGS") {
                 if (! it->canConvert(QVariant::StringList))
                     throw UnexpectedHere(line, start);   // FIXME: wrong offset
-
-                data[identifier] = QSharedPointer<AbstractData>(
-                                       new RespData<QStringList>(it->toStringList()));
+                setItem(ITEM_FLAGS, line, start);
+                flags = it->toStringList();
 
             } else if (identifier == "INTERNALDATE") {
                 if (it->type() != QVariant::ByteArray)
                     throw UnexpectedHere(line, start);   // FIXME: wrong offset
-                QByteArray _str = it->toByteArray();
-                data[ identifier ] = QSharedPointer<AbstractData>(
-                                         new RespData<QDateTime>(dateify(_str, line, start)));
+                setItem(ITEM_INTERNALDATE, line, start);
+                internalDate = dateify(it->toByteArray(), line, start);
 
             } else if (identifier == "RFC822" ||
                        identifier == "RFC822.HEADER" || identifier == "RFC822.TEXT") {
                 if (it->type() != QVariant::ByteArray)
                     throw UnexpectedHere(line, start);   // FIXME: wrong offset
-                data[ identifier ] = QSharedPointer<AbstractData>(
-                                         new RespData<QByteArray>(it->toByteArray()));
-            } else if (identifier == "RFC822.SIZE" || identifier == "UID") {
+                if (identifier == "RFC822") {
+                    setItem(ITEM_RFC822, line, start);
+                    rfc822 = it->toByteArray();
+                } else if (identifier == "RFC822.HEADER") {
+                    setItem(ITEM_RFC822_HEADER, line, start);
+                    rfc822Header = it->toByteArray();
+                } else {
+                    setItem(ITEM_RFC822_TEXT, line, start);
+                    rfc822Text = it->toByteArray();
+                }
+            } else if (identifier == "RFC822.SIZE" || identifier == "UID" || identifier.startsWith("BINARY.SIZE[")) {
                 if (it->type() != QVariant::UInt)
                     throw ParseError(line, start);   // FIXME: wrong offset
-                data[ identifier ] = QSharedPointer<AbstractData>(
-                                         new RespData<uint>(it->toUInt()));
+                if (identifier == "UID") {
+                    setItem(ITEM_UID, line, start);
+                    uid = it->toUInt();
+                } else if (identifier == "RFC822.SIZE") {
+                    setItem(ITEM_RFC822_SIZE, line, start);
+                    rfc822Size = it->toUInt();
+                } else {
+                    if (binarySizes.contains(identifier))
+                        throw UnexpectedHere(line, start);   // FIXME: wrong offset
+                    binarySizes[identifier] = it->toUInt();
+                }
             } else if (identifier == "MODSEQ") {
                 if (it->type() != QVariant::List)
                     throw UnexpectedHere("The MODSEQ entry in the FETCH response is not a list", line, start);
-                QVariantList items = it->toList();
-                if (items.size() != 1)
+                QVariantList modSeqList = it->toList();
+                if (modSeqList.size() != 1)
                     throw ParseError("MODSEQ should contain exactly one item", line, start); // FIXME: wrong offset
                 bool ok = false;
-                quint64 num = items[0].toULongLong(&ok);
+                quint64 num = modSeqList[0].toULongLong(&ok);
                 if (!ok)
                     throw UnexpectedHere("MODSEQ not an 64bit unsigned integer", line, start); // FIXME: wrong offset
-                data[identifier] = QSharedPointer<AbstractData>(new RespData<quint64>(num));
+                setItem(ITEM_MODSEQ, line, start);
+                modSeq = num;
             } else {
                 throw UnexpectedHere(line, start);   // FIXME: wrong offset
             }
@@ -959,8 +1004,57 @@ Fetch::Fetch(const uint _number, const QByteArray &line, int &start):
 }
 
 Fetch::Fetch(const uint _number, const Fetch::dataType &_data):
-    AbstractResponse(FETCH), number(_number), data(_data)
+    AbstractResponse(FETCH), number(_number), items(0), uid(0), rfc822Size(0), modSeq(0)
+{
+    for (dataType::const_iterator it = _data.constBegin(); it != _data.constEnd(); ++it) {
+        const QByteArray &identifier = it.key();
+        if (identifier == "UID") {
+            items |= ITEM_UID;
+            uid = dynamic_cast<const RespData<uint>&>(*it.value()).data;
+        } else if (identifier == "FLAGS") {
+            items |= ITEM_FLAGS;
+            flags = dynamic_cast<const RespData<QStringList>&>(*it.value()).data;
+        } else if (identifier == "ENVELOPE") {
+            items |= ITEM_ENVELOPE;
+            envelope = dynamic_cast<const RespData<Message::Envelope>&>(*it.value()).data;
+        } else if (identifier == "BODY" || identifier == "BODYSTRUCTURE") {
+            items |= identifier == "BODY" ? ITEM_BODY : ITEM_BODYSTRUCTURE;
+            bodyStructure = it.value().dynamicCast<Message::AbstractMessage>();
+            Q_ASSERT(bodyStructure);
+        } else if (identifier == "RFC822.SIZE") {
+            items |= ITEM_RFC822_SIZE;
+            rfc822Size = dynamic_cast<const RespData<uint>&>(*it.value()).data;
+        } else if (identifier == "INTERNALDATE") {
+            items |= ITEM_INTERNALDATE;
+            internalDate = dynamic_cast<const RespData<QDateTime>&>(*it.value()).data;
+        } else if (identifier == "MODSEQ") {
+            items |= ITEM_MODSEQ;
+            modSeq = dynamic_cast<const RespData<quint64>&>(*it.value()).data;
+        } else if (identifier == "RFC822") {
+            items |= ITEM_RFC822;
+            rfc822 = dynamic_cast<const RespData<QByteArray>&>(*it.value()).data;
+        } else if (identifier == "RFC822.HEADER") {
+            items |= ITEM_RFC822_HEADER;
+            rfc822Header = dynamic_cast<const RespData<QByteArray>&>(*it.value()).data;
+        } else if (identifier == "RFC822.TEXT") {
+            items |= ITEM_RFC822_TEXT;
+            rfc822Text = dynamic_cast<const RespData<QByteArray>&>(*it.value()).data;
+        } else if (identifier.startsWith("BINARY.SIZE[")) {
+            binarySizes[identifier] = dynamic_cast<const RespData<uint>&>(*it.value()).data;
+        } else if (identifier.startsWith("BODY[") || identifier.startsWith("BINARY[")) {
+            sections[identifier] = dynamic_cast<const RespData<QByteArray>&>(*it.value()).data;
+        } else {
+            Q_ASSERT(false);
+        }
+    }
+}
+
+/** @short Mark the @arg item as present, complaining about duplicates */
+void Fetch::setItem(const Item item, const QByteArray &line, const int start)
 {
+    if (items & item)
+        throw UnexpectedHere(line, start);   // FIXME: wrong offset
+    items |= item;
 }
 
 QList<NamespaceData> NamespaceData::listFromLine(const QByteArray &line, int &start)
@@ -1047,6 +1141,16 @@ static void threadingHelperInsertHere(ThreadingNode *where, const QVariantList &
     }
 }
 
+/** @short Parse one end of the RFC 5267 PARTIAL range, which might be negative to count from the end of the result */
+static int partialPositionHelper(const QByteArray &line, int &start)
+{
+    if (start < line.size() && line[start] == '-') {
+        ++start;
+        return -static_cast<int>(LowLevelParser::getUInt(line, start));
+    }
+    return LowLevelParser::getUInt(line, start);
+}
+
 Id::Id(const QByteArray &line, int &start): AbstractResponse(ID)
 {
     try {
@@ -1199,6 +1303,13 @@ QTextStream &ESearch::dump(QTextStream &stream) const
         node.children = it->thread;
         stream << "INCTHREAD " << it->previousThreadRoot << " [THREAD parsed-into-sane-form follows] " << threadDumpHelper(node) << " ";
     }
+    if (partialRange.first) {
+        stream << "PARTIAL (" << partialRange.first << ":" << partialRange.second << " ";
+        Q_FOREACH(const uint num, partialData) {
+            stream << num << ' ';
+        }
+        stream << ") ";
+    }
     return stream;
 }
 
@@ -1214,9 +1325,32 @@ QTextStream &Status::dump(QTextStream &stream) const
 QTextStream &Fetch::dump(QTextStream &stream) const
 {
     stream << "FETCH " << number << " (";
-    for (dataType::const_iterator it = data.begin();
-         it != data.end(); ++it)
-        stream << ' ' << it.key() << " \"" << *it.value() << '"';
+    if (has(ITEM_UID))
+        stream << " UID \"" << uid << '"';
+    if (has(ITEM_FLAGS))
+        stream << " FLAGS \"" << flags.join(QLatin1String(" ")) << '"';
+    if (has(ITEM_ENVELOPE))
+        stream << " ENVELOPE \"" << envelope << '"';
+    if (has(ITEM_BODY))
+        stream << " BODY \"" << *bodyStructure << '"';
+    if (has(ITEM_BODYSTRUCTURE))
+        stream << " BODYSTRUCTURE \"" << *bodyStructure << '"';
+    if (has(ITEM_RFC822_SIZE))
+        stream << " RFC822.SIZE \"" << rfc822Size << '"';
+    if (has(ITEM_INTERNALDATE))
+        stream << " INTERNALDATE \"" << internalDate.toString() << '"';
+    if (has(ITEM_MODSEQ))
+        stream << " MODSEQ \"" << modSeq << '"';
+    if (has(ITEM_RFC822))
+        stream << " RFC822 \"" << rfc822 << '"';
+    if (has(ITEM_RFC822_HEADER))
+        stream << " RFC822.HEADER \"" << rfc822Header << '"';
+    if (has(ITEM_RFC822_TEXT))
+        stream << " RFC822.TEXT \"" << rfc822Text << '"';
+    for (QMap<QByteArray,uint>::const_iterator it = binarySizes.constBegin(); it != binarySizes.constEnd(); ++it)
+        stream << ' ' << it.key() << " \"" << *it << '"';
+    for (QMap<QByteArray,QByteArray>::const_iterator it = sections.constBegin(); it != sections.constEnd(); ++it)
+        stream << ' ' << it.key() << " \"" << *it << '"';
     return stream << ')';
 }
 
@@ -1455,7 +1589,8 @@ bool ESearch::eq(const AbstractResponse &other) const
     try {
         const ESearch &s = dynamic_cast<const ESearch &>(other);
         return tag == s.tag && seqOrUids == s.seqOrUids && listData == s.listData &&
-                incrementalContextData == s.incrementalContextData && incThreadData == s.incThreadData;
+                incrementalContextData == s.incrementalContextData && incThreadData == s.incThreadData &&
+                partialRange == s.partialRange && partialData == s.partialData;
     } catch (std::bad_cast &) {
         return false;
     }
@@ -1475,15 +1610,20 @@ bool Fetch::eq(const AbstractResponse &other) const
 {
     try {
         const Fetch &f = dynamic_cast<const Fetch &>(other);
-        if (number != f.number)
-            return false;
-        if (data.keys() != f.data.keys())
+        if (number != f.number || items != f.items)
             return false;
-        for (dataType::const_iterator it = data.begin();
-             it != data.end(); ++it)
-            if (!f.data.contains(it.key()) || *it.value() != *f.data[ it.key() ])
-                return false;
-        return true;
+        // The serialized body structure is derived from the bodyStructure, so there's no point in comparing it
+        return (!has(ITEM_UID) || uid == f.uid) &&
+                (!has(ITEM_FLAGS) || flags == f.flags) &&
+                (!has(ITEM_ENVELOPE) || envelope == f.envelope) &&
+                (!(has(ITEM_BODY) || has(ITEM_BODYSTRUCTURE)) || *bodyStructure == *f.bodyStructure) &&
+                (!has(ITEM_RFC822_SIZE) || rfc822Size == f.rfc822Size) &&
+                (!has(ITEM_INTERNALDATE) || internalDate == f.internalDate) &&
+                (!has(ITEM_MODSEQ) || modSeq == f.modSeq) &&
+                (!has(ITEM_RFC822) || rfc822 == f.rfc822) &&
+                (!has(ITEM_RFC822_HEADER) || rfc822Header == f.rfc822Header) &&
+                (!has(ITEM_RFC822_TEXT) || rfc822Text == f.rfc822Text) &&
+                sections == f.sections && binarySizes == f.binarySizes;
     } catch (std::bad_cast &) {
         return false;
     }
@@ -1604,6 +1744,11 @@ bool NamespaceData::operator!=(const NamespaceData &other) const
     return !(*this == other);
 }
 
+// The FETCH parser doesn't create these anymore, but the Fetch(number, dataType) constructor still accepts them
+template class RespData<QByteArray>;
+template class RespData<QDateTime>;
+template class RespData<Message::Envelope>;
+
 #define PLUG(X) void X::plug( Imap::Parser* parser, Imap::Mailbox::Model* model ) const \
 { model->handle##X( parser, this ); } \
 bool X::plug( Imap::Mailbox::ImapTask* task ) const \
@@ -30,8 +30,10 @@
 #include <QVariantList>
 #include <QVector>
 #include "Command.h"
+#include "Common/ObjectPool.h"
 #include "../Exceptions.h"
 #include "Data.h"
+#include "Message.h"
 #include "ThreadingNode.h"
 
 #ifdef _MSC_VER
@@ -507,6 +509,15 @@ public:
     /** @short The threading information, draft-imap-incthread */
     IncrementalThreadingData_t incThreadData;
 
+    /** @short The range of positions from the RFC 5267 PARTIAL result, or (0, 0) if there was no PARTIAL
+
+    Negative positions are counted from the end of the result.
+    */
+    QPair<int, int> partialRange;
+
+    /** @short Items at the positions given by the partialRange */
+    QList<uint> partialData;
+
     // Other forms of returned data are quite explicitly not supported.
 
     ESearch(const QByteArray &line, int &start);
@@ -516,6 +527,10 @@ public:
         AbstractResponse(ESEARCH), tag(tag), seqOrUids(seqOrUids), incrementalContextData(incrementalContextData) {}
     ESearch(const QByteArray &tag, const SequencesOrUids seqOrUids, const IncrementalThreadingData_t &incThreadData):
         AbstractResponse(ESEARCH), tag(tag), seqOrUids(seqOrUids), incThreadData(incThreadData) {}
+    ESearch(const QByteArray &tag, const SequencesOrUids seqOrUids, const ListData_t &listData,
+            const QPair<int, int> &partialRange, const QList<uint> &partialData):
+        AbstractResponse(ESEARCH), tag(tag), seqOrUids(seqOrUids), listData(listData), partialRange(partialRange),
+        partialData(partialData) {}
     virtual QTextStream &dump(QTextStream &stream) const;
     virtual bool eq(const AbstractResponse &other) const;
     virtual void plug(Imap::Parser *parser, Imap::Mailbox::Model *model) const;
@@ -552,25 +567,68 @@ public:
     virtual bool plug(Imap::Mailbox::ImapTask *task) const;
 };
 
-/** @short FETCH response */
+/** @short FETCH response
+
+The well-known data items are stored in dedicated members and the has() tells which of them were present. Only the contents of
+the message parts and their sizes, i.e. the BODY[...], BINARY[...] and BINARY.SIZE[...], are kept in maps indexed by the name of
+the data item.
+*/
 class Fetch : public AbstractResponse
 {
 public:
     typedef QMap<QByteArray,QSharedPointer<AbstractData> > dataType;
 
+    /** @short Data items which are stored in their dedicated members */
+    typedef enum {
+        ITEM_UID = 1 << 0,
+        ITEM_FLAGS = 1 << 1,
+        ITEM_ENVELOPE = 1 << 2,
+        ITEM_BODYSTRUCTURE = 1 << 3,
+        ITEM_BODY = 1 << 4,
+        ITEM_RFC822_SIZE = 1 << 5,
+        ITEM_INTERNALDATE = 1 << 6,
+        ITEM_MODSEQ = 1 << 7,
+        ITEM_RFC822 = 1 << 8,
+        ITEM_RFC822_HEADER = 1 << 9,
+        ITEM_RFC822_TEXT = 1 << 10
+    } Item;
+
     /** @short Sequence number of message that we're working with */
     uint number;
 
-    /** @short Fetched items */
-    dataType data;
+    /** @short Bitmask of the Item values which were present in the response */
+    uint items;
+
+    uint uid;
+    QStringList flags;
+    Message::Envelope envelope;
+    /** @short The BODYSTRUCTURE or the BODY, whichever has been received */
+    QSharedPointer<Message::AbstractMessage> bodyStructure;
+    /** @short The bodyStructure in a serialized form suitable for the cache */
+    QByteArray serializedBodyStructure;
+    uint rfc822Size;
+    QDateTime internalDate;
+    quint64 modSeq;
+    QByteArray rfc822;
+    QByteArray rfc822Header;
+    QByteArray rfc822Text;
+
+    /** @short Contents of the BODY[...] and BINARY[...] items, with the origin octet of partial fetches kept in the key */
+    QMap<QByteArray,QByteArray> sections;
+    /** @short Values of the BINARY.SIZE[...] items */
+    QMap<QByteArray,uint> binarySizes;
 
     Fetch(const uint _number, const QByteArray &line, int &start);
+    /** @short Build the response from the individual data items as they would be named in the FETCH response */
     Fetch(const uint _number, const dataType &_data);
+    TROJITA_POOLED_ALLOCATION(Fetch)
+    bool has(const Item item) const { return items & item; }
     virtual QTextStream &dump(QTextStream &s) const;
     virtual bool eq(const AbstractResponse &other) const;
     virtual void plug(Imap::Parser *parser, Imap::Mailbox::Model *model) const;
     virtual bool plug(Imap::Mailbox::ImapTask *task) const;
 private:
+    void setItem(const Item item, const QByteArray &line, const int start);
     static QDateTime dateify(QByteArray str, const QByteArray &line, const int start);
 };
 
@@ -29,7 +29,7 @@ namespace Imap
 
 Sequence::Sequence(const uint num): kind(DISTINCT)
 {
-    list << num;
+    ranges.insert(num, num);
 }
 
 Sequence Sequence::startingAt(const uint lo)
@@ -45,24 +45,21 @@ QByteArray Sequence::toByteArray() const
     switch (kind) {
     case DISTINCT:
     {
-        Q_ASSERT(! list.isEmpty());
-
-        QStringList res;
-        int i = 0;
-        while (i < list.size()) {
-            int old = i;
-            while (i < list.size() - 1 &&
-                   list[i] == list[ i + 1 ] - 1)
-                ++i;
-            if (old != i) {
-                // we've found a sequence
-                res << QString::number(list[old]) + QLatin1Char(':') + QString::number(list[i]);
-            } else {
-                res << QString::number(list[i]);
+        Q_ASSERT(!ranges.isEmpty());
+
+        QByteArray res;
+        // Reserve enough space for the common case of the numbers with up to five digits
+        res.reserve(ranges.size() * 12);
+        for (QMap<uint, uint>::const_iterator it = ranges.constBegin(); it != ranges.constEnd(); ++it) {
+            if (it != ranges.constBegin())
+                res += ',';
+            res += QByteArray::number(it.key());
+            if (it.key() != it.value()) {
+                res += ':';
+                res += QByteArray::number(it.value());
             }
-            ++i;
         }
-        return res.join(QLatin1String(",")).toLocal8Bit();
+        return res;
     }
     case RANGE:
         Q_ASSERT(lo <= hi);
@@ -82,18 +79,20 @@ QList<uint> Sequence::toList() const
 {
     switch (kind) {
     case DISTINCT:
-        Q_ASSERT(!list.isEmpty());
-        return list;
     case RANGE:
-        Q_ASSERT(lo <= hi);
-        if (lo == hi) {
-            return QList<uint>() << lo;
-        } else {
-            QList<uint> res;
-            for (uint i = lo; i < hi; ++i)
+    {
+        Q_ASSERT(isValid());
+        QList<uint> res;
+        Q_FOREACH(const Range &range, rangeList()) {
+            for (uint i = range.first; i <= range.second; ++i) {
                 res << i;
-            return res;
+                // prevent an endless loop on the UINT_MAX
+                if (i == range.second)
+                    break;
+            }
         }
+        return res;
+    }
     case UNLIMITED:
         Q_ASSERT(false);
         return QList<uint>();
@@ -103,33 +102,165 @@ QList<uint> Sequence::toList() const
 }
 
 Sequence &Sequence::add(uint num)
+{
+    return add(num, num);
+}
+
+Sequence &Sequence::add(const uint lo, const uint hi)
 {
     Q_ASSERT(kind == DISTINCT);
-    QList<uint>::iterator it = qLowerBound(list.begin(), list.end(), num);
-    if (it == list.end() || *it != num)
-        list.insert(it, num);
+    Q_ASSERT(lo <= hi);
+
+    uint newLo = lo, newHi = hi;
+
+    // The only range starting at or before the new one which could overlap it or be adjacent to it is the last such one
+    QMap<uint, uint>::iterator it = ranges.upperBound(lo);
+    if (it != ranges.begin()) {
+        QMap<uint, uint>::iterator previous = it - 1;
+        if (previous.value() >= lo || previous.value() + 1 == lo) {
+            if (previous.value() >= hi) {
+                // Nothing new
+                return *this;
+            }
+            newLo = previous.key();
+            it = previous;
+        }
+    }
+
+    // Swallow all ranges which overlap the new one or are adjacent to it
+    while (it != ranges.end() && (it.key() <= newHi || it.key() - 1 == newHi)) {
+        newHi = qMax(newHi, it.value());
+        it = ranges.erase(it);
+    }
+    ranges.insert(newLo, newHi);
     return *this;
 }
 
-Sequence Sequence::fromList(QList<uint> numbers)
+Sequence Sequence::fromList(const QList<uint> &numbers)
 {
     Q_ASSERT(!numbers.isEmpty());
-    qSort(numbers);
-    Sequence seq(numbers.first());
-    for (int i = 1; i < numbers.size(); ++i) {
-        seq.add(numbers[i]);
+    // The numbers do not have to be sorted, add() puts them to the right place
+    Sequence seq;
+    Q_FOREACH(const uint num, numbers) {
+        seq.add(num);
     }
     return seq;
 }
 
 bool Sequence::isValid() const
 {
-    if (kind == DISTINCT && list.isEmpty())
+    if (kind == DISTINCT && ranges.isEmpty())
         return false;
     else
         return true;
 }
 
+int Sequence::rangeCount() const
+{
+    return kind == DISTINCT ? ranges.size() : 1;
+}
+
+/** @short Return the contents of a limited sequence as a list of ranges */
+QVector<Sequence::Range> Sequence::rangeList() const
+{
+    switch (kind) {
+    case DISTINCT:
+    {
+        QVector<Range> res;
+        res.reserve(ranges.size());
+        for (QMap<uint, uint>::const_iterator it = ranges.constBegin(); it != ranges.constEnd(); ++it)
+            res << Range(it.key(), it.value());
+        return res;
+    }
+    case RANGE:
+        return QVector<Range>() << Range(lo, hi);
+    case UNLIMITED:
+        break;
+    }
+    Q_ASSERT(false);
+    return QVector<Range>();
+}
+
+Sequence Sequence::fromRanges(const QVector<Range> &data)
+{
+    Sequence res;
+    Q_FOREACH(const Range &range, data) {
+        res.ranges.insert(range.first, range.second);
+    }
+    return res;
+}
+
+Sequence Sequence::united(const Sequence &other) const
+{
+    const QVector<Range> a = rangeList();
+    const QVector<Range> b = other.rangeList();
+    QVector<Range> res;
+    res.reserve(a.size() + b.size());
+    QVector<Range>::const_iterator ia = a.constBegin(), ib = b.constBegin();
+    while (ia != a.constEnd() || ib != b.constEnd()) {
+        // Always consume the range which starts first
+        Range current;
+        if (ib == b.constEnd() || (ia != a.constEnd() && ia->first <= ib->first))
+            current = *ia++;
+        else
+            current = *ib++;
+        if (!res.isEmpty() && (res.last().second >= current.first || res.last().second + 1 == current.first)) {
+            res.last().second = qMax(res.last().second, current.second);
+        } else {
+            res << current;
+        }
+    }
+    return fromRanges(res);
+}
+
+Sequence Sequence::intersected(const Sequence &other) const
+{
+    const QVector<Range> a = rangeList();
+    const QVector<Range> b = other.rangeList();
+    QVector<Range> res;
+    QVector<Range>::const_iterator ia = a.constBegin(), ib = b.constBegin();
+    while (ia != a.constEnd() && ib != b.constEnd()) {
+        const uint lo = qMax(ia->first, ib->first);
+        const uint hi = qMin(ia->second, ib->second);
+        if (lo <= hi)
+            res << Range(lo, hi);
+        // Move past the range which ends first
+        if (ia->second < ib->second)
+            ++ia;
+        else
+            ++ib;
+    }
+    return fromRanges(res);
+}
+
+Sequence Sequence::subtracted(const Sequence &other) const
+{
+    const QVector<Range> a = rangeList();
+    const QVector<Range> b = other.rangeList();
+    QVector<Range> res;
+    QVector<Range>::const_iterator ib = b.constBegin();
+    Q_FOREACH(Range current, a) {
+        // Skip the ranges which end before the current one starts
+        while (ib != b.constEnd() && ib->second < current.first)
+            ++ib;
+        bool exhausted = false;
+        QVector<Range>::const_iterator it = ib;
+        while (it != b.constEnd() && it->first <= current.second) {
+            if (it->first > current.first)
+                res << Range(current.first, it->first - 1);
+            if (it->second >= current.second) {
+                exhausted = true;
+                break;
+            }
+            current.first = it->second + 1;
+            ++it;
+        }
+        if (!exhausted)
+            res << current;
+    }
+    return fromRanges(res);
+}
+
 QTextStream &operator<<(QTextStream &stream, const Sequence &s)
 {
     return stream << s.toByteArray();
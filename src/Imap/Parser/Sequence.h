@@ -24,7 +24,10 @@
 #define IMAP_PARSER_SEQUENCE_H
 
 #include <QList>
+#include <QMap>
+#include <QPair>
 #include <QString>
+#include <QVector>
 
 /** @short Namespace for IMAP interaction */
 namespace Imap
@@ -35,12 +38,26 @@ namespace Imap
   Although named a sequence, there's no reason for a sequence to contain
   only consecutive ranges of numbers. For example, a set of
   { 1, 2, 3, 10, 15, 16, 17 } is perfectly valid sequence.
+
+  The numbers are stored as disjoint, non-adjacent ranges indexed by their
+  lower bound, so the memory footprint and the cost of serialization depend on
+  the number of ranges, not on the number of items, and adding a number in an
+  arbitrary order only takes a logarithmic time.
 */
 class Sequence
 {
+public:
+    /** @short A closed interval of numbers, both ends inclusive */
+    typedef QPair<uint, uint> Range;
+
+private:
     uint lo, hi;
-    QList<uint> list;
+    /** @short The upper bound of each range, indexed by its lower bound */
+    QMap<uint, uint> ranges;
     enum { DISTINCT, RANGE, UNLIMITED } kind;
+
+    QVector<Range> rangeList() const;
+    static Sequence fromRanges(const QVector<Range> &data);
 public:
     /** @short Construct an invalid sequence */
     Sequence(): kind(DISTINCT) {}
@@ -75,6 +92,12 @@ public:
     */
     Sequence &add(const uint num);
 
+    /** @short Add all numbers between lo and hi, inclusive
+
+      The same restrictions as for add(const uint num) apply.
+    */
+    Sequence &add(const uint lo, const uint hi);
+
     /** @short Converts sequence to a textual representation suitable for sending over the wire */
     QByteArray toByteArray() const;
 
@@ -82,11 +105,26 @@ public:
     QList<uint> toList() const;
 
     /** @short Create a sequence from a list of numbers */
-    static Sequence fromList(QList<uint> numbers);
+    static Sequence fromList(const QList<uint> &numbers);
 
     /** @short Return true if the sequence contains at least some items */
     bool isValid() const;
 
+    /** @short Return the number of contiguous ranges which make up this sequence */
+    int rangeCount() const;
+
+    /** @short Return a sequence containing numbers which are present in either of these sequences
+
+      Neither of the sequences can be an unlimited one.
+    */
+    Sequence united(const Sequence &other) const;
+
+    /** @short Return a sequence containing numbers which are present in both sequences */
+    Sequence intersected(const Sequence &other) const;
+
+    /** @short Return a sequence containing numbers from this sequence which are not present in the other one */
+    Sequence subtracted(const Sequence &other) const;
+
 };
 
 bool operator==(const Sequence &a, const Sequence &b);
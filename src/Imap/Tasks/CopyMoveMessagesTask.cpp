@@ -58,7 +58,6 @@ void CopyMoveMessagesTask::perform()
     IMAP_TASK_CHECK_ABORT_DIE;
 
     Sequence seq;
-    bool first = true;
 
     Q_FOREACH(const QPersistentModelIndex& index, messages) {
         if (! index.isValid()) {
@@ -69,16 +68,11 @@ void CopyMoveMessagesTask::perform()
             Q_ASSERT(item);
             TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(item);
             Q_ASSERT(message);
-            if (first) {
-                seq = Sequence(message->uid());
-                first = false;
-            } else {
-                seq.add(message->uid());
-            }
+            seq.add(message->uid());
         }
     }
 
-    if (first) {
+    if (!seq.isValid()) {
         // No valid messages
         _failed("All messages disappeared before we could have copied them");
         return;
@@ -51,7 +51,6 @@ void ExpungeMessagesTask::perform()
     IMAP_TASK_CHECK_ABORT_DIE;
 
     Sequence seq;
-    bool first = true;
 
     Q_FOREACH(const QPersistentModelIndex& index, messages) {
         if (! index.isValid()) {
@@ -61,16 +60,11 @@ void ExpungeMessagesTask::perform()
             Q_ASSERT(item);
             TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(item);
             Q_ASSERT(message);
-            if (first) {
-                seq = Sequence(message->uid());
-                first = false;
-            } else {
-                seq.add(message->uid());
-            }
+            seq.add(message->uid());
         }
     }
 
-    if (first) {
+    if (!seq.isValid()) {
         // No valid messages
         _failed("All messages are gone already");
         return;
@@ -32,10 +32,10 @@ namespace Imap
 namespace Mailbox
 {
 
-FetchMsgMetadataTask::FetchMsgMetadataTask(Model *model, const QModelIndex &mailbox, const QList<uint> &uids) :
+FetchMsgMetadataTask::FetchMsgMetadataTask(Model *model, const QModelIndex &mailbox, const Sequence &uids) :
     ImapTask(model), mailbox(mailbox), uids(uids)
 {
-    Q_ASSERT(!uids.isEmpty());
+    Q_ASSERT(uids.isValid());
     conn = model->findTaskResponsibleFor(mailbox);
     conn->addDependentTask(this);
 }
@@ -47,10 +47,8 @@ void FetchMsgMetadataTask::perform()
 
     IMAP_TASK_CHECK_ABORT_DIE;
 
-    Sequence seq = Sequence::fromList(uids);
-
     // we do not want to use _onlineMessageFetch because it contains UID and FLAGS
-    tag = parser->uidFetch(seq, QStringList() << QLatin1String("ENVELOPE") << QLatin1String("INTERNALDATE") <<
+    tag = parser->uidFetch(uids, QStringList() << QLatin1String("ENVELOPE") << QLatin1String("INTERNALDATE") <<
                            QLatin1String("BODYSTRUCTURE") << QLatin1String("RFC822.SIZE") <<
                            QLatin1String("BODY.PEEK[HEADER.FIELDS (References List-Post)]"));
 }
@@ -92,9 +90,9 @@ QString FetchMsgMetadataTask::debugIdentification() const
     if (!mailbox.isValid())
         return QLatin1String("[invalid mailbox]");
 
-    Q_ASSERT(!uids.isEmpty());
+    Q_ASSERT(uids.isValid());
     return QString::fromUtf8("%1: UIDs %2").arg(mailbox.data(RoleMailboxName).toString(),
-                                                QString::fromUtf8(Sequence::fromList(uids).toByteArray()));
+                                                QString::fromUtf8(uids.toByteArray()));
 }
 
 QVariant FetchMsgMetadataTask::taskData(const int role) const
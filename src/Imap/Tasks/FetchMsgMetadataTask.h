@@ -36,7 +36,7 @@ class FetchMsgMetadataTask : public ImapTask
 {
     Q_OBJECT
 public:
-    FetchMsgMetadataTask(Model *model, const QModelIndex &mailbox, const QList<uint> &uids);
+    FetchMsgMetadataTask(Model *model, const QModelIndex &mailbox, const Sequence &uids);
     virtual void perform();
 
     virtual bool handleFetch(const Imap::Responses::Fetch *const resp);
@@ -49,7 +49,7 @@ private:
     CommandHandle tag;
     ImapTask *conn;
     QPersistentModelIndex mailbox;
-    QList<uint> uids;
+    Sequence uids;
 };
 
 }
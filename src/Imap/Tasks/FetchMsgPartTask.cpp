@@ -32,10 +32,10 @@ namespace Imap
 namespace Mailbox
 {
 
-FetchMsgPartTask::FetchMsgPartTask(Model *model, const QModelIndex &mailbox, const QList<uint> &uids, const QStringList &parts):
+FetchMsgPartTask::FetchMsgPartTask(Model *model, const QModelIndex &mailbox, const Sequence &uids, const QStringList &parts):
     ImapTask(model), uids(uids), parts(parts), mailboxIndex(mailbox)
 {
-    Q_ASSERT(!uids.isEmpty());
+    Q_ASSERT(uids.isValid());
     conn = model->findTaskResponsibleFor(mailboxIndex);
     conn->addDependentTask(this);
 }
@@ -47,8 +47,7 @@ void FetchMsgPartTask::perform()
 
     IMAP_TASK_CHECK_ABORT_DIE;
 
-    Sequence seq = Sequence::fromList(uids);
-    tag = parser->uidFetch(seq, parts);
+    tag = parser->uidFetch(uids, parts);
 }
 
 bool FetchMsgPartTask::handleFetch(const Imap::Responses::Fetch *const resp)
@@ -79,7 +78,7 @@ bool FetchMsgPartTask::handleStateHelper(const Imap::Responses::State *const res
             log("Fetched parts", Common::LOG_MESSAGES);
             TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailboxIndex.internalPointer()));
             Q_ASSERT(mailbox);
-            QList<TreeItemMessage *> messages = model->findMessagesByUids(mailbox, uids);
+            QList<TreeItemMessage *> messages = model->findMessagesByUids(mailbox, uids.toList());
             Q_FOREACH(TreeItemMessage *message, messages) {
                 Q_FOREACH(const QString &partId, parts) {
                     log("Fetched part" + partId, Common::LOG_MESSAGES);
@@ -89,6 +88,18 @@ bool FetchMsgPartTask::handleStateHelper(const Imap::Responses::State *const res
             model->changeConnectionState(parser, CONN_STATE_SELECTED);
             _completed();
         } else {
+            if (resp->respCode == Responses::UNKNOWN_CTE) {
+                // The server cannot decode some part for us, but we can still do that ourselves
+                TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailboxIndex.internalPointer()));
+                Q_ASSERT(mailbox);
+                QList<TreeItemMessage *> messages = model->findMessagesByUids(mailbox, uids.toList());
+                Q_FOREACH(TreeItemMessage *message, messages) {
+                    Q_FOREACH(const QString &partId, parts) {
+                        if (partId.startsWith(QLatin1String("BINARY.PEEK[")))
+                            model->refetchPartWithoutBinary(mailbox, message->row() + 1, partId);
+                    }
+                }
+            }
             // FIXME: error handling
             _failed("Part fetch failed");
         }
@@ -103,10 +114,9 @@ QString FetchMsgPartTask::debugIdentification() const
     if (!mailboxIndex.isValid())
         return QLatin1String("[invalid mailbox]");
 
-    Q_ASSERT(!uids.isEmpty());
+    Q_ASSERT(uids.isValid());
     return QString::fromUtf8("%1: parts %2 for UIDs %3")
-           .arg(mailboxIndex.data(RoleMailboxName).toString(), parts.join(QLatin1String(", ")),
-                Sequence::fromList(uids).toByteArray());
+           .arg(mailboxIndex.data(RoleMailboxName).toString(), parts.join(QLatin1String(", ")), uids.toByteArray());
 }
 
 QVariant FetchMsgPartTask::taskData(const int role) const
@@ -36,7 +36,7 @@ class FetchMsgPartTask : public ImapTask
 {
     Q_OBJECT
 public:
-    FetchMsgPartTask(Model *model, const QModelIndex &mailbox, const QList<uint> &uids, const QStringList &parts);
+    FetchMsgPartTask(Model *model, const QModelIndex &mailbox, const Sequence &uids, const QStringList &parts);
     virtual void perform();
 
     virtual bool handleFetch(const Imap::Responses::Fetch *const resp);
@@ -48,7 +48,7 @@ public:
 private:
     CommandHandle tag;
     ImapTask *conn;
-    QList<uint> uids;
+    Sequence uids;
     QStringList parts;
     QPersistentModelIndex mailboxIndex;
 };
@@ -400,8 +400,8 @@ bool KeepMailboxOpenTask::handleNumberResponse(const Imap::Responses::NumberResp
 
         Q_ASSERT(list->m_children.size());
         uint highestKnownUid = 0;
-        for (int i = list->m_children.size() - 1; ! highestKnownUid && i >= 0; --i) {
-            highestKnownUid = static_cast<const TreeItemMessage *>(list->m_children[i])->uid();
+        for (int i = list->m_rows.size() - 1; ! highestKnownUid && i >= 0; --i) {
+            highestKnownUid = list->messageUid(i);
             //qDebug() << "UID disco: trying seq" << i << highestKnownUid;
         }
         breakOrCancelPossibleIdle();
@@ -690,20 +690,26 @@ void KeepMailboxOpenTask::slotFetchRequestedParts()
 
     // When asked to exit, do as much as possible and die
     while (shouldExit || fetchPartTasks.size() < limitParallelFetchTasks) {
-        QList<uint> uids;
+        // The map is ordered by UID, so the sequence is built by merely extending its last range
+        Sequence uids;
+        int messages = 0;
         uint totalSize = 0;
-        while (uids.size() < limitMessagesAtOnce && it != requestedParts.end() && totalSize < limitBytesAtOnce) {
+        while (messages < limitMessagesAtOnce && it != requestedParts.end() && totalSize < limitBytesAtOnce) {
             if (parts != *it)
                 break;
             parts = *it;
-            uids << it.key();
+            uids.add(it.key());
+            ++messages;
             totalSize += requestedPartSizes.take(it.key());
             it = requestedParts.erase(it);
         }
-        if (uids.isEmpty())
+        if (!uids.isValid())
             return;
 
-        fetchPartTasks << model->m_taskFactory->createFetchMsgPartTask(model, mailboxIndex, uids, parts.toList());
+        // Keep the order of the fetch items stable, the QSet has none
+        QStringList partList = parts.toList();
+        qSort(partList);
+        fetchPartTasks << model->m_taskFactory->createFetchMsgPartTask(model, mailboxIndex, uids, partList);
     }
 }
 
@@ -716,15 +722,12 @@ void KeepMailboxOpenTask::slotFetchRequestedEnvelopes()
 
     breakOrCancelPossibleIdle();
 
-    QList<uint> fetchNow;
-    if (shouldExit) {
-        fetchNow = requestedEnvelopes;
-        requestedEnvelopes.clear();
-    } else {
-        const int amount = qMin(requestedEnvelopes.size(), limitMessagesAtOnce); // FIXME: add an extra limit?
-        fetchNow = requestedEnvelopes.mid(0, amount);
-        requestedEnvelopes.erase(requestedEnvelopes.begin(), requestedEnvelopes.begin() + amount);
-    }
+    // FIXME: add an extra limit?
+    const int amount = shouldExit ? requestedEnvelopes.size() : qMin(requestedEnvelopes.size(), limitMessagesAtOnce);
+    Sequence fetchNow;
+    for (int i = 0; i < amount; ++i)
+        fetchNow.add(requestedEnvelopes[i]);
+    requestedEnvelopes.erase(requestedEnvelopes.begin(), requestedEnvelopes.begin() + amount);
     fetchMetadataTasks << model->m_taskFactory->createFetchMsgMetadataTask(model, mailboxIndex, fetchNow);
 }
 
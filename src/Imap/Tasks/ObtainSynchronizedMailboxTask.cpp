@@ -38,7 +38,8 @@ namespace Mailbox
 ObtainSynchronizedMailboxTask::ObtainSynchronizedMailboxTask(Model *model, const QModelIndex &mailboxIndex, ImapTask *parentTask,
         KeepMailboxOpenTask *keepTask):
     ImapTask(model), conn(parentTask), mailboxIndex(mailboxIndex), status(STATE_WAIT_FOR_CONN), uidSyncingMode(UID_SYNC_ALL),
-    firstUnknownUidOffset(0), m_usingQresync(false), unSelectTask(0), keepTaskChild(keepTask)
+    firstUnknownUidOffset(0), m_usingQresync(false), m_cachedFlagsUsable(true), m_bisectionActive(false),
+    m_bisectionFailed(false), unSelectTask(0), keepTaskChild(keepTask)
 {
     // The Parser* is not provided by our parent task, but instead through the keepTaskChild.  The reason is simple, the parent
     // task might not even exist, but there's always an KeepMailboxOpenTask in the game.
@@ -166,6 +167,25 @@ bool ObtainSynchronizedMailboxTask::handleStateHelper(const Imap::Responses::Sta
             // FIXME: error handling
         }
         return true;
+    } else if (resp->tag == m_bisectionCmd) {
+
+        m_bisectionCmd.clear();
+        Q_ASSERT(status == STATE_SYNCING_UIDS);
+        Q_ASSERT(mailboxIndex.isValid());   // FIXME
+        TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailboxIndex.internalPointer()));
+        Q_ASSERT(mailbox);
+        if (resp->kind == Responses::OK && !m_bisectionFailed && bisectionProcessProbes(mailbox)) {
+            bisectionNextRound(mailbox);
+        } else {
+            log("Bisection failed, falling back to the full UID synchronization", Common::LOG_MAILBOX_SYNC);
+            m_bisectionActive = false;
+            m_bisectionProbes.clear();
+            m_bisectionKnown.clear();
+            TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(mailbox->m_children[0]);
+            Q_ASSERT(list);
+            syncGeneric(mailbox, list);
+        }
+        return true;
     } else if (resp->tag == flagsCmd) {
 
         if (resp->kind == Responses::OK) {
@@ -302,9 +322,8 @@ void ObtainSynchronizedMailboxTask::finalizeSelect()
                     if (oldSyncState.uidNext() < syncState.uidNext()) {
                         list->m_fetchStatus = TreeItem::DONE;
                         int seqWithLowestUnknownUid = -1;
-                        for (int i = 0; i < list->m_children.size(); ++i) {
-                            TreeItemMessage *msg = static_cast<TreeItemMessage*>(list->m_children[i]);
-                            if (!msg->uid()) {
+                        for (int i = 0; i < list->m_rows.size(); ++i) {
+                            if (!list->messageUid(i)) {
                                 seqWithLowestUnknownUid = i;
                                 break;
                             }
@@ -348,8 +367,11 @@ void ObtainSynchronizedMailboxTask::finalizeSelect()
                 if (syncState.exists() == oldSyncState.exists()) {
                     // No deletions, either, so we resync only flag changes
                     syncNoNewNoDeletions(mailbox, list);
-                } else {
+                } else if (syncState.exists() < oldSyncState.exists()) {
                     // Some messages got deleted, but there have been no additions
+                    syncOnlyDeletions(mailbox, list);
+                } else {
+                    // More messages but the same UIDNEXT? That doesn't make any sense, so let's not trust anything.
                     syncGeneric(mailbox, list);
                 }
 
@@ -385,21 +407,20 @@ void ObtainSynchronizedMailboxTask::fullMboxSync(TreeItemMailbox *mailbox, TreeI
 {
     log("Full synchronization", Common::LOG_MAILBOX_SYNC);
 
+    // We're throwing away all messages, so whatever flags we might have in the cache cannot be combined with an incremental
+    // FETCH CHANGEDSINCE anymore
+    m_cachedFlagsUsable = false;
+
     QModelIndex parent = list->toIndex(model);
     if (! list->m_children.isEmpty()) {
         model->beginRemoveRows(parent, 0, list->m_children.size() - 1);
-        QList<TreeItem*> oldItems = list->m_children;
-        list->m_children.clear();
+        QList<TreeItem*> oldItems = list->takeMessages(0, list->m_children.size());
         model->endRemoveRows();
         qDeleteAll(oldItems);
     }
     if (mailbox->syncState.exists()) {
         model->beginInsertRows(parent, 0, mailbox->syncState.exists() - 1);
-        for (uint i = 0; i < mailbox->syncState.exists(); ++i) {
-            TreeItemMessage *msg = new TreeItemMessage(list);
-            msg->m_offset = i;
-            list->m_children << msg;
-        }
+        list->appendMessages(mailbox->syncState.exists());
         model->endInsertRows();
 
         syncUids(mailbox);
@@ -436,8 +457,8 @@ void ObtainSynchronizedMailboxTask::syncNoNewNoDeletions(TreeItemMailbox *mailbo
     if (mailbox->syncState.exists()) {
         // Verify that we indeed have all UIDs and not need them anymore
         bool uidsOk = true;
-        for (int i = 0; i < list->m_children.size(); ++i) {
-            if (! static_cast<TreeItemMessage *>(list->m_children[i])->uid()) {
+        for (int i = 0; i < list->m_rows.size(); ++i) {
+            if (! list->messageUid(i)) {
                 uidsOk = false;
                 break;
             }
@@ -451,14 +472,11 @@ void ObtainSynchronizedMailboxTask::syncNoNewNoDeletions(TreeItemMailbox *mailbo
     }
 
     if (list->m_children.isEmpty()) {
-        QList<TreeItem *> messages;
+        list->appendMessages(mailbox->syncState.exists());
         for (uint i = 0; i < mailbox->syncState.exists(); ++i) {
-            TreeItemMessage *msg = new TreeItemMessage(list);
-            msg->m_offset = i;
-            msg->m_uid = uidMap[ i ];
-            messages << msg;
+            list->m_rows[i].uid = uidMap[ i ];
+            loadCachedFlags(mailbox, list, i);
         }
-        list->setChildren(messages);
 
     } else {
         if (mailbox->syncState.exists() != static_cast<uint>(list->m_children.size())) {
@@ -509,6 +527,169 @@ void ObtainSynchronizedMailboxTask::syncGeneric(TreeItemMailbox *mailbox, TreeIt
     syncUids(mailbox);
 }
 
+/** @short Find out which messages got expunged while there were no new arrivals
+
+Without QRESYNC, we have no way of asking the server about what UIDs got removed. A UID SEARCH ALL works, but when ESEARCH is
+not available, that means transferring each and every UID in the mailbox, which is a lot of data for huge mailboxes where just a
+message or two got deleted.
+
+Because there were no new arrivals, the new mailbox layout is just a subset of the cached UID map. That's why we can use a
+bisection over the sequence numbers: a FETCH n (UID) tells us how many messages preceding the message #n have been expunged. If
+the number is the same at both ends of an interval, nothing got removed in there and the interval is resolved. The remaining
+intervals are split again until they are short enough to be fetched completely.
+*/
+void ObtainSynchronizedMailboxTask::syncOnlyDeletions(TreeItemMailbox *mailbox, TreeItemMsgList *list)
+{
+    if (model->accessParser(parser).capabilities.contains(QLatin1String("ESEARCH"))) {
+        // The ESEARCH sends a compact list of UIDs, there's no point in playing games with round trips
+        syncGeneric(mailbox, list);
+        return;
+    }
+
+    // For small mailboxes, the list of all UIDs is short enough to make the extra round trips not worth it
+    const int bisectionMinimalMailboxSize = 64;
+    if (uidMap.size() < bisectionMinimalMailboxSize || static_cast<uint>(uidMap.size()) <= mailbox->syncState.exists()) {
+        syncGeneric(mailbox, list);
+        return;
+    }
+
+    for (int i = 0; i < uidMap.size(); ++i) {
+        if (uidMap[i] == 0 || (i > 0 && uidMap[i - 1] >= uidMap[i])) {
+            log("Cached UID map is not usable for bisection", Common::LOG_MAILBOX_SYNC);
+            syncGeneric(mailbox, list);
+            return;
+        }
+    }
+
+    log("Looking for expunged messages through bisection", Common::LOG_MAILBOX_SYNC);
+    list->m_numberFetchingStatus = TreeItem::LOADING;
+    list->m_unreadMessageCount = 0;
+    uidSyncingMode = UID_SYNC_ALL;
+    status = STATE_SYNCING_UIDS;
+    m_bisectionActive = true;
+    m_bisectionFailed = false;
+    m_bisectionProbes.clear();
+    m_bisectionKnown.clear();
+    model->cache()->clearUidMapping(mailbox->mailbox());
+    emit model->mailboxSyncingProgress(mailboxIndex, status);
+    bisectionNextRound(mailbox);
+}
+
+/** @short Ask for UIDs of messages which are needed to resolve the remaining intervals, or finish the bisection */
+void ObtainSynchronizedMailboxTask::bisectionNextRound(TreeItemMailbox *mailbox)
+{
+    // Intervals shorter than this are fetched completely
+    const uint fullFetchThreshold = 32;
+    // Longer intervals are split by this number of probes
+    const uint probesPerInterval = 8;
+
+    const uint newExists = mailbox->syncState.exists();
+    const uint expunged = uidMap.size() - newExists;
+
+    m_bisectionRequested = Sequence();
+
+    // Walk through the consecutive known points, including the virtual ones "before the first message" and "after the last one"
+    uint lastSeq = 0;
+    uint lastDelta = 0;
+    QMap<uint, uint>::const_iterator it = m_bisectionKnown.constBegin();
+    while (true) {
+        uint seq, delta;
+        if (it == m_bisectionKnown.constEnd()) {
+            seq = newExists + 1;
+            delta = expunged;
+        } else {
+            seq = it.key();
+            delta = it.value() - (seq - 1);
+        }
+
+        const uint gap = seq - lastSeq - 1;
+        if (gap > 0 && delta != lastDelta) {
+            if (gap <= fullFetchThreshold) {
+                m_bisectionRequested.add(lastSeq + 1, seq - 1);
+            } else {
+                for (uint j = 1; j <= probesPerInterval; ++j)
+                    m_bisectionRequested.add(lastSeq + ((gap + 1) * j) / (probesPerInterval + 1));
+            }
+        }
+
+        if (it == m_bisectionKnown.constEnd())
+            break;
+        lastSeq = seq;
+        lastDelta = delta;
+        ++it;
+    }
+
+    if (!m_bisectionRequested.isValid()) {
+        finalizeBisection(mailbox);
+    } else {
+        m_bisectionCmd = parser->fetch(m_bisectionRequested, QStringList() << QLatin1String("UID"));
+    }
+}
+
+/** @short Verify the received probes and convert them to offsets in the cached UID map
+
+Returns false when the results do not make sense, for example due to a new arrival.
+*/
+bool ObtainSynchronizedMailboxTask::bisectionProcessProbes(TreeItemMailbox *mailbox)
+{
+    const uint expunged = uidMap.size() - mailbox->syncState.exists();
+
+    Q_FOREACH(const uint seq, m_bisectionRequested.toList()) {
+        QMap<uint, uint>::const_iterator probe = m_bisectionProbes.constFind(seq);
+        if (probe == m_bisectionProbes.constEnd()) {
+            // The server didn't tell us about that message
+            return false;
+        }
+        QList<uint>::const_iterator found = qBinaryFind(uidMap.constBegin(), uidMap.constEnd(), *probe);
+        if (found == uidMap.constEnd()) {
+            // That's not a message which we knew about the last time
+            return false;
+        }
+        const uint offset = found - uidMap.constBegin();
+        if (offset < seq - 1) {
+            // A message cannot move to a higher sequence number when no new messages have arrived
+            return false;
+        }
+        m_bisectionKnown[seq] = offset;
+    }
+    m_bisectionProbes.clear();
+
+    // The number of expunged messages preceding each message shall never decrease
+    uint lastDelta = 0;
+    for (QMap<uint, uint>::const_iterator it = m_bisectionKnown.constBegin(); it != m_bisectionKnown.constEnd(); ++it) {
+        const uint delta = it.value() - (it.key() - 1);
+        if (delta < lastDelta || delta > expunged) {
+            return false;
+        }
+        lastDelta = delta;
+    }
+    return true;
+}
+
+/** @short All intervals are resolved, so build the new UID map and continue as if we received a UID SEARCH ALL */
+void ObtainSynchronizedMailboxTask::finalizeBisection(TreeItemMailbox *mailbox)
+{
+    const uint newExists = mailbox->syncState.exists();
+    QList<uint> newUidMap;
+    newUidMap.reserve(newExists);
+    uint lastDelta = 0;
+    QMap<uint, uint>::const_iterator next = m_bisectionKnown.constBegin();
+    for (uint seq = 1; seq <= newExists; ++seq) {
+        if (next != m_bisectionKnown.constEnd() && next.key() == seq) {
+            lastDelta = next.value() - (seq - 1);
+            ++next;
+        }
+        newUidMap << uidMap[seq - 1 + lastDelta];
+    }
+    m_bisectionActive = false;
+    m_bisectionKnown.clear();
+    log(QString::fromUtf8("Bisection found %1 expunged messages").arg(QString::number(uidMap.size() - newUidMap.size())),
+        Common::LOG_MAILBOX_SYNC);
+    uidMap = newUidMap;
+    finalizeSearch();
+    syncFlags(mailbox);
+}
+
 void ObtainSynchronizedMailboxTask::syncUids(TreeItemMailbox *mailbox, const uint lowestUidToQuery)
 {
     status = STATE_SYNCING_UIDS;
@@ -517,7 +698,7 @@ void ObtainSynchronizedMailboxTask::syncUids(TreeItemMailbox *mailbox, const uin
     if (lowestUidToQuery == 0) {
         uidSpecification = "ALL";
     } else {
-        uidSpecification = QString::fromUtf8("UID %1:*").arg(QString::number(lowestUidToQuery)).toUtf8();
+        uidSpecification = "UID " + Sequence::startingAt(lowestUidToQuery).toByteArray();
     }
     uidMap.clear();
     if (model->accessParser(parser).capabilities.contains(QLatin1String("ESEARCH"))) {
@@ -538,7 +719,10 @@ void ObtainSynchronizedMailboxTask::syncFlags(TreeItemMailbox *mailbox)
 
     // 0 => don't use it; >0 => use that as the old value
     quint64 useModSeq = 0;
-    if ((model->accessParser(parser).capabilities.contains(QLatin1String("CONDSTORE")) ||
+    if (!m_cachedFlagsUsable) {
+        // The FETCH CHANGEDSINCE would only tell us about some messages, and we have no idea about the flags of the rest
+        log("Cached flags are not usable, will fetch all of them", Common::LOG_MAILBOX_SYNC);
+    } else if ((model->accessParser(parser).capabilities.contains(QLatin1String("CONDSTORE")) ||
          model->accessParser(parser).capabilities.contains(QLatin1String("QRESYNC"))) &&
             oldSyncState.highestModSeq() > 0 && mailbox->syncState.isUsableForCondstore() &&
             oldSyncState.uidValidity() == mailbox->syncState.uidValidity()) {
@@ -671,8 +855,8 @@ bool ObtainSynchronizedMailboxTask::handleResponseCodeInsideState(const Imap::Re
 void ObtainSynchronizedMailboxTask::updateHighestKnownUid(TreeItemMailbox *mailbox, const TreeItemMsgList *list) const
 {
     uint highestKnownUid = 0;
-    for (int i = list->m_children.size() - 1; ! highestKnownUid && i >= 0; --i) {
-        highestKnownUid = static_cast<const TreeItemMessage *>(list->m_children[i])->uid();
+    for (int i = list->m_rows.size() - 1; ! highestKnownUid && i >= 0; --i) {
+        highestKnownUid = list->messageUid(i);
     }
     if (highestKnownUid) {
         // If the UID walk return a usable number, remember that and use it for updating our idea of the UIDNEXT
@@ -707,12 +891,8 @@ bool ObtainSynchronizedMailboxTask::handleNumberResponse(const Imap::Responses::
                     QModelIndex parent = list->toIndex(model);
                     int offset = list->m_children.size();
                     model->beginInsertRows(parent, offset, resp->number - 1);
-                    for (int i = 0; i < newArrivals; ++i) {
-                        TreeItemMessage *msg = new TreeItemMessage(list);
-                        msg->m_offset = i + offset;
-                        list->m_children << msg;
-                        // yes, we really have to add this message with UID 0 :(
-                    }
+                    // yes, we really have to add these messages with UID 0 :(
+                    list->appendMessages(newArrivals);
                     model->endInsertRows();
                     list->m_totalMessageCount = resp->number;
                 }
@@ -724,6 +904,10 @@ bool ObtainSynchronizedMailboxTask::handleNumberResponse(const Imap::Responses::
             return true;
 
         case STATE_SYNCING_UIDS:
+            if (m_bisectionActive) {
+                // The bisection relies on the mailbox being stable; the full UID syncing will take care of this
+                m_bisectionFailed = true;
+            }
             mailbox->handleExists(model, *resp);
             updateHighestKnownUid(mailbox, list);
             return true;
@@ -798,6 +982,8 @@ bool ObtainSynchronizedMailboxTask::handleNumberResponse(const Imap::Responses::
         case STATE_SYNCING_UIDS:
             // We shouldn't delete stuff at this point, it will be handled by the UID syncing.
             // The response shall be consumed, though.
+            if (m_bisectionActive)
+                m_bisectionFailed = true;
             return true;
 
         case STATE_SYNCING_FLAGS:
@@ -957,6 +1143,14 @@ bool ObtainSynchronizedMailboxTask::handleFetch(const Imap::Responses::Fetch *co
     if (dieIfInvalidMailbox())
         return true;
 
+    if (m_bisectionActive) {
+        // The message list does not match the mailbox yet, so we cannot apply anything. The flags will be synced later anyway.
+        if (resp->has(Responses::Fetch::ITEM_UID)) {
+            m_bisectionProbes[resp->number] = resp->uid;
+        }
+        return true;
+    }
+
     TreeItemMailbox *mailbox = Model::mailboxForSomeItem(mailboxIndex);
     Q_ASSERT(mailbox);
     QList<TreeItemPart *> changedParts;
@@ -1003,35 +1197,37 @@ void ObtainSynchronizedMailboxTask::applyUids(TreeItemMailbox *mailbox)
             // now we're just adding new messages to the end of the list
             const int futureTotalMessages = mailbox->syncState.exists();
             model->beginInsertRows(parent, i, futureTotalMessages - 1);
+            // Add all messages in one go
+            list->appendMessages(futureTotalMessages - i);
             for (/*nothing*/; i < futureTotalMessages; ++i) {
-                // Add all messages in one go
-                TreeItemMessage *msg = new TreeItemMessage(list);
-                msg->m_offset = i;
                 // We're iterating with i, so we got to update the uidOffset
                 uidOffset = i - firstUnknownUidOffset;
                 Q_ASSERT(uidOffset >= 0);
                 Q_ASSERT(uidOffset < uidMap.size());
-                msg->m_uid = uidMap[uidOffset];
-                list->m_children << msg;
+                list->m_rows[i].uid = uidMap[uidOffset];
+                if (uidMap[uidOffset] < oldSyncState.uidNext()) {
+                    // This message was present when we synced the last time, so its flags might be found in the cache.
+                    // Newer arrivals are guaranteed to be reported by a FETCH CHANGEDSINCE, so there's no point in looking.
+                    loadCachedFlags(mailbox, list, i);
+                }
             }
             model->endInsertRows();
             Q_ASSERT(i == list->m_children.size());
             Q_ASSERT(i == futureTotalMessages);
-        } else if (dynamic_cast<TreeItemMessage *>(list->m_children[i])->m_uid == uidMap[uidOffset]) {
+        } else if (list->messageUid(i) == uidMap[uidOffset]) {
             // If the UID of the "current message" matches, we're okay
-            dynamic_cast<TreeItemMessage *>(list->m_children[i])->m_offset = i;
             ++i;
-        } else if (dynamic_cast<TreeItemMessage *>(list->m_children[i])->m_uid == 0) {
+        } else if (list->messageUid(i) == 0) {
             // If the UID of the "current message" is zero, replace that with this message
-            TreeItemMessage *msg = static_cast<TreeItemMessage*>(list->m_children[i]);
-            msg->m_uid = uidMap[uidOffset];
-            msg->m_offset = i;
-            QModelIndex idx = model->createIndex(i, 0, msg);
-            emit model->dataChanged(idx, idx);
-            if (msg->m_fetchStatus == TreeItem::LOADING) {
-                // We've got to ask for the message metadata once again; the first attempt happened when the UID was still zero,
-                // so this is our chance
-                model->askForMsgMetadata(msg, Model::PRELOAD_PER_POLICY);
+            list->m_rows[i].uid = uidMap[uidOffset];
+            if (TreeItemMessage *msg = list->existingMessage(i)) {
+                QModelIndex idx = model->createIndex(i, 0, msg);
+                emit model->dataChanged(idx, idx);
+                if (msg->m_fetchStatus == TreeItem::LOADING) {
+                    // We've got to ask for the message metadata once again; the first attempt happened when the UID was still
+                    // zero, so this is our chance
+                    model->askForMsgMetadata(msg, Model::PRELOAD_PER_POLICY);
+                }
             }
             ++i;
         } else {
@@ -1043,10 +1239,9 @@ void ObtainSynchronizedMailboxTask::applyUids(TreeItemMailbox *mailbox)
                 // other message already in the mailbox. Just for the sake of completeness, should an evil server send us a
                 // malformed response, we wouldn't care (or notice at this point), we'd just "needlessly" delete many "innocent"
                 // messages due to that one out-of-place arrival -- but we'd still remain correct and not crash.
-                TreeItemMessage *otherMessage = dynamic_cast<TreeItemMessage*>(list->m_children[pos]);
-                Q_ASSERT(otherMessage);
-                if (otherMessage->m_uid != 0 && otherMessage->m_uid != uidMap[uidOffset]) {
-                    model->cache()->clearMessage(mailbox->mailbox(), otherMessage->uid());
+                const uint otherUid = list->messageUid(pos);
+                if (otherUid != 0 && otherUid != uidMap[uidOffset]) {
+                    model->cache()->clearMessage(mailbox->mailbox(), otherUid);
                     ++pos;
                 } else {
                     break;
@@ -1054,11 +1249,8 @@ void ObtainSynchronizedMailboxTask::applyUids(TreeItemMailbox *mailbox)
             }
             Q_ASSERT(pos > i);
             model->beginRemoveRows(parent, i, pos - 1);
-            QList<TreeItem*> removedItems;
-            for (int j = i; j < pos; ++j)
-                removedItems << list->m_children.takeAt(i);
+            QList<TreeItem*> removedItems = list->takeMessages(i, pos - i);
             model->endRemoveRows();
-            // the m_offset of all subsequent messages will be updated later, at the time *they* are processed
             qDeleteAll(removedItems);
             if (i == list->m_children.size()) {
                 // We're asked to add messages to the end of the list. That's something that's already implemented above,
@@ -1074,12 +1266,10 @@ void ObtainSynchronizedMailboxTask::applyUids(TreeItemMailbox *mailbox)
     if (i != list->m_children.size()) {
         // remove items at the end
         model->beginRemoveRows(parent, i, list->m_children.size() - 1);
-        QList<TreeItem*> oldItems;
-        for (/* nothing */; i < list->m_children.size(); ++i) {
-            TreeItemMessage *message = static_cast<TreeItemMessage *>(list->m_children.takeAt(i));
-            model->cache()->clearMessage(mailbox->mailbox(), message->uid());
-            oldItems << message;
+        for (int j = i; j < list->m_rows.size(); ++j) {
+            model->cache()->clearMessage(mailbox->mailbox(), list->messageUid(j));
         }
+        QList<TreeItem*> oldItems = list->takeMessages(i, list->m_children.size() - i);
         model->endRemoveRows();
         qDeleteAll(oldItems);
     }
@@ -1180,6 +1370,19 @@ QVariant ObtainSynchronizedMailboxTask::taskData(const int role) const
     return role == RoleTaskCompactName ? QVariant(tr("Synchronizing mailbox")) : QVariant();
 }
 
+/** @short Restore flags of a message from the cache
+
+This is required for the FETCH CHANGEDSINCE to work as expected; the server will only tell us about messages whose flags have
+changed since the last time, so the rest has to be restored from the cache.
+*/
+void ObtainSynchronizedMailboxTask::loadCachedFlags(TreeItemMailbox *mailbox, TreeItemMsgList *list, const int row)
+{
+    MessageRow &message = list->m_rows[row];
+    Q_ASSERT(message.uid);
+    message.flags = list->m_flagDictionary.fromList(model->cache()->msgFlags(mailbox->mailbox(), message.uid));
+    message.flags.clear(FlagDictionary::FLAG_RECENT);
+}
+
 void ObtainSynchronizedMailboxTask::saveSyncState(TreeItemMailbox *mailbox)
 {
     model->cache()->setMailboxSyncState(mailbox->mailbox(), mailbox->syncState);
@@ -69,12 +69,18 @@ private:
     void syncNoNewNoDeletions(TreeItemMailbox *mailbox, TreeItemMsgList *list);
     void syncOnlyAdditions(TreeItemMailbox *mailbox, TreeItemMsgList *list);
     void syncGeneric(TreeItemMailbox *mailbox, TreeItemMsgList *list);
+    void syncOnlyDeletions(TreeItemMailbox *mailbox, TreeItemMsgList *list);
+
+    void bisectionNextRound(TreeItemMailbox *mailbox);
+    bool bisectionProcessProbes(TreeItemMailbox *mailbox);
+    void finalizeBisection(TreeItemMailbox *mailbox);
 
     void applyUids(TreeItemMailbox *mailbox);
     void finalizeSearch();
 
     void syncUids(TreeItemMailbox *mailbox, const uint lowestUidToQuery=0);
     void syncFlags(TreeItemMailbox *mailbox);
+    void loadCachedFlags(TreeItemMailbox *mailbox, TreeItemMsgList *list, const int row);
     void saveSyncState(TreeItemMailbox *mailbox);
     void updateHighestKnownUid(TreeItemMailbox *mailbox, const TreeItemMsgList *list) const;
 
@@ -111,6 +117,21 @@ private:
     uint firstUnknownUidOffset;
     SyncState oldSyncState;
     bool m_usingQresync;
+    /** @short Are the flags of already known messages available from the cache, i.e. is FETCH CHANGEDSINCE usable? */
+    bool m_cachedFlagsUsable;
+
+    /** @short The FETCH (UID) command which probes the mailbox when looking for expunged messages */
+    CommandHandle m_bisectionCmd;
+    /** @short Is the bisection-based detection of expunged messages in progress? */
+    bool m_bisectionActive;
+    /** @short Has the bisection been invalidated by an unexpected change of the mailbox? */
+    bool m_bisectionFailed;
+    /** @short Sequence numbers requested by the current round of bisection */
+    Sequence m_bisectionRequested;
+    /** @short Raw results of the FETCH (UID) probes, i.e. seq -> UID */
+    QMap<uint, uint> m_bisectionProbes;
+    /** @short Verified results of the probes, i.e. seq -> offset in the cached UID map */
+    QMap<uint, uint> m_bisectionKnown;
 
     /** @short An UNSELECT task, if active */
     UnSelectTask *unSelectTask;
@@ -34,9 +34,11 @@ namespace Mailbox
 {
 
 
-SortTask::SortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria):
+SortTask::SortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria,
+                   const QPair<int, int> &partialRange):
     ImapTask(model), mailboxIndex(mailbox), searchConditions(searchConditions), sortCriteria(sortCriteria),
-    m_persistentSearch(false), m_firstUntaggedReceived(false), m_firstCommandCompleted(false)
+    m_persistentSearch(false), m_firstUntaggedReceived(false), m_firstCommandCompleted(false), m_partialRange(partialRange),
+    m_partialSearch(false), m_partialCount(0)
 {
     conn = model->findTaskResponsibleFor(mailbox);
     conn->addDependentTask(this);
@@ -65,7 +67,14 @@ void SortTask::perform()
         if (model->accessParser(parser).capabilitiesFresh &&
                 model->accessParser(parser).capabilities.contains(QLatin1String("ESEARCH"))) {
             // We always prefer ESEARCH over SEARCH, if only for its embedded reference to the command tag
-            if (model->accessParser(parser).capabilities.contains(QLatin1String("CONTEXT=SEARCH"))) {
+            if (m_partialRange.first && model->accessParser(parser).capabilities.contains(QLatin1String("CONTEXT=SEARCH"))) {
+                // Only a window of the result is requested, along with the total number of matches
+                m_partialSearch = true;
+                sortTag = parser->uidESearch("utf-8", searchConditions,
+                                             QStringList() << QLatin1String("COUNT") <<
+                                             QString::fromUtf8("PARTIAL %1:%2").arg(QString::number(m_partialRange.first),
+                                                                                    QString::number(m_partialRange.second)));
+            } else if (model->accessParser(parser).capabilities.contains(QLatin1String("CONTEXT=SEARCH"))) {
                 // Hurray, this IMAP server supports incremental ESEARCH updates
                 m_persistentSearch = true;
                 sortTag = parser->uidESearch("utf-8", searchConditions,
@@ -128,7 +137,10 @@ bool SortTask::handleStateHelper(const Imap::Responses::State *const resp)
     if (resp->tag == sortTag) {
         m_firstCommandCompleted = true;
         if (resp->kind == Responses::OK) {
-            emit sortingAvailable(sortResult);
+            if (m_partialSearch)
+                emit partialSortingAvailable(sortResult, qAbs(m_partialRange.first) - 1, m_partialCount);
+            else
+                emit sortingAvailable(sortResult);
             if (!m_persistentSearch || _aborted) {
                 // This is a one-shot operation, we shall not remain as an active task, listening for further updates
                 _completed();
@@ -209,6 +221,19 @@ bool SortTask::handleESearch(const Responses::ESearch *const resp)
 
     Q_ASSERT(allIterator == resp->listData.constEnd());
 
+    if (m_partialSearch) {
+        m_firstUntaggedReceived = true;
+        sortResult = resp->partialData;
+        Responses::ESearch::CompareListDataIdentifier<Responses::ESearch::ListData_t> countComparator("COUNT");
+        Responses::ESearch::ListData_t::const_iterator countIterator =
+                std::find_if(resp->listData.constBegin(), resp->listData.constEnd(), countComparator);
+        if (countIterator != resp->listData.constEnd() && countIterator->second.size() == 1)
+            m_partialCount = countIterator->second.first();
+        else
+            m_partialCount = sortResult.size();
+        return true;
+    }
+
     if (resp->incrementalContextData.isEmpty()) {
         sortResult.clear();
         // This means that there have been no matches
@@ -243,6 +268,12 @@ bool SortTask::isPersistent() const
     return m_persistentSearch;
 }
 
+/** @short Return true if the task asks for a window of the result only */
+bool SortTask::isPartial() const
+{
+    return m_partialSearch;
+}
+
 /** @short Return true if this task has already done its job and is now merely listening for further updates */
 bool SortTask::isJustUpdatingNow() const
 {
@@ -36,7 +36,8 @@ class SortTask : public ImapTask
 {
     Q_OBJECT
 public:
-    SortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria);
+    SortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria,
+             const QPair<int, int> &partialRange = QPair<int, int>());
     virtual void perform();
     virtual void abort();
 
@@ -49,6 +50,7 @@ public:
 
     bool isPersistent() const;
     bool isJustUpdatingNow() const;
+    bool isPartial() const;
 
     void cancelSortingUpdates();
 
@@ -56,6 +58,13 @@ signals:
     /** @short Sort result has arrived */
     void sortingAvailable(const QList<uint> &uids);
 
+    /** @short A window of the search result according to RFC 5267's PARTIAL has arrived
+
+    The @arg offset is the zero-based position of the first UID in the whole result, the @arg total is the number of all
+    matching messages. When the positions were counted from the end, so is the @arg offset.
+    */
+    void partialSortingAvailable(const QList<uint> &uids, const uint offset, const uint total);
+
     /** @short Sort operation has failed */
     void sortingFailed();
 
@@ -81,6 +90,18 @@ private:
 
     /** @short Did the first command (the ESEARCH/ESORT) finish properly, including its tagged response? */
     bool m_firstCommandCompleted;
+
+    /** @short One-based range of positions to ask for through PARTIAL, or (0, 0) for the whole result
+
+    Negative positions are counted from the end of the result.
+    */
+    QPair<int, int> m_partialRange;
+
+    /** @short Is the PARTIAL actually being used? */
+    bool m_partialSearch;
+
+    /** @short Number of all matches as reported by COUNT */
+    uint m_partialCount;
 };
 
 }
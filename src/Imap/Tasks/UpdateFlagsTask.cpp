@@ -66,7 +66,8 @@ void UpdateFlagsTask::perform()
     IMAP_TASK_CHECK_ABORT_DIE;
 
     Sequence seq;
-    bool first = true;
+    MessageFlags changedFlags;
+    bool changedFlagsKnown = false;
 
     Q_FOREACH(const QPersistentModelIndex& index, messages) {
         if (!index.isValid()) {
@@ -76,12 +77,7 @@ void UpdateFlagsTask::perform()
             Q_ASSERT(item);
             TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(item);
             Q_ASSERT(message);
-            if (first) {
-                seq = Sequence(message->uid());
-                first = false;
-            } else {
-                seq.add(message->uid());
-            }
+            seq.add(message->uid());
             switch (flagOperation) {
             case FLAG_ADD:
             case FLAG_REMOVE:
@@ -89,32 +85,30 @@ void UpdateFlagsTask::perform()
                 // we aren't supposed to update them ourselves; the IMAP server will tell us
                 break;
             case FLAG_REMOVE_SILENT:
-            {
-                TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(message->parent());
-                Q_ASSERT(list);
-                QStringList newFlags = message->m_flags;
-                newFlags.removeOne(flags);
-                message->setFlags(list, newFlags , false);
-                // we don't have to either re-sort or call Model::normalizeFlags again from this context;
-                // this will change when the model starts de-duplicating whole lists
-                break;
-            }
             case FLAG_ADD_SILENT:
             {
                 TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(message->parent());
                 Q_ASSERT(list);
-                QStringList newFlags = message->m_flags;
-                if (!newFlags.contains(flags)) {
-                    newFlags << flags;
-                    message->setFlags(list, model->normalizeFlags(newFlags), false);
+                // All messages are in the same mailbox, so they share the dictionary
+                if (!changedFlagsKnown) {
+                    changedFlags = list->m_flagDictionary.fromList(flags.split(QLatin1Char(' '), QString::SkipEmptyParts));
+                    changedFlagsKnown = true;
                 }
+                const int row = message->row();
+                MessageFlags newFlags = list->messageFlags(row);
+                if (flagOperation == FLAG_ADD_SILENT)
+                    newFlags.unite(changedFlags);
+                else
+                    newFlags.subtract(changedFlags);
+                if (newFlags != list->messageFlags(row))
+                    list->setMessageFlags(row, newFlags, false);
                 break;
             }
             }
         }
     }
 
-    if (first) {
+    if (!seq.isValid()) {
         // No valid messages
         _failed("All messages got removed before we could've updated their flags");
         return;
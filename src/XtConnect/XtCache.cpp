@@ -142,6 +142,21 @@ void XtCache::setMsgPart( const QString& mailbox, uint uid, const QString& partI
     Q_UNUSED(data);
 }
 
+void XtCache::addMsgSearchableText( const QString& mailbox, uint uid, const QString& text )
+{
+    Q_UNUSED(mailbox);
+    Q_UNUSED(uid);
+    Q_UNUSED(text);
+}
+
+QList<uint> XtCache::searchMessages( const QString& mailbox, const QString& query, const uint fields ) const
+{
+    Q_UNUSED(mailbox);
+    Q_UNUSED(query);
+    Q_UNUSED(fields);
+    return QList<uint>();
+}
+
 XtCache::SavingState XtCache::messageSavingStatus( const QString &mailbox, const uint uid ) const
 {
     QStringList flags = _sqlCache->msgFlags( mailbox, uid );
@@ -182,6 +197,18 @@ void XtCache::setMessageThreading(const QString &mailbox, const QVector<Imap::Re
     Q_UNUSED(threading);
 }
 
+XtCache::MessageSorting XtCache::messageSorting(const QString &mailbox) const
+{
+    Q_UNUSED(mailbox);
+    return MessageSorting();
+}
+
+void XtCache::setMessageSorting(const QString &mailbox, const MessageSorting &sorting)
+{
+    Q_UNUSED(mailbox);
+    Q_UNUSED(sorting);
+}
+
 void XtCache::setRenewalThreshold(const int days)
 {
     Q_UNUSED(days);
@@ -88,11 +88,21 @@ public:
     /** @short Do nothing */
     virtual void setMsgPart( const QString& mailbox, uint uid, const QString& partId, const QByteArray& data );
 
+    /** @short Do nothing */
+    virtual void addMsgSearchableText( const QString& mailbox, uint uid, const QString& text );
+    /** @short Returns an empty list */
+    virtual QList<uint> searchMessages( const QString& mailbox, const QString& query, const uint fields ) const;
+
     /** @short Do nothing */
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
     /** @short Do nothing */
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading);
 
+    /** @short Returns an empty result */
+    virtual MessageSorting messageSorting(const QString &mailbox) const;
+    /** @short Do nothing */
+    virtual void setMessageSorting(const QString &mailbox, const MessageSorting &sorting);
+
     /** @short Open a connection to the cache */
     bool open();
 
@@ -42,6 +42,15 @@ public:
         }
         model->updateCapabilities( model->m_parsers.begin().key(), existingCaps << cap );
     }
+
+    /** @short Pretend that the server does not support the specified capability */
+    void removeCapability(const QString &cap)
+    {
+        Q_ASSERT(!model->m_parsers.isEmpty());
+        QStringList existingCaps = model->capabilities();
+        existingCaps.removeAll(cap);
+        model->updateCapabilities(model->m_parsers.begin().key(), existingCaps);
+    }
 private:
     Imap::Mailbox::Model *model;
 };
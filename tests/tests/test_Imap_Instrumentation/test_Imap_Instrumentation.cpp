@@ -0,0 +1,120 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QtTest>
+#include "test_Imap_Instrumentation.h"
+#include "../headless_test.h"
+#include "Common/Instrumentation.h"
+#include "Imap/Model/Cache.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Streams/FakeSocket.h"
+
+using Common::Instrumentation;
+
+void ImapInstrumentationTest::init()
+{
+    LibMailboxSync::init();
+    Instrumentation::reset();
+}
+
+/** @short Return the sum of all counters within the @arg category */
+qint64 ImapInstrumentationTest::helperSum(const Instrumentation::Snapshot &snapshot, const QString &category)
+{
+    qint64 res = 0;
+    Q_FOREACH(const qint64 value, snapshot.value(category))
+        res += value;
+    return res;
+}
+
+/** @short Test that the tree items are counted, including the ones which are created lazily */
+void ImapInstrumentationTest::testTreeItems()
+{
+    model->setProperty("trojita-imap-preload-msg-metadata", QVariant(0));
+    initialMessages(3);
+
+    Instrumentation::Snapshot snapshot = model->instrumentationSnapshot();
+    QCOMPARE(snapshot[QLatin1String("tree items")].value(QLatin1String("TreeItemMessage")), qint64(3));
+    QCOMPARE(snapshot[QLatin1String("tree items")].value(QLatin1String("MessageMetadata")), qint64(0));
+    QCOMPARE(snapshot[QLatin1String("tree items")].value(QLatin1String("TreeItemPart")), qint64(0));
+    // Each mailbox, including the invisible root, has its list of messages
+    QCOMPARE(snapshot[QLatin1String("tree items")].value(QLatin1String("TreeItemMailbox")), qint64(model->rowCount() + 1));
+    QCOMPARE(snapshot[QLatin1String("tree items")].value(QLatin1String("TreeItemMsgList")), qint64(model->rowCount() + 1));
+    QCOMPARE(snapshot[QLatin1String("object pools")].value(QLatin1String("TreeItemMessage live objects")), qint64(3));
+
+    QModelIndex msg = msgListA.child(0, 0);
+    QVERIFY(msg.isValid());
+    QCOMPARE(msg.data(Imap::Mailbox::RoleMessageSubject).toString(), QString());
+    cClient(t.mk("UID FETCH 1 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 1 FETCH (UID 1 RFC822.SIZE 89 INTERNALDATE \"01-Apr-2013 12:30:00 +0000\" "
+            "ENVELOPE (NIL \"subj\" NIL NIL NIL NIL NIL NIL NIL \"<msgid>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL))\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(msg.data(Imap::Mailbox::RoleMessageSubject).toString(), QString::fromUtf8("subj"));
+
+    snapshot = model->instrumentationSnapshot();
+    QCOMPARE(snapshot[QLatin1String("tree items")].value(QLatin1String("TreeItemMessage")), qint64(3));
+    QCOMPARE(snapshot[QLatin1String("tree items")].value(QLatin1String("MessageMetadata")), qint64(1));
+    QCOMPARE(snapshot[QLatin1String("tree items")].value(QLatin1String("TreeItemPart")), qint64(0));
+
+    // The parts only show up once somebody asks for them
+    QCOMPARE(model->rowCount(msg), 1);
+    snapshot = model->instrumentationSnapshot();
+    QCOMPARE(snapshot[QLatin1String("tree items")].value(QLatin1String("TreeItemPart")), qint64(1));
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short Test that the cache lookups, the parsed responses and the received data are counted in instrumented builds */
+void ImapInstrumentationTest::testCounters()
+{
+    initialMessages(1);
+    Instrumentation::Snapshot snapshot = model->instrumentationSnapshot();
+#ifdef TROJITA_INSTRUMENTATION
+    // There was nothing in the cache prior to the first sync
+    QVERIFY(snapshot[QLatin1String("cache misses")].value(QLatin1String("MemoryCache::mailboxSyncState")) > 0);
+    QCOMPARE(snapshot[QLatin1String("cache hits")].value(QLatin1String("MemoryCache::mailboxSyncState")), qint64(0));
+    const qint64 fetches = snapshot[QLatin1String("parsed responses")].value(QLatin1String("FETCH"));
+    QVERIFY(fetches > 0);
+    const qint64 received = helperSum(snapshot, QLatin1String("bytes received"));
+    QVERIFY(received > 0);
+
+    // ...but it's there now
+    model->cache()->mailboxSyncState(QLatin1String("a"));
+    QCOMPARE(Instrumentation::snapshot()[QLatin1String("cache hits")].value(QLatin1String("MemoryCache::mailboxSyncState")),
+             qint64(1));
+
+    const QByteArray response = "* 1 FETCH (UID 1 FLAGS (\\Seen))\r\n";
+    cServer(response);
+    snapshot = model->instrumentationSnapshot();
+    QCOMPARE(snapshot[QLatin1String("parsed responses")].value(QLatin1String("FETCH")), fetches + 1);
+    QCOMPARE(helperSum(snapshot, QLatin1String("bytes received")), received + response.size());
+#else
+    // Regular builds do not have any counters
+    QVERIFY(!snapshot.contains(QLatin1String("cache hits")));
+    QVERIFY(!snapshot.contains(QLatin1String("cache misses")));
+    QVERIFY(!snapshot.contains(QLatin1String("parsed responses")));
+    QVERIFY(!snapshot.contains(QLatin1String("bytes received")));
+#endif
+    cEmpty();
+    justKeepTask();
+}
+
+TROJITA_HEADLESS_TEST(ImapInstrumentationTest)
@@ -0,0 +1,2 @@
+TARGET = test_Imap_Instrumentation
+include(../tests.pri)
@@ -25,6 +25,8 @@
 #include "test_Imap_Message.h"
 #include "../headless_test.h"
 #include "Imap/Encoders.h"
+#include "Imap/Model/CompactEnvelope.h"
+#include "Imap/Model/FlagDictionary.h"
 
 Q_DECLARE_METATYPE(Imap::Message::MailAddress)
 Q_DECLARE_METATYPE(QVariantList)
@@ -292,6 +294,99 @@ void ImapMessageTest::testMessage_data()
 }
 
 
+/** @short Test that the envelope survives the conversion to the compact form and that the addresses are shared */
+void ImapMessageTest::testCompactEnvelope()
+{
+    using namespace Imap::Message;
+    using Imap::Mailbox::AddressPool;
+    using Imap::Mailbox::CompactEnvelope;
+
+    MailAddress alice(QLatin1String("Alice"), QString(), QLatin1String("alice"), QLatin1String("example.org"));
+    MailAddress bob(QLatin1String("Bob"), QString(), QLatin1String("bob"), QLatin1String("example.org"));
+    MailAddress carol(QString(), QString(), QLatin1String("carol"), QLatin1String("example.net"));
+    Envelope envelope(QDateTime(QDate(2013, 4, 1), QTime(12, 30)), QLatin1String("Re: lunch"),
+                      QList<MailAddress>() << alice, QList<MailAddress>() << alice, QList<MailAddress>(),
+                      QList<MailAddress>() << bob << carol, QList<MailAddress>() << alice, QList<MailAddress>(),
+                      QList<QByteArray>() << "<1@example.org>", "<2@example.org>");
+
+    AddressPool pool;
+    CompactEnvelope compact(pool, envelope);
+    QCOMPARE(pool.size(), 3);
+    QCOMPARE(compact.envelope(pool), envelope);
+    QCOMPARE(compact.addresses(pool, CompactEnvelope::TO), QList<MailAddress>() << bob << carol);
+    QCOMPARE(compact.addresses(pool, CompactEnvelope::REPLY_TO), QList<MailAddress>());
+
+    // Another message from the same people doesn't need any more addresses
+    qSwap(envelope.to, envelope.cc);
+    CompactEnvelope another(pool, envelope);
+    QCOMPARE(pool.size(), 3);
+    QCOMPARE(another.envelope(pool), envelope);
+    QCOMPARE(another.addresses(pool, CompactEnvelope::TO), QList<MailAddress>() << alice);
+
+    // Envelopes without any addresses are fine, too
+    CompactEnvelope empty(pool, Envelope());
+    QCOMPARE(empty.envelope(pool), Envelope());
+    QCOMPARE(empty.addresses(pool, CompactEnvelope::FROM), QList<MailAddress>());
+    compact.clear(pool);
+    QCOMPARE(compact.envelope(pool), Envelope());
+
+    // The addresses stay around as long as some envelope uses them
+    QCOMPARE(pool.size(), 3);
+    QCOMPARE(another.envelope(pool), envelope);
+    another.clear(pool);
+    QCOMPARE(pool.size(), 0);
+
+    // The IDs of the dropped addresses get reused
+    CompactEnvelope onlyCarol(pool, Envelope(QDateTime(), QString(), QList<MailAddress>() << carol, QList<MailAddress>(),
+                                             QList<MailAddress>(), QList<MailAddress>(), QList<MailAddress>(),
+                                             QList<MailAddress>(), QList<QByteArray>(), QByteArray()));
+    CompactEnvelope carolAndBob(pool, Envelope(QDateTime(), QString(), QList<MailAddress>() << carol, QList<MailAddress>(),
+                                               QList<MailAddress>(), QList<MailAddress>() << bob, QList<MailAddress>(),
+                                               QList<MailAddress>(), QList<QByteArray>(), QByteArray()));
+    QCOMPARE(pool.size(), 2);
+    onlyCarol.clear(pool);
+    QCOMPARE(pool.size(), 2);
+    QCOMPARE(carolAndBob.addresses(pool, CompactEnvelope::FROM), QList<MailAddress>() << carol);
+    QCOMPARE(carolAndBob.addresses(pool, CompactEnvelope::TO), QList<MailAddress>() << bob);
+    carolAndBob.clear(pool);
+    QCOMPARE(pool.size(), 0);
+}
+
+/** @short Test the conversion of flags to the bit sets and back */
+void ImapMessageTest::testFlagDictionary()
+{
+    using Imap::Mailbox::FlagDictionary;
+    using Imap::Mailbox::MessageFlags;
+
+    FlagDictionary dict;
+    MessageFlags flags = dict.fromList(QStringList() << QLatin1String("\\SEEN") << QLatin1String("foo") << QLatin1String("$Forwarded"));
+    QVERIFY(flags.test(FlagDictionary::FLAG_SEEN));
+    QVERIFY(flags.test(FlagDictionary::FLAG_FORWARDED));
+    QVERIFY(!flags.test(FlagDictionary::FLAG_DELETED));
+    // The system flags are case-insensitive, the keywords are not
+    QCOMPARE(dict.toList(flags), QStringList() << QLatin1String("$Forwarded") << QLatin1String("\\Seen") << QLatin1String("foo"));
+    QCOMPARE(dict.find(QLatin1String("FOO")), -1);
+
+    // Lots of keywords have to work, too
+    QStringList keywords;
+    for (int i = 0; i < 200; ++i)
+        keywords << QString::fromUtf8("kw%1").arg(i, 3, 10, QLatin1Char('0'));
+    MessageFlags many = dict.fromList(keywords);
+    QCOMPARE(dict.toList(many), keywords);
+    QVERIFY(many != flags);
+
+    MessageFlags both = flags;
+    both.unite(many);
+    QCOMPARE(dict.toList(both).size(), keywords.size() + 3);
+    both.subtract(many);
+    QCOMPARE(both, flags);
+    both.clear(dict.find(QLatin1String("foo")));
+    both.clear(FlagDictionary::FLAG_SEEN);
+    both.clear(FlagDictionary::FLAG_FORWARDED);
+    QVERIFY(both.isEmpty());
+    QVERIFY(both == MessageFlags());
+}
+
 TROJITA_HEADLESS_TEST( ImapMessageTest )
 
 namespace QTest {
@@ -47,6 +47,9 @@ private Q_SLOTS:
     void testMessage();
     void testMessage_data();
 
+    void testCompactEnvelope();
+    void testFlagDictionary();
+
     /** @short Test cases for operator==() */
 };
 
@@ -49,6 +49,7 @@ private Q_SLOTS:
     /** @short Test sequence output */
     void testSequences();
     void testSequences_data();
+    void testSequenceToList();
     /** @short Test for parsing errors */
     void testThrow();
     void testThrow_data();
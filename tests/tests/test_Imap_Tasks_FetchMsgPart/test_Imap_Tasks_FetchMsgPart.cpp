@@ -0,0 +1,418 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QtTest>
+#include "test_Imap_Tasks_FetchMsgPart.h"
+#include "../headless_test.h"
+#include "Streams/FakeSocket.h"
+#include "test_LibMailboxSync/FakeCapabilitiesInjector.h"
+#include "test_LibMailboxSync/ModelEvents.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/MailboxTree.h"
+#include "Imap/Network/MsgPartNetworkReply.h"
+
+/** @short Sync a mailbox with one message which consists of a single text/plain part */
+Imap::Mailbox::TreeItemPart *ImapModelFetchMsgPartTest::helperPrepareSinglePart(const QByteArray &encoding, const uint octets)
+{
+    model->setProperty("trojita-imap-delayed-fetch-part", QVariant(0u));
+    model->setProperty("trojita-imap-partial-fetch-chunk", QVariant(10u));
+
+    existsA = 1;
+    uidValidityA = 333666;
+    uidMapA << 10;
+    uidNextA = 11;
+    helperSyncAWithMessagesEmptyState();
+
+    cServer("* 1 FETCH (BODYSTRUCTURE "
+            "(\"text\" \"plain\" (\"charset\" \"UTF-8\") NIL NIL \"" + encoding + "\" " + QByteArray::number(octets) + " 1 NIL NIL NIL)"
+            " ENVELOPE (NIL \"subj\" NIL NIL NIL NIL NIL NIL NIL \"<msgid>\")"
+            ")\r\n");
+
+    QModelIndex msg = model->index(0, 0, msgListA);
+    if (!msg.isValid() || model->rowCount(msg) != 1)
+        return 0;
+    QModelIndex partIdx = model->index(0, 0, msg);
+    if (!partIdx.isValid())
+        return 0;
+    return dynamic_cast<Imap::Mailbox::TreeItemPart *>(static_cast<Imap::Mailbox::TreeItem *>(partIdx.internalPointer()));
+}
+
+/** @short Test that a big part is fetched in chunks, and that asking for the whole data fetches all that remains */
+void ImapModelFetchMsgPartTest::testProgressivePlain()
+{
+    QByteArray contents;
+    for (int i = 0; i < 9; ++i)
+        contents += "line " + QByteArray::number(i) + "...\r\n";
+    contents += "tail";
+    Imap::Mailbox::TreeItemPart *part = helperPrepareSinglePart("8bit", contents.size());
+    QVERIFY(part);
+    QCOMPARE(contents.size(), 103);
+
+    part->fetchNextChunk(model);
+    cClient(t.mk("UID FETCH 10 (BODY.PEEK[1]<0.10>)\r\n"));
+    cServer("* 1 FETCH (UID 10 BODY[1]<0> {10}\r\n" + contents.left(10) + ")\r\n" + t.last("OK fetched\r\n"));
+    QVERIFY(part->isPartiallyFetched());
+    QVERIFY(!part->fetched());
+    QCOMPARE(*part->dataPtr(), contents.left(10));
+    QCOMPARE(part->fetchedOctets(), 10u);
+    cEmpty();
+
+    // The next chunk is only requested on demand
+    part->fetchNextChunk(model);
+    cClient(t.mk("UID FETCH 10 (BODY.PEEK[1]<10.10>)\r\n"));
+    cServer("* 1 FETCH (UID 10 BODY[1]<10> {10}\r\n" + contents.mid(10, 10) + ")\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(*part->dataPtr(), contents.left(20));
+
+    // Somebody needs the whole part now
+    part->fetch(model);
+    cClient(t.mk("UID FETCH 10 (BODY.PEEK[1]<20.103>)\r\n"));
+    cServer("* 1 FETCH (UID 10 BODY[1]<20> {83}\r\n" + contents.mid(20) + ")\r\n" + t.last("OK fetched\r\n"));
+    QVERIFY(part->fetched());
+    QVERIFY(!part->isPartiallyFetched());
+    QCOMPARE(*part->dataPtr(), contents);
+    QCOMPARE(model->cache()->messagePart(QLatin1String("a"), 10, QLatin1String("1")), contents);
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short Test that the transfer encoding is only decoded up to complete lines */
+void ImapModelFetchMsgPartTest::testProgressiveBase64()
+{
+    const QByteArray plain("Some text which is long enough to be split into several chunks.");
+    const QByteArray base64 = plain.toBase64();
+    QByteArray encoded;
+    for (int i = 0; i < base64.size(); i += 8)
+        encoded += base64.mid(i, 8) + "\r\n";
+    Imap::Mailbox::TreeItemPart *part = helperPrepareSinglePart("base64", encoded.size());
+    QVERIFY(part);
+
+    part->fetchNextChunk(model);
+    cClient(t.mk("UID FETCH 10 (BODY.PEEK[1]<0.10>)\r\n"));
+    cServer("* 1 FETCH (UID 10 BODY[1]<0> {10}\r\n" + encoded.left(10) + ")\r\n" + t.last("OK fetched\r\n"));
+    // That's exactly one line, i.e. six bytes of data
+    QCOMPARE(*part->dataPtr(), plain.left(6));
+
+    part->fetchNextChunk(model);
+    cClient(t.mk("UID FETCH 10 (BODY.PEEK[1]<10.10>)\r\n"));
+    cServer("* 1 FETCH (UID 10 BODY[1]<10> {5}\r\n" + encoded.mid(10, 5) + ")\r\n" + t.last("OK fetched\r\n"));
+    // A short read means that there's nothing more to come
+    QVERIFY(part->fetched());
+    QCOMPARE(*part->dataPtr(), QByteArray::fromBase64(encoded.left(15)));
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short Parts which are not big enough are fetched at once even when asked for progressively */
+void ImapModelFetchMsgPartTest::testSmallPartAtOnce()
+{
+    Imap::Mailbox::TreeItemPart *part = helperPrepareSinglePart("8bit", 40);
+    QVERIFY(part);
+
+    part->fetchNextChunk(model);
+    cClient(t.mk("UID FETCH 10 (BODY.PEEK[1])\r\n"));
+    cServer("* 1 FETCH (UID 10 BODY[1] \"short\")\r\n" + t.last("OK fetched\r\n"));
+    QVERIFY(part->fetched());
+    QCOMPARE(*part->dataPtr(), QByteArray("short"));
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short Test that the BINARY is used when available, and that its BINARY.SIZE is used for the progress reporting */
+void ImapModelFetchMsgPartTest::testBinaryProgressive()
+{
+    const QByteArray plain("Some text which is long enough to be split into several chunks.");
+    const QByteArray base64 = plain.toBase64();
+    QByteArray encoded;
+    for (int i = 0; i < base64.size(); i += 8)
+        encoded += base64.mid(i, 8) + "\r\n";
+    Imap::Mailbox::TreeItemPart *part = helperPrepareSinglePart("base64", encoded.size());
+    QVERIFY(part);
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QLatin1String("BINARY"));
+    QCOMPARE(plain.size(), 63);
+
+    part->fetchNextChunk(model);
+    cClient(t.mk("UID FETCH 10 (BINARY.PEEK[1]<0.10> BINARY.SIZE[1])\r\n"));
+    cServer("* 1 FETCH (UID 10 BINARY.SIZE[1] 63 BINARY[1]<0> {10}\r\n" + plain.left(10) + ")\r\n" + t.last("OK fetched\r\n"));
+    QVERIFY(part->isPartiallyFetched());
+    QCOMPARE(part->binarySize(), 63u);
+    QCOMPARE(part->expectedOctets(), 63u);
+    QCOMPARE(*part->dataPtr(), plain.left(10));
+
+    // The exact size of the rest is known now
+    part->fetch(model);
+    cClient(t.mk("UID FETCH 10 (BINARY.PEEK[1]<10.53>)\r\n"));
+    cServer("* 1 FETCH (UID 10 BINARY[1]<10> {53}\r\n" + plain.mid(10) + ")\r\n" + t.last("OK fetched\r\n"));
+    QVERIFY(part->fetched());
+    QCOMPARE(*part->dataPtr(), plain);
+    // The cache gets the decoded form
+    QCOMPARE(model->cache()->messagePart(QLatin1String("a"), 10, QLatin1String("1")), plain);
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short Test that the data are decoded locally when the server refuses to do that */
+void ImapModelFetchMsgPartTest::testBinaryUnknownCte()
+{
+    const QByteArray plain("hello world");
+    const QByteArray encoded = plain.toBase64();
+    Imap::Mailbox::TreeItemPart *part = helperPrepareSinglePart("base64", encoded.size());
+    QVERIFY(part);
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QLatin1String("BINARY"));
+
+    part->fetch(model);
+    cClient(t.mk("UID FETCH 10 (BINARY.PEEK[1])\r\n"));
+    cServer(t.last("NO [UNKNOWN-CTE] can't decode that\r\n"));
+    QVERIFY(part->loading());
+    cClient(t.mk("UID FETCH 10 (BODY.PEEK[1])\r\n"));
+    cServer("* 1 FETCH (UID 10 BODY[1] \"" + encoded + "\")\r\n" + t.last("OK fetched\r\n"));
+    QVERIFY(part->fetched());
+    QCOMPARE(*part->dataPtr(), plain);
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short Test that the part data which don't fit into the memory budget are released and re-read from the cache later */
+void ImapModelFetchMsgPartTest::testMemoryBudget()
+{
+    model->setProperty("trojita-imap-delayed-fetch-part", QVariant(0u));
+    model->setPartDataBudget(15);
+
+    existsA = 1;
+    uidValidityA = 333666;
+    uidMapA << 10;
+    uidNextA = 11;
+    helperSyncAWithMessagesEmptyState();
+
+    cServer("* 1 FETCH (BODYSTRUCTURE ("
+            "(\"text\" \"plain\" (\"charset\" \"UTF-8\") NIL NIL \"8bit\" 10 1 NIL NIL NIL)"
+            "(\"text\" \"plain\" (\"charset\" \"UTF-8\") NIL NIL \"8bit\" 10 1 NIL NIL NIL)"
+            " \"mixed\") ENVELOPE (NIL \"subj\" NIL NIL NIL NIL NIL NIL NIL \"<msgid>\"))\r\n");
+
+    QModelIndex msg = model->index(0, 0, msgListA);
+    QVERIFY(msg.isValid());
+    QModelIndex multipart = model->index(0, 0, msg);
+    QVERIFY(multipart.isValid());
+    QCOMPARE(model->rowCount(multipart), 2);
+    Imap::Mailbox::TreeItemPart *part1 = dynamic_cast<Imap::Mailbox::TreeItemPart *>(
+                static_cast<Imap::Mailbox::TreeItem *>(model->index(0, 0, multipart).internalPointer()));
+    Imap::Mailbox::TreeItemPart *part2 = dynamic_cast<Imap::Mailbox::TreeItemPart *>(
+                static_cast<Imap::Mailbox::TreeItem *>(model->index(1, 0, multipart).internalPointer()));
+    QVERIFY(part1);
+    QVERIFY(part2);
+
+    part1->fetch(model);
+    cClient(t.mk("UID FETCH 10 (BODY.PEEK[1])\r\n"));
+    cServer("* 1 FETCH (UID 10 BODY[1] \"0123456789\")\r\n" + t.last("OK fetched\r\n"));
+    QVERIFY(part1->fetched());
+    QCOMPARE(model->partDataInMemory(), qint64(10));
+
+    // The second part doesn't fit, so the first one has to go away
+    part2->fetch(model);
+    cClient(t.mk("UID FETCH 10 (BODY.PEEK[2])\r\n"));
+    cServer("* 1 FETCH (UID 10 BODY[2] \"abcdefghij\")\r\n" + t.last("OK fetched\r\n"));
+    QVERIFY(part2->fetched());
+    QVERIFY(!part1->fetched());
+    QVERIFY(part1->dataPtr()->isEmpty());
+    QCOMPARE(model->partDataInMemory(), qint64(10));
+    QCOMPARE(model->releasedPartData(), qint64(10));
+
+    // The released data come back from the cache, without any network activity
+    part1->fetch(model);
+    QVERIFY(part1->fetched());
+    QCOMPARE(*part1->dataPtr(), QByteArray("0123456789"));
+    QVERIFY(!part2->fetched());
+    QCOMPARE(model->partDataInMemory(), qint64(10));
+    cEmpty();
+
+    // Without a budget, nothing is released
+    model->setPartDataBudget(0);
+    part2->fetch(model);
+    QVERIFY(part1->fetched());
+    QVERIFY(part2->fetched());
+    QCOMPARE(model->partDataInMemory(), qint64(20));
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short Test that the data which are being read through a network reply are not released, and that the released ones are announced */
+void ImapModelFetchMsgPartTest::testMemoryBudgetOpenReply()
+{
+    model->setProperty("trojita-imap-delayed-fetch-part", QVariant(0u));
+    model->setPartDataBudget(15);
+
+    existsA = 1;
+    uidValidityA = 333666;
+    uidMapA << 10;
+    uidNextA = 11;
+    helperSyncAWithMessagesEmptyState();
+
+    cServer("* 1 FETCH (BODYSTRUCTURE ("
+            "(\"text\" \"plain\" (\"charset\" \"UTF-8\") NIL NIL \"8bit\" 10 1 NIL NIL NIL)"
+            "(\"text\" \"plain\" (\"charset\" \"UTF-8\") NIL NIL \"8bit\" 10 1 NIL NIL NIL)"
+            "(\"text\" \"plain\" (\"charset\" \"UTF-8\") NIL NIL \"8bit\" 10 1 NIL NIL NIL)"
+            " \"mixed\") ENVELOPE (NIL \"subj\" NIL NIL NIL NIL NIL NIL NIL \"<msgid>\"))\r\n");
+
+    QModelIndex msg = model->index(0, 0, msgListA);
+    QVERIFY(msg.isValid());
+    QModelIndex multipart = model->index(0, 0, msg);
+    QVERIFY(multipart.isValid());
+    QCOMPARE(model->rowCount(multipart), 3);
+    QModelIndex idx1 = model->index(0, 0, multipart);
+    QModelIndex idx2 = model->index(1, 0, multipart);
+    Imap::Mailbox::TreeItemPart *part1 = dynamic_cast<Imap::Mailbox::TreeItemPart *>(
+                static_cast<Imap::Mailbox::TreeItem *>(idx1.internalPointer()));
+    Imap::Mailbox::TreeItemPart *part2 = dynamic_cast<Imap::Mailbox::TreeItemPart *>(
+                static_cast<Imap::Mailbox::TreeItem *>(idx2.internalPointer()));
+    Imap::Mailbox::TreeItemPart *part3 = dynamic_cast<Imap::Mailbox::TreeItemPart *>(
+                static_cast<Imap::Mailbox::TreeItem *>(model->index(2, 0, multipart).internalPointer()));
+    QVERIFY(part1);
+    QVERIFY(part2);
+    QVERIFY(part3);
+
+    part1->fetch(model);
+    cClient(t.mk("UID FETCH 10 (BODY.PEEK[1])\r\n"));
+    cServer("* 1 FETCH (UID 10 BODY[1] \"0123456789\")\r\n" + t.last("OK fetched\r\n"));
+    QVERIFY(part1->fetched());
+
+    // Somebody is reading the first part directly from the model
+    Imap::Network::MsgPartNetworkReply *reply = new Imap::Network::MsgPartNetworkReply(0, idx1);
+
+    // The budget is exceeded, yet the first part stays because of the reply
+    part2->fetch(model);
+    cClient(t.mk("UID FETCH 10 (BODY.PEEK[2])\r\n"));
+    cServer("* 1 FETCH (UID 10 BODY[2] \"abcdefghij\")\r\n" + t.last("OK fetched\r\n"));
+    QVERIFY(part2->fetched());
+    QVERIFY(part1->fetched());
+    QCOMPARE(*part1->dataPtr(), QByteArray("0123456789"));
+    QCOMPARE(model->releasedPartData(), qint64(0));
+    QCOMPARE(reply->readAll(), QByteArray("0123456789"));
+    cEmpty();
+
+    // Once the reply is gone, both older parts can be released, and the views are told about that
+    delete reply;
+    qRegisterMetaType<QModelIndex>("QModelIndex");
+    QSignalSpy dataChangedSpy(model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+    part3->fetch(model);
+    cClient(t.mk("UID FETCH 10 (BODY.PEEK[3])\r\n"));
+    cServer("* 1 FETCH (UID 10 BODY[3] \"ABCDEFGHIJ\")\r\n" + t.last("OK fetched\r\n"));
+    QVERIFY(part3->fetched());
+    QVERIFY(!part1->fetched());
+    QVERIFY(!part2->fetched());
+    QCOMPARE(model->partDataInMemory(), qint64(10));
+    QCOMPARE(model->releasedPartData(), qint64(20));
+    bool seen1 = false, seen2 = false;
+    for (int i = 0; i < dataChangedSpy.size(); ++i) {
+        QModelIndex changed = dataChangedSpy[i][0].value<QModelIndex>();
+        seen1 |= changed == idx1;
+        seen2 |= changed == idx2;
+    }
+    QVERIFY(seen1);
+    QVERIFY(seen2);
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short Return the number of the regular message parts which exist in the model */
+qint64 ImapModelFetchMsgPartTest::helperPartCount()
+{
+    return model->instrumentationSnapshot()[QLatin1String("tree items")].value(QLatin1String("TreeItemPart"));
+}
+
+/** @short Test that the parts are only created when somebody asks for them, no matter where the BODYSTRUCTURE came from */
+void ImapModelFetchMsgPartTest::testLazyParts()
+{
+    existsA = 1;
+    uidValidityA = 333666;
+    uidMapA << 10;
+    uidNextA = 11;
+    helperSyncAWithMessagesEmptyState();
+
+    QModelIndex msg = model->index(0, 0, msgListA);
+    QVERIFY(msg.isValid());
+    QCOMPARE(msg.data(Imap::Mailbox::RoleMessageSubject).toString(), QString());
+    cClient(t.mk("UID FETCH 10 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 1 FETCH (UID 10 RFC822.SIZE 89 INTERNALDATE \"01-Apr-2013 12:30:00 +0000\" "
+            "ENVELOPE (NIL \"subj\" NIL NIL NIL NIL NIL NIL NIL \"<msgid>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL))\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(msg.data(Imap::Mailbox::RoleMessageSubject).toString(), QString::fromUtf8("subj"));
+    QCOMPARE(helperPartCount(), qint64(0));
+    QCOMPARE(model->rowCount(msg), 1);
+    QCOMPARE(helperPartCount(), qint64(1));
+
+    // The metadata which come from the cache get their parts on demand, too
+    model->releaseMessageData(msg);
+    QCOMPARE(helperPartCount(), qint64(0));
+    QCOMPARE(msg.data(Imap::Mailbox::RoleMessageSubject).toString(), QString::fromUtf8("subj"));
+    QCOMPARE(helperPartCount(), qint64(0));
+    QCOMPARE(model->rowCount(msg), 1);
+    QCOMPARE(helperPartCount(), qint64(1));
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short Test that a cached BODYSTRUCTURE which cannot be parsed is thrown away and the message is asked for again */
+void ImapModelFetchMsgPartTest::testBrokenCachedBodyStructure()
+{
+    existsA = 1;
+    uidValidityA = 333666;
+    uidMapA << 10;
+    uidNextA = 11;
+    helperSyncAWithMessagesEmptyState();
+
+    QByteArray broken;
+    QDataStream stream(&broken, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_4_6);
+    stream << (QVariantList() << QByteArray("text"));
+    Imap::Mailbox::AbstractCache::MessageDataBundle bundle;
+    bundle.uid = 10;
+    bundle.envelope = Imap::Message::Envelope(QDateTime(), QLatin1String("subj"),
+                                              QList<Imap::Message::MailAddress>(), QList<Imap::Message::MailAddress>(),
+                                              QList<Imap::Message::MailAddress>(), QList<Imap::Message::MailAddress>(),
+                                              QList<Imap::Message::MailAddress>(), QList<Imap::Message::MailAddress>(),
+                                              QList<QByteArray>(), QByteArray());
+    bundle.serializedBodyStructure = broken;
+    model->cache()->setMessageMetadata(QLatin1String("a"), 10, bundle);
+
+    // The envelope is fine, so it is shown right away
+    QModelIndex msg = model->index(0, 0, msgListA);
+    QVERIFY(msg.isValid());
+    QCOMPARE(msg.data(Imap::Mailbox::RoleMessageSubject).toString(), QString::fromUtf8("subj"));
+    cEmpty();
+
+    // The parts cannot be built, so the cached structure is dropped and the server is asked instead
+    QCOMPARE(model->rowCount(msg), 0);
+    QVERIFY(model->cache()->messageMetadata(QLatin1String("a"), 10).serializedBodyStructure.isEmpty());
+    cClient(t.mk("UID FETCH 10 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 1 FETCH (UID 10 RFC822.SIZE 89 INTERNALDATE \"01-Apr-2013 12:30:00 +0000\" "
+            "ENVELOPE (NIL \"subj\" NIL NIL NIL NIL NIL NIL NIL \"<msgid>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL))\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(model->rowCount(msg), 1);
+    QCOMPARE(helperPartCount(), qint64(1));
+    QVERIFY(!model->cache()->messageMetadata(QLatin1String("a"), 10).serializedBodyStructure.isEmpty());
+    cEmpty();
+    QVERIFY(errorSpy->isEmpty());
+    justKeepTask();
+}
+
+TROJITA_HEADLESS_TEST(ImapModelFetchMsgPartTest)
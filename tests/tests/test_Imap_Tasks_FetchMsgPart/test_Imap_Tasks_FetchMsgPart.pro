@@ -0,0 +1,2 @@
+TARGET = test_Imap_Tasks_FetchMsgPart
+include(../tests.pri)
@@ -385,6 +385,43 @@ void ImapModelObtainSynchronizedMailboxTest::testFlagReSyncBenchmark()
     }
 }
 
+/** @short Report how many of the pooled objects get allocated during a full sync of a big mailbox */
+void ImapModelObtainSynchronizedMailboxTest::testSyncAllocationsBenchmark()
+{
+    using Common::ObjectPool;
+    using Common::PoolStatistics;
+
+    existsA = 100000;
+    uidValidityA = 333;
+    for (uint i = 1; i <= existsA; ++i) {
+        uidMapA << i;
+    }
+    uidNextA = existsA + 2;
+
+    const PoolStatistics messagesBefore = ObjectPool<Imap::Mailbox::TreeItemMessage>::statistics();
+    const PoolStatistics metadataBefore = ObjectPool<Imap::Mailbox::MessageMetadata>::statistics();
+    const PoolStatistics fetchBefore = ObjectPool<Imap::Responses::Fetch>::statistics();
+    QBENCHMARK_ONCE {
+        helperSyncAWithMessagesEmptyState();
+    }
+    const PoolStatistics messages = ObjectPool<Imap::Mailbox::TreeItemMessage>::statistics();
+    const PoolStatistics metadata = ObjectPool<Imap::Mailbox::MessageMetadata>::statistics();
+    const PoolStatistics fetch = ObjectPool<Imap::Responses::Fetch>::statistics();
+
+    qDebug() << "TreeItemMessage:" << messages.allocations - messagesBefore.allocations << "allocations in"
+             << messages.chunksAllocated - messagesBefore.chunksAllocated << "chunks";
+    qDebug() << "Responses::Fetch:" << fetch.allocations - fetchBefore.allocations << "allocations,"
+             << fetch.liveObjects() << "alive," << fetch.liveChunks() << "chunks held";
+
+    // No view shows the mailbox, so its rows are just UIDs and flags without any TreeItemMessage
+    QCOMPARE(messages.allocations - messagesBefore.allocations, quint64(0));
+    // Nothing but UIDs and flags were synced, so there's no reason for allocating the per-message metadata
+    QCOMPARE(metadata.allocations, metadataBefore.allocations);
+    QVERIFY(fetch.allocations - fetchBefore.allocations >= quint64(existsA));
+    // The parsed responses are short-lived, so their memory gets recycled
+    QVERIFY(fetch.liveChunks() < 10);
+}
+
 /** @short Make sure that calling Model::resyncMailbox() preloads data from the cache */
 void ImapModelObtainSynchronizedMailboxTest::testReloadReadsFromCache()
 {
@@ -791,6 +828,55 @@ void ImapModelObtainSynchronizedMailboxTest::helperCacheExpunges(const ESearchMo
     justKeepTask();
 }
 
+/** @short Test that a few expunges in a big mailbox are found by bisection instead of the UID SEARCH ALL */
+void ImapModelObtainSynchronizedMailboxTest::testCacheExpungesBisection()
+{
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(100);
+    sync.setUidValidity(666);
+    sync.setUidNext(101);
+    QList<uint> uidMap;
+    for (uint i = 1; i <= 100; ++i)
+        uidMap << i;
+    model->cache()->setMailboxSyncState("a", sync);
+    model->cache()->setUidMapping("a", uidMap);
+    QCOMPARE(model->rowCount(msgListA), 0);
+    cClient(t.mk("SELECT a\r\n"));
+    cServer("* 99 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 101] .\r\n");
+    cServer(t.last("OK selected\r\n"));
+    // The message with UID 38 is gone
+    uidMap.removeOne(38);
+
+    // The first round splits the whole mailbox into nine intervals
+    cClient(t.mk("FETCH 11,22,33,44,55,66,77,88 (UID)\r\n"));
+    QByteArray buf;
+    for (int seq = 11; seq <= 88; seq += 11) {
+        buf += "* " + QByteArray::number(seq) + " FETCH (UID " + QByteArray::number(uidMap[seq - 1]) + ")\r\n";
+    }
+    cServer(buf + t.last("OK fetched\r\n"));
+
+    // Only one of them has changed, and it is short enough to be fetched completely
+    cClient(t.mk("FETCH 34:43 (UID)\r\n"));
+    buf.clear();
+    for (int seq = 34; seq <= 43; ++seq) {
+        buf += "* " + QByteArray::number(seq) + " FETCH (UID " + QByteArray::number(uidMap[seq - 1]) + ")\r\n";
+    }
+    cServer(buf + t.last("OK fetched\r\n"));
+
+    cClient(t.mk("FETCH 1:99 (FLAGS)\r\n"));
+    cServer("* 38 FETCH (FLAGS (x))\r\n");
+    cServer(t.last("OK fetch\r\n"));
+    cEmpty();
+    sync.setExists(99);
+    QCOMPARE(model->cache()->mailboxSyncState("a"), sync);
+    QCOMPARE(model->cache()->uidMapping("a"), uidMap);
+    QCOMPARE(model->cache()->msgFlags("a", 39), QStringList() << "x");
+    QCOMPARE(model->rowCount(msgListA), 99);
+    justKeepTask();
+}
+
 /** @short Test two expunges, once during normal sync and then once again during the UID syncing */
 void ImapModelObtainSynchronizedMailboxTest::testCacheExpungesDuringUid()
 {
@@ -1485,6 +1571,91 @@ void ImapModelObtainSynchronizedMailboxTest::testCondstoreDecreasedHighestModSeq
     justKeepTask();
 }
 
+/** @short Test that CONDSTORE-only deletion detection combines the cached flags with the FETCH CHANGEDSINCE */
+void ImapModelObtainSynchronizedMailboxTest::testCondstoreDeletionsFlagsFromCache()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability("CONDSTORE");
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(3);
+    sync.setUidValidity(666);
+    sync.setUidNext(15);
+    sync.setHighestModSeq(33);
+    QList<uint> uidMap;
+    uidMap << 6 << 9 << 10;
+    model->cache()->setMailboxSyncState("a", sync);
+    model->cache()->setUidMapping("a", uidMap);
+    model->cache()->setMsgFlags("a", 6, QStringList() << "x");
+    model->cache()->setMsgFlags("a", 9, QStringList() << "y");
+    model->cache()->setMsgFlags("a", 10, QStringList() << "z");
+    model->resyncMailbox(idxA);
+    cClient(t.mk("SELECT a (CONDSTORE)\r\n"));
+    cServer("* 2 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 15] .\r\n"
+            "* OK [HIGHESTMODSEQ 36] .\r\n"
+            );
+    cServer(t.last("OK selected\r\n"));
+    cClient(t.mk("UID SEARCH ALL\r\n"));
+    cServer("* SEARCH 6 10\r\n");
+    cServer(t.last("OK uids\r\n"));
+    cClient(t.mk("FETCH 1:2 (FLAGS) (CHANGEDSINCE 33)\r\n"));
+    cServer("* 2 FETCH (FLAGS (f101))\r\n");
+    cServer(t.last("OK fetched\r\n"));
+    cEmpty();
+    sync.setExists(2);
+    sync.setHighestModSeq(36);
+    uidMap.removeAt(1);
+    QCOMPARE(model->cache()->mailboxSyncState("a"), sync);
+    QCOMPARE(model->cache()->uidMapping("a"), uidMap);
+    QCOMPARE(model->cache()->msgFlags("a", 6), QStringList() << "x");
+    QCOMPARE(model->cache()->msgFlags("a", 9), QStringList());
+    QCOMPARE(model->cache()->msgFlags("a", 10), QStringList() << "f101");
+    // The unchanged message shall have its flags restored from the cache
+    QCOMPARE(model->index(0, 0, msgListA).data(Imap::Mailbox::RoleMessageFlags).toStringList(), QStringList() << "x");
+    QCOMPARE(model->index(1, 0, msgListA).data(Imap::Mailbox::RoleMessageFlags).toStringList(), QStringList() << "f101");
+    justKeepTask();
+}
+
+/** @short Test that an inconsistent cache prevents the FETCH CHANGEDSINCE from being used */
+void ImapModelObtainSynchronizedMailboxTest::testCondstoreInconsistentCache()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability("CONDSTORE");
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(3);
+    sync.setUidValidity(666);
+    sync.setUidNext(15);
+    sync.setHighestModSeq(33);
+    QList<uint> uidMap;
+    uidMap << 6 << 9;
+    model->cache()->setMailboxSyncState("a", sync);
+    model->cache()->setUidMapping("a", uidMap);
+    model->resyncMailbox(idxA);
+    cClient(t.mk("SELECT a (CONDSTORE)\r\n"));
+    cServer("* 3 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 15] .\r\n"
+            "* OK [HIGHESTMODSEQ 36] .\r\n"
+            );
+    cServer(t.last("OK selected\r\n"));
+    cClient(t.mk("UID SEARCH ALL\r\n"));
+    cServer("* SEARCH 6 9 10\r\n");
+    cServer(t.last("OK uids\r\n"));
+    cClient(t.mk("FETCH 1:3 (FLAGS)\r\n"));
+    cServer("* 1 FETCH (FLAGS (x1))\r\n"
+            "* 2 FETCH (FLAGS (x2))\r\n"
+            "* 3 FETCH (FLAGS (x3))\r\n");
+    cServer(t.last("OK fetched\r\n"));
+    cEmpty();
+    sync.setHighestModSeq(36);
+    uidMap << 10;
+    QCOMPARE(model->cache()->mailboxSyncState("a"), sync);
+    QCOMPARE(model->cache()->uidMapping("a"), uidMap);
+    QCOMPARE(model->cache()->msgFlags("a", 10), QStringList() << "x3");
+    justKeepTask();
+}
+
 /** @short Test QRESYNC when there are no changes */
 void ImapModelObtainSynchronizedMailboxTest::testQresyncNoChanges()
 {
@@ -2048,6 +2219,8 @@ void ImapModelObtainSynchronizedMailboxTest::testOfflineOpening()
     Imap::Mailbox::AbstractCache::MessageDataBundle msg10, msg20;
     msg10.uid = 10;
     msg10.envelope.subject = "msg10";
+    msg10.internalDate = QDateTime(QDate(2013, 5, 1), QTime(12, 0));
+    msg10.size = 1234;
     msg20.uid = 20;
     msg20.envelope.subject = "msg20";
 
@@ -2056,7 +2229,7 @@ void ImapModelObtainSynchronizedMailboxTest::testOfflineOpening()
     Imap::Responses::Fetch fetchResponse(666, QByteArray(" (BODYSTRUCTURE (\"text\" \"plain\" (\"chaRset\" \"UTF-8\" "
                                                          "\"format\" \"flowed\") NIL NIL \"8bit\" 362 15 NIL NIL NIL))\r\n"),
                                          start);
-    msg10.serializedBodyStructure = dynamic_cast<const Imap::Responses::RespData<QByteArray>&>(*(fetchResponse.data["x-trojita-bodystructure"])).data;
+    msg10.serializedBodyStructure = fetchResponse.serializedBodyStructure;
     msg20.serializedBodyStructure = msg10.serializedBodyStructure;
 
     model->cache()->setMessageMetadata("a", 10, msg10);
@@ -2069,6 +2242,8 @@ void ImapModelObtainSynchronizedMailboxTest::testOfflineOpening()
     checkCachedSubject(0, "msg10");
     checkCachedSubject(1, "msg20");
     checkCachedSubject(2, "");
+    QCOMPARE(msgListA.child(0, 0).data(Imap::Mailbox::RoleMessageInternalDate).toDateTime(), msg10.internalDate);
+    QCOMPARE(msgListA.child(0, 0).data(Imap::Mailbox::RoleMessageSize).toUInt(), 1234u);
     QCOMPARE(msgListA.child(2, 0).data(Imap::Mailbox::RoleIsFetched).toBool(), false);
 
     QCOMPARE(model->taskModel()->rowCount(), 0);
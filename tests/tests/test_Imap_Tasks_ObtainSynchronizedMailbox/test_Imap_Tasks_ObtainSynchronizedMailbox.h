@@ -56,6 +56,7 @@ private slots:
     void testCacheArrivalRaceDuringFlags();
     void testCacheExpunges();
     void testCacheExpunges_ESearch();
+    void testCacheExpungesBisection();
     void testCacheExpungesDuringUid();
     void testCacheExpungesDuringUid2();
     void testCacheExpungesDuringSelect();
@@ -70,6 +71,8 @@ private slots:
     void testCondstoreErrorUidNext();
     void testCondstoreUidValidity();
     void testCondstoreDecreasedHighestModSeq();
+    void testCondstoreDeletionsFlagsFromCache();
+    void testCondstoreInconsistentCache();
 
     void testQresyncNoChanges();
     void testQresyncChangedFlags();
@@ -90,6 +93,7 @@ private slots:
 
     // We put the benchmark to the last position as this one takes a long time
     void testFlagReSyncBenchmark();
+    void testSyncAllocationsBenchmark();
 };
 
 #endif
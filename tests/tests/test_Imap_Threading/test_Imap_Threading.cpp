@@ -23,6 +23,9 @@
 #include <QtTest>
 #include "test_Imap_Threading.h"
 #include "../headless_test.h"
+#include "Imap/Model/FullTextIndex.h"
+#include "Imap/Model/LocalSorting.h"
+#include "Imap/Model/LocalThreading.h"
 #include "Imap/Model/MsgListModel.h"
 #include "Imap/Model/ThreadingMsgListModel.h"
 #include "Streams/FakeSocket.h"
@@ -195,6 +198,13 @@ void ImapModelThreadingTest::testThreadDeletionsAdditions()
 
             existsA += newArrivals;
 
+            // The new arrivals shall be put into their places without resetting the whole layout
+            QSignalSpy layoutSpy(threadingModel, SIGNAL(layoutChanged()));
+            QSignalSpy insertSpy(threadingModel, SIGNAL(rowsInserted(QModelIndex,int,int)));
+
+            // Only the new arrivals shall be asked for their headers
+            model->setNetworkExpensive();
+
             // Send information about the new arrival
             SOCK->fakeReading(QString::fromUtf8("* %1 EXISTS\r\n").arg(QString::number(existsA)).toUtf8());
             QCoreApplication::processEvents();
@@ -224,16 +234,30 @@ void ImapModelThreadingTest::testThreadDeletionsAdditions()
             QCoreApplication::processEvents();
             QCoreApplication::processEvents();
             QCoreApplication::processEvents();
-            QByteArray expectedThread = t.mk("UID THREAD REFS utf-8 ALL\r\n");
-            QByteArray uidThreadResponse = QByteArray("* THREAD ") + expectedRes.toUtf8() + QByteArray("\r\n") + t.last("OK thread\r\n");
-            QCOMPARE(SOCK->writtenStuff(), expectedThread);
-            SOCK->fakeReading(uidThreadResponse);
+
+            // The headers tell that these messages are not replies to anything, so there's no need for a THREAD command
+            QByteArray newUids = QByteArray::number(uidNextA - newArrivals);
+            if (newArrivals > 1)
+                newUids += ":" + QByteArray::number(uidNextA - 1);
+            QByteArray metadataResponse;
+            for (int i = 0; i < newArrivals; ++i) {
+                int offset = existsA - newArrivals + i;
+                metadataResponse += "* " + QByteArray::number(offset + 1) + " FETCH (UID " + QByteArray::number(uidMapA[offset]) +
+                        " ENVELOPE (NIL \"new\" NIL NIL NIL NIL NIL NIL NIL NIL) "
+                        "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n";
+            }
+            QCOMPARE(SOCK->writtenStuff(), t.mk("UID FETCH " + newUids + " (" FETCH_METADATA_ITEMS ")\r\n"));
+            SOCK->fakeReading(metadataResponse + t.last("OK fetched\r\n"));
+            QCoreApplication::processEvents();
+            QCoreApplication::processEvents();
             QCoreApplication::processEvents();
             QCoreApplication::processEvents();
 
             QVERIFY(SOCK->writtenStuff().isEmpty());
             QVERIFY(errorSpy->isEmpty());
             QCOMPARE(QString::fromUtf8(treeToThreading(QModelIndex())), expectedRes);
+            QCOMPARE(layoutSpy.count(), 0);
+            QCOMPARE(insertSpy.count(), newArrivals);
         } else {
             Q_ASSERT(false);
         }
@@ -276,6 +300,7 @@ void ImapModelThreadingTest::testThreadDeletionsAdditions_data()
 
     // Test new arrivals
     QTest::newRow("flat-list-new") << (uint)2 << QByteArray("(1)(2)") << (QStringList() << "+1" << "(1)(2)(3)");
+    QTest::newRow("fork-new-thread") << (uint)5 << QByteArray("(1 (2 3)(4 5))") << (QStringList() << "+2" << "(1 (2 3)(4 5))(6)(7)");
 }
 
 /** @short Test deletion of one message */
@@ -357,6 +382,7 @@ void ImapModelThreadingTest::testDynamicThreading()
     QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(3)(4 (5)(6))(7 (8)(9))"));
 
     // Push a new message, but with an unknown UID so far
+    model->setNetworkExpensive();
     ++existsA;
     ++uidNextA;
     QCOMPARE(existsA, 9u);
@@ -366,13 +392,11 @@ void ImapModelThreadingTest::testDynamicThreading()
     QCoreApplication::processEvents();
     QCoreApplication::processEvents();
     QCoreApplication::processEvents();
-    // There should be a message with zero UID at the end
-    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(3)(4 (5)(6))(7 (8)(9))()"));
+    // The new message is not shown until it is known where it belongs
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(3)(4 (5)(6))(7 (8)(9))"));
 
     QByteArray fetchCommand1 = t.mk("UID FETCH ") + QString::fromUtf8("%1:* (FLAGS)\r\n").arg(QString::number(uidNextA - 1)).toUtf8();
     QByteArray delayedFetchResponse1 = t.last("OK uid fetch\r\n");
-    QByteArray threadCommand1 = t.mk("UID THREAD REFS utf-8 ALL\r\n");
-    QByteArray delayedThreadResponse1 = t.last("OK threading\r\n");
     QCOMPARE(SOCK->writtenStuff(), fetchCommand1);
 
     QByteArray fetchUntagged1("* 9 FETCH (UID 66 FLAGS (\\Recent))\r\n");
@@ -387,7 +411,14 @@ void ImapModelThreadingTest::testDynamicThreading()
     if (1) {
         // Make the UID known
         cServer(fetchUntagged1 + delayedFetchResponse1);
-        // After the UID got known, it is now time to ask for threading
+        // The headers are needed for finding the thread
+        cClient(t.mk("UID FETCH 66 (" FETCH_METADATA_ITEMS ")\r\n"));
+        // The parent's headers are not known, so the only option is to ask for threading
+        cServer("* 9 FETCH (UID 66 ENVELOPE (NIL \"re\" NIL NIL NIL NIL NIL NIL \"<7@x>\" \"<66@x>\") "
+                "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+                + t.last("OK fetched\r\n"));
+        QByteArray threadCommand1 = t.mk("UID THREAD REFS utf-8 ALL\r\n");
+        QByteArray delayedThreadResponse1 = t.last("OK threading\r\n");
         cClient(threadCommand1);
         // In the meanwhile, the message is temporarily visible as a standalone thread
         QCOMPARE(QString::fromUtf8(treeToThreading(QModelIndex())), QString::fromUtf8("(1)(3)(4 (5)(6))(7 (8)(9))(66)"));
@@ -1087,6 +1118,178 @@ void ImapModelThreadingTest::testDynamicSearch()
     justKeepTask();
 }
 
+/** @short Test that the result of the last SORT is remembered in the cache and reused when the mailbox hasn't changed */
+void ImapModelThreadingTest::testSortingCache()
+{
+    using namespace Imap::Mailbox;
+
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability("SORT");
+    threadingModel->setUserWantsThreading(false);
+    initialMessages(3);
+
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT));
+    cClient(t.mk("UID SORT (SUBJECT) utf-8 ALL\r\n"));
+    cServer("* SORT 3 1 2\r\n" + t.last("OK sorted\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(3)(1)(2)"));
+
+    AbstractCache::MessageSorting cached = model->cache()->messageSorting(QLatin1String("a"));
+    QCOMPARE(cached.sortCriteria, QStringList() << QLatin1String("SUBJECT"));
+    QVERIFY(cached.searchConditions.isEmpty());
+    QCOMPARE(cached.uids, QList<uint>() << 3 << 1 << 2);
+    QCOMPARE(cached.uidValidity, 333u);
+    QCOMPARE(cached.uidNext, 4u);
+
+    // Nothing has changed since then, so there's no need to ask again
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_NONE));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2)(3)"));
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT));
+    cEmpty();
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(3)(1)(2)"));
+
+    // An outdated result is shown right away, but the server is asked for the current one
+    cached.uids = QList<uint>() << 2 << 3 << 1;
+    cached.uidNext = 3;
+    model->cache()->setMessageSorting(QLatin1String("a"), cached);
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_NONE));
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(2)(3)(1)"));
+    cClient(t.mk("UID SORT (SUBJECT) utf-8 ALL\r\n"));
+    cServer("* SORT 1 2 3\r\n" + t.last("OK sorted\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2)(3)"));
+    cached = model->cache()->messageSorting(QLatin1String("a"));
+    QCOMPARE(cached.uids, QList<uint>() << 1 << 2 << 3);
+    QCOMPARE(cached.uidNext, 4u);
+
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short Test that the cached SORT is checked against the cached mailbox state when the mailbox gets opened again */
+void ImapModelThreadingTest::testSortingCacheReopen()
+{
+    using namespace Imap::Mailbox;
+
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability("SORT");
+    threadingModel->setUserWantsThreading(false);
+    initialMessages(3);
+
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT));
+    cClient(t.mk("UID SORT (SUBJECT) utf-8 ALL\r\n"));
+    cServer("* SORT 3 1 2\r\n" + t.last("OK sorted\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(3)(1)(2)"));
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_NONE));
+
+    // Open the mailbox again; until the SELECT finishes, nothing is known about its current state
+    helperSyncBNoMessages();
+    model->switchToMailbox(idxA);
+    cClient(t.mk("SELECT a\r\n"));
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(3)(1)(2)"));
+    cEmpty();
+
+    // The mailbox hasn't changed, so the cached result remains in use
+    helperFakeExistsUidValidityUidNext();
+    helperSyncFlags();
+    cEmpty();
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(3)(1)(2)"));
+
+    // This time, a new message has arrived in the meanwhile
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_NONE));
+    helperSyncBNoMessages();
+    model->switchToMailbox(idxA);
+    cClient(t.mk("SELECT a\r\n"));
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(3)(1)(2)"));
+    cEmpty();
+    const uint oldExists = existsA;
+    ++existsA;
+    uidMapA << uidNextA;
+    ++uidNextA;
+    helperFakeExistsUidValidityUidNext();
+    helperFakeUidSearch(oldExists);
+    helperSyncFlags();
+
+    // The cached result turned out to be stale, so the server is asked again
+    cClient(t.mk("UID SORT (SUBJECT) utf-8 ALL\r\n"));
+    cServer("* SORT 3 1 4 2\r\n" + t.last("OK sorted\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(3)(1)(4)(2)"));
+
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short Test that huge SEARCH results are fetched page by page through ESEARCH PARTIAL */
+void ImapModelThreadingTest::testPartialSearch()
+{
+    using namespace Imap::Mailbox;
+
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability("ESEARCH");
+    injector.injectCapability("CONTEXT=SEARCH");
+    threadingModel->setUserWantsThreading(false);
+    threadingModel->setSearchPageSize(2);
+    initialMessages(5);
+
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("SUBJECT") << QLatin1String("x"),
+                                                              ThreadingMsgListModel::SORT_NONE));
+    cClient(t.mk("UID SEARCH RETURN (COUNT PARTIAL 1:2) CHARSET utf-8 SUBJECT x\r\n"));
+    cServer("* ESEARCH (TAG \"" + t.last() + "\") UID COUNT 3 PARTIAL (1:2 1,3)\r\n" + t.last("OK searched\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(3)"));
+    QVERIFY(threadingModel->canFetchMore(QModelIndex()));
+
+    // The view has scrolled down to the end, so the next page is needed
+    threadingModel->fetchMore(QModelIndex());
+    cClient(t.mk("UID SEARCH RETURN (COUNT PARTIAL 3:4) CHARSET utf-8 SUBJECT x\r\n"));
+    QVERIFY(!threadingModel->canFetchMore(QModelIndex()));
+    cServer("* ESEARCH (TAG \"" + t.last() + "\") UID COUNT 3 PARTIAL (3:4 5)\r\n" + t.last("OK searched\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(3)(5)"));
+    QVERIFY(!threadingModel->canFetchMore(QModelIndex()));
+
+    // Going back to the whole mailbox disables the paging
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_NONE));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2)(3)(4)(5)"));
+    QVERIFY(!threadingModel->canFetchMore(QModelIndex()));
+
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short Test that a descending view gets the pages of a huge SEARCH result from its end */
+void ImapModelThreadingTest::testPartialSearchReverse()
+{
+    using namespace Imap::Mailbox;
+
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability("ESEARCH");
+    injector.injectCapability("CONTEXT=SEARCH");
+    threadingModel->setUserWantsThreading(false);
+    threadingModel->setSearchPageSize(2);
+    initialMessages(5);
+
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("SUBJECT") << QLatin1String("x"),
+                                                              ThreadingMsgListModel::SORT_NONE, Qt::DescendingOrder));
+    cClient(t.mk("UID SEARCH RETURN (COUNT PARTIAL -1:-2) CHARSET utf-8 SUBJECT x\r\n"));
+    cServer("* ESEARCH (TAG \"" + t.last() + "\") UID COUNT 3 PARTIAL (-1:-2 3,5)\r\n" + t.last("OK searched\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(5)(3)"));
+    QVERIFY(threadingModel->canFetchMore(QModelIndex()));
+
+    threadingModel->fetchMore(QModelIndex());
+    cClient(t.mk("UID SEARCH RETURN (COUNT PARTIAL -3:-4) CHARSET utf-8 SUBJECT x\r\n"));
+    cServer("* ESEARCH (TAG \"" + t.last() + "\") UID COUNT 3 PARTIAL (-3:-4 1)\r\n" + t.last("OK searched\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(5)(3)(1)"));
+    QVERIFY(!threadingModel->canFetchMore(QModelIndex()));
+
+    // Everything has been loaded already, so flipping the order needs no new search
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("SUBJECT") << QLatin1String("x"),
+                                                              ThreadingMsgListModel::SORT_NONE, Qt::AscendingOrder));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(3)(5)"));
+
+    cEmpty();
+    justKeepTask();
+}
+
 void ImapModelThreadingTest::testThreadingPerformance()
 {
     const uint num = 100000;
@@ -1138,6 +1341,81 @@ void ImapModelThreadingTest::testThreadingPerformance()
     }
 }
 
+/** @short Benchmark the client-side threading over the same shape of threads as the testThreadingPerformance uses */
+void ImapModelThreadingTest::testLocalThreadingPerformance()
+{
+    const uint num = 100000;
+    // Parents of the messages within a group of ten, relative to its first message; -1 means "no parent"
+    const int sampleThread[] = {-1, 0, 1, 2, 2, 4, 5, 0, 7, 8};
+    const int linearThread[] = {-1, 0, 1, 2, 3, 4, 5, 6, 7, 8};
+    const int flatThread[] = {-1, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    QVector<QByteArray> messageIds(num + 1);
+    QVector<QList<QByteArray> > references(num + 1);
+    for (uint i = 1; i < num; i += 10) {
+        const int *parents = 0;
+        switch (i % 100) {
+        case 51:
+        case 61:
+            parents = linearThread;
+            break;
+        case 71:
+        case 81:
+        case 91:
+            parents = flatThread;
+            break;
+        default:
+            parents = sampleThread;
+            break;
+        }
+        for (uint j = 0; j < 10; ++j) {
+            messageIds[i + j] = "<" + QByteArray::number(i + j) + "@example.org>";
+            if (parents[j] != -1) {
+                references[i + j] = references[i + parents[j]];
+                references[i + j] << messageIds[i + parents[j]];
+            }
+        }
+    }
+
+    QBENCHMARK {
+        Imap::Mailbox::LocalThreading engine;
+        for (uint i = 1; i <= num; ++i) {
+            engine.addMessage(i, messageIds[i], references[i]);
+        }
+        QCOMPARE(engine.threading().size(), static_cast<int>(num / 10));
+    }
+}
+
+/** @short Benchmark the key extraction and the sorting of the local sorting engine */
+void ImapModelThreadingTest::testLocalSortingPerformance()
+{
+    const int num = 100000;
+    const char *prefixes[] = {"", "Re: ", "Fwd: ", "[list] ", "Re: [list] Re: ", "AW: "};
+    QStringList subjects;
+    QVector<quint64> dates(num);
+    for (int i = 0; i < num; ++i) {
+        subjects << QString::fromUtf8(prefixes[i % 6]) + QString::fromUtf8("Sübject %1 of thread").arg((i * 7919) % (num / 3));
+        dates[i] = (i * 104729) % num;
+    }
+
+    QBENCHMARK {
+        QVector<QString> keys(num);
+        for (int i = 0; i < num; ++i) {
+            keys[i] = Imap::Mailbox::LocalSorting::collationKey(Imap::Mailbox::LocalSorting::baseSubject(subjects[i]));
+        }
+        QVector<int> order = Imap::Mailbox::LocalSorting::sortedOrder(keys);
+        QCOMPARE(order.size(), num);
+        for (int i = 1; i < num; ++i) {
+            QVERIFY(keys[order[i - 1]] < keys[order[i]] || (keys[order[i - 1]] == keys[order[i]] && order[i - 1] < order[i]));
+        }
+    }
+
+    QBENCHMARK {
+        QVector<int> order = Imap::Mailbox::LocalSorting::sortedOrder(dates);
+        QCOMPARE(order.size(), num);
+        QCOMPARE(dates[order.first()], static_cast<quint64>(0));
+    }
+}
+
 void ImapModelThreadingTest::testSortingPerformance()
 {
     threadingModel->setUserWantsThreading(false);
@@ -1211,10 +1489,16 @@ void ImapModelThreadingTest::testIncrementalThreading()
     injector.injectCapability("INCTHREAD");
 
     // Fake delivery of one new message
+    model->setNetworkExpensive();
     cServer("* 11 EXISTS\r\n");
     // Ask for the UID and deliver it immediately
     cClient(t.mk("UID FETCH 11:* (FLAGS)\r\n"));
     cServer("* 11 FETCH (UID 11 FLAGS ())\r\n" + t.last("OK fetch\r\n"));
+    // It's a reply to a message whose headers are not known
+    cClient(t.mk("UID FETCH 11 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 11 FETCH (UID 11 ENVELOPE (NIL \"re\" NIL NIL NIL NIL NIL NIL \"<9@x>\" \"<11@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            + t.last("OK fetched\r\n"));
 
     // Test the incremental threading
     cClient(t.mk("UID THREAD RETURN (INCTHREAD) REFS utf-8 INTHREAD REFS UID 11:*\r\n"));
@@ -1226,6 +1510,128 @@ void ImapModelThreadingTest::testIncrementalThreading()
     cEmpty();
 }
 
+/** @short Test that new arrivals are put into their threads without asking the server and without a layout change */
+void ImapModelThreadingTest::testArrivalsThreadedLocally()
+{
+    initialMessages(3);
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer(QByteArray("* THREAD (1 2)(3)\r\n") + t.last("OK thread\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 2)(3)"));
+
+    // The headers of the existing messages are known because they are shown
+    model->setNetworkExpensive();
+    QVERIFY(!findItem("0").data(Imap::Mailbox::RoleMessageSubject).isValid());
+    QVERIFY(!findItem("0.0").data(Imap::Mailbox::RoleMessageSubject).isValid());
+    QVERIFY(!findItem("1").data(Imap::Mailbox::RoleMessageSubject).isValid());
+    cClient(t.mk("UID FETCH 1:3 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 1 FETCH (UID 1 ENVELOPE (NIL \"one\" NIL NIL NIL NIL NIL NIL NIL \"<1@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            "* 2 FETCH (UID 2 ENVELOPE (NIL \"two\" NIL NIL NIL NIL NIL NIL \"<1@x>\" \"<2@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            "* 3 FETCH (UID 3 ENVELOPE (NIL \"three\" NIL NIL NIL NIL NIL NIL NIL \"<3@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            + t.last("OK fetched\r\n"));
+
+    QSignalSpy insertedSpy(threadingModel, SIGNAL(rowsInserted(QModelIndex,int,int)));
+    QSignalSpy removedSpy(threadingModel, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+    QSignalSpy movedSpy(threadingModel, SIGNAL(rowsMoved(QModelIndex,int,int,QModelIndex,int)));
+    QSignalSpy layoutSpy(threadingModel, SIGNAL(layoutChanged()));
+    QSignalSpy resetSpy(threadingModel, SIGNAL(modelReset()));
+
+    // A reply to the second message, a new thread and a reply to the third one
+    cServer("* 6 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 4:* (FLAGS)\r\n"));
+    cServer("* 4 FETCH (UID 4 FLAGS ())\r\n* 5 FETCH (UID 5 FLAGS ())\r\n* 6 FETCH (UID 6 FLAGS ())\r\n" + t.last("OK fetch\r\n"));
+    existsA = 6;
+    uidNextA = 7;
+    uidMapA << 4 << 5 << 6;
+    // Nothing is shown until we know where the new messages belong
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 2)(3)"));
+    QCOMPARE(insertedSpy.count(), 0);
+
+    cClient(t.mk("UID FETCH 4:6 (" FETCH_METADATA_ITEMS ")\r\n"));
+    QByteArray references("References: <1@x> <2@x>\r\n\r\n");
+    cServer("* 4 FETCH (UID 4 ENVELOPE (NIL \"four\" NIL NIL NIL NIL NIL NIL NIL \"<4@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89 "
+            "BODY[HEADER.FIELDS (References List-Post)] {" + QByteArray::number(references.size()) + "}\r\n" + references + ")\r\n"
+            "* 5 FETCH (UID 5 ENVELOPE (NIL \"five\" NIL NIL NIL NIL NIL NIL NIL \"<5@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            "* 6 FETCH (UID 6 ENVELOPE (NIL \"six\" NIL NIL NIL NIL NIL NIL \"<3@x>\" \"<6@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            + t.last("OK fetched\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 2 4)(3 6)(5)"));
+
+    // No THREAD command, and the views only see the new rows
+    cEmpty();
+    QCOMPARE(insertedSpy.count(), 3);
+    QCOMPARE(removedSpy.count(), 0);
+    QCOMPARE(movedSpy.count(), 0);
+    QCOMPARE(layoutSpy.count(), 0);
+    QCOMPARE(resetSpy.count(), 0);
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short Test that the ORDEREDSUBJECT threading puts new arrivals below the root with the same base subject */
+void ImapModelThreadingTest::testArrivalsOrderedSubject()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.removeCapability(QLatin1String("THREAD=REFS"));
+    injector.injectCapability(QLatin1String("THREAD=ORDEREDSUBJECT"));
+    initialMessages(3);
+    cClient(t.mk("UID THREAD ORDEREDSUBJECT utf-8 ALL\r\n"));
+    cServer(QByteArray("* THREAD (1 2)(3)\r\n") + t.last("OK thread\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 2)(3)"));
+
+    model->setNetworkExpensive();
+    QVERIFY(!findItem("0").data(Imap::Mailbox::RoleMessageSubject).isValid());
+    QVERIFY(!findItem("0.0").data(Imap::Mailbox::RoleMessageSubject).isValid());
+    QVERIFY(!findItem("1").data(Imap::Mailbox::RoleMessageSubject).isValid());
+    cClient(t.mk("UID FETCH 1:3 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 1 FETCH (UID 1 ENVELOPE (\"Mon, 1 Jan 2018 10:00:00 +0000\" \"a\" NIL NIL NIL NIL NIL NIL NIL \"<1@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            "* 2 FETCH (UID 2 ENVELOPE (\"Mon, 1 Jan 2018 11:00:00 +0000\" \"Re: a\" NIL NIL NIL NIL NIL NIL NIL \"<2@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            "* 3 FETCH (UID 3 ENVELOPE (\"Mon, 1 Jan 2018 12:00:00 +0000\" \"b\" NIL NIL NIL NIL NIL NIL NIL \"<3@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            + t.last("OK fetched\r\n"));
+
+    QSignalSpy layoutSpy(threadingModel, SIGNAL(layoutChanged()));
+
+    // A follow-up in the second thread and a new thread, both newer than everything else
+    cServer("* 5 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 4:* (FLAGS)\r\n"));
+    cServer("* 4 FETCH (UID 4 FLAGS ())\r\n* 5 FETCH (UID 5 FLAGS ())\r\n" + t.last("OK fetch\r\n"));
+    existsA = 5;
+    uidNextA = 6;
+    uidMapA << 4 << 5;
+    cClient(t.mk("UID FETCH 4:5 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 4 FETCH (UID 4 ENVELOPE (\"Tue, 2 Jan 2018 10:00:00 +0000\" \"Fwd: b\" NIL NIL NIL NIL NIL NIL NIL \"<4@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            "* 5 FETCH (UID 5 ENVELOPE (\"Tue, 2 Jan 2018 11:00:00 +0000\" \"c\" NIL NIL NIL NIL NIL NIL NIL \"<5@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            + t.last("OK fetched\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 2)(3 4)(5)"));
+    cEmpty();
+    QCOMPARE(layoutSpy.count(), 0);
+
+    // An old message would have to go into the middle of its thread, so the server has to be asked
+    cServer("* 6 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 6:* (FLAGS)\r\n"));
+    cServer("* 6 FETCH (UID 6 FLAGS ())\r\n" + t.last("OK fetch\r\n"));
+    existsA = 6;
+    uidNextA = 7;
+    uidMapA << 6;
+    cClient(t.mk("UID FETCH 6 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 6 FETCH (UID 6 ENVELOPE (\"Mon, 1 Jan 2018 10:30:00 +0000\" \"re: a\" NIL NIL NIL NIL NIL NIL NIL \"<6@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            + t.last("OK fetched\r\n"));
+    cClient(t.mk("UID THREAD ORDEREDSUBJECT utf-8 ALL\r\n"));
+    cServer(QByteArray("* THREAD (1 (6)(2))(3 4)(5)\r\n") + t.last("OK thread\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 (6)(2))(3 4)(5)"));
+    cEmpty();
+    QVERIFY(errorSpy->isEmpty());
+}
+
 /** Test what happens when a thread root ceases to exist while the THREAD response is in flight */
 void ImapModelThreadingTest::testRemovingRootWithThreadingInFlight()
 {
@@ -1246,12 +1652,18 @@ void ImapModelThreadingTest::testRemovingRootWithThreadingInFlight()
     QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2)"));
 
     // Now let one more message arrive
+    model->setNetworkExpensive();
     cServer("* 3 EXISTS\r\n");
     cClient(t.mk("UID FETCH 3:* (FLAGS)\r\n"));
     QByteArray fetchUntagged("* 3 FETCH (UID 3 FLAGS ())\r\n");
     QByteArray fetchTagged(t.last("OK fetched\r\n"));
     cServer(fetchUntagged);
     cServer(fetchTagged);
+    // The headers of its parent are not known, so the threading has to be requested from the server
+    cClient(t.mk("UID FETCH 3 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 3 FETCH (UID 3 ENVELOPE (NIL \"re\" NIL NIL NIL NIL NIL NIL \"<2@x>\" \"<3@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            + t.last("OK fetched\r\n"));
     // While the threading is requested, one thread root gets removed
     cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
     QByteArray threadUntagged("* THREAD (1)(2 3)\r\n");
@@ -1273,6 +1685,52 @@ void ImapModelThreadingTest::testRemovingRootWithThreadingInFlight()
     cEmpty();
 }
 
+/** @short Test that the persistent indexes in all columns follow their messages through layout changes */
+void ImapModelThreadingTest::testPersistentIndexes()
+{
+    using namespace Imap::Mailbox;
+
+    initialMessages(4);
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer(QByteArray("* THREAD (1 2)(3)(4)\r\n") + t.last("OK thread\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 2)(3)(4)"));
+
+    QPersistentModelIndex msg1 = findItem("0");
+    QPersistentModelIndex msg2 = findItem("0.0").sibling(0, MsgListModel::FROM);
+    QPersistentModelIndex msg3 = findItem("1").sibling(1, MsgListModel::SIZE);
+    QPersistentModelIndex msg4 = findItem("2");
+    QCOMPARE(msg2.data(RoleMessageUid).toUInt(), 2u);
+    QCOMPARE(msg3.data(RoleMessageUid).toUInt(), 3u);
+
+    // Going back to the flat list moves the second message to the top level
+    threadingModel->setUserWantsThreading(false);
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2)(3)(4)"));
+    QCOMPARE(msg1.row(), 0);
+    QCOMPARE(msg2.row(), 1);
+    QCOMPARE(msg2.column(), static_cast<int>(MsgListModel::FROM));
+    QVERIFY(!msg2.parent().isValid());
+    QCOMPARE(msg2.data(RoleMessageUid).toUInt(), 2u);
+    QCOMPARE(msg3.row(), 2);
+    QCOMPARE(msg3.column(), static_cast<int>(MsgListModel::SIZE));
+    QCOMPARE(msg4.row(), 3);
+
+    // An expunge kills the index of that message and shifts the following ones
+    cServer("* 1 EXPUNGE\r\n");
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(2)(3)(4)"));
+    QVERIFY(!msg1.isValid());
+    QCOMPARE(msg2.row(), 0);
+    QCOMPARE(msg2.data(RoleMessageUid).toUInt(), 2u);
+    QCOMPARE(msg3.row(), 1);
+    QCOMPARE(msg3.data(RoleMessageUid).toUInt(), 3u);
+    QCOMPARE(msg4.row(), 2);
+
+    // The mapping from the upstream rows has been shifted as well
+    QCOMPARE(threadingModel->mapFromSource(msgListModel->index(1, 0)), QModelIndex(msg3.sibling(1, 0)));
+    QCOMPARE(threadingModel->mapToSource(msg4.sibling(2, 0)), msgListModel->index(2, 0));
+
+    cEmpty();
+}
+
 /** @short Check that multiple messages being removed at once doesn't break stuff */
 void ImapModelThreadingTest::testMultipleExpunges()
 {
@@ -1324,6 +1782,358 @@ void ImapModelThreadingTest::testMultipleExpunges()
     cEmpty();
 }
 
+/** @short Convert the result of threading into a THREAD-like string where each message is enclosed in parentheses */
+static QByteArray threadingToString(const QVector<Imap::Responses::ThreadingNode> &nodes)
+{
+    QByteArray res;
+    Q_FOREACH(const Imap::Responses::ThreadingNode &node, nodes) {
+        res += '(' + QByteArray::number(node.num);
+        if (!node.children.isEmpty())
+            res += ' ' + threadingToString(node.children);
+        res += ')';
+    }
+    return res;
+}
+
+/** @short Test the client-side threading algorithm on its own */
+void ImapModelThreadingTest::testLocalThreadingEngine()
+{
+    QFETCH(QStringList, messages);
+    QFETCH(QByteArray, result);
+
+    Imap::Mailbox::LocalThreading engine;
+    Q_FOREACH(const QString &message, messages) {
+        // The format is "UID Message-Id [references...]" with "-" standing for a missing Message-Id
+        QStringList items = message.split(QLatin1Char(' '));
+        const uint uid = items.takeFirst().toUInt();
+        const QString messageId = items.takeFirst();
+        QList<QByteArray> references;
+        Q_FOREACH(const QString &reference, items) {
+            references << reference.toUtf8();
+        }
+        engine.addMessage(uid, messageId == QLatin1String("-") ? QByteArray() : messageId.toUtf8(), references);
+    }
+    QCOMPARE(threadingToString(engine.threading()), result);
+}
+
+void ImapModelThreadingTest::testLocalThreadingEngine_data()
+{
+    QTest::addColumn<QStringList>("messages");
+    QTest::addColumn<QByteArray>("result");
+
+    QTest::newRow("flat")
+            << (QStringList() << QLatin1String("1 a") << QLatin1String("2 b") << QLatin1String("3 -"))
+            << QByteArray("(1)(2)(3)");
+
+    // Threads are ordered by their most recent message
+    QTest::newRow("replies")
+            << (QStringList() << QLatin1String("1 a") << QLatin1String("2 b") << QLatin1String("3 c a")
+                << QLatin1String("4 d a c"))
+            << QByteArray("(2)(1 (3 (4)))");
+
+    // The parent arrives later than its reply
+    QTest::newRow("parent-later")
+            << (QStringList() << QLatin1String("1 b a") << QLatin1String("2 a"))
+            << QByteArray("(2 (1))");
+
+    // A missing message which is referenced by just one reply is dropped, but the siblings remain together
+    QTest::newRow("missing-parent")
+            << (QStringList() << QLatin1String("1 b x") << QLatin1String("2 c y") << QLatin1String("3 d y"))
+            << QByteArray("(1)(0 (2)(3))");
+
+    // The missing message in the middle of the References doesn't break the thread
+    QTest::newRow("missing-middle")
+            << (QStringList() << QLatin1String("1 a") << QLatin1String("2 c a b"))
+            << QByteArray("(1 (2))");
+
+    // Messages which claim to be each other's parents must not form a loop
+    QTest::newRow("loop")
+            << (QStringList() << QLatin1String("1 a b") << QLatin1String("2 b a") << QLatin1String("3 c c"))
+            << QByteArray("(2 (1))(3)");
+
+    // Duplicate Message-Ids are treated as if the message had none
+    QTest::newRow("duplicate-id")
+            << (QStringList() << QLatin1String("1 a") << QLatin1String("2 a") << QLatin1String("3 z a"))
+            << QByteArray("(2)(1 (3))");
+}
+
+/** @short Test that the messages are threaded locally when the server doesn't support THREAD */
+void ImapModelThreadingTest::testLocalThreading()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.removeCapability(QLatin1String("THREAD=REFS"));
+    initialMessages(4);
+    // The headers are only asked for once a view needs them, and the preloading takes care of the rest
+    cEmpty();
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2)(3)(4)"));
+    threadingModel->index(0, 0).data(Imap::Mailbox::RoleMessageSubject);
+
+    cClient(t.mk("UID FETCH 1:4 (" FETCH_METADATA_ITEMS ")\r\n"));
+    QByteArray references("References: <1@x>\r\n\r\n");
+    cServer("* 1 FETCH (UID 1 ENVELOPE (NIL \"one\" NIL NIL NIL NIL NIL NIL NIL \"<1@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            "* 2 FETCH (UID 2 ENVELOPE (NIL \"two\" NIL NIL NIL NIL NIL NIL NIL \"<2@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89 "
+            "BODY[HEADER.FIELDS (References List-Post)] {" + QByteArray::number(references.size()) + "}\r\n" + references + ")\r\n"
+            "* 3 FETCH (UID 3 ENVELOPE (NIL \"three\" NIL NIL NIL NIL NIL NIL NIL \"<3@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            // The In-Reply-To is used when there are no References
+            "* 4 FETCH (UID 4 ENVELOPE (NIL \"four\" NIL NIL NIL NIL NIL NIL \"<1@x>\" \"<4@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            + t.last("OK fetched\r\n"));
+    // The replies are moved below their parent, the threads stay where they were
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 (2)(4))(3)"));
+    QVERIFY(SOCK->writtenStuff().isEmpty());
+    QVERIFY(errorSpy->isEmpty());
+
+    // Expunging the thread root keeps the replies together
+    cServer("* 1 EXPUNGE\r\n");
+    --existsA;
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(2 4)(3)"));
+    cEmpty();
+}
+
+/** @short Test that the headers which arrive one by one only move the affected messages of the local threading */
+void ImapModelThreadingTest::testLocalThreadingLateHeaders()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.removeCapability(QLatin1String("THREAD=REFS"));
+    model->setProperty("trojita-imap-preload-msg-metadata", 0);
+    initialMessages(4);
+    cEmpty();
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2)(3)(4)"));
+
+    QSignalSpy layoutSpy(threadingModel, SIGNAL(layoutChanged()));
+    QSignalSpy movedSpy(threadingModel, SIGNAL(rowsMoved(QModelIndex,int,int,QModelIndex,int)));
+    QPersistentModelIndex reply = threadingModel->index(1, 0);
+
+    // A reply whose parent has not got its headers yet stays where it is
+    msgListA.child(1, 0).data(Imap::Mailbox::RoleMessageSubject);
+    cClient(t.mk("UID FETCH 2 (" FETCH_METADATA_ITEMS ")\r\n"));
+    QByteArray references("References: <1@x>\r\n\r\n");
+    cServer("* 2 FETCH (UID 2 ENVELOPE (NIL \"two\" NIL NIL NIL NIL NIL NIL NIL \"<2@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89 "
+            "BODY[HEADER.FIELDS (References List-Post)] {" + QByteArray::number(references.size()) + "}\r\n" + references + ")\r\n"
+            + t.last("OK fetched\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2)(3)(4)"));
+
+    // The parent adopts it as soon as its own headers are known
+    msgListA.child(0, 0).data(Imap::Mailbox::RoleMessageSubject);
+    cClient(t.mk("UID FETCH 1 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 1 FETCH (UID 1 ENVELOPE (NIL \"one\" NIL NIL NIL NIL NIL NIL NIL \"<1@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            + t.last("OK fetched\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 2)(3)(4)"));
+    QCOMPARE(movedSpy.size(), 1);
+    QVERIFY(reply.isValid());
+    QCOMPARE(reply.data(Imap::Mailbox::RoleMessageUid).toUInt(), 2u);
+    QCOMPARE(reply.parent(), QModelIndex(threadingModel->index(0, 0)));
+
+    // Another reply goes right below its parent
+    msgListA.child(3, 0).data(Imap::Mailbox::RoleMessageSubject);
+    cClient(t.mk("UID FETCH 4 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 4 FETCH (UID 4 ENVELOPE (NIL \"four\" NIL NIL NIL NIL NIL NIL \"<1@x>\" \"<4@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            + t.last("OK fetched\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 (2)(4))(3)"));
+    QCOMPARE(movedSpy.size(), 2);
+
+    // The headers of the third message do not change anything
+    msgListA.child(2, 0).data(Imap::Mailbox::RoleMessageSubject);
+    cClient(t.mk("UID FETCH 3 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 3 FETCH (UID 3 ENVELOPE (NIL \"three\" NIL NIL NIL NIL NIL NIL NIL \"<3@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            + t.last("OK fetched\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 (2)(4))(3)"));
+    QCOMPARE(movedSpy.size(), 2);
+
+    QVERIFY(layoutSpy.isEmpty());
+    cEmpty();
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short Test the base subject extraction from RFC 5256 which the local sorting uses */
+void ImapModelThreadingTest::testLocalSortingBaseSubject()
+{
+    QFETCH(QString, subject);
+    QFETCH(QString, baseSubject);
+    QCOMPARE(Imap::Mailbox::LocalSorting::baseSubject(subject), baseSubject);
+}
+
+void ImapModelThreadingTest::testLocalSortingBaseSubject_data()
+{
+    QTest::addColumn<QString>("subject");
+    QTest::addColumn<QString>("baseSubject");
+
+    QTest::newRow("plain") << QString::fromUtf8("foo bar") << QString::fromUtf8("foo bar");
+    QTest::newRow("whitespace") << QString::fromUtf8("  foo \t  bar ") << QString::fromUtf8("foo bar");
+    QTest::newRow("re") << QString::fromUtf8("Re: foo") << QString::fromUtf8("foo");
+    QTest::newRow("re-re") << QString::fromUtf8("RE: re:foo") << QString::fromUtf8("foo");
+    QTest::newRow("fwd") << QString::fromUtf8("Fwd: foo") << QString::fromUtf8("foo");
+    QTest::newRow("fw") << QString::fromUtf8("FW: foo") << QString::fromUtf8("foo");
+    QTest::newRow("re-blob") << QString::fromUtf8("Re[2]: foo") << QString::fromUtf8("foo");
+    QTest::newRow("list-blob") << QString::fromUtf8("[list] foo") << QString::fromUtf8("foo");
+    QTest::newRow("list-blob-re") << QString::fromUtf8("Re: [list] Re: foo") << QString::fromUtf8("foo");
+    QTest::newRow("blob-only") << QString::fromUtf8("[foo]") << QString::fromUtf8("[foo]");
+    QTest::newRow("trailer") << QString::fromUtf8("foo (fwd) (FWD)") << QString::fromUtf8("foo");
+    QTest::newRow("fwd-wrapper") << QString::fromUtf8("[Fwd: Re: foo]") << QString::fromUtf8("foo");
+    QTest::newRow("not-a-prefix") << QString::fromUtf8("Really: foo") << QString::fromUtf8("Really: foo");
+    QTest::newRow("empty") << QString() << QString();
+}
+
+/** @short Test the client-side sorting on a server without the SORT extension */
+void ImapModelThreadingTest::testLocalSorting()
+{
+    threadingModel->setUserWantsThreading(false);
+    initialMessages(4);
+
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_SUBJECT,
+                                                              Qt::AscendingOrder));
+    // Nothing is known yet, so the order is not changed
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2)(3)(4)"));
+
+    cClient(t.mk("UID FETCH 1:4 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 1 FETCH (UID 1 ENVELOPE (NIL \"Re: beta\" NIL NIL NIL NIL NIL NIL NIL \"<1@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n"
+            "* 2 FETCH (UID 2 ENVELOPE (NIL \"alpha\" NIL NIL NIL NIL NIL NIL NIL \"<2@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 120)\r\n"
+            "* 3 FETCH (UID 3 ENVELOPE (NIL \"[list] Gamma\" NIL NIL NIL NIL NIL NIL NIL \"<3@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 50)\r\n"
+            "* 4 FETCH (UID 4 ENVELOPE (NIL \"Fwd: Alpha\" NIL NIL NIL NIL NIL NIL NIL \"<4@x>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 70)\r\n"
+            + t.last("OK fetched\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(2)(4)(1)(3)"));
+    // The base subjects are computed as soon as the envelopes arrive
+    QCOMPARE(msgListA.child(0, 0).data(Imap::Mailbox::RoleMessageBaseSubject).toString(), QString::fromUtf8("beta"));
+    QCOMPARE(msgListA.child(2, 0).data(Imap::Mailbox::RoleMessageBaseSubject).toString(), QString::fromUtf8("Gamma"));
+    QCOMPARE(msgListA.child(3, 0).data(Imap::Mailbox::RoleMessageSubject).toString(), QString::fromUtf8("Fwd: Alpha"));
+
+    // The keys are cached now, so none of these shall go to the server
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_SUBJECT,
+                                                              Qt::DescendingOrder));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(3)(1)(4)(2)"));
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_SIZE,
+                                                              Qt::AscendingOrder));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(3)(4)(1)(2)"));
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_NONE,
+                                                              Qt::AscendingOrder));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2)(3)(4)"));
+
+    // Searching is still up to the server
+    QVERIFY(!threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("SUBJECT") << QLatin1String("x"),
+                                                               Imap::Mailbox::ThreadingMsgListModel::SORT_SIZE, Qt::AscendingOrder));
+    cEmpty();
+    QVERIFY(errorSpy->isEmpty());
+}
+
+/** @short Test the word splitting and the prefix matching of the full-text index */
+void ImapModelThreadingTest::testFullTextIndex()
+{
+    using Imap::Mailbox::FullTextIndex;
+
+    QCOMPARE(FullTextIndex::words(QString::fromUtf8("Re: Café-meeting, CAFÉ at 10:30")),
+             QStringList() << QLatin1String("re") << QLatin1String("cafe") << QLatin1String("meeting") << QLatin1String("at")
+             << QLatin1String("10") << QLatin1String("30"));
+
+    FullTextIndex index;
+    index.addText(1, FullTextIndex::FIELD_SUBJECT, QString::fromUtf8("Quarterly report"));
+    index.addText(1, FullTextIndex::FIELD_FROM, QString::fromUtf8("Alice"));
+    index.addText(2, FullTextIndex::FIELD_SUBJECT, QString::fromUtf8("Lunch"));
+    index.addText(2, FullTextIndex::FIELD_FROM, QString::fromUtf8("Bob"));
+    index.addText(3, FullTextIndex::FIELD_SUBJECT, QString::fromUtf8("Re: Quarterly report"));
+    index.addText(3, FullTextIndex::FIELD_BODY, QString::fromUtf8("See you at lunch, Bob. Alice says hi."));
+
+    QCOMPARE(index.search(QLatin1String("quarter")), QList<uint>() << 1 << 3);
+    QCOMPARE(index.search(QLatin1String("LUNCH bob")), QList<uint>() << 2 << 3);
+    QCOMPARE(index.search(QLatin1String("report alice")), QList<uint>() << 1 << 3);
+    QCOMPARE(index.search(QLatin1String("nothing")), QList<uint>());
+    QCOMPARE(index.search(QLatin1String("...")), QList<uint>());
+
+    // Only the requested fields are considered
+    QCOMPARE(index.search(QLatin1String("alice"), FullTextIndex::FIELD_FROM), QList<uint>() << 1);
+    QCOMPARE(index.search(QLatin1String("alice"), FullTextIndex::FIELD_BODY), QList<uint>() << 3);
+    QCOMPARE(index.search(QLatin1String("lunch"), FullTextIndex::FIELD_SUBJECT | FullTextIndex::FIELD_FROM),
+             QList<uint>() << 2);
+    QCOMPARE(index.search(QLatin1String("report alice"), FullTextIndex::fieldsForSearchKey(QLatin1String("text"))),
+             QList<uint>() << 1 << 3);
+    QCOMPARE(FullTextIndex::fieldsForSearchKey(QLatin1String("UNSEEN")), 0u);
+
+    index.removeMessage(3);
+    QCOMPARE(index.search(QLatin1String("quarter")), QList<uint>() << 1);
+    QCOMPARE(index.search(QLatin1String("lunch")), QList<uint>() << 2);
+
+    index.clear();
+    QCOMPARE(index.search(QLatin1String("lunch")), QList<uint>());
+}
+
+/** @short Test that the search goes to the local index when the network is not available */
+void ImapModelThreadingTest::testLocalSearch()
+{
+    model->setProperty("trojita-imap-delayed-fetch-part", QVariant(0u));
+    threadingModel->setUserWantsThreading(false);
+    initialMessages(3);
+
+    // Use the local sorting for getting the metadata
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_SUBJECT,
+                                                              Qt::AscendingOrder));
+    cClient(t.mk("UID FETCH 1:3 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 1 FETCH (UID 1 ENVELOPE (NIL \"Quarterly report\" ((\"Alice\" NIL \"alice\" \"example.org\")) NIL NIL NIL NIL NIL NIL "
+            "\"<1@x>\") BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89 "
+            "INTERNALDATE \"15-Jan-2013 12:17:06 +0000\")\r\n"
+            "* 2 FETCH (UID 2 ENVELOPE (NIL \"Lunch\" ((\"Bob\" NIL \"bob\" \"example.org\")) NIL NIL NIL NIL NIL NIL "
+            "\"<2@x>\") BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89 "
+            "INTERNALDATE \"15-Jan-2013 12:18:06 +0000\")\r\n"
+            "* 3 FETCH (UID 3 ENVELOPE (NIL \"Re: Quarterly report\" ((\"Bob\" NIL \"bob\" \"example.org\")) NIL NIL NIL NIL NIL "
+            "NIL \"<3@x>\") BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89 "
+            "INTERNALDATE \"15-Jan-2013 12:19:06 +0000\")\r\n"
+            + t.last("OK fetched\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(2)(1)(3)"));
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_NONE,
+                                                              Qt::AscendingOrder));
+
+    // Body parts are indexed as they arrive
+    QModelIndex part = msgListA.child(1, 0).child(0, 0);
+    QVERIFY(part.isValid());
+    QCOMPARE(part.data(Imap::Mailbox::RolePartData).toByteArray(), QByteArray());
+    cClient(t.mk("UID FETCH 2 (BODY.PEEK[1])\r\n"));
+    cServer("* 2 FETCH (UID 2 BODY[1] {18}\r\nMeeting at the pub)\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(part.data(Imap::Mailbox::RolePartData).toByteArray(), QByteArray("Meeting at the pub"));
+
+    model->setNetworkOffline();
+    cClient(t.mk("LOGOUT\r\n"));
+
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("OR") << QLatin1String("SUBJECT")
+                                                              << QLatin1String("quarter") << QLatin1String("BODY")
+                                                              << QLatin1String("quarter"),
+                                                              Imap::Mailbox::ThreadingMsgListModel::SORT_NONE, Qt::AscendingOrder));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(3)"));
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("BODY") << QLatin1String("PUB"),
+                                                              Imap::Mailbox::ThreadingMsgListModel::SORT_NONE, Qt::AscendingOrder));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(2)"));
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("FROM") << QLatin1String("bob"),
+                                                              Imap::Mailbox::ThreadingMsgListModel::SORT_SUBJECT, Qt::DescendingOrder));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(3)(2)"));
+    // The words are matched only within the field which the search key asks for
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("FROM") << QLatin1String("pub"),
+                                                              Imap::Mailbox::ThreadingMsgListModel::SORT_NONE, Qt::AscendingOrder));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray());
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("BODY") << QLatin1String("bob"),
+                                                              Imap::Mailbox::ThreadingMsgListModel::SORT_NONE, Qt::AscendingOrder));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray());
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("SUBJECT") << QLatin1String("alice"),
+                                                              Imap::Mailbox::ThreadingMsgListModel::SORT_NONE, Qt::AscendingOrder));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray());
+    QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("TEXT") << QLatin1String("alice report"),
+                                                              Imap::Mailbox::ThreadingMsgListModel::SORT_NONE, Qt::AscendingOrder));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)"));
+
+    // The local index knows nothing about flags
+    QVERIFY(!threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("UNSEEN"),
+                                                               Imap::Mailbox::ThreadingMsgListModel::SORT_NONE, Qt::AscendingOrder));
+    cEmpty();
+    QVERIFY(errorSpy->isEmpty());
+}
+
 void ImapModelThreadingTest::helper_multipleExpunges()
 {
     if (helper_multipleExpunges_hit == -1) {
@@ -41,10 +41,28 @@ private slots:
     void testDynamicSorting();
     void testDynamicSortingContext();
     void testDynamicSearch();
+    void testSortingCache();
+    void testSortingCacheReopen();
+    void testPartialSearch();
+    void testPartialSearchReverse();
     void testIncrementalThreading();
+    void testArrivalsThreadedLocally();
+    void testArrivalsOrderedSubject();
     void testRemovingRootWithThreadingInFlight();
     void testMultipleExpunges();
+    void testPersistentIndexes();
+    void testLocalThreadingEngine();
+    void testLocalThreadingEngine_data();
+    void testLocalThreading();
+    void testLocalThreadingLateHeaders();
+    void testLocalSortingBaseSubject();
+    void testLocalSortingBaseSubject_data();
+    void testLocalSorting();
+    void testFullTextIndex();
+    void testLocalSearch();
     void testThreadingPerformance();
+    void testLocalThreadingPerformance();
+    void testLocalSortingPerformance();
     void testSortingPerformance();
 
     void helper_multipleExpunges();
@@ -0,0 +1,447 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QtTest>
+#include "test_Imap_Threading_Performance.h"
+#include "../headless_test.h"
+#include "Imap/Model/MsgListModel.h"
+#include "Imap/Model/ThreadingMsgListModel.h"
+#include "Imap/Parser/Response.h"
+#include "Streams/FakeSocket.h"
+#include "test_LibMailboxSync/FakeCapabilitiesInjector.h"
+
+namespace {
+
+/** @short Length of the linear chains of replies */
+const uint chainLength = 500;
+/** @short Number of direct replies to a single announcement */
+const uint fanOutWidth = 300;
+
+/** @short Contents of a THREAD response for a synthetic mailbox */
+struct SyntheticThreads {
+    /** @short The threads, without the leading "* THREAD" and the trailing CRLF */
+    QByteArray response;
+    /** @short Number of threads at the top level */
+    int threadCount;
+};
+
+/** @short Produce threads for all UIDs from @arg firstUid up to @arg lastUid
+
+The shapes of the threads are mixed just like they are in real mailboxes: there are small conversations, long chains where
+each message is a reply to the previous one, announcements with hundreds of direct replies, replies whose parent is not in the
+mailbox (they share a dummy root in the THREAD response) and standalone messages.
+*/
+SyntheticThreads generateThreads(const uint firstUid, const uint lastUid)
+{
+    SyntheticThreads res;
+    res.threadCount = 0;
+    res.response.reserve((lastUid - firstUid + 1) * 10);
+    uint uid = firstUid;
+    while (uid <= lastUid) {
+        const uint left = lastUid - uid + 1;
+        QByteArray &out = res.response;
+        switch (res.threadCount % 16) {
+        case 0:
+        {
+            // A deep chain
+            const uint length = qMin(left, chainLength);
+            out += '(';
+            for (uint i = 0; i < length; ++i) {
+                if (i)
+                    out += ' ';
+                out += QByteArray::number(uid++);
+            }
+            out += ')';
+            break;
+        }
+        case 1:
+            if (left >= 3) {
+                // A wide fan-out
+                const uint width = qMin(left - 1, fanOutWidth);
+                out += '(' + QByteArray::number(uid++) + ' ';
+                for (uint i = 0; i < width; ++i) {
+                    out += '(' + QByteArray::number(uid++) + ')';
+                }
+                out += ')';
+                break;
+            }
+            // fall through
+        case 2:
+        case 3:
+            if (left >= 4) {
+                // Orphan replies to a message which is not around
+                out += "((" + QByteArray::number(uid) + ")(" + QByteArray::number(uid + 1) + ' ' + QByteArray::number(uid + 2) +
+                        ")(" + QByteArray::number(uid + 3) + "))";
+                uid += 4;
+                break;
+            }
+            // fall through
+        case 4:
+            out += '(' + QByteArray::number(uid++) + ')';
+            break;
+        default:
+            if (left >= 10) {
+                // A regular conversation of ten messages
+                out += QString::fromUtf8("(%1 (%2 %3 (%4)(%5 %6 %7))(%8 %9 %10))").arg(
+                            QString::number(uid), QString::number(uid + 1), QString::number(uid + 2), QString::number(uid + 3),
+                            QString::number(uid + 4), QString::number(uid + 5), QString::number(uid + 6), QString::number(uid + 7),
+                            QString::number(uid + 8)).arg(QString::number(uid + 9)).toUtf8();
+                uid += 10;
+            } else {
+                out += '(' + QByteArray::number(uid++) + ')';
+            }
+            break;
+        }
+        ++res.threadCount;
+    }
+    return res;
+}
+
+/** @short Upper bound of the memory which a single message may take up in any of the measured steps */
+const qint64 maxBytesPerMessage = 4096;
+
+/** @short Return the current resident memory of this process in kB, or -1 if it is not known on this platform */
+qint64 residentMemoryKB()
+{
+#ifdef Q_OS_LINUX
+    QFile status(QLatin1String("/proc/self/status"));
+    if (!status.open(QIODevice::ReadOnly))
+        return -1;
+    Q_FOREACH(const QByteArray &line, status.readAll().split('\n')) {
+        if (line.startsWith("VmRSS:"))
+            return line.mid(6).simplified().split(' ').first().toLongLong();
+    }
+#endif
+    return -1;
+}
+
+}
+
+void ImapThreadingPerformanceTest::init()
+{
+    LibMailboxSync::init();
+
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QLatin1String("THREAD=REFS"));
+    threadingModel->setUserWantsThreading(true);
+}
+
+/** @short Return the size of the biggest mailbox to test with */
+uint ImapThreadingPerformanceTest::maximumMailboxSize()
+{
+    QByteArray env = qgetenv("TROJITA_THREADING_PERF_MESSAGES");
+    return env.isEmpty() ? 100000 : env.toUInt();
+}
+
+/** @short Add the sizes of the mailboxes to test with as a data column */
+void ImapThreadingPerformanceTest::mailboxSizes()
+{
+    QTest::addColumn<uint>("num");
+
+    for (uint num = 10000; num <= maximumMailboxSize(); num *= 10) {
+        QTest::newRow(QByteArray::number(num).constData()) << num;
+    }
+}
+
+/** @short Answer the initial UID THREAD command by the @arg threads */
+void ImapThreadingPerformanceTest::threadMessages(const QByteArray &threads)
+{
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer("* THREAD " + threads + "\r\n" + t.last("OK thread\r\n"));
+}
+
+/** @short Measure how long it takes to parse the THREAD response */
+void ImapThreadingPerformanceTest::testThreadParsing()
+{
+    QFETCH(uint, num);
+    SyntheticThreads threads = generateThreads(1, num);
+    const QByteArray prefix("* THREAD ");
+    QByteArray line = prefix + threads.response + "\r\n";
+
+    QBENCHMARK {
+        int start = prefix.size();
+        Imap::Responses::Thread response(line, start);
+        QCOMPARE(response.rootItems.size(), threads.threadCount);
+    }
+}
+
+void ImapThreadingPerformanceTest::testThreadParsing_data()
+{
+    mailboxSizes();
+}
+
+/** @short Measure the processing of the THREAD response by the model, including the pruning of the dummy nodes */
+void ImapThreadingPerformanceTest::testApplyThreading()
+{
+    QFETCH(uint, num);
+    SyntheticThreads threads = generateThreads(1, num);
+    initialMessages(num);
+
+    QBENCHMARK {
+        threadMessages(threads.response);
+        QCOMPARE(threadingModel->rowCount(QModelIndex()), threads.threadCount);
+        // Make sure that the next round has to go to the server again
+        model->cache()->setMessageThreading("a", QVector<Imap::Responses::ThreadingNode>());
+        threadingModel->wantThreading();
+    }
+}
+
+void ImapThreadingPerformanceTest::testApplyThreading_data()
+{
+    mailboxSizes();
+}
+
+/** @short Measure the reordering of the threads when switching between the ascending and descending order */
+void ImapThreadingPerformanceTest::testApplySort()
+{
+    using namespace Imap::Mailbox;
+
+    QFETCH(uint, num);
+    SyntheticThreads threads = generateThreads(1, num);
+    initialMessages(num);
+    threadMessages(threads.response);
+    QCOMPARE(threadingModel->rowCount(QModelIndex()), threads.threadCount);
+
+    QBENCHMARK {
+        QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_NONE,
+                                                                  Qt::DescendingOrder));
+        QVERIFY(threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_NONE,
+                                                                  Qt::AscendingOrder));
+    }
+    QCOMPARE(threadingModel->rowCount(QModelIndex()), threads.threadCount);
+    cEmpty();
+}
+
+void ImapThreadingPerformanceTest::testApplySort_data()
+{
+    mailboxSizes();
+}
+
+/** @short Measure how the results of the server-side SORT get applied to a flat list */
+void ImapThreadingPerformanceTest::testServerSort()
+{
+    using namespace Imap::Mailbox;
+
+    QFETCH(uint, num);
+    threadingModel->setUserWantsThreading(false);
+    initialMessages(num);
+
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability(QLatin1String("QRESYNC"));
+    injector.injectCapability(QLatin1String("SORT=DISPLAY"));
+    injector.injectCapability(QLatin1String("SORT"));
+
+    // The second half of the mailbox goes first
+    QByteArray resp = "* SORT";
+    resp.reserve(num * 8);
+    for (uint i = 0; i < num; ++i) {
+        resp += ' ' + QByteArray::number((i + num / 2) % num + 1);
+    }
+    resp += "\r\n";
+
+    bool flag = false;
+    QBENCHMARK {
+        ThreadingMsgListModel::SortCriterium criterium = flag ? ThreadingMsgListModel::SORT_SUBJECT : ThreadingMsgListModel::SORT_CC;
+        Qt::SortOrder order = flag ? Qt::AscendingOrder : Qt::DescendingOrder;
+        threadingModel->setUserSearchingSortingPreference(QStringList(), criterium, order);
+        if (flag) {
+            cClient(t.mk("UID SORT (SUBJECT) utf-8 ALL\r\n"));
+        } else {
+            cClient(t.mk("UID SORT (CC) utf-8 ALL\r\n"));
+        }
+        flag = !flag;
+        cServer(resp);
+        cServer(t.last("OK sorted\r\n"));
+    }
+    QCOMPARE(threadingModel->rowCount(QModelIndex()), static_cast<int>(num));
+}
+
+void ImapThreadingPerformanceTest::testServerSort_data()
+{
+    mailboxSizes();
+    // Half a million messages is a size which real mailing list archives reach
+    if (maximumMailboxSize() >= 500000)
+        QTest::newRow("500000") << 500000u;
+}
+
+/** @short Measure the delivery of a burst of new messages which get attached to their thread locally */
+void ImapThreadingPerformanceTest::testArrivals()
+{
+    QFETCH(uint, num);
+    SyntheticThreads threads = generateThreads(1, num);
+    initialMessages(num);
+    threadMessages(threads.response);
+
+    const uint batch = qMax(num / 100, 1u);
+    QByteArray flagsResponse;
+    QByteArray metadataResponse;
+    for (uint i = 1; i <= batch; ++i) {
+        const QByteArray uid = QByteArray::number(uidNextA + i - 1);
+        flagsResponse += "* " + QByteArray::number(existsA + i) + " FETCH (UID " + uid + " FLAGS (\\Recent))\r\n";
+        // All of them form a single new thread
+        const QByteArray inReplyTo = i == 1 ? QByteArray("NIL") : "\"<" + QByteArray::number(uidNextA + i - 2) + "@perf>\"";
+        metadataResponse += "* " + QByteArray::number(existsA + i) + " FETCH (UID " + uid + " ENVELOPE (NIL \"new\" NIL NIL NIL "
+                "NIL NIL NIL " + inReplyTo + " \"<" + uid + "@perf>\") "
+                "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL) RFC822.SIZE 89)\r\n";
+    }
+    const uint oldUidNext = uidNextA;
+    existsA += batch;
+    uidNextA += batch;
+    const QByteArray newUids = batch == 1 ? QByteArray::number(oldUidNext) :
+                                            QByteArray::number(oldUidNext) + ":" + QByteArray::number(uidNextA - 1);
+
+    // Only the new arrivals shall be asked for their headers
+    model->setNetworkExpensive();
+
+    QBENCHMARK_ONCE {
+        cServer("* " + QByteArray::number(existsA) + " EXISTS\r\n");
+        cClient(t.mk("UID FETCH " + QByteArray::number(oldUidNext) + ":* (FLAGS)\r\n"));
+        cServer(flagsResponse + t.last("OK uid fetch\r\n"));
+        cClient(t.mk("UID FETCH " + newUids + " (" FETCH_METADATA_ITEMS ")\r\n"));
+        cServer(metadataResponse + t.last("OK fetched\r\n"));
+    }
+
+    QCOMPARE(msgListModel->rowCount(QModelIndex()), static_cast<int>(existsA));
+    QCOMPARE(threadingModel->rowCount(QModelIndex()), threads.threadCount + 1);
+    cEmpty();
+}
+
+void ImapThreadingPerformanceTest::testArrivals_data()
+{
+    mailboxSizes();
+}
+
+/** @short Measure the removal of many messages scattered across the threads */
+void ImapThreadingPerformanceTest::testExpunges()
+{
+    QFETCH(uint, num);
+    SyntheticThreads threads = generateThreads(1, num);
+    initialMessages(num);
+    threadMessages(threads.response);
+
+    const uint batch = qMax(num / 100, 1u);
+    const uint stride = num / batch;
+    // Going from the end means that the sequence numbers of the pending ones do not change
+    QByteArray expunges;
+    for (uint i = 0; i < batch; ++i) {
+        expunges += "* " + QByteArray::number(num - i * stride) + " EXPUNGE\r\n";
+    }
+    existsA -= batch;
+
+    QBENCHMARK_ONCE {
+        cServer(expunges);
+    }
+
+    QCOMPARE(msgListModel->rowCount(QModelIndex()), static_cast<int>(existsA));
+    QVERIFY(threadingModel->rowCount(QModelIndex()) > 0);
+    cEmpty();
+}
+
+void ImapThreadingPerformanceTest::testExpunges_data()
+{
+    mailboxSizes();
+}
+
+/** @short Measure just the removal of the nodes whose messages are gone, without the rest of the expunge handling
+
+The model is left in an inconsistent state afterwards, which is fine because it gets thrown away by the cleanup().
+*/
+void ImapThreadingPerformanceTest::testPruneTree()
+{
+    using namespace Imap::Mailbox;
+
+    QFETCH(uint, num);
+    SyntheticThreads threads = generateThreads(1, num);
+    initialMessages(num);
+    threadMessages(threads.response);
+
+    // Detach messages scattered across the threads from their nodes, just like the handling of EXPUNGE does
+    const uint batch = qMax(num / 100, 1u);
+    const uint stride = num / batch;
+    QList<uint> detached;
+    for (uint i = 0; i < batch; ++i) {
+        const uint internalId = threadingModel->uidToInternal.value(num - i * stride);
+        ThreadNodeStorage::iterator it = threadingModel->threading.find(internalId);
+        QVERIFY(it != threadingModel->threading.end());
+        it->uid = 0;
+        it->ptr = 0;
+        detached << internalId;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    threadingModel->pruneTree();
+    QTest::setBenchmarkResult(timer.elapsed(), QTest::WalltimeMilliseconds);
+
+    Q_FOREACH(const uint internalId, detached) {
+        QVERIFY(!threadingModel->threading.contains(internalId));
+    }
+}
+
+void ImapThreadingPerformanceTest::testPruneTree_data()
+{
+    mailboxSizes();
+}
+
+/** @short Measure how much the resident memory grows when a big mailbox gets listed, and when it gets threaded
+
+Each row measures just one of these steps. The result is reported as the benchmark result, and it is checked against a generous
+upper bound so that an accidental per-message blowup makes the test fail.
+*/
+void ImapThreadingPerformanceTest::testMemoryUsage()
+{
+    QFETCH(uint, num);
+    QFETCH(bool, threaded);
+    SyntheticThreads threads = generateThreads(1, num);
+
+    qint64 before = residentMemoryKB();
+    initialMessages(num);
+    if (threaded) {
+        before = residentMemoryKB();
+        threadMessages(threads.response);
+        QCOMPARE(threadingModel->rowCount(QModelIndex()), threads.threadCount);
+    }
+    const qint64 after = residentMemoryKB();
+    if (before < 0 || after < 0) {
+        // Not supported on this platform
+        return;
+    }
+
+    const qint64 grownBytes = qMax(after - before, qint64(0)) * 1024;
+    QTest::setBenchmarkResult(grownBytes, QTest::BytesAllocated);
+    QVERIFY2(grownBytes <= maxBytesPerMessage * num,
+             qPrintable(QString::fromUtf8("%1 bytes per message").arg(QString::number(grownBytes / num))));
+}
+
+void ImapThreadingPerformanceTest::testMemoryUsage_data()
+{
+    QTest::addColumn<uint>("num");
+    QTest::addColumn<bool>("threaded");
+
+    for (uint num = 10000; num <= maximumMailboxSize(); num *= 10) {
+        QTest::newRow(QByteArray(QByteArray::number(num) + " listing").constData()) << num << false;
+        QTest::newRow(QByteArray(QByteArray::number(num) + " threading").constData()) << num << true;
+    }
+}
+
+TROJITA_HEADLESS_TEST( ImapThreadingPerformanceTest )
@@ -0,0 +1,2 @@
+TARGET = test_Imap_Threading_Performance
+include(../tests.pri)
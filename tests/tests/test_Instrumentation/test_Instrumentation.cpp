@@ -0,0 +1,74 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QTest>
+#include "test_Instrumentation.h"
+#include "../headless_test.h"
+#include "Common/Instrumentation.h"
+
+using Common::Instrumentation;
+
+void InstrumentationTest::init()
+{
+    Instrumentation::reset();
+}
+
+/** @short The counters add up within their categories and go away after a reset */
+void InstrumentationTest::testCounters()
+{
+    QVERIFY(Instrumentation::snapshot().isEmpty());
+
+    Instrumentation::add(QLatin1String("cache hits"), QLatin1String("SQLCache::msgFlags"), 1);
+    Instrumentation::add(QLatin1String("cache hits"), QLatin1String("SQLCache::msgFlags"), 1);
+    Instrumentation::add(QLatin1String("cache misses"), QLatin1String("SQLCache::msgFlags"), 1);
+    Instrumentation::add(QLatin1String("bytes received"), QLatin1String("parser 0"), 333);
+    Instrumentation::add(QLatin1String("bytes received"), QLatin1String("parser 0"), -33);
+
+    Instrumentation::Snapshot snapshot = Instrumentation::snapshot();
+    QCOMPARE(snapshot.size(), 3);
+    QCOMPARE(snapshot[QLatin1String("cache hits")][QLatin1String("SQLCache::msgFlags")], qint64(2));
+    QCOMPARE(snapshot[QLatin1String("cache misses")][QLatin1String("SQLCache::msgFlags")], qint64(1));
+    QCOMPARE(snapshot[QLatin1String("bytes received")][QLatin1String("parser 0")], qint64(300));
+
+    Instrumentation::reset();
+    QVERIFY(Instrumentation::snapshot().isEmpty());
+}
+
+/** @short The dump has a header line followed by one tab-separated line per counter */
+void InstrumentationTest::testFormat()
+{
+    Instrumentation::Snapshot snapshot;
+    snapshot[QLatin1String("tree items")][QLatin1String("TreeItemPart")] = 10;
+    snapshot[QLatin1String("tree items")][QLatin1String("TreeItemMessage")] = 3;
+    snapshot[QLatin1String("memory")][QLatin1String("broken\tname")] = 1;
+
+    QCOMPARE(Instrumentation::format(snapshot), QByteArray(
+                 "# trojita-instrumentation 1\n"
+                 "memory\tbroken name\t1\n"
+                 "tree items\tTreeItemMessage\t3\n"
+                 "tree items\tTreeItemPart\t10\n"
+                 ));
+    QCOMPARE(Instrumentation::format(Instrumentation::Snapshot()), QByteArray("# trojita-instrumentation 1\n"));
+}
+
+TROJITA_HEADLESS_TEST(InstrumentationTest)
@@ -0,0 +1,2 @@
+TARGET = test_Instrumentation
+include(../tests.pri)
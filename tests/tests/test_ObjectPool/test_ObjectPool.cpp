@@ -0,0 +1,113 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QTest>
+#include "test_ObjectPool.h"
+#include "../headless_test.h"
+#include "Common/ObjectPool.h"
+
+using Common::ObjectPool;
+using Common::PoolStatistics;
+
+namespace {
+
+class Pooled
+{
+public:
+    Pooled(): a(0), b(0) {}
+    virtual ~Pooled() {}
+    TROJITA_POOLED_ALLOCATION(Pooled)
+    qint64 a;
+    qint64 b;
+};
+
+class Derived: public Pooled
+{
+public:
+    Derived(): c(0) {}
+    qint64 c;
+};
+
+/** @short Another type, so that the counters are not shared with the other test cases */
+class Small
+{
+public:
+    TROJITA_POOLED_ALLOCATION(Small)
+    int x;
+};
+
+}
+
+/** @short Test that the freed objects are handed out again */
+void ObjectPoolTest::testReuse()
+{
+    const PoolStatistics before = ObjectPool<Pooled>::statistics();
+    Pooled *first = new Pooled();
+    delete first;
+    Pooled *second = new Pooled();
+    QCOMPARE(second, first);
+    delete second;
+
+    const PoolStatistics after = ObjectPool<Pooled>::statistics();
+    QCOMPARE(after.allocations - before.allocations, quint64(2));
+    QCOMPARE(after.deallocations - before.deallocations, quint64(2));
+    QCOMPARE(after.liveObjects(), before.liveObjects());
+}
+
+/** @short Test that the chunks are allocated as needed, and that the empty ones are given back */
+void ObjectPoolTest::testChunkRelease()
+{
+    QList<Small *> objects;
+    for (int i = 0; i < 1000; ++i)
+        objects << new Small();
+
+    PoolStatistics stats = ObjectPool<Small>::statistics();
+    QCOMPARE(stats.liveObjects(), quint64(1000));
+    // The default chunk holds 256 objects
+    QCOMPARE(stats.chunksAllocated, quint64(4));
+
+    qDeleteAll(objects);
+    objects.clear();
+    stats = ObjectPool<Small>::statistics();
+    QCOMPARE(stats.liveObjects(), quint64(0));
+    // One chunk is kept around for the future allocations
+    QCOMPARE(stats.liveChunks(), quint64(1));
+
+    for (int i = 0; i < 256; ++i)
+        objects << new Small();
+    stats = ObjectPool<Small>::statistics();
+    QCOMPARE(stats.chunksAllocated, quint64(4));
+    qDeleteAll(objects);
+}
+
+/** @short Test that the derived classes of a different size are not served from the pool */
+void ObjectPoolTest::testDerivedClass()
+{
+    const PoolStatistics before = ObjectPool<Pooled>::statistics();
+    Pooled *derived = new Derived();
+    delete derived;
+    const PoolStatistics after = ObjectPool<Pooled>::statistics();
+    QCOMPARE(after.allocations, before.allocations);
+    QCOMPARE(after.deallocations, before.deallocations);
+}
+
+TROJITA_HEADLESS_TEST(ObjectPoolTest)
@@ -0,0 +1,2 @@
+TARGET = test_ObjectPool
+include(../tests.pri)
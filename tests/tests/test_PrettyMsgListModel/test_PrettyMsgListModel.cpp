@@ -0,0 +1,175 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QtTest>
+#include "test_PrettyMsgListModel.h"
+#include "../headless_test.h"
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/MsgListModel.h"
+#include "Imap/Model/PrettyMsgListModel.h"
+#include "Imap/Model/ThreadingMsgListModel.h"
+#include "Streams/FakeSocket.h"
+#include "test_LibMailboxSync/ModelEvents.h"
+
+using Imap::Mailbox::MessageDisplayCache;
+using Imap::Mailbox::MsgListModel;
+
+void PrettyMsgListModelTest::init()
+{
+    LibMailboxSync::init();
+    prettyModel = new Imap::Mailbox::PrettyMsgListModel(this);
+    prettyModel->setSourceModel(threadingModel);
+}
+
+void PrettyMsgListModelTest::cleanup()
+{
+    delete prettyModel;
+    prettyModel = 0;
+    LibMailboxSync::cleanup();
+}
+
+/** @short Sync a mailbox with a single message and have its metadata fetched through the pretty model */
+void PrettyMsgListModelTest::helperFetchOneMessage()
+{
+    existsA = 1;
+    uidValidityA = 333;
+    uidMapA << 10;
+    uidNextA = 11;
+    helperSyncAWithMessagesEmptyState();
+    msgListModel->setMailbox(idxA);
+    QCOMPARE(prettyModel->rowCount(), 1);
+
+    // Nothing can be cached until the message gets fetched
+    QModelIndex subject = prettyModel->index(0, MsgListModel::SUBJECT);
+    QCOMPARE(subject.data().toString(), QString::fromUtf8("Loading..."));
+    QCOMPARE(prettyModel->m_displayCache.size(), 0);
+    cClient(t.mk("UID FETCH 10 (" FETCH_METADATA_ITEMS ")\r\n"));
+    cServer("* 1 FETCH (UID 10 RFC822.SIZE 89 INTERNALDATE \"01-Apr-2013 12:30:00 +0000\" "
+            "ENVELOPE (NIL \"subj\" NIL NIL NIL NIL NIL NIL NIL \"<msgid>\") "
+            "BODYSTRUCTURE (\"text\" \"plain\" () NIL NIL NIL 19 2 NIL NIL NIL NIL))\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(subject.data().toString(), QString::fromUtf8("subj"));
+}
+
+/** @short Return the display cache slot of the message at the @arg index of the pretty model */
+int PrettyMsgListModelTest::helperSlot(const QModelIndex &index)
+{
+    return prettyModel->m_displayCache.find(prettyModel->mapToSource(index).internalPointer());
+}
+
+/** @short Test that the cells of a message which has been shown are served from the cache */
+void PrettyMsgListModelTest::testCacheHit()
+{
+    helperFetchOneMessage();
+    QModelIndex subject = prettyModel->index(0, MsgListModel::SUBJECT);
+    QCOMPARE(prettyModel->m_displayCache.size(), 1);
+    int slot = helperSlot(subject);
+    QVERIFY(slot != -1);
+    QCOMPARE(prettyModel->m_displayCache.text(slot, MessageDisplayCache::COLUMN_SUBJECT), QString::fromUtf8("subj"));
+    QCOMPARE(prettyModel->m_displayCache.text(slot, MessageDisplayCache::COLUMN_SIZE), QString::fromUtf8("89"));
+
+    // The value comes from the cache and not from the underlying models
+    prettyModel->m_displayCache.setText(slot, MessageDisplayCache::COLUMN_SUBJECT, QLatin1String("cached"));
+    QCOMPARE(subject.data().toString(), QString::fromUtf8("cached"));
+    QCOMPARE(prettyModel->m_displayCache.size(), 1);
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short Test that a message is formatted again once the source model reports a change */
+void PrettyMsgListModelTest::testDataChangedInvalidation()
+{
+    helperFetchOneMessage();
+    QModelIndex subject = prettyModel->index(0, MsgListModel::SUBJECT);
+    int slot = helperSlot(subject);
+    QVERIFY(slot != -1);
+    prettyModel->m_displayCache.setText(slot, MessageDisplayCache::COLUMN_SUBJECT, QLatin1String("stale"));
+
+    qRegisterMetaType<QModelIndex>("QModelIndex");
+    QModelIndex source = prettyModel->mapToSource(subject);
+    QVERIFY(QMetaObject::invokeMethod(threadingModel, "dataChanged", Q_ARG(QModelIndex, source), Q_ARG(QModelIndex, source)));
+    QCOMPARE(prettyModel->m_displayCache.size(), 0);
+    QCOMPARE(helperSlot(subject), -1);
+
+    QCOMPARE(subject.data().toString(), QString::fromUtf8("subj"));
+    QVERIFY(helperSlot(subject) != -1);
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short Test that the icon and the style follow the changes of the message flags */
+void PrettyMsgListModelTest::testFlagChangeInvalidation()
+{
+    helperFetchOneMessage();
+    QModelIndex subject = prettyModel->index(0, MsgListModel::SUBJECT);
+    int slot = helperSlot(subject);
+    QVERIFY(slot != -1);
+    QCOMPARE(prettyModel->m_displayCache.style(slot), 0u);
+    QCOMPARE(prettyModel->m_displayCache.flagIcon(slot), MessageDisplayCache::ICON_NONE);
+
+    cServer("* 1 FETCH (FLAGS (\\Seen \\Answered))\r\n");
+    QCOMPARE(helperSlot(subject), -1);
+
+    QCOMPARE(subject.data().toString(), QString::fromUtf8("subj"));
+    slot = helperSlot(subject);
+    QVERIFY(slot != -1);
+    QCOMPARE(prettyModel->m_displayCache.style(slot), uint(MessageDisplayCache::STYLE_READ));
+    QCOMPARE(prettyModel->m_displayCache.flagIcon(slot), MessageDisplayCache::ICON_REPLIED);
+
+    cServer("* 1 FETCH (FLAGS (\\Seen \\Deleted))\r\n");
+    QCOMPARE(helperSlot(subject), -1);
+    QCOMPARE(subject.data().toString(), QString::fromUtf8("subj"));
+    slot = helperSlot(subject);
+    QVERIFY(slot != -1);
+    QCOMPARE(prettyModel->m_displayCache.style(slot), uint(MessageDisplayCache::STYLE_READ | MessageDisplayCache::STYLE_DELETED));
+    QCOMPARE(prettyModel->m_displayCache.flagIcon(slot), MessageDisplayCache::ICON_DELETED);
+    cEmpty();
+    justKeepTask();
+}
+
+/** @short Test that the whole cache is flushed periodically, so that the relative dates get updated */
+void PrettyMsgListModelTest::testFlush()
+{
+    QVERIFY(prettyModel->m_displayCacheFlushTimer->isActive());
+    QCOMPARE(prettyModel->m_displayCacheFlushTimer->interval(), 60 * 1000);
+
+    helperFetchOneMessage();
+    QCOMPARE(prettyModel->m_displayCache.size(), 1);
+    QDateTime previousTime = prettyModel->m_displayCacheTime;
+
+    // Don't wait for a whole minute
+    prettyModel->m_displayCacheFlushTimer->start(10);
+    QTest::qWait(50);
+    QCOMPARE(prettyModel->m_displayCache.size(), 0);
+    QVERIFY(prettyModel->m_displayCacheTime >= previousTime);
+
+    // The data() is not what triggers a flush
+    prettyModel->m_displayCacheFlushTimer->stop();
+    QModelIndex subject = prettyModel->index(0, MsgListModel::SUBJECT);
+    QCOMPARE(subject.data().toString(), QString::fromUtf8("subj"));
+    QCOMPARE(prettyModel->m_displayCache.size(), 1);
+    QCOMPARE(subject.data().toString(), QString::fromUtf8("subj"));
+    QCOMPARE(prettyModel->m_displayCache.size(), 1);
+    cEmpty();
+    justKeepTask();
+}
+
+TROJITA_HEADLESS_TEST(PrettyMsgListModelTest)
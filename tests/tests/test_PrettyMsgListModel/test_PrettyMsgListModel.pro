@@ -0,0 +1,2 @@
+TARGET = test_PrettyMsgListModel
+include(../tests.pri)
@@ -0,0 +1,82 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QtTest>
+#include "test_SQLCache.h"
+#include "../headless_test.h"
+#include "Imap/Model/FullTextIndex.h"
+#include "Imap/Model/SQLCache.h"
+
+using Imap::Mailbox::FullTextIndex;
+
+typedef QList<uint> UidList;
+Q_DECLARE_METATYPE(UidList)
+
+void SQLCacheTest::init()
+{
+    cache = new Imap::Mailbox::SQLCache(this);
+    errorSpy = new QSignalSpy(cache, SIGNAL(error(QString)));
+    QVERIFY(cache->open(QLatin1String("test_SQLCache"), QLatin1String(":memory:")));
+}
+
+void SQLCacheTest::cleanup()
+{
+    QVERIFY(errorSpy->isEmpty());
+    delete errorSpy;
+    errorSpy = 0;
+    delete cache;
+    cache = 0;
+}
+
+/** @short Test that words which look like numbers are matched by their prefixes, just like in the in-memory index */
+void SQLCacheTest::testSearchNumericPrefix()
+{
+    QFETCH(QString, query);
+    QFETCH(UidList, uids);
+
+    FullTextIndex index;
+    QStringList texts = QStringList() << QLatin1String("2013") << QLatin1String("20130") << QLatin1String("2013abc")
+                                      << QLatin1String("1999") << QLatin1String("report");
+    for (int i = 0; i < texts.size(); ++i) {
+        cache->addMsgSearchableText(QLatin1String("a"), i + 1, texts[i]);
+        index.addText(i + 1, FullTextIndex::FIELD_BODY, texts[i]);
+    }
+
+    QList<uint> found = cache->searchMessages(QLatin1String("a"), query, FullTextIndex::FIELD_ANY);
+    qSort(found);
+    QCOMPARE(found, uids);
+    QCOMPARE(index.search(query), uids);
+}
+
+void SQLCacheTest::testSearchNumericPrefix_data()
+{
+    QTest::addColumn<QString>("query");
+    QTest::addColumn<UidList>("uids");
+
+    QTest::newRow("whole-number") << QString::fromUtf8("2013") << (UidList() << 1 << 2 << 3);
+    QTest::newRow("number-prefix") << QString::fromUtf8("201") << (UidList() << 1 << 2 << 3);
+    QTest::newRow("longer-number") << QString::fromUtf8("20130") << (UidList() << 2);
+    QTest::newRow("digit") << QString::fromUtf8("1") << (UidList() << 4);
+    QTest::newRow("text") << QString::fromUtf8("rep") << (UidList() << 5);
+}
+
+TROJITA_HEADLESS_TEST(SQLCacheTest)
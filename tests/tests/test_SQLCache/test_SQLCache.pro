@@ -0,0 +1,3 @@
+QT += sql
+TARGET = test_SQLCache
+include(../tests.pri)
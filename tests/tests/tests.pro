@@ -2,21 +2,28 @@ TEMPLATE = subdirs
 SUBDIRS  = \
     test_algorithms \
     test_RingBuffer \
+    test_ObjectPool \
+    test_Instrumentation \
+    test_Imap_Instrumentation \
     test_Imap_LowLevelParser test_Imap_Message test_Imap_Parser_parse \
     test_Imap_Responses test_rfccodecs test_Imap_Model \
+    test_SQLCache \
     test_Imap_Tasks_OpenConnection \
     test_Imap_Tasks_ListChildMailboxes \
     test_Imap_Tasks_CreateMailbox \
     test_Imap_Tasks_DeleteMailbox \
     test_Imap_Tasks_ObtainSynchronizedMailbox \
+    test_Imap_Tasks_FetchMsgPart \
     test_Imap_Idle \
     test_Imap_SelectedMailboxUpdates \
     test_Imap_DisappearingMailboxes \
     test_Imap_Threading \
+    test_Imap_Threading_Performance \
     test_Composer_responses \
     test_Html_formatting \
     test_Rfc5322 \
     test_SenderIdentitiesModel \
+    test_PrettyMsgListModel \
     test_Composer_Submission
 
 # At first, we define the "check" target which simply propagates the "check" call below